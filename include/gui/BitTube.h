@@ -66,27 +66,76 @@ public:
         return recvObjects(tube, events, count, sizeof(T));
     }
 
+    // send objects as messages of objectsPerMessage objects each, all in a
+    // single system call. Unlike sendObjects, the messages are sent
+    // individually: this returns how many objects were sent in whole messages,
+    // which is less than count if the tube filled up, or an error if no
+    // message could be sent.
+    template <typename T>
+    static ssize_t sendObjectsBatched(const sp<BitTube>& tube,
+            T const* events, size_t count, size_t objectsPerMessage = 1) {
+        return sendObjectsBatched(tube, events, count, sizeof(T),
+                objectsPerMessage);
+    }
+
+    // receive as many messages of up to maxObjectsPerMessage objects as fit in
+    // events, all in a single system call, and pack their objects at the start
+    // of events. This is meant for channels whose messages are all sent with
+    // sendObjectsBatched, as objects beyond maxObjectsPerMessage in a message
+    // are silently discarded.
+    template <typename T>
+    static ssize_t recvObjectsBatched(const sp<BitTube>& tube,
+            T* events, size_t count, size_t maxObjectsPerMessage = 1) {
+        return recvObjectsBatched(tube, events, count, sizeof(T),
+                maxObjectsPerMessage);
+    }
+
     // parcels this BitTube
-    status_t writeToParcel(Parcel* reply) const;
+    virtual status_t writeToParcel(Parcel* reply) const;
+
+protected:
+    // creates a BitTube without any file descriptors, for subclasses that set
+    // up their own channel or call init
+    enum class DefaultConstructTag { kDefaultConstructTag };
+    explicit BitTube(DefaultConstructTag);
 
-private:
     void init(size_t rcvbuf, size_t sndbuf);
 
     // send a message. The write is guaranteed to send the whole message or fail.
-    ssize_t write(void const* vaddr, size_t size);
+    virtual ssize_t write(void const* vaddr, size_t size);
 
     // receive a message. the passed buffer must be at least as large as the
     // write call used to send the message, excess data is silently discarded.
-    ssize_t read(void* vaddr, size_t size);
+    virtual ssize_t read(void* vaddr, size_t size);
+
+    // send the size bytes at vaddr as consecutive messages of messageSize bytes
+    // (the last one may be shorter). Returns how many bytes were sent in whole
+    // messages, or an error if no message could be sent.
+    virtual ssize_t writeMessages(void const* vaddr, size_t size,
+            size_t messageSize);
+
+    // receive messages into consecutive windows of messageSize bytes of the
+    // size bytes at vaddr, truncating larger messages, then pack them at the
+    // start of vaddr. Returns how many bytes were received.
+    virtual ssize_t readMessages(void* vaddr, size_t size, size_t messageSize);
 
     int mSendFd;
     mutable int mReceiveFd;
 
+private:
     static ssize_t sendObjects(const sp<BitTube>& tube,
             void const* events, size_t count, size_t objSize);
 
     static ssize_t recvObjects(const sp<BitTube>& tube,
             void* events, size_t count, size_t objSize);
+
+    static ssize_t sendObjectsBatched(const sp<BitTube>& tube,
+            void const* events, size_t count, size_t objSize,
+            size_t objectsPerMessage);
+
+    static ssize_t recvObjectsBatched(const sp<BitTube>& tube,
+            void* events, size_t count, size_t objSize,
+            size_t maxObjectsPerMessage);
 };
 
 // ----------------------------------------------------------------------------
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_BUFFERCOUNTTUNER_H
+#define ANDROID_GUI_BUFFERCOUNTTUNER_H
+
+#include <gui/OccupancyTracker.h>
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+
+class String8;
+
+// BufferCountTuner decides whether a BufferQueue should be double- or
+// triple-buffered from how it is used. A double-buffered queue whose producer
+// often has to wait in dequeueBuffer for the consumer to return a buffer
+// should grow to triple-buffering, and a triple-buffered queue that never
+// uses its third buffer should shrink to double-buffering to save the memory
+// of that buffer.
+//
+// Only the max dequeued buffer count is tuned. With a consumer that acquires
+// one buffer at a time, it alone makes the difference between double- and
+// triple-buffering, whereas the max acquired buffer count is set by the
+// consumer for what it needs to hold, which the queue can't know.
+//
+// BufferCountTuner isn't thread-safe, BufferQueueCore calls it with mMutex
+// held.
+class BufferCountTuner
+{
+public:
+    BufferCountTuner();
+
+    // See IGraphicBufferConsumer::setBufferCountTuning
+    void setMode(int mode);
+    int getMode() const { return mMode; }
+
+    // onDequeue records a dequeueBuffer call, and whether it had to wait for
+    // a buffer to be released
+    void onDequeue(bool blocked);
+
+    // onSegment records a segment of the occupancy history of the queue
+    void onSegment(const OccupancyTracker::Segment& segment);
+
+    // onRecentSegments records the segments returned by
+    // OccupancyTracker::takeRecentSegments, most recent first, in the order
+    // they were recorded in
+    void onRecentSegments(
+            const std::vector<OccupancyTracker::Segment>& segments);
+
+    // getTargetMaxDequeuedBufferCount returns the max dequeued buffer count
+    // the recorded use of the queue calls for, given the current one. Only
+    // double- and triple-buffered queues are tuned, any other count is
+    // returned unchanged.
+    int getTargetMaxDequeuedBufferCount(int maxDequeuedBufferCount) const;
+
+    // onMaxDequeuedBufferCountChanged restarts the measurement after the max
+    // dequeued buffer count changed, either because the tuner's target was
+    // applied (byTuner) or because the producer set it.
+    void onMaxDequeuedBufferCountChanged(int maxDequeuedBufferCount,
+            bool byTuner);
+
+    void dump(String8& result, const char* prefix,
+            int maxDequeuedBufferCount) const;
+
+private:
+    static constexpr int DOUBLE_BUFFERED = 1;
+    static constexpr int TRIPLE_BUFFERED = 2;
+
+    // A double-buffered queue grows once GROW_BLOCKED_DEQUEUES of
+    // DEQUEUE_WINDOW consecutive dequeueBuffer calls blocked
+    static constexpr uint32_t DEQUEUE_WINDOW = 60;
+    static constexpr uint32_t GROW_BLOCKED_DEQUEUES = 6;
+
+    // A triple-buffered queue shrinks once this many consecutive segments
+    // went by without the third buffer being used or dequeueBuffer blocking.
+    // Each time a queue has to grow again after it was shrunk, this doubles up
+    // to MAX_SHRINK_SEGMENTS, so that a queue on the edge doesn't keep
+    // flipping between the two.
+    static constexpr uint32_t SHRINK_SEGMENTS = 3;
+    static constexpr uint32_t MAX_SHRINK_SEGMENTS = 24;
+
+    int mMode;
+
+    uint32_t mWindowDequeues;
+    uint32_t mWindowBlockedDequeues;
+    bool mShouldGrow;
+
+    uint32_t mUnusedSegments;
+    uint32_t mShrinkSegments;
+    bool mLastChangeWasShrink;
+
+    // Statistics reported by dump
+    uint64_t mDequeueCount;
+    uint64_t mBlockedDequeueCount;
+    uint32_t mGrowCount;
+    uint32_t mShrinkCount;
+};
+
+} // namespace android
+
+#endif
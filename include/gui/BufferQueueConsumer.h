@@ -143,6 +143,9 @@ public:
     // See IGraphicBufferConsumer::discardFreeBuffers
     virtual status_t discardFreeBuffers() override;
 
+    // See IGraphicBufferConsumer::setBufferCountTuning
+    virtual status_t setBufferCountTuning(int mode) override;
+
     // dump our state in a String
     virtual void dump(String8& result, const char* prefix) const;
 
@@ -17,6 +17,7 @@
 #ifndef ANDROID_GUI_BUFFERQUEUECORE_H
 #define ANDROID_GUI_BUFFERQUEUECORE_H
 
+#include <gui/BufferCountTuner.h>
 #include <gui/BufferItem.h>
 #include <gui/BufferQueueDefs.h>
 #include <gui/BufferSlot.h>
@@ -31,6 +32,7 @@
 #include <utils/Trace.h>
 #include <utils/Vector.h>
 
+#include <atomic>
 #include <list>
 #include <set>
 
@@ -84,6 +86,21 @@ public:
     BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator = NULL);
     virtual ~BufferQueueCore();
 
+    // setLockStatsEnabled makes the BufferQueues of this process measure how
+    // long dequeueBuffer, queueBuffer, acquireBuffer and releaseBuffer hold
+    // mMutex, not counting the time spent waiting on a condition. dump
+    // reports the statistics. This is off by default since it costs two clock
+    // reads per call.
+    static void setLockStatsEnabled(bool enabled);
+
+    // setConsistencyChecksEnabled makes the BufferQueues of this process
+    // check that their slot lists agree with the slot states after every
+    // change, as userdebug and eng builds always do.
+    // getConsistencyErrorCount returns the number of inconsistencies that
+    // were found so far, which are also logged.
+    static void setConsistencyChecksEnabled(bool enabled);
+    static uint32_t getConsistencyErrorCount();
+
 private:
     // Dump our state in a string
     void dump(String8& result, const char* prefix) const;
@@ -125,6 +142,13 @@ private:
     // all slots, even if they're currently dequeued, queued, or acquired.
     void freeAllBuffersLocked();
 
+    // recycleBufferLocked hands the buffer of the given slot back to
+    // mAllocator for reuse if it allocated it, along with the release fence
+    // of the slot, ahead of the slot being cleared. Buffers are only recycled
+    // while a producer is connected, since they are kept for the uid of that
+    // producer.
+    void recycleBufferLocked(int slot);
+
     // discardFreeBuffersLocked releases all currently-free buffers held by the
     // queue, in order to reduce the memory consumption of the queue to the
     // minimum possible without discarding data.
@@ -134,14 +158,46 @@ private:
     // away slots. Returns false if the request can't be met.
     bool adjustAvailableSlotsLocked(int delta);
 
+    // tuneMaxDequeuedBufferCountLocked feeds the segments mOccupancyTracker
+    // recorded since the last call to mBufferCountTuner and, in
+    // BUFFER_COUNT_TUNING_AUTO mode, applies the max dequeued buffer count it
+    // calls for if the dequeued buffers and the other buffer counts allow it.
+    // Returns true if the count shrank, in which case the consumer must be
+    // told its buffers may have been released.
+    bool tuneMaxDequeuedBufferCountLocked();
+
     // waitWhileAllocatingLocked blocks until mIsAllocating is false.
     void waitWhileAllocatingLocked() const;
 
-#if DEBUG_ONLY_CODE
+    // releaseSlotLocked hands the buffer the consumer acquired in slot back
+    // to the producer, along with the fences the consumer released it with.
+    void releaseSlotLocked(int slot, const sp<Fence>& releaseFence,
+            EGLDisplay eglDisplay, EGLSyncKHR eglFence);
+
+    // allowDeferredReleaseLocked lets deferReleaseBuffer release the buffer
+    // the consumer just acquired in slot. Any other change to the slot that
+    // takes the buffer away from the consumer must clear
+    // mReleasableFrameNumbers for it.
+    void allowDeferredReleaseLocked(int slot);
+
+    // deferReleaseBuffer is the fast path of releaseBuffer. It releases the
+    // buffer in slot without locking mMutex, if the consumer acquired it as
+    // frameNumber and hasn't released or detached it since, and the producer
+    // didn't free it. The slot stays ACQUIRED until the next
+    // applyDeferredReleasesLocked call. outListener is set to the producer
+    // listener to notify. Returns false if the release has to lock mMutex.
+    bool deferReleaseBuffer(int slot, uint64_t frameNumber,
+            const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+            EGLSyncKHR eglFence, sp<IProducerListener>* outListener);
+
+    // applyDeferredReleasesLocked applies the releases deferReleaseBuffer
+    // handed off. It must be called before looking for free buffers or
+    // counting the acquired ones. Returns true if any buffer was released.
+    bool applyDeferredReleasesLocked();
+
     // validateConsistencyLocked ensures that the free lists are in sync with
     // the information stored in mSlots
     void validateConsistencyLocked() const;
-#endif
 
     // mAllocator is the connection to SurfaceFlinger that is used to allocate
     // new GraphicBuffer objects.
@@ -150,8 +206,54 @@ private:
     // mMutex is the mutex used to prevent concurrent access to the member
     // variables of BufferQueueCore objects. It must be locked whenever any
     // member variable is accessed.
+    //
+    // The one exception is releaseBuffer, which hands most releases off
+    // under mReleaseMutex instead, see deferReleaseBuffer. The producer
+    // applies them to the slots when it next looks for a free buffer, so the
+    // consumer no longer waits for mMutex while the producer holds it, and
+    // each frame locks it once on the consumer side. setLockStatsEnabled
+    // measures how long each call holds mMutex.
     mutable Mutex mMutex;
 
+    // mReleaseMutex guards the releases deferReleaseBuffer hands off, that
+    // is mDeferredReleases and mDeferredReleaseMask. It may be locked while
+    // mMutex is held, but mMutex must never be locked while it is held.
+    mutable Mutex mReleaseMutex;
+
+    // DeferredRelease holds a release deferReleaseBuffer handed off, along
+    // with the producer listener that was connected when the buffer was
+    // acquired.
+    struct DeferredRelease {
+        DeferredRelease() : frameNumber(0), fence(), eglDisplay(EGL_NO_DISPLAY),
+                eglFence(EGL_NO_SYNC_KHR), listener() {}
+        uint64_t frameNumber;
+        sp<Fence> fence;
+        EGLDisplay eglDisplay;
+        EGLSyncKHR eglFence;
+        sp<IProducerListener> listener;
+    };
+    DeferredRelease mDeferredReleases[BufferQueueDefs::NUM_BUFFER_SLOTS];
+
+    // mDeferredReleaseMask has a bit set for each slot in mDeferredReleases
+    // that holds a release yet to be applied.
+    uint64_t mDeferredReleaseMask;
+    static_assert(BufferQueueDefs::NUM_BUFFER_SLOTS <= 64,
+            "mDeferredReleaseMask has a bit per slot");
+
+    // mReleasableFrameNumbers holds, for each slot whose buffer
+    // deferReleaseBuffer may release, the frame number it was acquired as,
+    // and 0 otherwise. deferReleaseBuffer claims a release by clearing it.
+    std::atomic<uint64_t>
+            mReleasableFrameNumbers[BufferQueueDefs::NUM_BUFFER_SLOTS];
+
+    // mDequeueWaiterCount is the number of producer threads waiting on
+    // mDequeueCondition. deferReleaseBuffer locks mMutex to wake them up.
+    std::atomic<int> mDequeueWaiterCount;
+
+    // mDeferredReleaseCount is the number of releases deferReleaseBuffer
+    // handed off, which dump reports.
+    uint64_t mDeferredReleaseCount;
+
     // mIsAbandoned indicates that the BufferQueue will no longer be used to
     // consume image buffers pushed to it using the IGraphicBufferProducer
     // interface. It is initialized to false, and set to true in the
@@ -184,6 +286,9 @@ private:
     int mConnectedApi;
     // PID of the process which last successfully called connect(...)
     pid_t mConnectedPid;
+    // UID of the same process, which owns the buffers recycled while it is
+    // connected
+    uid_t mConnectedUid;
 
     // mConnectedProducerToken is used to set a binder death notification on
     // the producer.
@@ -332,8 +437,114 @@ private:
 
     OccupancyTracker mOccupancyTracker;
 
+    // mBufferCountTuner decides on the max dequeued buffer count from the use
+    // of the queue, see IGraphicBufferConsumer::setBufferCountTuning
+    BufferCountTuner mBufferCountTuner;
+
+    // The attributes dequeueBuffer allocates buffers with
+    struct BufferAttributes {
+        BufferAttributes()
+          : width(0),
+            height(0),
+            format(PIXEL_FORMAT_UNKNOWN),
+            usage(0) {}
+
+        bool operator==(const BufferAttributes& other) const {
+            return width == other.width && height == other.height &&
+                    format == other.format && usage == other.usage;
+        }
+        bool operator!=(const BufferAttributes& other) const {
+            return !(*this == other);
+        }
+
+        uint32_t width;
+        uint32_t height;
+        PixelFormat format;
+        uint32_t usage;
+    };
+
+    // mPredictiveAllocation indicates whether predictive allocation is
+    // enabled, see IGraphicBufferProducer::setPredictiveAllocation.
+    bool mPredictiveAllocation;
+
+    // mPredictedAttributes holds the attributes that the last
+    // PREDICTION_DEQUEUE_COUNT dequeueBuffer calls in predictive allocation
+    // mode asked for, which the next calls are expected to use as well.
+    BufferAttributes mPredictedAttributes;
+
+    // mDequeuedAttributes holds the attributes of the last dequeueBuffer call
+    // in predictive allocation mode, and mDequeuedAttributesCount the number
+    // of calls in a row, up to PREDICTION_DEQUEUE_COUNT, that asked for them.
+    // A single dequeueBuffer call with other attributes doesn't change the
+    // prediction.
+    enum { PREDICTION_DEQUEUE_COUNT = 2 };
+    BufferAttributes mDequeuedAttributes;
+    uint32_t mDequeuedAttributesCount;
+
+    // mIsPreallocating indicates whether a background thread is running
+    // BufferQueueProducer::preallocateBuffers.
+    bool mIsPreallocating;
+
+    // Predictive allocation statistics reported by dump: the buffers that
+    // were preallocated, the ones that were dropped because the attributes
+    // changed or no slot was left for them, the dequeueBuffer calls that got
+    // a preallocated buffer, and the ones that had to allocate anyway.
+    uint64_t mPreallocatedBufferCount;
+    uint64_t mDroppedPreallocationCount;
+    uint64_t mAvoidedStallCount;
+    uint64_t mAllocationStallCount;
+
     const uint64_t mUniqueId;
 
+    // The calls whose mMutex hold times are measured, see setLockStatsEnabled
+    enum LockedCall {
+        LOCKED_DEQUEUE,
+        LOCKED_QUEUE,
+        LOCKED_ACQUIRE,
+        LOCKED_RELEASE,
+        NUM_LOCKED_CALLS,
+    };
+
+    struct LockStats {
+        LockStats() : count(0), totalTime(0), maxTime(0) {}
+        uint64_t count;
+        nsecs_t totalTime;
+        nsecs_t maxTime;
+    };
+
+    // LockTimer records how long mMutex is held from its construction to its
+    // destruction in mLockStats, so it must be declared right after the
+    // Autolock of the call.
+    class LockTimer {
+    public:
+        LockTimer(BufferQueueCore* core, LockedCall call);
+        ~LockTimer();
+    private:
+        BufferQueueCore* const mCore;
+        const LockedCall mCall;
+        const nsecs_t mStartTime;
+        const nsecs_t mWaitTimeAtStart;
+    };
+
+    // WaitTimer adds the time from its construction to its destruction to
+    // the wait time of the calling thread, which the LockTimer of the call
+    // subtracts from the hold time. It must be declared around waits on a
+    // condition, which release mMutex.
+    class WaitTimer {
+    public:
+        WaitTimer();
+        ~WaitTimer();
+    private:
+        const nsecs_t mStartTime;
+    };
+
+    static std::atomic<bool> sConsistencyChecksEnabled;
+    static std::atomic<uint32_t> sConsistencyErrorCount;
+
+    static std::atomic<bool> sLockStatsEnabled;
+    // Guarded by mMutex
+    LockStats mLockStats[NUM_LOCKED_CALLS];
+
 }; // class BufferQueueCore
 
 } // namespace android
@@ -17,6 +17,7 @@
 #ifndef ANDROID_GUI_BUFFERQUEUEPRODUCER_H
 #define ANDROID_GUI_BUFFERQUEUEPRODUCER_H
 
+#include <gui/BufferQueueCore.h>
 #include <gui/BufferQueueDefs.h>
 #include <gui/IGraphicBufferProducer.h>
 
@@ -183,6 +184,13 @@ public:
     // See IGraphicBufferProducer::getUniqueId
     virtual status_t getUniqueId(uint64_t* outId) const override;
 
+    // See IGraphicBufferProducer::setPredictiveAllocation
+    virtual status_t setPredictiveAllocation(bool enabled) override;
+
+    // See IGraphicBufferProducer::reclaimNextBuffer
+    virtual status_t reclaimNextBuffer(int* outSlot,
+            sp<Fence>* outFence) override;
+
 private:
     // This is required by the IBinder::DeathRecipient interface
     virtual void binderDied(const wp<IBinder>& who);
@@ -206,6 +214,21 @@ private:
     };
     status_t waitForFreeSlotThenRelock(FreeSlotCaller caller, int* found) const;
 
+    // preallocateBuffers runs on a background thread started by
+    // dequeueBuffer in predictive allocation mode. It allocates buffers with
+    // mCore->mPredictedAttributes for the free slots without a buffer and
+    // for the free buffers that don't match them, until the attributes stop
+    // changing under it.
+    void preallocateBuffers();
+
+    // Returns whether buffers may be preallocated at the moment
+    bool canPreallocateLocked() const;
+
+    // Returns the next free slot to preallocate a buffer with the given
+    // attributes for, or BufferQueueCore::INVALID_BUFFER_SLOT if there is none
+    int findPreallocationSlotLocked(
+            const BufferQueueCore::BufferAttributes& attributes) const;
+
     sp<BufferQueueCore> mCore;
 
     // This references mCore->mSlots. Lock mCore->mMutex while accessing.
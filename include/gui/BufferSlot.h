@@ -182,7 +182,9 @@ struct BufferSlot {
       mEglFence(EGL_NO_SYNC_KHR),
       mFence(Fence::NO_FENCE),
       mAcquireCalled(false),
-      mNeedsReallocation(false) {
+      mNeedsReallocation(false),
+      mPreallocated(false),
+      mRecyclable(false) {
     }
 
     // mGraphicBuffer points to the buffer allocated for this slot or is NULL
@@ -230,6 +232,15 @@ struct BufferSlot {
     // producer. If so, it needs to set the BUFFER_NEEDS_REALLOCATION flag when
     // dequeued to prevent the producer from using a stale cached buffer.
     bool mNeedsReallocation;
+
+    // Indicates whether the buffer was allocated ahead of time in predictive
+    // allocation mode and hasn't been dequeued since.
+    bool mPreallocated;
+
+    // Indicates whether the buffer was allocated by the BufferQueue's own
+    // allocator, rather than attached, and may be handed back to it for
+    // reuse when the slot is freed.
+    bool mRecyclable;
 };
 
 } // namespace android
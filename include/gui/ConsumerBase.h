@@ -92,6 +92,9 @@ public:
     // See IGraphicBufferConsumer::discardFreeBuffers
     status_t discardFreeBuffers();
 
+    // See IGraphicBufferConsumer::setBufferCountTuning
+    status_t setBufferCountTuning(int mode);
+
 private:
     ConsumerBase(const ConsumerBase&);
     void operator=(const ConsumerBase&);
@@ -43,6 +43,28 @@ class CpuConsumer : public ConsumerBase
   public:
     typedef ConsumerBase::FrameAvailableListener FrameAvailableListener;
 
+    enum { MAX_PLANES = 3 };
+
+    // A plane of a locked buffer: its first byte, the number of bytes from
+    // there to one past the last byte of the plane, and the distances in
+    // bytes between rows and between horizontally adjacent pixels. The size
+    // and strides are 0 for formats whose layout CpuConsumer doesn't know,
+    // such as RAW_OPAQUE, and the data is NULL for planes the buffer doesn't
+    // have.
+    struct Plane {
+        uint8_t    *data;
+        size_t      size;
+        uint32_t    rowStride;
+        uint32_t    pixelStride;
+
+        Plane() :
+            data(NULL),
+            size(0),
+            rowStride(0),
+            pixelStride(0)
+        {}
+    };
+
     struct LockedBuffer {
         uint8_t    *data;
         uint32_t    width;
@@ -67,6 +89,11 @@ class CpuConsumer : public ConsumerBase
         uint8_t    *dataCr;
         uint32_t    chromaStride;
         uint32_t    chromaStep;
+        // The planes of the buffer: Y, Cb and Cr for
+        // HAL_PIXEL_FORMAT_YCbCr_420_888 or compatible formats, a single
+        // plane otherwise.
+        Plane       planes[MAX_PLANES];
+        uint32_t    planeCount;
 
         LockedBuffer() :
             data(NULL),
@@ -84,7 +111,8 @@ class CpuConsumer : public ConsumerBase
             dataCb(NULL),
             dataCr(NULL),
             chromaStride(0),
-            chromaStep(0)
+            chromaStep(0),
+            planeCount(0)
         {}
     };
 
@@ -110,20 +138,66 @@ class CpuConsumer : public ConsumerBase
     // by calling unlockBuffer before more buffers can be acquired.
     status_t lockNextBuffer(LockedBuffer *nativeBuffer);
 
+    // Locks up to maxCount of the next buffers at once, for consumers that
+    // process frames in groups, and returns in outCount how many were locked,
+    // in queue order. Stops early when no more buffers are available or the
+    // maximum number of buffers is locked. Returns BAD_VALUE and
+    // NOT_ENOUGH_DATA as lockNextBuffer does when not a single buffer could
+    // be locked, and OK otherwise.
+    status_t lockNextBuffers(LockedBuffer *nativeBuffers, size_t maxCount,
+            size_t *outCount);
+
     // Returns a locked buffer to the queue, allowing it to be reused. Since
     // only a fixed number of buffers may be locked at a time, old buffers must
     // be released by calling unlockBuffer to ensure new buffers can be acquired by
     // lockNextBuffer.
     status_t unlockBuffer(const LockedBuffer &nativeBuffer);
 
+    // In persistent mapping mode, buffers stay locked for CPU reading from
+    // the first time they are acquired until the BufferQueue frees their
+    // slot, instead of being locked and unlocked around each acquire. This
+    // saves the gralloc lock and unlock calls, and their mapping costs, on
+    // every frame. lockNextBuffer waits for the acquire fence itself, and the
+    // whole buffer rather than its crop is mapped.
+    //
+    // This must only be used when the gralloc implementation keeps the CPU
+    // view of the buffers coherent without a lock per access, since any cache
+    // maintenance it does on lock and unlock only happens once per slot.
+    // Disabled by default.
+    void setPersistentMappingEnabled(bool enabled);
+
   private:
     // Maximum number of buffers that can be locked at a time
     size_t mMaxLockedBuffers;
 
+    status_t lockNextBufferLocked(LockedBuffer *nativeBuffer);
+
     status_t releaseAcquiredBufferLocked(size_t lockedIdx);
 
     virtual void freeBufferLocked(int slotIndex);
 
+    // Drops the persistent mapping of the given slot, unlocking the buffer
+    // now if it isn't acquired and when it is released otherwise.
+    void unmapSlotLocked(int slotIndex);
+
+    // Whether buffers are kept locked across acquires
+    bool mPersistentMapping;
+
+    // The buffers that stay locked in persistent mapping mode, per slot
+    struct Mapping {
+        sp<GraphicBuffer> mGraphicBuffer;
+        void *mBufferPointer;
+        android_ycbcr mYCbCr;
+        PixelFormat mFlexFormat;
+
+        Mapping() :
+                mBufferPointer(NULL),
+                mYCbCr(),
+                mFlexFormat(PIXEL_FORMAT_NONE) {
+        }
+    };
+    Mapping mMappings[BufferQueue::NUM_BUFFER_SLOTS];
+
     // Tracking for buffers acquired by the user
     struct AcquiredBuffer {
         // Need to track the original mSlot index and the buffer itself because
@@ -132,10 +206,13 @@ class CpuConsumer : public ConsumerBase
         int mSlot;
         sp<GraphicBuffer> mGraphicBuffer;
         void *mBufferPointer;
+        // Whether the buffer stays locked after it is released
+        bool mPersistent;
 
         AcquiredBuffer() :
                 mSlot(BufferQueue::INVALID_BUFFER_SLOT),
-                mBufferPointer(NULL) {
+                mBufferPointer(NULL),
+                mPersistent(false) {
         }
     };
     Vector<AcquiredBuffer> mAcquiredBuffers;
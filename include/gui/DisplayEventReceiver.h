@@ -107,7 +107,8 @@ public:
 
     /*
      * sendEvents write events to the queue and returns how many events were
-     * written.
+     * written. Each event is sent as a separate message, which getEvents
+     * relies on to receive several of them with a single system call.
      */
     static ssize_t sendEvents(const sp<BitTube>& dataChannel,
             Event const* events, size_t count);
@@ -23,19 +23,75 @@
 #include <gui/IGraphicBufferAlloc.h>
 #include <ui/PixelFormat.h>
 #include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
 
 namespace android {
 // ---------------------------------------------------------------------------
 
 class GraphicBuffer;
 
+/* GraphicBufferAlloc allocates buffers from gralloc on behalf of the
+ * BufferQueues of this process and of remote clients.
+ *
+ * Once setPoolLimits enables it, the buffers that local BufferQueues free
+ * are kept in a pool shared by all the GraphicBufferAlloc instances of the
+ * process, keyed by width, height, format, usage and the uid of the producer
+ * they were exposed to, along with their release fence. Once nothing else
+ * references a pooled buffer, createOrReuseGraphicBuffer returns it and its
+ * release fence to the next request from the same uid with the same
+ * attributes instead of allocating. So surfaces that are torn down and
+ * created again, or resized back and forth, skip gralloc. As its remote
+ * callers can't be handed the fence, createGraphicBuffer only reuses
+ * buffers whose release fence has already signaled.
+ *
+ * The pool is split in classes, each GraphicBufferAlloc recycling into and
+ * reusing from the class it was created with. Each class holds at most a
+ * given number of bytes, the least recently recycled buffers being freed
+ * first, and drops buffers that have not been reused within a given time
+ * whenever a buffer is recycled or requested. The whole pool is emptied
+ * when gralloc runs out of memory.
+ */
 class GraphicBufferAlloc : public BnGraphicBufferAlloc {
 public:
+    enum PoolClass {
+        // The buffers of the layers and of remote clients
+        POOL_SHARED,
+        // The scratch buffers SurfaceFlinger composes virtual displays into
+        POOL_VIRTUAL_DISPLAY,
+        POOL_CLASS_COUNT,
+    };
+
     GraphicBufferAlloc();
+    explicit GraphicBufferAlloc(PoolClass poolClass);
     virtual ~GraphicBufferAlloc();
     virtual sp<GraphicBuffer> createGraphicBuffer(uint32_t width,
             uint32_t height, PixelFormat format, uint32_t usage,
             std::string requestorName, status_t* error) override;
+
+    virtual sp<GraphicBuffer> createOrReuseGraphicBuffer(uint32_t width,
+            uint32_t height, PixelFormat format, uint32_t usage,
+            std::string requestorName, status_t* error,
+            sp<Fence>* outReleaseFence) override;
+
+    virtual void recycleGraphicBuffer(const sp<GraphicBuffer>& buffer,
+            uid_t ownerUid, const sp<Fence>& releaseFence) override;
+
+    // Sets the limits of POOL_SHARED. A maxBytes of zero, the default for
+    // every class, disables recycling. A maxIdleTime of zero keeps buffers
+    // until they are evicted by size.
+    static void setPoolLimits(size_t maxBytes, nsecs_t maxIdleTime);
+    static void setPoolLimits(PoolClass poolClass, size_t maxBytes,
+            nsecs_t maxIdleTime);
+
+    // Frees pooled buffers, least recently recycled first, until each class
+    // holds at most maxBytes. Returns the number of buffers dropped.
+    static size_t trimPool(size_t maxBytes);
+
+    static void dumpPool(String8& result);
+
+private:
+    const PoolClass mPoolClass;
 };
 
 
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 
 #include <binder/IInterface.h>
+#include <ui/Fence.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/PixelFormat.h>
 #include <utils/RefBase.h>
@@ -45,6 +46,29 @@ public:
             PixelFormat format, uint32_t usage, status_t* error) {
         return createGraphicBuffer(w, h, format, usage, "<Unknown>", error);
     }
+
+    /* Like createGraphicBuffer, but may hand out a buffer that was given
+     * back with recycleGraphicBuffer instead of allocating one. In that case
+     * outReleaseFence is set to the release fence the buffer was recycled
+     * with, which must signal before the buffer is written to; otherwise it
+     * is set to Fence::NO_FENCE. The default implementation, which the binder
+     * proxy uses, calls createGraphicBuffer.
+     */
+    virtual sp<GraphicBuffer> createOrReuseGraphicBuffer(uint32_t w,
+            uint32_t h, PixelFormat format, uint32_t usage,
+            std::string requestorName, status_t* error,
+            sp<Fence>* outReleaseFence);
+
+    /* Hand a buffer returned by createGraphicBuffer back once the
+     * BufferQueue it was allocated for has freed it, along with the fence
+     * that signals once its last user is done with it. ownerUid is the uid of
+     * the producer the buffer was exposed to; an allocator that keeps the
+     * buffer must only hand it out again to that same uid. The default
+     * implementation drops the buffer, and so does the binder proxy, since
+     * the buffer remains mapped by the caller.
+     */
+    virtual void recycleGraphicBuffer(const sp<GraphicBuffer>& buffer,
+            uid_t ownerUid, const sp<Fence>& releaseFence);
 };
 
 // ----------------------------------------------------------------------------
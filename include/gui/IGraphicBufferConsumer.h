@@ -54,6 +54,13 @@ public:
         PRESENT_LATER,
     };
 
+    enum {
+        // The modes of setBufferCountTuning
+        BUFFER_COUNT_TUNING_OFF = 0,
+        BUFFER_COUNT_TUNING_RECOMMEND = 1,
+        BUFFER_COUNT_TUNING_AUTO = 2,
+    };
+
     // acquireBuffer attempts to acquire ownership of the next pending buffer in
     // the BufferQueue.  If no buffer is pending then it returns
     // NO_BUFFER_AVAILABLE.  If a buffer is successfully acquired, the
@@ -277,6 +284,23 @@ public:
     // possible without discarding data.
     virtual status_t discardFreeBuffers() = 0;
 
+    // setBufferCountTuning sets how the queue tunes its max dequeued buffer
+    // count from its use. A double-buffered queue whose dequeueBuffer calls
+    // often block for the consumer to release a buffer should be
+    // triple-buffered, and a triple-buffered queue whose third buffer stays
+    // unused over several segments of its occupancy history (see
+    // getOccupancyHistory) should be double-buffered. In
+    // BUFFER_COUNT_TUNING_RECOMMEND mode, the count this calls for is only
+    // reported by dump. In BUFFER_COUNT_TUNING_AUTO mode, it is applied as
+    // setMaxDequeuedBufferCount would, as soon as the buffers dequeued by the
+    // producer allow it. Queues with any other max dequeued buffer count are
+    // left alone. The default is BUFFER_COUNT_TUNING_OFF.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned.
+    // * BAD_VALUE - mode isn't one of the modes above.
+    virtual status_t setBufferCountTuning(int mode) = 0;
+
     // dump state into a string
     virtual void dump(String8& result, const char* prefix) const = 0;
 
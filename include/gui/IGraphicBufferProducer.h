@@ -590,6 +590,52 @@ public:
 
     // Returns a unique id for this BufferQueue
     virtual status_t getUniqueId(uint64_t* outId) const = 0;
+
+    // Sets whether the BufferQueue allocates buffers ahead of dequeueBuffer.
+    //
+    // Once two dequeueBuffer calls in a row have asked for the same size,
+    // format and usage, the BufferQueue allocates buffers with these
+    // attributes on a background thread, for the free slots that have no
+    // buffer and in place of the free buffers that don't match them. After a
+    // resize, only the first dequeueBuffer calls have to wait for an
+    // allocation, and a single dequeueBuffer call with other attributes
+    // doesn't make the BufferQueue replace the buffers. Buffers allocated
+    // this way are returned with the BUFFER_NEEDS_REALLOCATION flag like any
+    // other new buffer.
+    //
+    // This is off by default, and has no effect while allocation is
+    // disallowed or in shared buffer mode.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * INVALID_OPERATION - this producer doesn't support it.
+    virtual status_t setPredictiveAllocation(bool /*enabled*/) {
+        return INVALID_OPERATION;
+    }
+
+    // reclaimNextBuffer takes back the oldest buffer released by the consumer
+    // like detachNextBuffer does, except that it leaves the buffer in its slot
+    // and returns the slot, as dequeueBuffer would. A producer that attached
+    // its buffers once can then queue them again by slot, without sending
+    // them back and forth with detachNextBuffer and attachBuffer.
+    //
+    // Like detachNextBuffer, it never blocks or allocates, and like
+    // dequeueBuffer, it can't exceed the max dequeued buffer count once a
+    // buffer has been queued. outFence is equivalent to fence from the
+    // dequeueBuffer call.
+    //
+    // Return of a value other than NO_ERROR means an error has occurred:
+    // * NO_INIT - the buffer queue has been abandoned or the producer is not
+    //             connected.
+    // * BAD_VALUE - either outSlot or outFence were NULL, or the queue is in
+    //               shared buffer mode.
+    // * NO_MEMORY - no slots were found that were both free and contained a
+    //               GraphicBuffer.
+    // * INVALID_OPERATION - the max dequeued buffer count would be exceeded,
+    //                       or this producer doesn't support it.
+    virtual status_t reclaimNextBuffer(int* /*outSlot*/,
+            sp<Fence>* /*outFence*/) {
+        return INVALID_OPERATION;
+    }
 };
 
 // ----------------------------------------------------------------------------
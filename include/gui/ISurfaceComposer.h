@@ -153,6 +153,21 @@ public:
             bool useIdentityTransform,
             Rotation rotation = eRotateNone) = 0;
 
+    /* Same as captureScreen, but SurfaceFlinger's composition thread only
+     * issues the GPU commands: the buffer is queued to the producer with the
+     * rendering fence, so the consumer's readback overlaps with the next
+     * compositions. Pass a reqWidth/reqHeight smaller than the display for
+     * thumbnails, rendering then only touches the downscaled pixels.
+     * Falls back to captureScreen when native fences are not supported.
+     * requires READ_FRAME_BUFFER permission
+     */
+    virtual status_t captureScreenAsync(const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform,
+            Rotation rotation = eRotateNone) = 0;
+
     /* Clears the frame statistics for animations.
      *
      * Requires the ACCESS_SURFACE_FLINGER permission.
@@ -202,6 +217,7 @@ public:
         GET_DISPLAY_COLOR_MODES,
         GET_ACTIVE_COLOR_MODE,
         SET_ACTIVE_COLOR_MODE,
+        CAPTURE_SCREEN_ASYNC,
     };
 
     virtual status_t onTransact(uint32_t code, const Parcel& data,
@@ -35,6 +35,8 @@ public:
     OccupancyTracker()
       : mPendingSegment(),
         mSegmentHistory(),
+        mUnreviewedSegment(),
+        mRecentSegments(),
         mLastOccupancy(0),
         mLastOccupancyChangeTime(0) {}
 
@@ -72,6 +74,13 @@ public:
     void registerOccupancyChange(size_t occupancy);
     std::vector<Segment> getSegmentHistory(bool forceFlush);
 
+    // takeRecentSegments returns the segments recorded since the last call,
+    // most recent first, without affecting getSegmentHistory. Since a queue
+    // that is never idle never closes its segment, the part of the pending
+    // segment since the last call is returned as a segment of its own once it
+    // is at least maxPendingTime long.
+    std::vector<Segment> takeRecentSegments(nsecs_t maxPendingTime);
+
 private:
     static constexpr size_t MAX_HISTORY_SIZE = 10;
     static constexpr nsecs_t NEW_SEGMENT_DELAY = ms2ns(100);
@@ -84,6 +93,17 @@ private:
             mOccupancyTimes.clear();
         }
 
+        void addTime(size_t occupancy, nsecs_t delta) {
+            totalTime += delta;
+            if (mOccupancyTimes.count(occupancy)) {
+                mOccupancyTimes[occupancy] += delta;
+            } else {
+                mOccupancyTimes[occupancy] = delta;
+            }
+        }
+
+        Segment toSegment() const;
+
         nsecs_t totalTime;
         size_t numFrames;
         std::unordered_map<size_t, nsecs_t> mOccupancyTimes;
@@ -94,6 +114,11 @@ private:
     PendingSegment mPendingSegment;
     std::deque<Segment> mSegmentHistory;
 
+    // The part of mPendingSegment since the last takeRecentSegments call, and
+    // the segments takeRecentSegments hasn't returned yet
+    PendingSegment mUnreviewedSegment;
+    std::deque<Segment> mRecentSegments;
+
     size_t mLastOccupancy;
     nsecs_t mLastOccupancyChangeTime;
 
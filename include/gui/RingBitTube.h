@@ -0,0 +1,111 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_RING_BIT_TUBE_H
+#define ANDROID_GUI_RING_BIT_TUBE_H
+
+#include <gui/BitTube.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// RingBitTube is a BitTube for high-rate channels that passes messages through
+// a ring buffer in shared memory instead of a socket, so that sending and
+// receiving messages doesn't take a system call each. getFd returns an eventfd
+// that the writer only signals when the reader may have run out of messages,
+// so it can be polled with a Looper like the socket of a BitTube.
+//
+// If the shared memory or the eventfd can't be created, a RingBitTube falls
+// back to the socket of a BitTube, which isRing tells apart. In both cases,
+// it is used through the BitTube object APIs, and has to be unparceled with
+// RingBitTube(const Parcel&) since its parcel differs from that of a BitTube.
+//
+// Unlike a socket, the ring doesn't tell the writer when the reader has gone
+// away: writes keep succeeding until the ring is full. It also supports one
+// writer and one reader at a time, which must serialize their own calls.
+//
+// Nothing in the platform uses a RingBitTube yet. It is meant for a
+// connection that carries hundreds or thousands of small messages per second
+// to a single reader, such as a SensorEventConnection for fast sensors, where
+// the socket's system calls and wakeups per message dominate. Moving such a
+// connection over takes the server creating a RingBitTube and the client
+// unparceling it with RingBitTube(const Parcel&), so both sides have to be
+// updated together. libgui_bittube_benchmark compares it with a BitTube.
+class RingBitTube : public BitTube
+{
+public:
+
+    // creates a RingBitTube with a default (4KB) ring
+    RingBitTube();
+
+    // creates a RingBitTube with a ring of at least bufsize bytes, or socket
+    // buffers of bufsize bytes for the fallback
+    explicit RingBitTube(size_t bufsize);
+
+    explicit RingBitTube(const Parcel& data);
+    virtual ~RingBitTube();
+
+    // whether messages go through the shared memory ring rather than the
+    // fallback socket
+    bool isRing() const;
+
+    // parcels this RingBitTube. Unlike a BitTube, the sending side keeps the
+    // eventfd, which it needs to wake up the receiving side.
+    virtual status_t writeToParcel(Parcel* reply) const;
+
+protected:
+    virtual ssize_t write(void const* vaddr, size_t size);
+    virtual ssize_t read(void* vaddr, size_t size);
+    virtual ssize_t writeMessages(void const* vaddr, size_t size,
+            size_t messageSize);
+    virtual ssize_t readMessages(void* vaddr, size_t size, size_t messageSize);
+
+private:
+    struct Header;
+
+    void initRing(size_t bufsize);
+    status_t mapRing(int memoryFd);
+
+    // copies between the ring and linear memory, wrapping around the end of
+    // the ring
+    void copyToRing(uint32_t index, const void* src, size_t size);
+    void copyFromRing(void* dst, uint32_t index, size_t size) const;
+
+    // publishes the records written up to tail, and wakes up the reader if it
+    // had read everything up to oldTail
+    void publish(uint32_t oldTail, uint32_t tail);
+
+    // called by the reader once it has read everything up to head, to clear
+    // the eventfd without missing the records published in the meantime
+    void onRingDrained(uint32_t head);
+
+    // signals the eventfd
+    void wakeReader();
+
+    // The shared memory file descriptor and mapping. The eventfd is
+    // mReceiveFd, on both sides.
+    int mMemoryFd;
+    void* mMemory;
+    size_t mMemorySize;
+    Header* mHeader;
+    uint8_t* mData;
+    uint32_t mCapacity;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_GUI_RING_BIT_TUBE_H
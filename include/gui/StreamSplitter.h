@@ -17,6 +17,7 @@
 #ifndef ANDROID_GUI_STREAMSPLITTER_H
 #define ANDROID_GUI_STREAMSPLITTER_H
 
+#include <gui/BufferQueueDefs.h>
 #include <gui/IConsumerListener.h>
 #include <gui/IProducerListener.h>
 
@@ -60,9 +61,30 @@ public:
     // A return value other than NO_ERROR means that an error has occurred and
     // outputQueue has not been added to the splitter. BAD_VALUE is returned if
     // outputQueue is NULL. See IGraphicBufferProducer::connect for explanations
-    // of other error codes.
+    // of other error codes. In persistent slot mode, an outputQueue that
+    // doesn't support IGraphicBufferProducer::reclaimNextBuffer is still added,
+    // but each frame is attached to it and detached from it again as without
+    // persistent slots.
     status_t addOutput(const sp<IGraphicBufferProducer>& outputQueue);
 
+    // setPersistentSlotsEnabled sets whether buffers stay in their slots of the
+    // input and of the outputs. By default, each frame is detached from the
+    // input and attached to every output, then detached from every output and
+    // attached back to the input once released, which takes several binder
+    // transactions per output and frame. In persistent slot mode, a buffer is
+    // only attached to each output the first time it's seen. After that, it is
+    // queued to the outputs by slot, taken back from them with
+    // IGraphicBufferProducer::reclaimNextBuffer, and released to the input by
+    // slot. The splitter keeps up to MAX_OUTSTANDING_BUFFERS buffers acquired
+    // from the input, and raises the max dequeued buffer count of each output
+    // to the number of input buffers attached to it.
+    //
+    // This must be called before any output is added, otherwise
+    // INVALID_OPERATION is returned. See
+    // IGraphicBufferConsumer::setMaxAcquiredBufferCount for explanations of
+    // other error codes.
+    status_t setPersistentSlotsEnabled(bool enabled);
+
     // setName sets the consumer name of the input queue
     void setName(const String8& name);
 
@@ -77,10 +99,12 @@ private:
     virtual void onFrameAvailable(const BufferItem& item);
 
     // From IConsumerListener
-    // We don't care about released buffers because we detach each buffer as
-    // soon as we acquire it. See the comment for onBufferReleased below for
+    // Outside of persistent slot mode, we don't care about released buffers
+    // because we detach each buffer as soon as we acquire it. In persistent
+    // slot mode, the buffers that were freed from their input slots are
+    // dropped from the outputs. See the comment for onBufferReleased below for
     // some clarifying notes about the name.
-    virtual void onBuffersReleased() {}
+    virtual void onBuffersReleased();
 
     // From IConsumerListener
     // We don't care about sideband streams, since we won't be splitting them
@@ -97,6 +121,24 @@ private:
     // onFrameAvailable call to proceed.
     void onBufferReleasedByOutput(const sp<IGraphicBufferProducer>& from);
 
+    // The persistent slot mode parts of onFrameAvailable and
+    // onBufferReleasedByOutput, which must be called with mMutex locked
+    void queueToOutputsPersistentLocked(const BufferItem& bufferItem);
+    void onBufferReleasedByOutputPersistentLocked(
+            const sp<IGraphicBufferProducer>& from);
+
+    // attachToOutputLocked attaches buffer to the given output in persistent
+    // slot mode, after raising the max dequeued buffer count of the output if
+    // needed to keep all of the attached buffers dequeued
+    status_t attachToOutputLocked(size_t output,
+            const sp<GraphicBuffer>& buffer, int* outSlot);
+
+    // retireInputSlotLocked stops tracking the buffer of the given input slot
+    // in persistent slot mode, once it is no longer in that slot. It is
+    // detached from the outputs that hold it right away, and from the others
+    // as they release it.
+    void retireInputSlotLocked(int slot);
+
     // When this is called, the splitter disconnects from (i.e., abandons) its
     // input queue and signals any waiting onFrameAvailable calls to wake up.
     // It still processes callbacks from other outputs, but only detaches their
@@ -139,6 +181,21 @@ private:
         // Only called while mMutex is held
         size_t incrementReleaseCountLocked() { return ++mReleaseCount; }
 
+        // The following are only used in persistent slot mode, where a tracker
+        // lives as long as its buffer stays in its input slot and is reused
+        // for every frame of that buffer. Only called while mMutex is held.
+
+        // Starts tracking a frame acquired from the input
+        void startFrameLocked(uint64_t frameNumber);
+        uint64_t getFrameNumber() const { return mFrameNumber; }
+
+        // The slot of the buffer in each output, indexed like mOutputs, or
+        // INVALID_BUFFER_SLOT if it isn't attached to that output. A buffer
+        // that is attached but not queued is held dequeued by the splitter.
+        int getOutputSlot(size_t output) const;
+        bool isQueuedToOutput(size_t output) const;
+        void setOutputSlotLocked(size_t output, int slot, bool queued);
+
     private:
         // Only destroy through LightRefBase
         friend LightRefBase<BufferTracker>;
@@ -151,6 +208,13 @@ private:
         sp<GraphicBuffer> mBuffer; // One instance that holds this native handle
         sp<Fence> mMergedFence;
         size_t mReleaseCount;
+
+        struct OutputSlot {
+            int slot;
+            bool queued;
+        };
+        uint64_t mFrameNumber;
+        Vector<OutputSlot> mOutputSlots;
     };
 
     // Only called from createSplitter
@@ -177,6 +241,25 @@ private:
     // objects (which are mostly for counting how many outputs have released the
     // buffer, but also contain merged release fences).
     KeyedVector<uint64_t, sp<BufferTracker> > mBuffers;
+
+    // mPersistentSlots indicates whether persistent slot mode is enabled, see
+    // setPersistentSlotsEnabled.
+    bool mPersistentSlots;
+
+    // In persistent slot mode, the buffer tracking objects by input slot, and
+    // the ones whose buffers left their input slot while still queued to some
+    // of the outputs
+    sp<BufferTracker> mInputSlots[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    Vector<sp<BufferTracker> > mRetiredBuffers;
+
+    // In persistent slot mode, the max dequeued buffer count the splitter set
+    // on each output, indexed like mOutputs
+    Vector<int> mOutputMaxDequeuedBufferCounts;
+
+    // In persistent slot mode, whether each output supports
+    // IGraphicBufferProducer::reclaimNextBuffer, indexed like mOutputs. Buffers
+    // released by the other outputs are detached with detachNextBuffer.
+    Vector<bool> mOutputReclaimsBuffers;
 };
 
 } // namespace android
@@ -122,6 +122,9 @@ public:
     // See IGraphicBufferProducer::setDequeueTimeout
     status_t setDequeueTimeout(nsecs_t timeout);
 
+    // See IGraphicBufferProducer::setPredictiveAllocation
+    status_t setPredictiveAllocation(bool enabled);
+
     /*
      * Wait for frame number to increase past lastFrame for at most
      * timeoutNs. Useful for one thread to wait for another unknown
@@ -243,9 +246,17 @@ private:
 
     struct BufferSlot {
         sp<GraphicBuffer> buffer;
-        Region dirtyRegion;
+        // The lock() frame that was last rendered into the buffer, or 0 if
+        // its content is unknown.
+        uint64_t lockedFrame = 0;
     };
 
+    // getStaleRegionLocked returns the region of the given buffer that was
+    // redrawn by the lock() frames rendered since the buffer's own, that is
+    // the region in which it differs from mPostedBuffer.
+    Region getStaleRegionLocked(const sp<GraphicBuffer>& buffer,
+            const Rect& bounds) const;
+
     // mSurfaceTexture is the interface to the surface texture server. All
     // operations on the surface texture client ultimately translate into
     // interactions with the server using this interface.
@@ -356,6 +367,14 @@ private:
     // (the change since the previous frame) passed in by the producer.
     Region mDirtyRegion;
 
+    // The regions redrawn by the most recent lock() frames, indexed by frame
+    // number modulo DIRTY_HISTORY_SIZE, and the number of the last of these
+    // frames. Buffers last rendered longer ago than the history goes back
+    // are copied back entirely.
+    enum { DIRTY_HISTORY_SIZE = 8 };
+    Region mDirtyHistory[DIRTY_HISTORY_SIZE];
+    uint64_t mLockedFrameCount;
+
     // Stores the current generation number. See setGenerationNumber and
     // IGraphicBufferProducer::setGenerationNumber for more information.
     uint32_t mGenerationNumber;
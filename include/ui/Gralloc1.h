@@ -20,6 +20,7 @@
 #define GRALLOC1_LOG_TAG "Gralloc1"
 
 #include <ui/Gralloc1On0Adapter.h>
+#include <ui/Gralloc1OnHeap.h>
 
 #include <unordered_set>
 
@@ -226,8 +227,17 @@ public:
 
     std::unique_ptr<Device> getDevice();
 
+    // Makes the Loaders created from now on load a Gralloc1OnHeap device
+    // instead of the gralloc module. Without it, a missing gralloc module is
+    // fatal. Since GraphicBufferAllocator and GraphicBufferMapper create
+    // their Loader once, this must be called before any buffer is allocated
+    // or imported.
+    static void useHeapDevice();
+
 private:
     static std::unique_ptr<Gralloc1On0Adapter> mAdapter;
+    static std::unique_ptr<Gralloc1OnHeap> mHeapDevice;
+    static std::atomic<bool> mUseHeapDevice;
     std::unique_ptr<Device> mDevice;
 };
 
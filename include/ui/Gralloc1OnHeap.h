@@ -0,0 +1,218 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_UI_GRALLOC_1_ON_HEAP_H
+#define ANDROID_UI_GRALLOC_1_ON_HEAP_H
+
+#include <ui/Fence.h>
+
+#include <hardware/gralloc1.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace android {
+
+// Gralloc1OnHeap is a gralloc1 device that doesn't need any graphics
+// hardware: every buffer is a shared memory region (a memfd, or ashmem where
+// memfd_create isn't available) that is mapped into the process the first
+// time it is locked and stays mapped until the buffer is released. The buffer
+// handles carry the buffer geometry, so handles sent to another process can
+// be retained and locked there as well.
+//
+// Locking never waits for anything but the acquire fence, and unlocking
+// returns no release fence. Flexible locking is supported for the YUV 4:2:0
+// formats (YV12, YCrCb_420_SP and YCbCr_420_888, which is laid out as I420).
+//
+// This is meant for running and benchmarking BufferQueue and its clients on
+// devices without a usable gralloc module. A process only gets it by calling
+// Gralloc1::Loader::useHeapDevice; the buffers can't be used by the GPU or
+// any other hardware.
+class Gralloc1OnHeap : public gralloc1_device_t
+{
+public:
+    Gralloc1OnHeap();
+    ~Gralloc1OnHeap();
+
+    gralloc1_device_t* getDevice() {
+        return static_cast<gralloc1_device_t*>(this);
+    }
+
+private:
+    static inline Gralloc1OnHeap* getHeap(gralloc1_device_t* device) {
+        return static_cast<Gralloc1OnHeap*>(device);
+    }
+
+    // getCapabilities
+
+    static void getCapabilitiesHook(gralloc1_device_t* device,
+            uint32_t* outCount,
+            int32_t* /*gralloc1_capability_t*/ outCapabilities);
+
+    // getFunction
+
+    gralloc1_function_pointer_t doGetFunction(
+            int32_t /*gralloc1_function_descriptor_t*/ descriptor);
+    static gralloc1_function_pointer_t getFunctionHook(
+            gralloc1_device_t* device,
+            int32_t /*gralloc1_function_descriptor_t*/ descriptor) {
+        return getHeap(device)->doGetFunction(descriptor);
+    }
+
+    // dump
+
+    void dump(uint32_t* outSize, char* outBuffer);
+    static void dumpHook(gralloc1_device_t* device, uint32_t* outSize,
+            char* outBuffer) {
+        return getHeap(device)->dump(outSize, outBuffer);
+    }
+    std::string mCachedDump;
+
+    // Buffer descriptors
+
+    struct Descriptor {
+        Descriptor()
+          : width(0),
+            height(0),
+            format(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED),
+            producerUsage(GRALLOC1_PRODUCER_USAGE_NONE),
+            consumerUsage(GRALLOC1_CONSUMER_USAGE_NONE) {}
+
+        uint32_t width;
+        uint32_t height;
+        int32_t format;
+        gralloc1_producer_usage_t producerUsage;
+        gralloc1_consumer_usage_t consumerUsage;
+    };
+
+    static int32_t createDescriptorHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t* outDescriptor);
+    static int32_t destroyDescriptorHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t descriptor);
+    static int32_t setConsumerUsageHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t descriptor, uint64_t usage);
+    static int32_t setDimensionsHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t descriptor, uint32_t width,
+            uint32_t height);
+    static int32_t setFormatHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t descriptor, int32_t format);
+    static int32_t setProducerUsageHook(gralloc1_device_t* device,
+            gralloc1_buffer_descriptor_t descriptor, uint64_t usage);
+
+    // Buffers
+
+    // The part of the buffer handle after the file descriptor, which lets
+    // any process that receives the handle use the buffer
+    struct Layout {
+        uint32_t magic;
+        uint32_t width;
+        uint32_t height;
+        // in pixels, or in bytes for BLOB and the YUV formats
+        uint32_t stride;
+        int32_t format;
+        uint32_t size;
+        uint32_t producerUsageLow;
+        uint32_t producerUsageHigh;
+        uint32_t consumerUsageLow;
+        uint32_t consumerUsageHigh;
+        uint32_t storeLow;
+        uint32_t storeHigh;
+    };
+
+    struct Buffer {
+        Buffer(native_handle_t* handle, const Layout& layout,
+                bool wasAllocated)
+          : handle(handle),
+            layout(layout),
+            wasAllocated(wasAllocated),
+            referenceCount(1),
+            lockCount(0),
+            data(nullptr) {}
+
+        native_handle_t* const handle;
+        const Layout layout;
+        // Whether this buffer was allocated in this process (as opposed to
+        // just being retained here), which determines whether releasing it
+        // frees the handle
+        const bool wasAllocated;
+
+        size_t referenceCount;
+        uint32_t lockCount;
+        // Mapped on the first lock
+        uint8_t* data;
+    };
+
+    static int32_t allocateHook(gralloc1_device_t* device,
+            uint32_t numDescriptors,
+            const gralloc1_buffer_descriptor_t* descriptors,
+            buffer_handle_t* outBuffers);
+    gralloc1_error_t allocate(const Descriptor& descriptor,
+            buffer_handle_t* outBuffer);
+
+    static int32_t retainHook(gralloc1_device_t* device,
+            buffer_handle_t buffer);
+    static int32_t releaseHook(gralloc1_device_t* device,
+            buffer_handle_t buffer);
+
+    static int32_t getBackingStoreHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, gralloc1_backing_store_t* outStore);
+    static int32_t getConsumerUsageHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint64_t* outUsage);
+    static int32_t getDimensionsHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint32_t* outWidth, uint32_t* outHeight);
+    static int32_t getFormatHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, int32_t* outFormat);
+    static int32_t getNumFlexPlanesHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint32_t* outNumPlanes);
+    static int32_t getProducerUsageHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint64_t* outUsage);
+    static int32_t getStrideHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint32_t* outStride);
+
+    static int32_t lockHook(gralloc1_device_t* device, buffer_handle_t buffer,
+            uint64_t producerUsage, uint64_t consumerUsage,
+            const gralloc1_rect_t* accessRegion, void** outData,
+            int32_t acquireFence);
+    static int32_t lockFlexHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, uint64_t producerUsage,
+            uint64_t consumerUsage, const gralloc1_rect_t* accessRegion,
+            struct android_flex_layout* outFlexLayout, int32_t acquireFence);
+    static int32_t unlockHook(gralloc1_device_t* device,
+            buffer_handle_t buffer, int32_t* outReleaseFence);
+
+    // Waits for acquireFence and returns the mapped buffer data
+    gralloc1_error_t lock(buffer_handle_t buffer,
+            const gralloc1_rect_t* accessRegion, int32_t acquireFence,
+            Layout* outLayout, uint8_t** outData);
+
+    // Returns a copy of the layout of the buffer, or false if the handle is
+    // unknown
+    bool getLayout(buffer_handle_t buffer, Layout* outLayout);
+
+    static std::atomic<gralloc1_buffer_descriptor_t> sNextBufferDescriptorId;
+    static std::atomic<uint32_t> sNextBufferId;
+    std::mutex mDescriptorMutex;
+    std::unordered_map<gralloc1_buffer_descriptor_t, Descriptor> mDescriptors;
+    std::mutex mBufferMutex;
+    std::unordered_map<buffer_handle_t, std::unique_ptr<Buffer>> mBuffers;
+};
+
+} // namespace android
+
+#endif
@@ -42,6 +42,7 @@ LOCAL_SRC_FILES := \
 	IGraphicBufferConsumer.cpp \
 	IConsumerListener.cpp \
 	BitTube.cpp \
+	BufferCountTuner.cpp \
 	BufferItem.cpp \
 	BufferItemConsumer.cpp \
 	BufferQueue.cpp \
@@ -65,6 +66,7 @@ LOCAL_SRC_FILES := \
 	ISurfaceComposerClient.cpp \
 	LayerState.cpp \
 	OccupancyTracker.cpp \
+	RingBitTube.cpp \
 	Sensor.cpp \
 	SensorEventQueue.cpp \
 	SensorManager.cpp \
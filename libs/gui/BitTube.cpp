@@ -19,8 +19,11 @@
 #include <sys/socket.h>
 
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <utils/Errors.h>
 
 #include <binder/Parcel.h>
@@ -34,6 +37,9 @@ namespace android {
 // we really need.  So we make it smaller.
 static const size_t DEFAULT_SOCKET_BUFFER_SIZE = 4 * 1024;
 
+// The most messages sent or received by a single sendmmsg or recvmmsg call
+static const size_t MAX_BATCH_MESSAGES = 64;
+
 
 BitTube::BitTube()
     : mSendFd(-1), mReceiveFd(-1)
@@ -47,6 +53,11 @@ BitTube::BitTube(size_t bufsize)
     init(bufsize, bufsize);
 }
 
+BitTube::BitTube(DefaultConstructTag)
+    : mSendFd(-1), mReceiveFd(-1)
+{
+}
+
 BitTube::BitTube(const Parcel& data)
     : mSendFd(-1), mReceiveFd(-1)
 {
@@ -130,6 +141,108 @@ ssize_t BitTube::read(void* vaddr, size_t size)
     return err == 0 ? len : -err;
 }
 
+ssize_t BitTube::writeMessages(void const* vaddr, size_t size,
+        size_t messageSize)
+{
+    const char* base = reinterpret_cast<const char*>(vaddr);
+    size_t sent = 0;
+    while (sent < size) {
+        struct mmsghdr msgs[MAX_BATCH_MESSAGES];
+        struct iovec iovs[MAX_BATCH_MESSAGES];
+        unsigned int count = 0;
+        for (size_t offset = sent; offset < size && count < MAX_BATCH_MESSAGES;
+                ++count) {
+            iovs[count].iov_base = const_cast<char*>(base + offset);
+            iovs[count].iov_len = std::min(messageSize, size - offset);
+            memset(&msgs[count], 0, sizeof(msgs[count]));
+            msgs[count].msg_hdr.msg_iov = &iovs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            offset += iovs[count].iov_len;
+        }
+
+        int result, err;
+        do {
+            result = ::sendmmsg(mSendFd, msgs, count,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+            err = result < 0 ? errno : 0;
+        } while (err == EINTR);
+
+        if (err == ENOSYS) {
+            // Fall back to one send per message on kernels without sendmmsg
+            result = 0;
+            for (unsigned int i = 0; i < count; ++i) {
+                ssize_t len = write(iovs[i].iov_base, iovs[i].iov_len);
+                if (len < 0) {
+                    err = static_cast<int>(-len);
+                    break;
+                }
+                msgs[i].msg_len = static_cast<unsigned int>(len);
+                ++result;
+            }
+        }
+        if (result <= 0) {
+            return sent > 0 ? static_cast<ssize_t>(sent) : -err;
+        }
+
+        for (int i = 0; i < result; ++i) {
+            sent += msgs[i].msg_len;
+        }
+        if (static_cast<unsigned int>(result) < count) {
+            // The socket buffer is full
+            break;
+        }
+    }
+    return static_cast<ssize_t>(sent);
+}
+
+ssize_t BitTube::readMessages(void* vaddr, size_t size, size_t messageSize)
+{
+    char* base = reinterpret_cast<char*>(vaddr);
+    messageSize = std::min(messageSize, size);
+    if (messageSize == 0) {
+        return 0;
+    }
+
+    struct mmsghdr msgs[MAX_BATCH_MESSAGES];
+    struct iovec iovs[MAX_BATCH_MESSAGES];
+    unsigned int count = static_cast<unsigned int>(
+            std::min(size / messageSize, MAX_BATCH_MESSAGES));
+    for (unsigned int i = 0; i < count; ++i) {
+        iovs[i].iov_base = base + i * messageSize;
+        iovs[i].iov_len = messageSize;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int result, err;
+    do {
+        result = ::recvmmsg(mReceiveFd, msgs, count, MSG_DONTWAIT, NULL);
+        err = result < 0 ? errno : 0;
+    } while (err == EINTR);
+    if (err == ENOSYS) {
+        // Fall back to receiving a single message
+        return read(base, messageSize);
+    }
+    if (err == EAGAIN || err == EWOULDBLOCK) {
+        return 0;
+    }
+    if (err != 0) {
+        return -err;
+    }
+
+    // Pack the messages that were shorter than their window
+    size_t received = 0;
+    for (int i = 0; i < result; ++i) {
+        char* window = static_cast<char*>(iovs[i].iov_base);
+        if (window != base + received) {
+            memmove(base + received, window, msgs[i].msg_len);
+        }
+        received += msgs[i].msg_len;
+    }
+    return static_cast<ssize_t>(received);
+}
+
 status_t BitTube::writeToParcel(Parcel* reply) const
 {
     if (mReceiveFd < 0)
@@ -172,5 +285,33 @@ ssize_t BitTube::recvObjects(const sp<BitTube>& tube,
     return size < 0 ? size : size / static_cast<ssize_t>(objSize);
 }
 
+ssize_t BitTube::sendObjectsBatched(const sp<BitTube>& tube,
+        void const* events, size_t count, size_t objSize,
+        size_t objectsPerMessage)
+{
+    ssize_t size = tube->writeMessages(events, count*objSize,
+            std::max(objectsPerMessage, size_t(1))*objSize);
+
+    LOG_ALWAYS_FATAL_IF((size >= 0) && (size % static_cast<ssize_t>(objSize)),
+            "BitTube::sendObjectsBatched(count=%zu, size=%zu), res=%zd (partial events were sent!)",
+            count, objSize, size);
+
+    return size < 0 ? size : size / static_cast<ssize_t>(objSize);
+}
+
+ssize_t BitTube::recvObjectsBatched(const sp<BitTube>& tube,
+        void* events, size_t count, size_t objSize,
+        size_t maxObjectsPerMessage)
+{
+    ssize_t size = tube->readMessages(events, count*objSize,
+            std::max(maxObjectsPerMessage, size_t(1))*objSize);
+
+    LOG_ALWAYS_FATAL_IF((size >= 0) && (size % static_cast<ssize_t>(objSize)),
+            "BitTube::recvObjectsBatched(count=%zu, size=%zu), res=%zd (partial events were received!)",
+            count, objSize, size);
+
+    return size < 0 ? size : size / static_cast<ssize_t>(objSize);
+}
+
 // ----------------------------------------------------------------------------
 }; // namespace android
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BufferCountTuner"
+
+#include <gui/BufferCountTuner.h>
+#include <gui/IGraphicBufferConsumer.h>
+
+#include <utils/String8.h>
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+namespace android {
+
+BufferCountTuner::BufferCountTuner()
+  : mMode(IGraphicBufferConsumer::BUFFER_COUNT_TUNING_OFF),
+    mWindowDequeues(0),
+    mWindowBlockedDequeues(0),
+    mShouldGrow(false),
+    mUnusedSegments(0),
+    mShrinkSegments(SHRINK_SEGMENTS),
+    mLastChangeWasShrink(false),
+    mDequeueCount(0),
+    mBlockedDequeueCount(0),
+    mGrowCount(0),
+    mShrinkCount(0) {}
+
+void BufferCountTuner::setMode(int mode) {
+    mMode = mode;
+}
+
+void BufferCountTuner::onDequeue(bool blocked) {
+    ++mDequeueCount;
+    ++mWindowDequeues;
+    if (blocked) {
+        ++mBlockedDequeueCount;
+        ++mWindowBlockedDequeues;
+        mUnusedSegments = 0;
+    }
+    if (mWindowBlockedDequeues >= GROW_BLOCKED_DEQUEUES) {
+        mShouldGrow = true;
+    }
+    if (mWindowDequeues >= DEQUEUE_WINDOW) {
+        mWindowDequeues = 0;
+        mWindowBlockedDequeues = 0;
+    }
+}
+
+void BufferCountTuner::onSegment(const OccupancyTracker::Segment& segment) {
+    if (segment.usedThirdBuffer) {
+        mUnusedSegments = 0;
+    } else {
+        ++mUnusedSegments;
+    }
+}
+
+void BufferCountTuner::onRecentSegments(
+        const std::vector<OccupancyTracker::Segment>& segments) {
+    // onSegment counts the segments in a row since the third buffer was
+    // last used, so they must be replayed oldest first
+    for (auto it = segments.rbegin(); it != segments.rend(); ++it) {
+        onSegment(*it);
+    }
+}
+
+int BufferCountTuner::getTargetMaxDequeuedBufferCount(
+        int maxDequeuedBufferCount) const {
+    if (maxDequeuedBufferCount == DOUBLE_BUFFERED && mShouldGrow) {
+        return TRIPLE_BUFFERED;
+    }
+    if (maxDequeuedBufferCount == TRIPLE_BUFFERED &&
+            mUnusedSegments >= mShrinkSegments) {
+        return DOUBLE_BUFFERED;
+    }
+    return maxDequeuedBufferCount;
+}
+
+void BufferCountTuner::onMaxDequeuedBufferCountChanged(
+        int maxDequeuedBufferCount, bool byTuner) {
+    if (byTuner) {
+        if (maxDequeuedBufferCount == TRIPLE_BUFFERED) {
+            ++mGrowCount;
+            if (mLastChangeWasShrink) {
+                mShrinkSegments = std::min(mShrinkSegments * 2,
+                        MAX_SHRINK_SEGMENTS);
+            }
+            mLastChangeWasShrink = false;
+        } else {
+            ++mShrinkCount;
+            mLastChangeWasShrink = true;
+        }
+    }
+    mWindowDequeues = 0;
+    mWindowBlockedDequeues = 0;
+    mShouldGrow = false;
+    mUnusedSegments = 0;
+}
+
+void BufferCountTuner::dump(String8& result, const char* prefix,
+        int maxDequeuedBufferCount) const {
+    static const char* const modeNames[] = { "off", "recommend", "auto" };
+    const char* modeName = (mMode >= 0 && mMode < 3) ? modeNames[mMode] : "?";
+    result.appendFormat("%s-Buffer count tuning: %s, recommended "
+            "maxDequeuedBufferCount=%d, dequeues=%" PRIu64 ", blocked=%"
+            PRIu64 ", unused segments=%u/%u, grown=%u, shrunk=%u\n", prefix,
+            modeName, getTargetMaxDequeuedBufferCount(maxDequeuedBufferCount),
+            mDequeueCount, mBlockedDequeueCount, mUnusedSegments,
+            mShrinkSegments, mGrowCount, mShrinkCount);
+}
+
+} // namespace android
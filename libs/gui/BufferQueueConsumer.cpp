@@ -23,7 +23,11 @@
 #if DEBUG_ONLY_CODE
 #define VALIDATE_CONSISTENCY() do { mCore->validateConsistencyLocked(); } while (0)
 #else
-#define VALIDATE_CONSISTENCY()
+#define VALIDATE_CONSISTENCY() do { \
+        if (BufferQueueCore::sConsistencyChecksEnabled) { \
+            mCore->validateConsistencyLocked(); \
+        } \
+    } while (0)
 #endif
 
 #include <gui/BufferItem.h>
@@ -53,6 +57,9 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
     sp<IProducerListener> listener;
     {
         Mutex::Autolock lock(mCore->mMutex);
+        BufferQueueCore::LockTimer lockTimer(mCore.get(),
+                BufferQueueCore::LOCKED_ACQUIRE);
+        mCore->applyDeferredReleasesLocked();
 
         // Check that the consumer doesn't currently have the maximum number of
         // buffers acquired. We allow the max buffer count to be exceeded by one
@@ -243,6 +250,11 @@ status_t BufferQueueConsumer::acquireBuffer(BufferItem* outBuffer,
                 mSlots[slot].mBufferState.acquire();
             }
             mSlots[slot].mFence = Fence::NO_FENCE;
+
+            // The shared buffer is always released through mMutex
+            if (!mSlots[slot].mBufferState.isShared()) {
+                mCore->allowDeferredReleaseLocked(slot);
+            }
         }
 
         // If the buffer has previously been acquired by the consumer, set
@@ -279,6 +291,7 @@ status_t BufferQueueConsumer::detachBuffer(int slot) {
     ATRACE_BUFFER_INDEX(slot);
     BQ_LOGV("detachBuffer: slot %d", slot);
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
 
     if (mCore->mIsAbandoned) {
         BQ_LOGE("detachBuffer: BufferQueue has been abandoned");
@@ -323,6 +336,7 @@ status_t BufferQueueConsumer::attachBuffer(int* outSlot,
     }
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
 
     if (mCore->mSharedBufferMode) {
         BQ_LOGE("attachBuffer: cannot attach a buffer in shared buffer mode");
@@ -412,9 +426,14 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
         return BAD_VALUE;
     }
 
+    // Most releases are handed off to the producer without locking mMutex
     sp<IProducerListener> listener;
-    { // Autolock scope
+    if (!mCore->deferReleaseBuffer(slot, frameNumber, releaseFence, eglDisplay,
+            eglFence, &listener)) {
         Mutex::Autolock lock(mCore->mMutex);
+        BufferQueueCore::LockTimer lockTimer(mCore.get(),
+                BufferQueueCore::LOCKED_RELEASE);
+        mCore->applyDeferredReleasesLocked();
 
         // If the frame number has changed because the buffer has been reallocated,
         // we can ignore this releaseBuffer for the old buffer.
@@ -433,29 +452,14 @@ status_t BufferQueueConsumer::releaseBuffer(int slot, uint64_t frameNumber,
             return BAD_VALUE;
         }
 
-        mSlots[slot].mEglDisplay = eglDisplay;
-        mSlots[slot].mEglFence = eglFence;
-        mSlots[slot].mFence = releaseFence;
-        mSlots[slot].mBufferState.release();
-
-        // After leaving shared buffer mode, the shared buffer will
-        // still be around. Mark it as no longer shared if this
-        // operation causes it to be free.
-        if (!mCore->mSharedBufferMode && mSlots[slot].mBufferState.isFree()) {
-            mSlots[slot].mBufferState.mShared = false;
-        }
-        // Don't put the shared buffer on the free list.
-        if (!mSlots[slot].mBufferState.isShared()) {
-            mCore->mActiveBuffers.erase(slot);
-            mCore->mFreeBuffers.push_back(slot);
-        }
+        mCore->releaseSlotLocked(slot, releaseFence, eglDisplay, eglFence);
 
         listener = mCore->mConnectedProducerListener;
         BQ_LOGV("releaseBuffer: releasing slot %d", slot);
 
         mCore->mDequeueCondition.broadcast();
         VALIDATE_CONSISTENCY();
-    } // Autolock scope
+    }
 
     // Call back without lock held
     if (listener != NULL) {
@@ -502,6 +506,7 @@ status_t BufferQueueConsumer::disconnect() {
         return BAD_VALUE;
     }
 
+    mCore->applyDeferredReleasesLocked();
     mCore->mIsAbandoned = true;
     mCore->mConsumerListener = NULL;
     mCore->mQueue.clear();
@@ -576,6 +581,7 @@ status_t BufferQueueConsumer::setMaxBufferCount(int bufferCount) {
     }
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
 
     if (mCore->mConnectedApi != BufferQueueCore::NO_CONNECTED_API) {
         BQ_LOGE("setMaxBufferCount: producer is already connected");
@@ -617,6 +623,7 @@ status_t BufferQueueConsumer::setMaxAcquiredBufferCount(
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mCore->waitWhileAllocatingLocked();
+        mCore->applyDeferredReleasesLocked();
 
         if (mCore->mIsAbandoned) {
             BQ_LOGE("setMaxAcquiredBufferCount: consumer is abandoned");
@@ -727,10 +734,29 @@ status_t BufferQueueConsumer::getOccupancyHistory(bool forceFlush,
 
 status_t BufferQueueConsumer::discardFreeBuffers() {
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
     mCore->discardFreeBuffersLocked();
     return NO_ERROR;
 }
 
+status_t BufferQueueConsumer::setBufferCountTuning(int mode) {
+    ATRACE_CALL();
+    BQ_LOGV("setBufferCountTuning: %d", mode);
+
+    if (mode < BUFFER_COUNT_TUNING_OFF || mode > BUFFER_COUNT_TUNING_AUTO) {
+        BQ_LOGE("setBufferCountTuning: invalid mode %d", mode);
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mCore->mMutex);
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("setBufferCountTuning: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+    mCore->mBufferCountTuner.setMode(mode);
+    return NO_ERROR;
+}
+
 void BufferQueueConsumer::dump(String8& result, const char* prefix) const {
     const IPCThreadState* ipc = IPCThreadState::self();
     const pid_t pid = ipc->getCallingPid();
@@ -23,15 +23,22 @@
 #if DEBUG_ONLY_CODE
 #define VALIDATE_CONSISTENCY() do { validateConsistencyLocked(); } while (0)
 #else
-#define VALIDATE_CONSISTENCY()
+#define VALIDATE_CONSISTENCY() do { \
+        if (BufferQueueCore::sConsistencyChecksEnabled) { \
+            validateConsistencyLocked(); \
+        } \
+    } while (0)
 #endif
 
 #include <inttypes.h>
 
+#include <algorithm>
+
 #include <gui/BufferItem.h>
 #include <gui/BufferQueueCore.h>
 #include <gui/IConsumerListener.h>
 #include <gui/IGraphicBufferAlloc.h>
+#include <gui/IGraphicBufferConsumer.h>
 #include <gui/IProducerListener.h>
 #include <gui/ISurfaceComposer.h>
 #include <private/gui/ComposerService.h>
@@ -53,12 +60,19 @@ static uint64_t getUniqueId() {
 BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     mAllocator(allocator),
     mMutex(),
+    mReleaseMutex(),
+    mDeferredReleases(),
+    mDeferredReleaseMask(0),
+    mReleasableFrameNumbers(),
+    mDequeueWaiterCount(0),
+    mDeferredReleaseCount(0),
     mIsAbandoned(false),
     mConsumerControlledByApp(false),
     mConsumerName(getUniqueName()),
     mConsumerListener(),
     mConsumerUsageBits(0),
     mConnectedApi(NO_CONNECTED_API),
+    mConnectedUid(0),
     mConnectedProducerListener(),
     mSlots(),
     mQueue(),
@@ -89,7 +103,18 @@ BufferQueueCore::BufferQueueCore(const sp<IGraphicBufferAlloc>& allocator) :
     mSharedBufferSlot(INVALID_BUFFER_SLOT),
     mSharedBufferCache(Rect::INVALID_RECT, 0, NATIVE_WINDOW_SCALING_MODE_FREEZE,
             HAL_DATASPACE_UNKNOWN),
-    mUniqueId(getUniqueId())
+    mBufferCountTuner(),
+    mPredictiveAllocation(false),
+    mPredictedAttributes(),
+    mDequeuedAttributes(),
+    mDequeuedAttributesCount(0),
+    mIsPreallocating(false),
+    mPreallocatedBufferCount(0),
+    mDroppedPreallocationCount(0),
+    mAvoidedStallCount(0),
+    mAllocationStallCount(0),
+    mUniqueId(getUniqueId()),
+    mLockStats()
 {
     if (allocator == NULL) {
         sp<ISurfaceComposer> composer(ComposerService::getComposerService());
@@ -163,6 +188,94 @@ void BufferQueueCore::dump(String8& result, const char* prefix) const {
         result.appendFormat("%s [%02d:%p] state=%-8s\n", prefix, s,
                 buffer.get(), mSlots[s].mBufferState.string());
     }
+
+    if (mPredictiveAllocation || mPreallocatedBufferCount > 0) {
+        result.appendFormat("%s-Predictive allocation: %s, attributes=[%ux%u, "
+                "format=%d, usage=%#x], preallocated=%" PRIu64 ", dropped=%"
+                PRIu64 ", stalls avoided=%" PRIu64 ", stalls=%" PRIu64 "\n",
+                prefix, mPredictiveAllocation ? "on" : "off",
+                mPredictedAttributes.width, mPredictedAttributes.height,
+                mPredictedAttributes.format, mPredictedAttributes.usage,
+                mPreallocatedBufferCount, mDroppedPreallocationCount,
+                mAvoidedStallCount, mAllocationStallCount);
+    }
+
+    if (mBufferCountTuner.getMode() !=
+            IGraphicBufferConsumer::BUFFER_COUNT_TUNING_OFF) {
+        mBufferCountTuner.dump(result, prefix, mMaxDequeuedBufferCount);
+    }
+
+    static const char* const lockedCallNames[NUM_LOCKED_CALLS] = {
+        "dequeue", "queue", "acquire", "release",
+    };
+    String8 lockStats;
+    for (int call = 0; call < NUM_LOCKED_CALLS; call++) {
+        const LockStats& stats(mLockStats[call]);
+        if (stats.count == 0) {
+            continue;
+        }
+        lockStats.appendFormat(" %s: n=%" PRIu64 " mean=%.2f max=%.2f",
+                lockedCallNames[call], stats.count,
+                stats.totalTime / 1000.0 / stats.count,
+                stats.maxTime / 1000.0);
+    }
+    if (!lockStats.isEmpty()) {
+        result.appendFormat("%s-Lock hold times (us):%s\n", prefix,
+                lockStats.string());
+    }
+    if (mDeferredReleaseCount > 0) {
+        result.appendFormat("%s-Releases handed off without mMutex: %" PRIu64
+                "\n", prefix, mDeferredReleaseCount);
+    }
+}
+
+std::atomic<bool> BufferQueueCore::sConsistencyChecksEnabled(false);
+std::atomic<uint32_t> BufferQueueCore::sConsistencyErrorCount(0);
+
+void BufferQueueCore::setConsistencyChecksEnabled(bool enabled) {
+    sConsistencyChecksEnabled = enabled;
+}
+
+uint32_t BufferQueueCore::getConsistencyErrorCount() {
+    return sConsistencyErrorCount;
+}
+
+std::atomic<bool> BufferQueueCore::sLockStatsEnabled(false);
+
+// The time the calling thread spent waiting on the conditions of any
+// BufferQueue. The calls of other threads wait and acquire mMutex while a
+// call waits, so its wait time can only be told apart per thread.
+static thread_local nsecs_t sLockWaitTime = 0;
+
+void BufferQueueCore::setLockStatsEnabled(bool enabled) {
+    sLockStatsEnabled = enabled;
+}
+
+BufferQueueCore::LockTimer::LockTimer(BufferQueueCore* core, LockedCall call) :
+    mCore(core),
+    mCall(call),
+    mStartTime(sLockStatsEnabled ? systemTime() : 0),
+    mWaitTimeAtStart(sLockWaitTime) {}
+
+BufferQueueCore::LockTimer::~LockTimer() {
+    if (mStartTime == 0) {
+        return;
+    }
+    nsecs_t heldTime = systemTime() - mStartTime -
+            (sLockWaitTime - mWaitTimeAtStart);
+    LockStats& stats(mCore->mLockStats[mCall]);
+    stats.count++;
+    stats.totalTime += heldTime;
+    stats.maxTime = std::max(stats.maxTime, heldTime);
+}
+
+BufferQueueCore::WaitTimer::WaitTimer() :
+    mStartTime(sLockStatsEnabled ? systemTime() : 0) {}
+
+BufferQueueCore::WaitTimer::~WaitTimer() {
+    if (mStartTime != 0) {
+        sLockWaitTime += systemTime() - mStartTime;
+    }
 }
 
 int BufferQueueCore::getMinUndequeuedBufferCountLocked() const {
@@ -200,12 +313,15 @@ int BufferQueueCore::getMaxBufferCountLocked() const {
 void BufferQueueCore::clearBufferSlotLocked(int slot) {
     BQ_LOGV("clearBufferSlotLocked: slot %d", slot);
 
+    mReleasableFrameNumbers[slot] = 0;
     mSlots[slot].mGraphicBuffer.clear();
     mSlots[slot].mBufferState.reset();
     mSlots[slot].mRequestBufferCalled = false;
     mSlots[slot].mFrameNumber = 0;
     mSlots[slot].mAcquireCalled = false;
     mSlots[slot].mNeedsReallocation = true;
+    mSlots[slot].mPreallocated = false;
+    mSlots[slot].mRecyclable = false;
 
     // Destroy fence as BufferQueue now takes ownership
     if (mSlots[slot].mEglFence != EGL_NO_SYNC_KHR) {
@@ -220,19 +336,31 @@ void BufferQueueCore::clearBufferSlotLocked(int slot) {
     }
 }
 
+void BufferQueueCore::recycleBufferLocked(int slot) {
+    if (mSlots[slot].mRecyclable && mSlots[slot].mGraphicBuffer != NULL &&
+            mConnectedApi != NO_CONNECTED_API) {
+        mAllocator->recycleGraphicBuffer(mSlots[slot].mGraphicBuffer,
+                mConnectedUid, mSlots[slot].mFence);
+    }
+    mSlots[slot].mRecyclable = false;
+}
+
 void BufferQueueCore::freeAllBuffersLocked() {
     for (int s : mFreeSlots) {
+        recycleBufferLocked(s);
         clearBufferSlotLocked(s);
     }
 
     for (int s : mFreeBuffers) {
         mFreeSlots.insert(s);
+        recycleBufferLocked(s);
         clearBufferSlotLocked(s);
     }
     mFreeBuffers.clear();
 
     for (int s : mActiveBuffers) {
         mFreeSlots.insert(s);
+        recycleBufferLocked(s);
         clearBufferSlotLocked(s);
     }
     mActiveBuffers.clear();
@@ -247,6 +375,7 @@ void BufferQueueCore::freeAllBuffersLocked() {
 void BufferQueueCore::discardFreeBuffersLocked() {
     for (int s : mFreeBuffers) {
         mFreeSlots.insert(s);
+        recycleBufferLocked(s);
         clearBufferSlotLocked(s);
     }
     mFreeBuffers.clear();
@@ -278,11 +407,13 @@ bool BufferQueueCore::adjustAvailableSlotsLocked(int delta) {
         while (delta < 0) {
             if (!mFreeSlots.empty()) {
                 auto slot = mFreeSlots.begin();
+                recycleBufferLocked(*slot);
                 clearBufferSlotLocked(*slot);
                 mUnusedSlots.push_back(*slot);
                 mFreeSlots.erase(slot);
             } else if (!mFreeBuffers.empty()) {
                 int slot = mFreeBuffers.back();
+                recycleBufferLocked(slot);
                 clearBufferSlotLocked(slot);
                 mUnusedSlots.push_back(slot);
                 mFreeBuffers.pop_back();
@@ -295,16 +426,168 @@ bool BufferQueueCore::adjustAvailableSlotsLocked(int delta) {
     return true;
 }
 
+bool BufferQueueCore::tuneMaxDequeuedBufferCountLocked() {
+    // A segment is sampled from a busy queue at least this often
+    static constexpr nsecs_t TUNING_SEGMENT_TIME = s2ns(1);
+
+    if (mBufferCountTuner.getMode() ==
+            IGraphicBufferConsumer::BUFFER_COUNT_TUNING_OFF) {
+        return false;
+    }
+    mBufferCountTuner.onRecentSegments(
+            mOccupancyTracker.takeRecentSegments(TUNING_SEGMENT_TIME));
+    if (mBufferCountTuner.getMode() !=
+            IGraphicBufferConsumer::BUFFER_COUNT_TUNING_AUTO ||
+            mSharedBufferMode) {
+        return false;
+    }
+
+    int maxDequeuedBuffers = mBufferCountTuner.getTargetMaxDequeuedBufferCount(
+            mMaxDequeuedBufferCount);
+    if (maxDequeuedBuffers == mMaxDequeuedBufferCount) {
+        return false;
+    }
+
+    // Apply the count only if setMaxDequeuedBufferCount would accept it,
+    // otherwise try again on a later call
+    int dequeuedCount = 0;
+    for (int s : mActiveBuffers) {
+        if (mSlots[s].mBufferState.isDequeued()) {
+            dequeuedCount++;
+        }
+    }
+    int bufferCount = getMinUndequeuedBufferCountLocked() + maxDequeuedBuffers;
+    if (dequeuedCount > maxDequeuedBuffers ||
+            bufferCount > BufferQueueDefs::NUM_BUFFER_SLOTS ||
+            bufferCount < getMinMaxBufferCountLocked() ||
+            bufferCount > mMaxBufferCount) {
+        return false;
+    }
+    int delta = maxDequeuedBuffers - mMaxDequeuedBufferCount;
+    if (!adjustAvailableSlotsLocked(delta)) {
+        return false;
+    }
+
+    BQ_LOGV("tuneMaxDequeuedBufferCountLocked: %d -> %d",
+            mMaxDequeuedBufferCount, maxDequeuedBuffers);
+    mMaxDequeuedBufferCount = maxDequeuedBuffers;
+    mBufferCountTuner.onMaxDequeuedBufferCountChanged(maxDequeuedBuffers,
+            true);
+    mDequeueCondition.broadcast();
+    return delta < 0;
+}
+
 void BufferQueueCore::waitWhileAllocatingLocked() const {
     ATRACE_CALL();
     while (mIsAllocating) {
+        WaitTimer waitTimer;
         mIsAllocatingCondition.wait(mMutex);
     }
 }
 
-#if DEBUG_ONLY_CODE
+void BufferQueueCore::releaseSlotLocked(int slot,
+        const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+        EGLSyncKHR eglFence) {
+    mReleasableFrameNumbers[slot] = 0;
+
+    mSlots[slot].mEglDisplay = eglDisplay;
+    mSlots[slot].mEglFence = eglFence;
+    mSlots[slot].mFence = releaseFence;
+    mSlots[slot].mBufferState.release();
+
+    // After leaving shared buffer mode, the shared buffer will
+    // still be around. Mark it as no longer shared if this
+    // operation causes it to be free.
+    if (!mSharedBufferMode && mSlots[slot].mBufferState.isFree()) {
+        mSlots[slot].mBufferState.mShared = false;
+    }
+    // Don't put the shared buffer on the free list.
+    if (!mSlots[slot].mBufferState.isShared()) {
+        mActiveBuffers.erase(slot);
+        mFreeBuffers.push_back(slot);
+    }
+}
+
+void BufferQueueCore::allowDeferredReleaseLocked(int slot) {
+    Mutex::Autolock lock(mReleaseMutex);
+    mDeferredReleases[slot].listener = mConnectedProducerListener;
+    mReleasableFrameNumbers[slot] = mSlots[slot].mFrameNumber;
+}
+
+bool BufferQueueCore::deferReleaseBuffer(int slot, uint64_t frameNumber,
+        const sp<Fence>& releaseFence, EGLDisplay eglDisplay,
+        EGLSyncKHR eglFence, sp<IProducerListener>* outListener) {
+    bool producerWaiting;
+    { // Autolock scope
+        Mutex::Autolock lock(mReleaseMutex);
+
+        // Frame numbers start at 1, so 0 never matches an acquired buffer
+        uint64_t releasableFrameNumber = frameNumber;
+        if (frameNumber == 0 ||
+                !mReleasableFrameNumbers[slot].compare_exchange_strong(
+                releasableFrameNumber, 0)) {
+            return false;
+        }
+
+        DeferredRelease& release(mDeferredReleases[slot]);
+        release.frameNumber = frameNumber;
+        release.fence = releaseFence;
+        release.eglDisplay = eglDisplay;
+        release.eglFence = eglFence;
+        *outListener = release.listener;
+        release.listener.clear();
+        mDeferredReleaseMask |= 1ULL << slot;
+
+        // A waiting producer checked for handed off releases under this lock
+        // after it started waiting, so it needs to be woken up
+        producerWaiting = mDequeueWaiterCount > 0;
+    } // Autolock scope
+
+    if (producerWaiting) {
+        Mutex::Autolock lock(mMutex);
+        applyDeferredReleasesLocked();
+        mDequeueCondition.broadcast();
+    }
+    return true;
+}
+
+bool BufferQueueCore::applyDeferredReleasesLocked() {
+    Mutex::Autolock lock(mReleaseMutex);
+    if (mDeferredReleaseMask == 0) {
+        return false;
+    }
+
+    bool released = false;
+    for (int slot = 0; slot < BufferQueueDefs::NUM_BUFFER_SLOTS; ++slot) {
+        if ((mDeferredReleaseMask & (1ULL << slot)) == 0) {
+            continue;
+        }
+        DeferredRelease& release(mDeferredReleases[slot]);
+        // The producer may have freed the buffer after it was released
+        if (mSlots[slot].mFrameNumber == release.frameNumber &&
+                mSlots[slot].mBufferState.isAcquired()) {
+            BQ_LOGV("applyDeferredReleasesLocked: releasing slot %d", slot);
+            releaseSlotLocked(slot, release.fence, release.eglDisplay,
+                    release.eglFence);
+            released = true;
+        } else if (release.eglFence != EGL_NO_SYNC_KHR) {
+            eglDestroySyncKHR(release.eglDisplay, release.eglFence);
+        }
+        release.fence.clear();
+        release.eglFence = EGL_NO_SYNC_KHR;
+        ++mDeferredReleaseCount;
+    }
+    mDeferredReleaseMask = 0;
+
+    if (released) {
+        VALIDATE_CONSISTENCY();
+    }
+    return released;
+}
+
 void BufferQueueCore::validateConsistencyLocked() const {
     static const useconds_t PAUSE_TIME = 0;
+    uint32_t errorCount = 0;
     int allocatedSlots = 0;
     for (int slot = 0; slot < BufferQueueDefs::NUM_BUFFER_SLOTS; ++slot) {
         bool isInFreeSlots = mFreeSlots.count(slot) != 0;
@@ -324,97 +607,118 @@ void BufferQueueCore::validateConsistencyLocked() const {
             if (isInFreeSlots) {
                 BQ_LOGE("Slot %d is in mUnusedSlots and in mFreeSlots", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInFreeBuffers) {
                 BQ_LOGE("Slot %d is in mUnusedSlots and in mFreeBuffers", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInActiveBuffers) {
                 BQ_LOGE("Slot %d is in mUnusedSlots and in mActiveBuffers",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (!mSlots[slot].mBufferState.isFree()) {
                 BQ_LOGE("Slot %d is in mUnusedSlots but is not FREE", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (mSlots[slot].mGraphicBuffer != NULL) {
                 BQ_LOGE("Slot %d is in mUnusedSluts but has an active buffer",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
         } else if (isInFreeSlots) {
             if (isInUnusedSlots) {
                 BQ_LOGE("Slot %d is in mFreeSlots and in mUnusedSlots", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInFreeBuffers) {
                 BQ_LOGE("Slot %d is in mFreeSlots and in mFreeBuffers", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInActiveBuffers) {
                 BQ_LOGE("Slot %d is in mFreeSlots and in mActiveBuffers", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (!mSlots[slot].mBufferState.isFree()) {
                 BQ_LOGE("Slot %d is in mFreeSlots but is not FREE", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (mSlots[slot].mGraphicBuffer != NULL) {
                 BQ_LOGE("Slot %d is in mFreeSlots but has a buffer",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
         } else if (isInFreeBuffers) {
             if (isInUnusedSlots) {
                 BQ_LOGE("Slot %d is in mFreeBuffers and in mUnusedSlots", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInFreeSlots) {
                 BQ_LOGE("Slot %d is in mFreeBuffers and in mFreeSlots", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInActiveBuffers) {
                 BQ_LOGE("Slot %d is in mFreeBuffers and in mActiveBuffers",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (!mSlots[slot].mBufferState.isFree()) {
                 BQ_LOGE("Slot %d is in mFreeBuffers but is not FREE", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (mSlots[slot].mGraphicBuffer == NULL) {
                 BQ_LOGE("Slot %d is in mFreeBuffers but has no buffer", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
         } else if (isInActiveBuffers) {
             if (isInUnusedSlots) {
                 BQ_LOGE("Slot %d is in mActiveBuffers and in mUnusedSlots",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInFreeSlots) {
                 BQ_LOGE("Slot %d is in mActiveBuffers and in mFreeSlots", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (isInFreeBuffers) {
                 BQ_LOGE("Slot %d is in mActiveBuffers and in mFreeBuffers",
                         slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (mSlots[slot].mBufferState.isFree() &&
                     !mSlots[slot].mBufferState.isShared()) {
                 BQ_LOGE("Slot %d is in mActiveBuffers but is FREE", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
             if (mSlots[slot].mGraphicBuffer == NULL && !mIsAllocating) {
                 BQ_LOGE("Slot %d is in mActiveBuffers but has no buffer", slot);
                 usleep(PAUSE_TIME);
+                errorCount++;
             }
         } else {
             BQ_LOGE("Slot %d isn't in any of mUnusedSlots, mFreeSlots, "
                     "mFreeBuffers, or mActiveBuffers", slot);
             usleep(PAUSE_TIME);
+            errorCount++;
         }
     }
 
@@ -425,8 +729,21 @@ void BufferQueueCore::validateConsistencyLocked() const {
                 getMaxBufferCountLocked(), mFreeSlots.size(),
                 mFreeBuffers.size(), mActiveBuffers.size(),
                 mUnusedSlots.size());
+        errorCount++;
+    }
+
+    for (const BufferItem& item : mQueue) {
+        if (!item.mIsStale && !mSlots[item.mSlot].mBufferState.isQueued()) {
+            BQ_LOGE("Slot %d is in mQueue but is not QUEUED (state = %s)",
+                    item.mSlot, mSlots[item.mSlot].mBufferState.string());
+            usleep(PAUSE_TIME);
+            errorCount++;
+        }
+    }
+
+    if (errorCount > 0) {
+        sConsistencyErrorCount += errorCount;
     }
 }
-#endif
 
 } // namespace android
@@ -23,7 +23,11 @@
 #if DEBUG_ONLY_CODE
 #define VALIDATE_CONSISTENCY() do { mCore->validateConsistencyLocked(); } while (0)
 #else
-#define VALIDATE_CONSISTENCY()
+#define VALIDATE_CONSISTENCY() do { \
+        if (BufferQueueCore::sConsistencyChecksEnabled) { \
+            mCore->validateConsistencyLocked(); \
+        } \
+    } while (0)
 #endif
 
 #define EGL_EGLEXT_PROTOTYPES
@@ -40,6 +44,8 @@
 #include <utils/Log.h>
 #include <utils/Trace.h>
 
+#include <thread>
+
 namespace android {
 
 BufferQueueProducer::BufferQueueProducer(const sp<BufferQueueCore>& core) :
@@ -96,6 +102,7 @@ status_t BufferQueueProducer::setMaxDequeuedBufferCount(
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mCore->waitWhileAllocatingLocked();
+        mCore->applyDeferredReleasesLocked();
 
         if (mCore->mIsAbandoned) {
             BQ_LOGE("setMaxDequeuedBufferCount: BufferQueue has been "
@@ -152,6 +159,8 @@ status_t BufferQueueProducer::setMaxDequeuedBufferCount(
             return BAD_VALUE;
         }
         mCore->mMaxDequeuedBufferCount = maxDequeuedBuffers;
+        mCore->mBufferCountTuner.onMaxDequeuedBufferCountChanged(
+                maxDequeuedBuffers, false);
         VALIDATE_CONSISTENCY();
         if (delta < 0) {
             listener = mCore->mConsumerListener;
@@ -175,6 +184,7 @@ status_t BufferQueueProducer::setAsyncMode(bool async) {
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
         mCore->waitWhileAllocatingLocked();
+        mCore->applyDeferredReleasesLocked();
 
         if (mCore->mIsAbandoned) {
             BQ_LOGE("setAsyncMode: BufferQueue has been abandoned");
@@ -244,7 +254,9 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
     auto callerString = (caller == FreeSlotCaller::Dequeue) ?
             "dequeueBuffer" : "attachBuffer";
     bool tryAgain = true;
+    bool blocked = false;
     while (tryAgain) {
+        mCore->applyDeferredReleasesLocked();
         if (mCore->mIsAbandoned) {
             BQ_LOGE("%s: BufferQueue has been abandoned", callerString);
             return NO_INIT;
@@ -326,18 +338,35 @@ status_t BufferQueueProducer::waitForFreeSlotThenRelock(FreeSlotCaller caller,
                     (acquiredCount <= mCore->mMaxAcquiredBufferCount)) {
                 return WOULD_BLOCK;
             }
+
+            // Releases handed off from now on wake this thread up through
+            // mMutex, so only the ones handed off before need to be checked
+            ++mCore->mDequeueWaiterCount;
+            if (mCore->applyDeferredReleasesLocked()) {
+                --mCore->mDequeueWaiterCount;
+                continue;
+            }
+
+            BufferQueueCore::WaitTimer waitTimer;
+            blocked = true;
+            status_t result = NO_ERROR;
             if (mDequeueTimeout >= 0) {
-                status_t result = mCore->mDequeueCondition.waitRelative(
-                        mCore->mMutex, mDequeueTimeout);
-                if (result == TIMED_OUT) {
-                    return result;
-                }
+                result = mCore->mDequeueCondition.waitRelative(mCore->mMutex,
+                        mDequeueTimeout);
             } else {
                 mCore->mDequeueCondition.wait(mCore->mMutex);
             }
+            --mCore->mDequeueWaiterCount;
+            if (result == TIMED_OUT) {
+                return result;
+            }
         }
     } // while (tryAgain)
 
+    if (caller == FreeSlotCaller::Dequeue) {
+        mCore->mBufferCountTuner.onDequeue(blocked);
+    }
+
     return NO_ERROR;
 }
 
@@ -345,21 +374,6 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         sp<android::Fence> *outFence, uint32_t width, uint32_t height,
         PixelFormat format, uint32_t usage) {
     ATRACE_CALL();
-    { // Autolock scope
-        Mutex::Autolock lock(mCore->mMutex);
-        mConsumerName = mCore->mConsumerName;
-
-        if (mCore->mIsAbandoned) {
-            BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
-            return NO_INIT;
-        }
-
-        if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
-            BQ_LOGE("dequeueBuffer: BufferQueue has no connected producer");
-            return NO_INIT;
-        }
-    } // Autolock scope
-
     BQ_LOGV("dequeueBuffer: w=%u h=%u format=%#x, usage=%#x", width, height,
             format, usage);
 
@@ -372,9 +386,27 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
     EGLDisplay eglDisplay = EGL_NO_DISPLAY;
     EGLSyncKHR eglFence = EGL_NO_SYNC_KHR;
     bool attachedByConsumer = false;
+    bool startPreallocation = false;
+    // The buffer being replaced by a reallocation, which is only dropped once
+    // mMutex is released since that may free it
+    sp<GraphicBuffer> replacedBuffer;
 
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        BufferQueueCore::LockTimer lockTimer(mCore.get(),
+                BufferQueueCore::LOCKED_DEQUEUE);
+        mConsumerName = mCore->mConsumerName;
+
+        if (mCore->mIsAbandoned) {
+            BQ_LOGE("dequeueBuffer: BufferQueue has been abandoned");
+            return NO_INIT;
+        }
+
+        if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
+            BQ_LOGE("dequeueBuffer: BufferQueue has no connected producer");
+            return NO_INIT;
+        }
+
         mCore->waitWhileAllocatingLocked();
 
         if (format == 0) {
@@ -449,6 +481,8 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
                 buffer->needsReallocation(width, height, format, usage))
         {
             mSlots[found].mAcquireCalled = false;
+            mCore->recycleBufferLocked(found);
+            replacedBuffer = mSlots[found].mGraphicBuffer;
             mSlots[found].mGraphicBuffer = NULL;
             mSlots[found].mRequestBufferCalled = false;
             mSlots[found].mEglDisplay = EGL_NO_DISPLAY;
@@ -468,6 +502,48 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         BQ_LOGV("dequeueBuffer: setting buffer age to %" PRIu64,
                 mCore->mBufferAge);
 
+        if (mCore->mPredictiveAllocation) {
+            if (returnFlags & BUFFER_NEEDS_REALLOCATION) {
+                mCore->mAllocationStallCount++;
+            } else if (mSlots[found].mPreallocated) {
+                mCore->mAvoidedStallCount++;
+            }
+
+            BufferQueueCore::BufferAttributes attributes;
+            attributes.width = width;
+            attributes.height = height;
+            attributes.format = format;
+            attributes.usage = usage;
+            if (attributes != mCore->mDequeuedAttributes) {
+                mCore->mDequeuedAttributes = attributes;
+                mCore->mDequeuedAttributesCount = 0;
+            }
+            bool predicted = false;
+            if (mCore->mDequeuedAttributesCount <
+                    BufferQueueCore::PREDICTION_DEQUEUE_COUNT) {
+                mCore->mDequeuedAttributesCount++;
+                predicted = mCore->mDequeuedAttributesCount ==
+                        BufferQueueCore::PREDICTION_DEQUEUE_COUNT;
+            }
+            if (predicted) {
+                mCore->mPredictedAttributes = attributes;
+            }
+
+            // Once the attributes are predicted, or when they were and
+            // dequeueBuffer had to allocate anyway, the other free buffers
+            // are likely to need it as well, so get them ready before they
+            // are dequeued
+            bool needsPreallocation = predicted ||
+                    ((returnFlags & BUFFER_NEEDS_REALLOCATION) &&
+                    attributes == mCore->mPredictedAttributes);
+            if (needsPreallocation && !mCore->mIsPreallocating &&
+                    !mCore->mSharedBufferMode) {
+                mCore->mIsPreallocating = true;
+                startPreallocation = true;
+            }
+        }
+        mSlots[found].mPreallocated = false;
+
         if (CC_UNLIKELY(mSlots[found].mFence == NULL)) {
             BQ_LOGE("dequeueBuffer: about to return a NULL fence - "
                     "slot=%d w=%d h=%d format=%u",
@@ -493,18 +569,37 @@ status_t BufferQueueProducer::dequeueBuffer(int *outSlot,
         }
     } // Autolock scope
 
+    replacedBuffer.clear();
+
+    if (startPreallocation) {
+        // Allocate on behalf of the caller, as the allocator only recycles
+        // buffers for the uid they were exposed to
+        int64_t identity = IPCThreadState::self()->clearCallingIdentity();
+        IPCThreadState::self()->restoreCallingIdentity(identity);
+        sp<BufferQueueProducer> self(this);
+        std::thread([self, identity]() {
+            IPCThreadState::self()->restoreCallingIdentity(identity);
+            self->preallocateBuffers();
+        }).detach();
+    }
+
     if (returnFlags & BUFFER_NEEDS_REALLOCATION) {
         status_t error;
+        sp<Fence> releaseFence;
         BQ_LOGV("dequeueBuffer: allocating a new buffer for slot %d", *outSlot);
-        sp<GraphicBuffer> graphicBuffer(mCore->mAllocator->createGraphicBuffer(
-                width, height, format, usage,
-                {mConsumerName.string(), mConsumerName.size()}, &error));
+        sp<GraphicBuffer> graphicBuffer(
+                mCore->mAllocator->createOrReuseGraphicBuffer(width, height,
+                format, usage, {mConsumerName.string(), mConsumerName.size()},
+                &error, &releaseFence));
         { // Autolock scope
             Mutex::Autolock lock(mCore->mMutex);
 
             if (graphicBuffer != NULL && !mCore->mIsAbandoned) {
                 graphicBuffer->setGenerationNumber(mCore->mGenerationNumber);
                 mSlots[*outSlot].mGraphicBuffer = graphicBuffer;
+                mSlots[*outSlot].mRecyclable = true;
+                // A reused buffer may still be in use by its previous owner
+                *outFence = releaseFence;
             }
 
             mCore->mIsAllocating = false;
@@ -640,6 +735,7 @@ status_t BufferQueueProducer::detachNextBuffer(sp<GraphicBuffer>* outBuffer,
     }
 
     mCore->waitWhileAllocatingLocked();
+    mCore->applyDeferredReleasesLocked();
 
     if (mCore->mFreeBuffers.empty()) {
         return NO_MEMORY;
@@ -659,6 +755,71 @@ status_t BufferQueueProducer::detachNextBuffer(sp<GraphicBuffer>* outBuffer,
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::reclaimNextBuffer(int* outSlot,
+        sp<Fence>* outFence) {
+    ATRACE_CALL();
+
+    if (outSlot == NULL) {
+        BQ_LOGE("reclaimNextBuffer: outSlot must not be NULL");
+        return BAD_VALUE;
+    } else if (outFence == NULL) {
+        BQ_LOGE("reclaimNextBuffer: outFence must not be NULL");
+        return BAD_VALUE;
+    }
+
+    Mutex::Autolock lock(mCore->mMutex);
+
+    if (mCore->mIsAbandoned) {
+        BQ_LOGE("reclaimNextBuffer: BufferQueue has been abandoned");
+        return NO_INIT;
+    }
+
+    if (mCore->mConnectedApi == BufferQueueCore::NO_CONNECTED_API) {
+        BQ_LOGE("reclaimNextBuffer: BufferQueue has no connected producer");
+        return NO_INIT;
+    }
+
+    if (mCore->mSharedBufferMode) {
+        BQ_LOGE("reclaimNextBuffer: cannot reclaim a buffer in shared buffer "
+            "mode");
+        return BAD_VALUE;
+    }
+
+    mCore->waitWhileAllocatingLocked();
+    mCore->applyDeferredReleasesLocked();
+
+    if (mCore->mFreeBuffers.empty()) {
+        return NO_MEMORY;
+    }
+
+    int dequeuedCount = 0;
+    for (int s : mCore->mActiveBuffers) {
+        if (mSlots[s].mBufferState.isDequeued()) {
+            ++dequeuedCount;
+        }
+    }
+    if (mCore->mBufferHasBeenQueued &&
+            dequeuedCount >= mCore->mMaxDequeuedBufferCount) {
+        BQ_LOGE("reclaimNextBuffer: attempting to exceed the max dequeued "
+                "buffer count (%d)", mCore->mMaxDequeuedBufferCount);
+        return INVALID_OPERATION;
+    }
+
+    int found = mCore->mFreeBuffers.front();
+    mCore->mFreeBuffers.remove(found);
+    mCore->mActiveBuffers.insert(found);
+    mSlots[found].mBufferState.dequeue();
+
+    BQ_LOGV("reclaimNextBuffer reclaimed slot %d", found);
+
+    *outSlot = found;
+    *outFence = mSlots[found].mFence;
+    mSlots[found].mFence = Fence::NO_FENCE;
+    VALIDATE_CONSISTENCY();
+
+    return NO_ERROR;
+}
+
 status_t BufferQueueProducer::attachBuffer(int* outSlot,
         const sp<android::GraphicBuffer>& buffer) {
     ATRACE_CALL();
@@ -760,12 +921,28 @@ status_t BufferQueueProducer::queueBuffer(int slot,
             return BAD_VALUE;
     }
 
+    // Fill in what doesn't depend on the BufferQueue state before locking
+    BufferItem item;
+    item.mTransform = transform &
+            ~static_cast<uint32_t>(NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY);
+    item.mTransformToDisplayInverse =
+            (transform & NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY) != 0;
+    item.mScalingMode = static_cast<uint32_t>(scalingMode);
+    item.mTimestamp = timestamp;
+    item.mIsAutoTimestamp = isAutoTimestamp;
+    item.mSlot = slot;
+    item.mFence = fence;
+    item.mSurfaceDamage = surfaceDamage;
+    item.mQueuedBuffer = true;
+
     sp<IConsumerListener> frameAvailableListener;
     sp<IConsumerListener> frameReplacedListener;
+    sp<IConsumerListener> buffersReleasedListener;
     int callbackTicket = 0;
-    BufferItem item;
     { // Autolock scope
         Mutex::Autolock lock(mCore->mMutex);
+        BufferQueueCore::LockTimer lockTimer(mCore.get(),
+                BufferQueueCore::LOCKED_QUEUE);
 
         if (mCore->mIsAbandoned) {
             BQ_LOGE("queueBuffer: BufferQueue has been abandoned");
@@ -829,22 +1006,11 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         item.mAcquireCalled = mSlots[slot].mAcquireCalled;
         item.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
         item.mCrop = crop;
-        item.mTransform = transform &
-                ~static_cast<uint32_t>(NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY);
-        item.mTransformToDisplayInverse =
-                (transform & NATIVE_WINDOW_TRANSFORM_INVERSE_DISPLAY) != 0;
-        item.mScalingMode = static_cast<uint32_t>(scalingMode);
-        item.mTimestamp = timestamp;
-        item.mIsAutoTimestamp = isAutoTimestamp;
         item.mDataSpace = dataSpace;
         item.mFrameNumber = mCore->mFrameCounter;
-        item.mSlot = slot;
-        item.mFence = fence;
         item.mIsDroppable = mCore->mAsyncMode ||
                 mCore->mDequeueBufferCannotBlock ||
                 (mCore->mSharedBufferMode && mCore->mSharedBufferSlot == slot);
-        item.mSurfaceDamage = surfaceDamage;
-        item.mQueuedBuffer = true;
         item.mAutoRefresh = mCore->mSharedBufferMode && mCore->mAutoRefresh;
 
         mStickyTransform = stickyTransform;
@@ -907,6 +1073,9 @@ status_t BufferQueueProducer::queueBuffer(int slot,
 
         ATRACE_INT(mCore->mConsumerName.string(), mCore->mQueue.size());
         mCore->mOccupancyTracker.registerOccupancyChange(mCore->mQueue.size());
+        if (mCore->tuneMaxDequeuedBufferCountLocked()) {
+            buffersReleasedListener = mCore->mConsumerListener;
+        }
 
         // Take a ticket for the callback functions
         callbackTicket = mNextCallbackTicket++;
@@ -937,6 +1106,11 @@ status_t BufferQueueProducer::queueBuffer(int slot,
         mCallbackCondition.broadcast();
     }
 
+    // Tuning the buffer count down may have freed buffers
+    if (buffersReleasedListener != NULL) {
+        buffersReleasedListener->onBuffersReleased();
+    }
+
     // Wait without lock held
     if (mCore->mConnectedApi == NATIVE_WINDOW_API_EGL) {
         // Waiting here allows for two full buffers to be queued but not a
@@ -1065,6 +1239,7 @@ status_t BufferQueueProducer::connect(const sp<IProducerListener>& listener,
         int api, bool producerControlledByApp, QueueBufferOutput *output) {
     ATRACE_CALL();
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
     mConsumerName = mCore->mConsumerName;
     BQ_LOGV("connect: api=%d producerControlledByApp=%s", api,
             producerControlledByApp ? "true" : "false");
@@ -1132,6 +1307,7 @@ status_t BufferQueueProducer::connect(const sp<IProducerListener>& listener,
             break;
     }
     mCore->mConnectedPid = IPCThreadState::self()->getCallingPid();
+    mCore->mConnectedUid = IPCThreadState::self()->getCallingUid();
     mCore->mBufferHasBeenQueued = false;
     mCore->mDequeueBufferCannotBlock = false;
     if (mDequeueTimeout < 0) {
@@ -1161,6 +1337,7 @@ status_t BufferQueueProducer::disconnect(int api, DisconnectMode mode) {
         }
 
         mCore->waitWhileAllocatingLocked();
+        mCore->applyDeferredReleasesLocked();
 
         if (mCore->mIsAbandoned) {
             // It's not really an error to disconnect after the surface has
@@ -1270,11 +1447,15 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
         } // Autolock scope
 
         Vector<sp<GraphicBuffer>> buffers;
+        Vector<sp<Fence>> releaseFences;
         for (size_t i = 0; i <  newBufferCount; ++i) {
             status_t result = NO_ERROR;
-            sp<GraphicBuffer> graphicBuffer(mCore->mAllocator->createGraphicBuffer(
-                    allocWidth, allocHeight, allocFormat, allocUsage,
-                    {mConsumerName.string(), mConsumerName.size()}, &result));
+            sp<Fence> releaseFence;
+            sp<GraphicBuffer> graphicBuffer(
+                    mCore->mAllocator->createOrReuseGraphicBuffer(allocWidth,
+                    allocHeight, allocFormat, allocUsage,
+                    {mConsumerName.string(), mConsumerName.size()}, &result,
+                    &releaseFence));
             if (result != NO_ERROR) {
                 BQ_LOGE("allocateBuffers: failed to allocate buffer (%u x %u, format"
                         " %u, usage %u)", width, height, format, usage);
@@ -1284,6 +1465,7 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
                 return;
             }
             buffers.push_back(graphicBuffer);
+            releaseFences.push_back(releaseFence);
         }
 
         { // Autolock scope
@@ -1311,7 +1493,8 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
                 auto slot = mCore->mFreeSlots.begin();
                 mCore->clearBufferSlotLocked(*slot); // Clean up the slot first
                 mSlots[*slot].mGraphicBuffer = buffers[i];
-                mSlots[*slot].mFence = Fence::NO_FENCE;
+                mSlots[*slot].mRecyclable = true;
+                mSlots[*slot].mFence = releaseFences[i];
 
                 // freeBufferLocked puts this slot on the free slots list. Since
                 // we then attached a buffer, move the slot to free buffer list.
@@ -1332,6 +1515,103 @@ void BufferQueueProducer::allocateBuffers(uint32_t width, uint32_t height,
     }
 }
 
+void BufferQueueProducer::preallocateBuffers() {
+    ATRACE_CALL();
+    while (true) {
+        BufferQueueCore::BufferAttributes attributes;
+        String8 consumerName;
+        { // Autolock scope
+            Mutex::Autolock lock(mCore->mMutex);
+            mCore->waitWhileAllocatingLocked();
+
+            attributes = mCore->mPredictedAttributes;
+            if (!canPreallocateLocked() || findPreallocationSlotLocked(
+                    attributes) == BufferQueueCore::INVALID_BUFFER_SLOT) {
+                mCore->mIsPreallocating = false;
+                return;
+            }
+            consumerName = mCore->mConsumerName;
+        } // Autolock scope
+
+        // Allocate one buffer at a time, so that a change of the attributes
+        // drops at most one buffer
+        status_t error = NO_ERROR;
+        sp<Fence> releaseFence;
+        sp<GraphicBuffer> graphicBuffer(
+                mCore->mAllocator->createOrReuseGraphicBuffer(attributes.width,
+                attributes.height, attributes.format, attributes.usage,
+                {consumerName.string(), consumerName.size()}, &error,
+                &releaseFence));
+
+        // The buffer previously in the slot, which is dropped after unlocking
+        sp<GraphicBuffer> replacedBuffer;
+        { // Autolock scope
+            Mutex::Autolock lock(mCore->mMutex);
+            if (graphicBuffer == NULL) {
+                BQ_LOGE("preallocateBuffers: createGraphicBuffer failed: %d",
+                        error);
+                mCore->mIsPreallocating = false;
+                return;
+            }
+            mCore->waitWhileAllocatingLocked();
+
+            int slot = BufferQueueCore::INVALID_BUFFER_SLOT;
+            if (canPreallocateLocked() &&
+                    attributes == mCore->mPredictedAttributes) {
+                slot = findPreallocationSlotLocked(attributes);
+            }
+            if (slot == BufferQueueCore::INVALID_BUFFER_SLOT) {
+                BQ_LOGV("preallocateBuffers: dropping a buffer, the "
+                        "attributes changed or no slot is left");
+                mCore->mDroppedPreallocationCount++;
+                continue;
+            }
+
+            if (mCore->mFreeSlots.erase(slot) > 0) {
+                mCore->mFreeBuffers.push_front(slot);
+            } else {
+                mCore->recycleBufferLocked(slot);
+                replacedBuffer = mSlots[slot].mGraphicBuffer;
+            }
+            // This also makes the next dequeueBuffer of the slot return
+            // BUFFER_NEEDS_REALLOCATION
+            mCore->clearBufferSlotLocked(slot);
+            graphicBuffer->setGenerationNumber(mCore->mGenerationNumber);
+            mSlots[slot].mGraphicBuffer = graphicBuffer;
+            mSlots[slot].mFence = releaseFence;
+            mSlots[slot].mPreallocated = true;
+            mSlots[slot].mRecyclable = true;
+            mCore->mPreallocatedBufferCount++;
+            BQ_LOGV("preallocateBuffers: preallocated a buffer in slot %d",
+                    slot);
+
+            VALIDATE_CONSISTENCY();
+        } // Autolock scope
+    }
+}
+
+bool BufferQueueProducer::canPreallocateLocked() const {
+    return !mCore->mIsAbandoned && mCore->mPredictiveAllocation &&
+            mCore->mAllowAllocation && !mCore->mSharedBufferMode &&
+            mCore->mConnectedApi != BufferQueueCore::NO_CONNECTED_API;
+}
+
+int BufferQueueProducer::findPreallocationSlotLocked(
+        const BufferQueueCore::BufferAttributes& attributes) const {
+    // Replacing the free buffers that don't match comes first, since those
+    // are the ones dequeueBuffer would have to reallocate
+    for (int slot : mCore->mFreeBuffers) {
+        if (mSlots[slot].mGraphicBuffer->needsReallocation(attributes.width,
+                attributes.height, attributes.format, attributes.usage)) {
+            return slot;
+        }
+    }
+    if (!mCore->mFreeSlots.empty()) {
+        return *mCore->mFreeSlots.begin();
+    }
+    return BufferQueueCore::INVALID_BUFFER_SLOT;
+}
+
 status_t BufferQueueProducer::allowAllocation(bool allow) {
     ATRACE_CALL();
     BQ_LOGV("allowAllocation: %s", allow ? "true" : "false");
@@ -1383,6 +1663,7 @@ status_t BufferQueueProducer::setDequeueTimeout(nsecs_t timeout) {
     BQ_LOGV("setDequeueTimeout: %" PRId64, timeout);
 
     Mutex::Autolock lock(mCore->mMutex);
+    mCore->applyDeferredReleasesLocked();
     int delta = mCore->getMaxBufferCountLocked(mCore->mAsyncMode, false,
             mCore->mMaxBufferCount) - mCore->getMaxBufferCountLocked();
     if (!mCore->adjustAvailableSlotsLocked(delta)) {
@@ -1456,4 +1737,14 @@ status_t BufferQueueProducer::getUniqueId(uint64_t* outId) const {
     return NO_ERROR;
 }
 
+status_t BufferQueueProducer::setPredictiveAllocation(bool enabled) {
+    ATRACE_CALL();
+    BQ_LOGV("setPredictiveAllocation: %s", enabled ? "true" : "false");
+
+    Mutex::Autolock lock(mCore->mMutex);
+    mCore->mPredictiveAllocation = enabled;
+    mCore->mDequeuedAttributesCount = 0;
+    return NO_ERROR;
+}
+
 } // namespace android
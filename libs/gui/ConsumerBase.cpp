@@ -254,6 +254,15 @@ status_t ConsumerBase::discardFreeBuffers() {
     return mConsumer->discardFreeBuffers();
 }
 
+status_t ConsumerBase::setBufferCountTuning(int mode) {
+    Mutex::Autolock _l(mMutex);
+    if (mAbandoned) {
+        CB_LOGE("setBufferCountTuning: ConsumerBase is abandoned!");
+        return NO_INIT;
+    }
+    return mConsumer->setBufferCountTuning(mode);
+}
+
 void ConsumerBase::dump(String8& result) const {
     dump(result, "");
 }
@@ -35,6 +35,7 @@ CpuConsumer::CpuConsumer(const sp<IGraphicBufferConsumer>& bq,
         size_t maxLockedBuffers, bool controlledByApp) :
     ConsumerBase(bq, controlledByApp),
     mMaxLockedBuffers(maxLockedBuffers),
+    mPersistentMapping(false),
     mCurrentLockedBuffers(0)
 {
     // Create tracking entries for locked buffers
@@ -86,10 +87,96 @@ static bool isPossiblyYUV(PixelFormat format) {
     }
 }
 
+// Fills in the planes of a locked buffer whose other fields are set
+static void setPlanes(CpuConsumer::LockedBuffer *nativeBuffer) {
+    const size_t width = nativeBuffer->width;
+    const size_t height = nativeBuffer->height;
+    CpuConsumer::Plane *planes = nativeBuffer->planes;
+
+    if (nativeBuffer->dataCb != NULL) {
+        const size_t chromaWidth = (width + 1) / 2;
+        const size_t chromaHeight = (height + 1) / 2;
+        planes[0].data = nativeBuffer->data;
+        planes[0].rowStride = nativeBuffer->stride;
+        planes[0].pixelStride = 1;
+        planes[0].size = (height - 1) * nativeBuffer->stride + width;
+        planes[1].data = nativeBuffer->dataCb;
+        planes[2].data = nativeBuffer->dataCr;
+        for (size_t i = 1; i < 3; i++) {
+            planes[i].rowStride = nativeBuffer->chromaStride;
+            planes[i].pixelStride = nativeBuffer->chromaStep;
+            planes[i].size = (chromaHeight - 1) * nativeBuffer->chromaStride +
+                    (chromaWidth - 1) * nativeBuffer->chromaStep + 1;
+        }
+        nativeBuffer->planeCount = 3;
+        return;
+    }
+
+    uint32_t bpp = 0;
+    switch (static_cast<int>(nativeBuffer->format)) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+            bpp = 4;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            bpp = 3;
+            break;
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_Y16:
+        case HAL_PIXEL_FORMAT_RAW16:
+            bpp = 2;
+            break;
+        case HAL_PIXEL_FORMAT_Y8:
+        case HAL_PIXEL_FORMAT_BLOB:
+            bpp = 1;
+            break;
+        default:
+            break;
+    }
+    planes[0].data = nativeBuffer->data;
+    if (bpp > 0) {
+        planes[0].rowStride = nativeBuffer->stride * bpp;
+        planes[0].pixelStride = bpp;
+        planes[0].size = ((height - 1) * nativeBuffer->stride + width) * bpp;
+    }
+    for (size_t i = 1; i < CpuConsumer::MAX_PLANES; i++) {
+        planes[i] = CpuConsumer::Plane();
+    }
+    nativeBuffer->planeCount = 1;
+}
+
 status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
+    if (!nativeBuffer) return BAD_VALUE;
+
+    Mutex::Autolock _l(mMutex);
+    return lockNextBufferLocked(nativeBuffer);
+}
+
+status_t CpuConsumer::lockNextBuffers(LockedBuffer *nativeBuffers,
+        size_t maxCount, size_t *outCount) {
+    if (!nativeBuffers || !outCount) return BAD_VALUE;
+
+    Mutex::Autolock _l(mMutex);
+    status_t err = OK;
+    size_t count = 0;
+    while (count < maxCount) {
+        err = lockNextBufferLocked(&nativeBuffers[count]);
+        if (err != OK) {
+            break;
+        }
+        count++;
+    }
+    *outCount = count;
+    if (count > 0 && (err == BAD_VALUE || err == NOT_ENOUGH_DATA)) {
+        return OK;
+    }
+    return err;
+}
+
+status_t CpuConsumer::lockNextBufferLocked(LockedBuffer *nativeBuffer) {
     status_t err;
 
-    if (!nativeBuffer) return BAD_VALUE;
     if (mCurrentLockedBuffers == mMaxLockedBuffers) {
         CC_LOGW("Max buffers have been locked (%zd), cannot lock anymore.",
                 mMaxLockedBuffers);
@@ -98,8 +185,6 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
 
     BufferItem b;
 
-    Mutex::Autolock _l(mMutex);
-
     err = acquireBufferLocked(&b, 0);
     if (err != OK) {
         if (err == BufferQueue::NO_BUFFER_AVAILABLE) {
@@ -117,49 +202,87 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
 
     PixelFormat format = mSlots[slot].mGraphicBuffer->getPixelFormat();
     PixelFormat flexFormat = format;
-    if (isPossiblyYUV(format)) {
-        if (b.mFence.get()) {
-            err = mSlots[slot].mGraphicBuffer->lockAsyncYCbCr(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &ycbcr,
-                b.mFence->dup());
-        } else {
-            err = mSlots[slot].mGraphicBuffer->lockYCbCr(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &ycbcr);
-        }
-        if (err == OK) {
-            bufferPointer = ycbcr.y;
-            flexFormat = HAL_PIXEL_FORMAT_YCbCr_420_888;
-            if (format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
-                CC_LOGV("locking buffer of format %#x as flex YUV", format);
-            }
-        } else if (format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
-            CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
+
+    Mapping& mapping(mMappings[slot]);
+    if (mapping.mGraphicBuffer != NULL &&
+            mapping.mGraphicBuffer != mSlots[slot].mGraphicBuffer) {
+        // The producer replaced the buffer of the slot
+        unmapSlotLocked(slot);
+    }
+    const bool persistent = mPersistentMapping;
+    // Buffers that stay mapped are locked as a whole and without a fence,
+    // the fence is waited for here on every acquire instead
+    const Rect lockRect(persistent ?
+            mSlots[slot].mGraphicBuffer->getBounds() : b.mCrop);
+    if (persistent && b.mFence.get()) {
+        err = b.mFence->waitForever("CpuConsumer::lockNextBuffer");
+        if (err != OK) {
+            CC_LOGE("Failed to wait for the acquire fence: %s (%d)",
                     strerror(-err), err);
+            releaseBufferLocked(slot, mSlots[slot].mGraphicBuffer,
+                    EGL_NO_DISPLAY, EGL_NO_SYNC_KHR);
             return err;
         }
     }
+    const bool useFence = !persistent && b.mFence.get();
+
+    if (persistent && mapping.mGraphicBuffer != NULL) {
+        bufferPointer = mapping.mBufferPointer;
+        ycbcr = mapping.mYCbCr;
+        flexFormat = mapping.mFlexFormat;
+    } else {
+        if (isPossiblyYUV(format)) {
+            if (useFence) {
+                err = mSlots[slot].mGraphicBuffer->lockAsyncYCbCr(
+                    GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    lockRect,
+                    &ycbcr,
+                    b.mFence->dup());
+            } else {
+                err = mSlots[slot].mGraphicBuffer->lockYCbCr(
+                    GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    lockRect,
+                    &ycbcr);
+            }
+            if (err == OK) {
+                bufferPointer = ycbcr.y;
+                flexFormat = HAL_PIXEL_FORMAT_YCbCr_420_888;
+                if (format != HAL_PIXEL_FORMAT_YCbCr_420_888) {
+                    CC_LOGV("locking buffer of format %#x as flex YUV",
+                            format);
+                }
+            } else if (format == HAL_PIXEL_FORMAT_YCbCr_420_888) {
+                CC_LOGE("Unable to lock YCbCr buffer for CPU reading: %s (%d)",
+                        strerror(-err), err);
+                return err;
+            }
+        }
 
-    if (bufferPointer == NULL) { // not flexible YUV
-        if (b.mFence.get()) {
-            err = mSlots[slot].mGraphicBuffer->lockAsync(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &bufferPointer,
-                b.mFence->dup());
-        } else {
-            err = mSlots[slot].mGraphicBuffer->lock(
-                GraphicBuffer::USAGE_SW_READ_OFTEN,
-                b.mCrop,
-                &bufferPointer);
+        if (bufferPointer == NULL) { // not flexible YUV
+            if (useFence) {
+                err = mSlots[slot].mGraphicBuffer->lockAsync(
+                    GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    lockRect,
+                    &bufferPointer,
+                    b.mFence->dup());
+            } else {
+                err = mSlots[slot].mGraphicBuffer->lock(
+                    GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    lockRect,
+                    &bufferPointer);
+            }
+            if (err != OK) {
+                CC_LOGE("Unable to lock buffer for CPU reading: %s (%d)",
+                        strerror(-err), err);
+                return err;
+            }
         }
-        if (err != OK) {
-            CC_LOGE("Unable to lock buffer for CPU reading: %s (%d)",
-                    strerror(-err), err);
-            return err;
+
+        if (persistent) {
+            mapping.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
+            mapping.mBufferPointer = bufferPointer;
+            mapping.mYCbCr = ycbcr;
+            mapping.mFlexFormat = flexFormat;
         }
     }
 
@@ -176,6 +299,7 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     ab.mSlot = slot;
     ab.mBufferPointer = bufferPointer;
     ab.mGraphicBuffer = mSlots[slot].mGraphicBuffer;
+    ab.mPersistent = persistent;
 
     nativeBuffer->data   =
             reinterpret_cast<uint8_t*>(bufferPointer);
@@ -198,6 +322,7 @@ status_t CpuConsumer::lockNextBuffer(LockedBuffer *nativeBuffer) {
     nativeBuffer->dataCr       = reinterpret_cast<uint8_t*>(ycbcr.cr);
     nativeBuffer->chromaStride = static_cast<uint32_t>(ycbcr.cstride);
     nativeBuffer->chromaStep   = static_cast<uint32_t>(ycbcr.chroma_step);
+    setPlanes(nativeBuffer);
 
     mCurrentLockedBuffers++;
 
@@ -224,11 +349,15 @@ status_t CpuConsumer::releaseAcquiredBufferLocked(size_t lockedIdx) {
     status_t err;
     int fd = -1;
 
-    err = mAcquiredBuffers[lockedIdx].mGraphicBuffer->unlockAsync(&fd);
-    if (err != OK) {
-        CC_LOGE("%s: Unable to unlock graphic buffer %zd", __FUNCTION__,
-                lockedIdx);
-        return err;
+    // Buffers that stay mapped are read by the time they are released, so
+    // there is no release fence to pass on
+    if (!mAcquiredBuffers[lockedIdx].mPersistent) {
+        err = mAcquiredBuffers[lockedIdx].mGraphicBuffer->unlockAsync(&fd);
+        if (err != OK) {
+            CC_LOGE("%s: Unable to unlock graphic buffer %zd", __FUNCTION__,
+                    lockedIdx);
+            return err;
+        }
     }
     int buf = mAcquiredBuffers[lockedIdx].mSlot;
     if (CC_LIKELY(fd != -1)) {
@@ -253,12 +382,52 @@ status_t CpuConsumer::releaseAcquiredBufferLocked(size_t lockedIdx) {
     ab.mSlot = BufferQueue::INVALID_BUFFER_SLOT;
     ab.mBufferPointer = NULL;
     ab.mGraphicBuffer.clear();
+    ab.mPersistent = false;
 
     mCurrentLockedBuffers--;
     return OK;
 }
 
+void CpuConsumer::setPersistentMappingEnabled(bool enabled) {
+    Mutex::Autolock _l(mMutex);
+    if (mPersistentMapping == enabled) {
+        return;
+    }
+    mPersistentMapping = enabled;
+    if (!enabled) {
+        for (int i = 0; i < BufferQueue::NUM_BUFFER_SLOTS; i++) {
+            unmapSlotLocked(i);
+        }
+    }
+}
+
+void CpuConsumer::unmapSlotLocked(int slotIndex) {
+    Mapping& mapping(mMappings[slotIndex]);
+    if (mapping.mGraphicBuffer == NULL) {
+        return;
+    }
+
+    bool acquired = false;
+    for (size_t i = 0; i < mMaxLockedBuffers; i++) {
+        AcquiredBuffer& ab = mAcquiredBuffers.editItemAt(i);
+        if (ab.mPersistent && ab.mGraphicBuffer == mapping.mGraphicBuffer) {
+            // Unlocked when released
+            ab.mPersistent = false;
+            acquired = true;
+        }
+    }
+    if (!acquired) {
+        status_t err = mapping.mGraphicBuffer->unlock();
+        if (err != OK) {
+            CC_LOGE("%s: Unable to unlock graphic buffer of slot %d",
+                    __FUNCTION__, slotIndex);
+        }
+    }
+    mapping = Mapping();
+}
+
 void CpuConsumer::freeBufferLocked(int slotIndex) {
+    unmapSlotLocked(slotIndex);
     ConsumerBase::freeBufferLocked(slotIndex);
 }
 
@@ -85,13 +85,15 @@ ssize_t DisplayEventReceiver::getEvents(DisplayEventReceiver::Event* events,
 ssize_t DisplayEventReceiver::getEvents(const sp<BitTube>& dataChannel,
         Event* events, size_t count)
 {
-    return BitTube::recvObjects(dataChannel, events, count);
+    // Each event is its own message, see sendEvents, so all of the pending
+    // events can be received at once
+    return BitTube::recvObjectsBatched(dataChannel, events, count);
 }
 
 ssize_t DisplayEventReceiver::sendEvents(const sp<BitTube>& dataChannel,
         Event const* events, size_t count)
 {
-    return BitTube::sendObjects(dataChannel, events, count);
+    return BitTube::sendObjectsBatched(dataChannel, events, count);
 }
 
 // ---------------------------------------------------------------------------
@@ -15,28 +15,255 @@
  ** limitations under the License.
  */
 
+#include <inttypes.h>
+
 #include <cutils/log.h>
 
+#include <binder/IPCThreadState.h>
+
 #include <ui/GraphicBuffer.h>
 
+#include <utils/Mutex.h>
+
 #include <gui/GraphicBufferAlloc.h>
 
+#include <vector>
+
 // ----------------------------------------------------------------------------
 namespace android {
 // ----------------------------------------------------------------------------
 
-GraphicBufferAlloc::GraphicBufferAlloc() {
+static const nsecs_t DEFAULT_POOL_MAX_IDLE_TIME = s2ns(5);
+
+class GraphicBufferPool {
+public:
+    typedef GraphicBufferAlloc::PoolClass PoolClass;
+
+    static GraphicBufferPool& getInstance() {
+        static GraphicBufferPool pool;
+        return pool;
+    }
+
+    // Unless requireSignaled is set, the buffer returned may still be in use
+    // until *outReleaseFence signals
+    sp<GraphicBuffer> acquire(PoolClass poolClass, uint32_t width,
+            uint32_t height, PixelFormat format, uint32_t usage, uid_t uid,
+            bool requireSignaled, sp<Fence>* outReleaseFence) {
+        Mutex::Autolock lock(mMutex);
+        evictIdleLocked(systemTime());
+
+        Class& c(mClasses[poolClass]);
+        // Most recently recycled first
+        for (auto it = mEntries.rbegin(); it != mEntries.rend(); ++it) {
+            const sp<GraphicBuffer>& buffer(it->buffer);
+            if (it->poolClass == poolClass && it->uid == uid &&
+                    isUnreferenced(buffer) &&
+                    buffer->getWidth() == width &&
+                    buffer->getHeight() == height &&
+                    buffer->getPixelFormat() == format &&
+                    buffer->getUsage() == usage &&
+                    (!requireSignaled ||
+                            it->releaseFence->getSignalTime() != INT64_MAX)) {
+                sp<GraphicBuffer> reused(buffer);
+                *outReleaseFence = it->releaseFence;
+                c.bytes -= it->bytes;
+                mEntries.erase(std::next(it).base());
+                c.reuses++;
+                return reused;
+            }
+        }
+        if (c.maxBytes > 0) {
+            c.misses++;
+        }
+        return NULL;
+    }
+
+    void recycle(PoolClass poolClass, const sp<GraphicBuffer>& buffer,
+            uid_t uid, const sp<Fence>& releaseFence) {
+        size_t bytes = estimateSize(buffer);
+        nsecs_t now = systemTime();
+        Mutex::Autolock lock(mMutex);
+        evictIdleLocked(now);
+        Class& c(mClasses[poolClass]);
+        if (bytes > c.maxBytes) {
+            return;
+        }
+        mEntries.push_back({buffer, releaseFence, poolClass, uid, bytes, now});
+        c.bytes += bytes;
+        c.recycles++;
+        evictLocked(poolClass, c.maxBytes);
+    }
+
+    void setLimits(PoolClass poolClass, size_t maxBytes,
+            nsecs_t maxIdleTime) {
+        Mutex::Autolock lock(mMutex);
+        mClasses[poolClass].maxBytes = maxBytes;
+        mClasses[poolClass].maxIdleTime = maxIdleTime;
+        evictLocked(poolClass, maxBytes);
+    }
+
+    size_t trim(size_t maxBytes) {
+        Mutex::Autolock lock(mMutex);
+        size_t evicted = 0;
+        for (size_t i = 0; i < GraphicBufferAlloc::POOL_CLASS_COUNT; i++) {
+            evicted += evictLocked(static_cast<PoolClass>(i), maxBytes);
+        }
+        return evicted;
+    }
+
+    void dump(String8& result) const {
+        static const char* const sClassNames[] = { "shared",
+                "virtual display" };
+        static_assert(sizeof(sClassNames) / sizeof(sClassNames[0]) ==
+                GraphicBufferAlloc::POOL_CLASS_COUNT, "missing class name");
+        Mutex::Autolock lock(mMutex);
+        result.append("Recycled buffer pool:\n");
+        for (size_t i = 0; i < GraphicBufferAlloc::POOL_CLASS_COUNT; i++) {
+            PoolClass poolClass = static_cast<PoolClass>(i);
+            const Class& c(mClasses[poolClass]);
+            size_t buffers = 0;
+            size_t unreferenced = 0;
+            for (const auto& entry : mEntries) {
+                if (entry.poolClass == poolClass) {
+                    buffers++;
+                    if (isUnreferenced(entry.buffer)) {
+                        unreferenced++;
+                    }
+                }
+            }
+            result.appendFormat("  %s: %zu buffers (%zu reusable), %zu KiB "
+                    "(max %zu KiB, idle %" PRId64 " ms), %" PRIu64
+                    " recycled, %" PRIu64 " reused, %" PRIu64 " missed, %"
+                    PRIu64 " evicted\n", sClassNames[i], buffers,
+                    unreferenced, c.bytes / 1024, c.maxBytes / 1024,
+                    ns2ms(c.maxIdleTime), c.recycles, c.reuses, c.misses,
+                    c.evictions);
+            for (const auto& entry : mEntries) {
+                if (entry.poolClass != poolClass) {
+                    continue;
+                }
+                result.appendFormat("    %4ux%4u fmt=%d usage=%#08x uid=%u "
+                        "%zu KiB%s\n", entry.buffer->getWidth(),
+                        entry.buffer->getHeight(),
+                        entry.buffer->getPixelFormat(),
+                        entry.buffer->getUsage(), entry.uid,
+                        entry.bytes / 1024,
+                        isUnreferenced(entry.buffer) ? "" : " (in use)");
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        sp<GraphicBuffer> buffer;
+        // Signals once the last owner of the buffer is done with it
+        sp<Fence> releaseFence;
+        PoolClass poolClass;
+        uid_t uid;
+        size_t bytes;
+        nsecs_t recycleTime;
+    };
+
+    struct Class {
+        size_t maxBytes = 0;
+        nsecs_t maxIdleTime = DEFAULT_POOL_MAX_IDLE_TIME;
+        size_t bytes = 0;
+        uint64_t recycles = 0;
+        uint64_t reuses = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    GraphicBufferPool() = default;
+
+    // A freed buffer may still be referenced for a while, e.g. by the
+    // consumer that is displaying it, and can only be reused afterwards
+    static bool isUnreferenced(const sp<GraphicBuffer>& buffer) {
+        return buffer->getStrongCount() == 1;
+    }
+
+    // YUV and implementation-defined formats are counted as 16 bits per
+    // pixel, which is about right for most of them
+    static size_t estimateSize(const sp<GraphicBuffer>& buffer) {
+        uint32_t bpp = bytesPerPixel(buffer->getPixelFormat());
+        return static_cast<size_t>(buffer->getStride()) *
+                buffer->getHeight() * (bpp > 0 ? bpp : 2);
+    }
+
+    size_t evictLocked(PoolClass poolClass, size_t maxBytes) {
+        Class& c(mClasses[poolClass]);
+        size_t evicted = 0;
+        for (auto it = mEntries.begin();
+                c.bytes > maxBytes && it != mEntries.end(); ) {
+            if (it->poolClass == poolClass) {
+                c.bytes -= it->bytes;
+                it = mEntries.erase(it);
+                evicted++;
+            } else {
+                ++it;
+            }
+        }
+        c.evictions += evicted;
+        return evicted;
+    }
+
+    void evictIdleLocked(nsecs_t now) {
+        for (auto it = mEntries.begin(); it != mEntries.end(); ) {
+            Class& c(mClasses[it->poolClass]);
+            if (c.maxIdleTime > 0 && now - it->recycleTime > c.maxIdleTime) {
+                c.bytes -= it->bytes;
+                it = mEntries.erase(it);
+                c.evictions++;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    mutable Mutex mMutex;
+    Class mClasses[GraphicBufferAlloc::POOL_CLASS_COUNT];
+    // Least recently recycled first
+    std::vector<Entry> mEntries;
+};
+
+GraphicBufferAlloc::GraphicBufferAlloc()
+  : mPoolClass(POOL_SHARED) {
+}
+
+GraphicBufferAlloc::GraphicBufferAlloc(PoolClass poolClass)
+  : mPoolClass(poolClass) {
 }
 
 GraphicBufferAlloc::~GraphicBufferAlloc() {
 }
 
-sp<GraphicBuffer> GraphicBufferAlloc::createGraphicBuffer(uint32_t width,
+static sp<GraphicBuffer> allocateGraphicBuffer(
+        GraphicBufferAlloc::PoolClass poolClass, uint32_t width,
         uint32_t height, PixelFormat format, uint32_t usage,
-        std::string requestorName, status_t* error) {
-    sp<GraphicBuffer> graphicBuffer(new GraphicBuffer(
-            width, height, format, usage, std::move(requestorName)));
+        std::string requestorName, status_t* error, bool requireSignaled,
+        sp<Fence>* outReleaseFence) {
+    GraphicBufferPool& pool(GraphicBufferPool::getInstance());
+    *outReleaseFence = Fence::NO_FENCE;
+    sp<GraphicBuffer> graphicBuffer(pool.acquire(poolClass, width, height,
+            format, usage, IPCThreadState::self()->getCallingUid(),
+            requireSignaled, outReleaseFence));
+    if (graphicBuffer != NULL) {
+        *error = NO_ERROR;
+        return graphicBuffer;
+    }
+
+    graphicBuffer = new GraphicBuffer(width, height, format, usage,
+            requestorName);
     status_t err = graphicBuffer->initCheck();
+    if (err == NO_MEMORY && pool.trim(0) > 0) {
+        // The pooled buffers are only worth keeping while gralloc has memory
+        // to spare, retry without them
+        ALOGW("GraphicBufferAlloc::createGraphicBuffer(w=%u, h=%u) out of "
+                "memory, emptied the recycled buffer pool", width, height);
+        graphicBuffer = new GraphicBuffer(width, height, format, usage,
+                std::move(requestorName));
+        err = graphicBuffer->initCheck();
+    }
     *error = err;
     if (err != 0 || graphicBuffer->handle == 0) {
         if (err == NO_MEMORY) {
@@ -50,6 +277,48 @@ sp<GraphicBuffer> GraphicBufferAlloc::createGraphicBuffer(uint32_t width,
     return graphicBuffer;
 }
 
+sp<GraphicBuffer> GraphicBufferAlloc::createGraphicBuffer(uint32_t width,
+        uint32_t height, PixelFormat format, uint32_t usage,
+        std::string requestorName, status_t* error) {
+    // Remote callers can't be handed the fence, so only the pooled buffers
+    // whose previous owner is done with them are reused for them
+    sp<Fence> releaseFence;
+    return allocateGraphicBuffer(mPoolClass, width, height, format, usage,
+            std::move(requestorName), error, true, &releaseFence);
+}
+
+sp<GraphicBuffer> GraphicBufferAlloc::createOrReuseGraphicBuffer(
+        uint32_t width, uint32_t height, PixelFormat format, uint32_t usage,
+        std::string requestorName, status_t* error,
+        sp<Fence>* outReleaseFence) {
+    return allocateGraphicBuffer(mPoolClass, width, height, format, usage,
+            std::move(requestorName), error, false, outReleaseFence);
+}
+
+void GraphicBufferAlloc::recycleGraphicBuffer(const sp<GraphicBuffer>& buffer,
+        uid_t ownerUid, const sp<Fence>& releaseFence) {
+    GraphicBufferPool::getInstance().recycle(mPoolClass, buffer, ownerUid,
+            releaseFence);
+}
+
+void GraphicBufferAlloc::setPoolLimits(size_t maxBytes, nsecs_t maxIdleTime) {
+    setPoolLimits(POOL_SHARED, maxBytes, maxIdleTime);
+}
+
+void GraphicBufferAlloc::setPoolLimits(PoolClass poolClass, size_t maxBytes,
+        nsecs_t maxIdleTime) {
+    GraphicBufferPool::getInstance().setLimits(poolClass, maxBytes,
+            maxIdleTime);
+}
+
+size_t GraphicBufferAlloc::trimPool(size_t maxBytes) {
+    return GraphicBufferPool::getInstance().trim(maxBytes);
+}
+
+void GraphicBufferAlloc::dumpPool(String8& result) {
+    GraphicBufferPool::getInstance().dump(result);
+}
+
 // ----------------------------------------------------------------------------
 }; // namespace android
 // ----------------------------------------------------------------------------
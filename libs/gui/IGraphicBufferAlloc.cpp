@@ -83,6 +83,20 @@ BpGraphicBufferAlloc::~BpGraphicBufferAlloc() {}
 
 IMPLEMENT_META_INTERFACE(GraphicBufferAlloc, "android.ui.IGraphicBufferAlloc");
 
+sp<GraphicBuffer> IGraphicBufferAlloc::createOrReuseGraphicBuffer(
+        uint32_t w, uint32_t h, PixelFormat format, uint32_t usage,
+        std::string requestorName, status_t* error,
+        sp<Fence>* outReleaseFence) {
+    *outReleaseFence = Fence::NO_FENCE;
+    return createGraphicBuffer(w, h, format, usage, std::move(requestorName),
+            error);
+}
+
+void IGraphicBufferAlloc::recycleGraphicBuffer(
+        const sp<GraphicBuffer>& /* buffer */, uid_t /* ownerUid */,
+        const sp<Fence>& /* releaseFence */) {
+}
+
 // ----------------------------------------------------------------------
 
 status_t BnGraphicBufferAlloc::onTransact(
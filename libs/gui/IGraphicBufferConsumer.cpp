@@ -53,6 +53,7 @@ enum {
     GET_SIDEBAND_STREAM,
     GET_OCCUPANCY_HISTORY,
     DISCARD_FREE_BUFFERS,
+    SET_BUFFER_COUNT_TUNING,
     DUMP,
 };
 
@@ -302,6 +303,23 @@ public:
         return result;
     }
 
+    virtual status_t setBufferCountTuning(int mode) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
+        data.writeInt32(mode);
+        status_t error = remote()->transact(SET_BUFFER_COUNT_TUNING, data,
+                &reply);
+        if (error != NO_ERROR) {
+            return error;
+        }
+        int32_t result = NO_ERROR;
+        error = reply.readInt32(&result);
+        if (error != NO_ERROR) {
+            return error;
+        }
+        return result;
+    }
+
     virtual void dump(String8& result, const char* prefix) const {
         Parcel data, reply;
         data.writeInterfaceToken(IGraphicBufferConsumer::getInterfaceDescriptor());
@@ -476,6 +494,13 @@ status_t BnGraphicBufferConsumer::onTransact(
             status_t error = reply->writeInt32(result);
             return error;
         }
+        case SET_BUFFER_COUNT_TUNING: {
+            CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
+            int mode = data.readInt32();
+            status_t result = setBufferCountTuning(mode);
+            status_t error = reply->writeInt32(result);
+            return error;
+        }
         case DUMP: {
             CHECK_INTERFACE(IGraphicBufferConsumer, data, reply);
             String8 result = data.readString8();
@@ -55,7 +55,9 @@ enum {
     SET_DEQUEUE_TIMEOUT,
     GET_LAST_QUEUED_BUFFER,
     GET_FRAME_TIMESTAMPS,
-    GET_UNIQUE_ID
+    GET_UNIQUE_ID,
+    SET_PREDICTIVE_ALLOCATION,
+    RECLAIM_NEXT_BUFFER,
 };
 
 class BpGraphicBufferProducer : public BpInterface<IGraphicBufferProducer>
@@ -476,6 +478,51 @@ public:
         }
         return actualResult;
     }
+
+    virtual status_t setPredictiveAllocation(bool enabled) {
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        data.writeInt32(enabled);
+        status_t result = remote()->transact(SET_PREDICTIVE_ALLOCATION, data,
+                &reply);
+        if (result != NO_ERROR) {
+            ALOGE("setPredictiveAllocation failed to transact: %d", result);
+            return result;
+        }
+        return reply.readInt32();
+    }
+
+    virtual status_t reclaimNextBuffer(int* outSlot, sp<Fence>* outFence) {
+        if (outSlot == NULL) {
+            ALOGE("reclaimNextBuffer: outSlot must not be NULL");
+            return BAD_VALUE;
+        } else if (outFence == NULL) {
+            ALOGE("reclaimNextBuffer: outFence must not be NULL");
+            return BAD_VALUE;
+        }
+        Parcel data, reply;
+        data.writeInterfaceToken(IGraphicBufferProducer::getInterfaceDescriptor());
+        status_t result = remote()->transact(RECLAIM_NEXT_BUFFER, data, &reply);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        result = reply.readInt32();
+        if (result == NO_ERROR) {
+            *outSlot = reply.readInt32();
+            bool nonNull = reply.readInt32();
+            if (nonNull) {
+                *outFence = new Fence;
+                result = reply.read(**outFence);
+                if (result != NO_ERROR) {
+                    outFence->clear();
+                    return result;
+                }
+            } else {
+                *outFence = Fence::NO_FENCE;
+            }
+        }
+        return result;
+    }
 };
 
 // Out-of-line virtual method definition to trigger vtable emission in this
@@ -754,6 +801,28 @@ status_t BnGraphicBufferProducer::onTransact(
             }
             return NO_ERROR;
         }
+        case SET_PREDICTIVE_ALLOCATION: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+            bool enabled = static_cast<bool>(data.readInt32());
+            status_t result = setPredictiveAllocation(enabled);
+            reply->writeInt32(result);
+            return NO_ERROR;
+        }
+        case RECLAIM_NEXT_BUFFER: {
+            CHECK_INTERFACE(IGraphicBufferProducer, data, reply);
+            int slot = 0;
+            sp<Fence> fence;
+            status_t result = reclaimNextBuffer(&slot, &fence);
+            reply->writeInt32(result);
+            if (result == NO_ERROR) {
+                reply->writeInt32(slot);
+                reply->writeInt32(fence != NULL);
+                if (fence != NULL) {
+                    reply->write(*fence);
+                }
+            }
+            return NO_ERROR;
+        }
     }
     return BBinder::onTransact(code, data, reply, flags);
 }
@@ -67,15 +67,12 @@ void OccupancyTracker::registerOccupancyChange(size_t occupancy) {
     if (delta > NEW_SEGMENT_DELAY) {
         recordPendingSegment();
     } else {
-        mPendingSegment.totalTime += delta;
-        if (mPendingSegment.mOccupancyTimes.count(mLastOccupancy)) {
-            mPendingSegment.mOccupancyTimes[mLastOccupancy] += delta;
-        } else {
-            mPendingSegment.mOccupancyTimes[mLastOccupancy] = delta;
-        }
+        mPendingSegment.addTime(mLastOccupancy, delta);
+        mUnreviewedSegment.addTime(mLastOccupancy, delta);
     }
     if (occupancy > mLastOccupancy) {
         ++mPendingSegment.numFrames;
+        ++mUnreviewedSegment.numFrames;
     }
     mLastOccupancyChangeTime = now;
     mLastOccupancy = occupancy;
@@ -92,26 +89,48 @@ std::vector<OccupancyTracker::Segment> OccupancyTracker::getSegmentHistory(
     return segments;
 }
 
+std::vector<OccupancyTracker::Segment> OccupancyTracker::takeRecentSegments(
+        nsecs_t maxPendingTime) {
+    if (mUnreviewedSegment.totalTime >= maxPendingTime &&
+            mUnreviewedSegment.numFrames > LONG_SEGMENT_THRESHOLD) {
+        mRecentSegments.push_front(mUnreviewedSegment.toSegment());
+        mUnreviewedSegment.clear();
+    }
+    std::vector<Segment> segments(mRecentSegments.cbegin(),
+            mRecentSegments.cend());
+    mRecentSegments.clear();
+    return segments;
+}
+
+OccupancyTracker::Segment OccupancyTracker::PendingSegment::toSegment() const {
+    float occupancyAverage = 0.0f;
+    bool usedThirdBuffer = false;
+    for (const auto& timePair : mOccupancyTimes) {
+        size_t occupancy = timePair.first;
+        float timeRatio = static_cast<float>(timePair.second) / totalTime;
+        occupancyAverage += timeRatio * occupancy;
+        usedThirdBuffer = usedThirdBuffer || (occupancy > 1);
+    }
+    return {totalTime, numFrames, occupancyAverage, usedThirdBuffer};
+}
+
 void OccupancyTracker::recordPendingSegment() {
     // Only record longer segments to get a better measurement of actual double-
     // vs. triple-buffered time
     if (mPendingSegment.numFrames > LONG_SEGMENT_THRESHOLD) {
-        float occupancyAverage = 0.0f;
-        bool usedThirdBuffer = false;
-        for (const auto& timePair : mPendingSegment.mOccupancyTimes) {
-            size_t occupancy = timePair.first;
-            float timeRatio = static_cast<float>(timePair.second) /
-                    mPendingSegment.totalTime;
-            occupancyAverage += timeRatio * occupancy;
-            usedThirdBuffer = usedThirdBuffer || (occupancy > 1);
-        }
-        mSegmentHistory.push_front({mPendingSegment.totalTime,
-                mPendingSegment.numFrames, occupancyAverage, usedThirdBuffer});
+        mSegmentHistory.push_front(mPendingSegment.toSegment());
         if (mSegmentHistory.size() > MAX_HISTORY_SIZE) {
             mSegmentHistory.pop_back();
         }
     }
+    if (mUnreviewedSegment.numFrames > LONG_SEGMENT_THRESHOLD) {
+        mRecentSegments.push_front(mUnreviewedSegment.toSegment());
+        if (mRecentSegments.size() > MAX_HISTORY_SIZE) {
+            mRecentSegments.pop_back();
+        }
+    }
     mPendingSegment.clear();
+    mUnreviewedSegment.clear();
 }
 
 } // namespace android
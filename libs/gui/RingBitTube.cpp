@@ -0,0 +1,396 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RingBitTube"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include <cutils/ashmem.h>
+
+#include <utils/Errors.h>
+
+#include <binder/Parcel.h>
+
+#include <gui/RingBitTube.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Ring size used by the default constructor, the same as the socket buffer
+// size of a default BitTube
+static const size_t DEFAULT_RING_SIZE = 4 * 1024;
+
+// Bounds of the ring size, which is always a power of two
+static const size_t MIN_RING_SIZE = 256;
+static const size_t MAX_RING_SIZE = 16 * 1024 * 1024;
+
+// Each message is stored as a record made of its 32-bit length followed by its
+// data, padded so that the next length is aligned
+static const size_t RECORD_ALIGNMENT = sizeof(uint32_t);
+
+static size_t recordSize(size_t length) {
+    return (sizeof(uint32_t) + length + RECORD_ALIGNMENT - 1) &
+            ~(RECORD_ALIGNMENT - 1);
+}
+
+// The indices are free-running byte counts, masked into the ring when used.
+// They are in separate cache lines since each is written by a different side.
+struct RingBitTube::Header {
+    // The end of the last record read, only written by the reader
+    alignas(64) std::atomic<uint32_t> head;
+    // The end of the last record published, only written by the writer
+    alignas(64) std::atomic<uint32_t> tail;
+};
+
+RingBitTube::RingBitTube()
+    : BitTube(DefaultConstructTag::kDefaultConstructTag),
+      mMemoryFd(-1), mMemory(NULL), mMemorySize(0), mHeader(NULL),
+      mData(NULL), mCapacity(0)
+{
+    initRing(DEFAULT_RING_SIZE);
+}
+
+RingBitTube::RingBitTube(size_t bufsize)
+    : BitTube(DefaultConstructTag::kDefaultConstructTag),
+      mMemoryFd(-1), mMemory(NULL), mMemorySize(0), mHeader(NULL),
+      mData(NULL), mCapacity(0)
+{
+    initRing(bufsize);
+}
+
+RingBitTube::RingBitTube(const Parcel& data)
+    : BitTube(DefaultConstructTag::kDefaultConstructTag),
+      mMemoryFd(-1), mMemory(NULL), mMemorySize(0), mHeader(NULL),
+      mData(NULL), mCapacity(0)
+{
+    if (data.readInt32() == 0) {
+        // The fallback socket, parceled like a BitTube
+        mReceiveFd = dup(data.readFileDescriptor());
+        if (mReceiveFd < 0) {
+            mReceiveFd = -errno;
+            ALOGE("RingBitTube(Parcel): can't dup filedescriptor (%s)",
+                    strerror(-mReceiveFd));
+        }
+        return;
+    }
+
+    int memoryFd = dup(data.readFileDescriptor());
+    if (memoryFd < 0) {
+        mReceiveFd = -errno;
+        ALOGE("RingBitTube(Parcel): can't dup memory filedescriptor (%s)",
+                strerror(-mReceiveFd));
+        return;
+    }
+    mReceiveFd = dup(data.readFileDescriptor());
+    if (mReceiveFd < 0) {
+        mReceiveFd = -errno;
+        ALOGE("RingBitTube(Parcel): can't dup event filedescriptor (%s)",
+                strerror(-mReceiveFd));
+        close(memoryFd);
+        return;
+    }
+    status_t err = mapRing(memoryFd);
+    if (err != NO_ERROR) {
+        ALOGE("RingBitTube(Parcel): can't map the ring (%s)", strerror(-err));
+        close(memoryFd);
+        close(mReceiveFd);
+        mReceiveFd = err;
+    }
+}
+
+RingBitTube::~RingBitTube()
+{
+    if (mMemory != NULL) {
+        munmap(mMemory, mMemorySize);
+    }
+    if (mMemoryFd >= 0) {
+        close(mMemoryFd);
+    }
+}
+
+void RingBitTube::initRing(size_t bufsize) {
+    size_t capacity = MIN_RING_SIZE;
+    while (capacity < bufsize && capacity < MAX_RING_SIZE) {
+        capacity *= 2;
+    }
+
+    int memoryFd = ashmem_create_region("RingBitTube",
+            sizeof(Header) + capacity);
+    if (memoryFd < 0) {
+        ALOGW("RingBitTube: can't create the ring (%s), using a socket",
+                strerror(errno));
+        init(bufsize, bufsize);
+        return;
+    }
+    int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd < 0) {
+        ALOGW("RingBitTube: can't create the eventfd (%s), using a socket",
+                strerror(errno));
+        close(memoryFd);
+        init(bufsize, bufsize);
+        return;
+    }
+    status_t err = mapRing(memoryFd);
+    if (err != NO_ERROR) {
+        ALOGW("RingBitTube: can't map the ring (%s), using a socket",
+                strerror(-err));
+        close(memoryFd);
+        close(eventFd);
+        init(bufsize, bufsize);
+        return;
+    }
+    new (mHeader) Header();
+    mReceiveFd = eventFd;
+}
+
+status_t RingBitTube::mapRing(int memoryFd) {
+    // The size comes from the region rather than from the other side, so
+    // that a misbehaving peer can't make either side access past the mapping
+    int size = ashmem_get_size_region(memoryFd);
+    if (size < 0) {
+        return -errno;
+    }
+    size_t memorySize = static_cast<size_t>(size);
+    if (memorySize <= sizeof(Header)) {
+        return BAD_VALUE;
+    }
+    size_t capacity = memorySize - sizeof(Header);
+    if (capacity < MIN_RING_SIZE || capacity > MAX_RING_SIZE ||
+            (capacity & (capacity - 1)) != 0) {
+        return BAD_VALUE;
+    }
+
+    void* memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED,
+            memoryFd, 0);
+    if (memory == MAP_FAILED) {
+        return -errno;
+    }
+    mMemoryFd = memoryFd;
+    mMemory = memory;
+    mMemorySize = memorySize;
+    mHeader = static_cast<Header*>(memory);
+    mData = static_cast<uint8_t*>(memory) + sizeof(Header);
+    mCapacity = static_cast<uint32_t>(capacity);
+    return NO_ERROR;
+}
+
+bool RingBitTube::isRing() const
+{
+    return mHeader != NULL;
+}
+
+status_t RingBitTube::writeToParcel(Parcel* reply) const
+{
+    if (!isRing()) {
+        status_t result = reply->writeInt32(0);
+        if (result != NO_ERROR) {
+            return result;
+        }
+        return BitTube::writeToParcel(reply);
+    }
+
+    status_t result = reply->writeInt32(1);
+    if (result == NO_ERROR) {
+        result = reply->writeDupFileDescriptor(mMemoryFd);
+    }
+    if (result == NO_ERROR) {
+        result = reply->writeDupFileDescriptor(mReceiveFd);
+    }
+    return result;
+}
+
+void RingBitTube::copyToRing(uint32_t index, const void* src, size_t size)
+{
+    size_t offset = index & (mCapacity - 1);
+    size_t first = std::min(size, mCapacity - offset);
+    memcpy(mData + offset, src, first);
+    memcpy(mData, static_cast<const uint8_t*>(src) + first, size - first);
+}
+
+void RingBitTube::copyFromRing(void* dst, uint32_t index, size_t size) const
+{
+    size_t offset = index & (mCapacity - 1);
+    size_t first = std::min(size, mCapacity - offset);
+    memcpy(dst, mData + offset, first);
+    memcpy(static_cast<uint8_t*>(dst) + first, mData, size - first);
+}
+
+void RingBitTube::wakeReader()
+{
+    uint64_t value = 1;
+    ssize_t result;
+    do {
+        result = ::write(mReceiveFd, &value, sizeof(value));
+    } while (result < 0 && errno == EINTR);
+    ALOGE_IF(result < 0, "RingBitTube: can't signal the eventfd (%s)",
+            strerror(errno));
+}
+
+void RingBitTube::publish(uint32_t oldTail, uint32_t tail)
+{
+    if (tail == oldTail) {
+        return;
+    }
+    // Together with the sequentially consistent head store and tail load in
+    // onRingDrained, this guarantees that either the reader sees the new
+    // records before it goes back to waiting, or the writer sees that it
+    // needs to wake it up
+    mHeader->tail.store(tail);
+    if (mHeader->head.load() == oldTail) {
+        wakeReader();
+    }
+}
+
+void RingBitTube::onRingDrained(uint32_t head)
+{
+    uint64_t value;
+    ssize_t result;
+    do {
+        result = ::read(mReceiveFd, &value, sizeof(value));
+    } while (result < 0 && errno == EINTR);
+    if (mHeader->tail.load() != head) {
+        // Records were published after the last read, possibly without the
+        // writer signaling the eventfd since head wasn't stored yet
+        wakeReader();
+    }
+}
+
+ssize_t RingBitTube::write(void const* vaddr, size_t size)
+{
+    if (!isRing()) {
+        return BitTube::write(vaddr, size);
+    }
+    // A single message, so it is either sent whole or not at all
+    return writeMessages(vaddr, size, size);
+}
+
+ssize_t RingBitTube::read(void* vaddr, size_t size)
+{
+    if (!isRing()) {
+        return BitTube::read(vaddr, size);
+    }
+    // Unlike a socket, this receives as many whole messages as fit, since
+    // the callers only care about the objects
+    return readMessages(vaddr, size, size);
+}
+
+ssize_t RingBitTube::writeMessages(void const* vaddr, size_t size,
+        size_t messageSize)
+{
+    if (!isRing()) {
+        return BitTube::writeMessages(vaddr, size, messageSize);
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(vaddr);
+    uint32_t oldTail = mHeader->tail.load(std::memory_order_relaxed);
+    uint32_t head = mHeader->head.load(std::memory_order_acquire);
+    if (oldTail - head > mCapacity) {
+        ALOGE("RingBitTube: inconsistent ring (head=%u, tail=%u)", head,
+                oldTail);
+        return -EINVAL;
+    }
+
+    uint32_t tail = oldTail;
+    size_t sent = 0;
+    while (sent < size) {
+        size_t length = std::min(messageSize, size - sent);
+        if (length > mCapacity || recordSize(length) > mCapacity) {
+            if (sent == 0) {
+                return -EMSGSIZE;
+            }
+            break;
+        }
+        if (recordSize(length) > mCapacity - (tail - head)) {
+            if (sent == 0) {
+                return -EAGAIN;
+            }
+            break;
+        }
+        uint32_t length32 = static_cast<uint32_t>(length);
+        copyToRing(tail, &length32, sizeof(length32));
+        copyToRing(tail + static_cast<uint32_t>(sizeof(length32)), src + sent,
+                length);
+        tail += static_cast<uint32_t>(recordSize(length));
+        sent += length;
+    }
+    publish(oldTail, tail);
+    return static_cast<ssize_t>(sent);
+}
+
+ssize_t RingBitTube::readMessages(void* vaddr, size_t size,
+        size_t messageSize)
+{
+    if (!isRing()) {
+        return BitTube::readMessages(vaddr, size, messageSize);
+    }
+
+    uint8_t* dst = static_cast<uint8_t*>(vaddr);
+    uint32_t head = mHeader->head.load(std::memory_order_relaxed);
+    uint32_t tail = mHeader->tail.load(std::memory_order_acquire);
+    bool corrupted = tail - head > mCapacity;
+
+    size_t received = 0;
+    while (!corrupted && head != tail) {
+        uint32_t length;
+        if (tail - head < sizeof(length)) {
+            corrupted = true;
+            break;
+        }
+        copyFromRing(&length, head, sizeof(length));
+        if (length > tail - head || recordSize(length) > tail - head) {
+            corrupted = true;
+            break;
+        }
+
+        // Messages larger than messageSize are truncated like by the socket,
+        // and so is the first message if it doesn't fit in the buffer
+        size_t copySize = std::min(static_cast<size_t>(length), messageSize);
+        if (copySize > size - received) {
+            if (received > 0) {
+                break;
+            }
+            copySize = size;
+        }
+        copyFromRing(dst + received,
+                head + static_cast<uint32_t>(sizeof(length)), copySize);
+        received += copySize;
+        head += static_cast<uint32_t>(recordSize(length));
+    }
+
+    if (corrupted) {
+        // Drop everything, as there is no telling where the next record is
+        ALOGE("RingBitTube: inconsistent ring (head=%u, tail=%u)", head, tail);
+        head = tail;
+    }
+    mHeader->head.store(head);
+    if (head == tail) {
+        onRingDrained(head);
+    }
+    return corrupted ? -EINVAL : static_cast<ssize_t>(received);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
@@ -56,7 +56,9 @@ status_t StreamSplitter::createSplitter(
 
 StreamSplitter::StreamSplitter(const sp<IGraphicBufferConsumer>& inputQueue)
       : mIsAbandoned(false), mMutex(), mReleaseCondition(),
-        mOutstandingBuffers(0), mInput(inputQueue), mOutputs(), mBuffers() {}
+        mOutstandingBuffers(0), mInput(inputQueue), mOutputs(), mBuffers(),
+        mPersistentSlots(false), mInputSlots(), mRetiredBuffers(),
+        mOutputMaxDequeuedBufferCounts(), mOutputReclaimsBuffers() {}
 
 StreamSplitter::~StreamSplitter() {
     mInput->consumerDisconnect();
@@ -89,7 +91,35 @@ status_t StreamSplitter::addOutput(
         return status;
     }
 
+    bool reclaimsBuffers = false;
+    if (mPersistentSlots) {
+        // Only a producer that reclaims a free buffer, or reports that it has
+        // none, supports reclaimNextBuffer. Those that predate it, or can't
+        // reclaim buffers in their current mode, get each frame attached and
+        // detached as without persistent slots.
+        int slot = BufferItem::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        status = outputQueue->reclaimNextBuffer(&slot, &fence);
+        if (status == NO_ERROR) {
+            // The output already had a free buffer, which the splitter never
+            // attached, so hand it back untouched
+            outputQueue->cancelBuffer(slot, fence);
+            reclaimsBuffers = true;
+        } else if (status == NO_MEMORY) {
+            reclaimsBuffers = true;
+        } else if (status == NO_INIT) {
+            ALOGE("addOutput: output was abandoned (%d)", status);
+            outputQueue->disconnect(NATIVE_WINDOW_API_CPU);
+            return status;
+        } else {
+            ALOGW("addOutput: output can't reclaim buffers (%d), attaching "
+                    "each frame to it", status);
+        }
+    }
+
     mOutputs.push_back(outputQueue);
+    mOutputMaxDequeuedBufferCounts.push_back(0);
+    mOutputReclaimsBuffers.push_back(reclaimsBuffers);
 
     return NO_ERROR;
 }
@@ -99,6 +129,30 @@ void StreamSplitter::setName(const String8 &name) {
     mInput->setConsumerName(name);
 }
 
+status_t StreamSplitter::setPersistentSlotsEnabled(bool enabled) {
+    {
+        Mutex::Autolock lock(mMutex);
+        if (!mOutputs.isEmpty()) {
+            ALOGE("setPersistentSlotsEnabled: outputs were already added");
+            return INVALID_OPERATION;
+        }
+    }
+
+    // Buffers stay acquired from the input while the outputs use them. This
+    // may call back into onBuffersReleased, so mMutex can't be held.
+    status_t status = mInput->setMaxAcquiredBufferCount(
+            enabled ? MAX_OUTSTANDING_BUFFERS : 1);
+    if (status != NO_ERROR) {
+        ALOGE("setPersistentSlotsEnabled: failed to set the max acquired "
+                "buffer count of the input (%d)", status);
+        return status;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    mPersistentSlots = enabled;
+    return NO_ERROR;
+}
+
 void StreamSplitter::onFrameAvailable(const BufferItem& /* item */) {
     ATRACE_CALL();
     Mutex::Autolock lock(mMutex);
@@ -129,6 +183,11 @@ void StreamSplitter::onFrameAvailable(const BufferItem& /* item */) {
     LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
             "acquiring buffer from input failed (%d)", status);
 
+    if (mPersistentSlots) {
+        queueToOutputsPersistentLocked(bufferItem);
+        return;
+    }
+
     ALOGV("acquired buffer %#" PRIx64 " from input",
             bufferItem.mGraphicBuffer->getId());
 
@@ -189,6 +248,11 @@ void StreamSplitter::onBufferReleasedByOutput(
     ATRACE_CALL();
     Mutex::Autolock lock(mMutex);
 
+    if (mPersistentSlots) {
+        onBufferReleasedByOutputPersistentLocked(from);
+        return;
+    }
+
     sp<GraphicBuffer> buffer;
     sp<Fence> fence;
     status_t status = from->detachNextBuffer(&buffer, &fence);
@@ -248,6 +312,267 @@ void StreamSplitter::onBufferReleasedByOutput(
     mReleaseCondition.signal();
 }
 
+void StreamSplitter::onBuffersReleased() {
+    Mutex::Autolock lock(mMutex);
+
+    if (!mPersistentSlots || mIsAbandoned) {
+        return;
+    }
+
+    uint64_t mask = 0;
+    status_t status = mInput->getReleasedBuffers(&mask);
+    if (status != NO_ERROR) {
+        ALOGE("onBuffersReleased: getReleasedBuffers failed (%d)", status);
+        return;
+    }
+    for (int slot = 0; slot < BufferQueueDefs::NUM_BUFFER_SLOTS; ++slot) {
+        if ((mask & (1ULL << slot)) != 0 && mInputSlots[slot] != NULL) {
+            retireInputSlotLocked(slot);
+        }
+    }
+}
+
+void StreamSplitter::queueToOutputsPersistentLocked(
+        const BufferItem& bufferItem) {
+    const int inputSlot = bufferItem.mSlot;
+
+    // The input only sends the buffer along the first time it's acquired from
+    // a slot
+    if (bufferItem.mGraphicBuffer != NULL) {
+        if (mInputSlots[inputSlot] != NULL) {
+            retireInputSlotLocked(inputSlot);
+        }
+        mInputSlots[inputSlot] = new BufferTracker(bufferItem.mGraphicBuffer);
+        ALOGV("tracking buffer %#" PRIx64 " in input slot %d",
+                bufferItem.mGraphicBuffer->getId(), inputSlot);
+    }
+    const sp<BufferTracker> tracker = mInputSlots[inputSlot];
+    LOG_ALWAYS_FATAL_IF(tracker == NULL,
+            "acquired untracked input slot %d", inputSlot);
+    tracker->startFrameLocked(bufferItem.mFrameNumber);
+
+    IGraphicBufferProducer::QueueBufferInput queueInput(
+            bufferItem.mTimestamp, bufferItem.mIsAutoTimestamp,
+            bufferItem.mDataSpace, bufferItem.mCrop,
+            static_cast<int32_t>(bufferItem.mScalingMode),
+            bufferItem.mTransform, bufferItem.mFence);
+
+    // Queue the buffer to each of the outputs, where it's already dequeued
+    // unless this is the first time the output sees it
+    for (size_t output = 0; output < mOutputs.size(); ++output) {
+        int slot = tracker->getOutputSlot(output);
+        status_t status = NO_ERROR;
+        if (slot == BufferItem::INVALID_BUFFER_SLOT) {
+            status = attachToOutputLocked(output, tracker->getBuffer(), &slot);
+            if (status == NO_ERROR) {
+                tracker->setOutputSlotLocked(output, slot, false);
+            }
+        }
+        if (status == NO_ERROR) {
+            IGraphicBufferProducer::QueueBufferOutput queueOutput;
+            status = mOutputs[output]->queueBuffer(slot, queueInput,
+                    &queueOutput);
+        }
+        if (status == NO_INIT) {
+            // If we just discovered that this output has been abandoned, note
+            // that, increment the release count so that we still release this
+            // buffer eventually, and move on to the next output
+            onAbandonedLocked();
+            tracker->incrementReleaseCountLocked();
+            continue;
+        } else {
+            LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                    "queueing buffer to output failed (%d)", status);
+        }
+        tracker->setOutputSlotLocked(output, slot, true);
+
+        ALOGV("queued input slot %d to slot %d of output %p", inputSlot, slot,
+                mOutputs[output].get());
+    }
+}
+
+status_t StreamSplitter::attachToOutputLocked(size_t output,
+        const sp<GraphicBuffer>& buffer, int* outSlot) {
+    // All of the buffers attached to the output may end up dequeued at once
+    int attachedCount = 1;
+    for (const sp<BufferTracker>& tracker : mInputSlots) {
+        if (tracker != NULL && tracker->getOutputSlot(output) !=
+                BufferItem::INVALID_BUFFER_SLOT) {
+            ++attachedCount;
+        }
+    }
+    for (size_t i = 0; i < mRetiredBuffers.size(); ++i) {
+        if (mRetiredBuffers[i]->getOutputSlot(output) !=
+                BufferItem::INVALID_BUFFER_SLOT) {
+            ++attachedCount;
+        }
+    }
+    const sp<IGraphicBufferProducer>& outputQueue = mOutputs[output];
+    if (attachedCount > mOutputMaxDequeuedBufferCounts[output]) {
+        status_t status = outputQueue->setMaxDequeuedBufferCount(
+                attachedCount);
+        if (status != NO_ERROR) {
+            return status;
+        }
+        mOutputMaxDequeuedBufferCounts.editItemAt(output) = attachedCount;
+    }
+
+    status_t status = outputQueue->attachBuffer(outSlot, buffer);
+    ALOGV("attached buffer %#" PRIx64 " to slot %d of output %p",
+            buffer->getId(), *outSlot, outputQueue.get());
+    return status;
+}
+
+void StreamSplitter::onBufferReleasedByOutputPersistentLocked(
+        const sp<IGraphicBufferProducer>& from) {
+    size_t output = 0;
+    while (output < mOutputs.size() && mOutputs[output] != from) {
+        ++output;
+    }
+    LOG_ALWAYS_FATAL_IF(output == mOutputs.size(), "unknown output %p",
+            from.get());
+
+    int slot = BufferItem::INVALID_BUFFER_SLOT;
+    sp<GraphicBuffer> detachedBuffer;
+    sp<Fence> fence;
+    status_t status;
+    if (mOutputReclaimsBuffers[output]) {
+        status = from->reclaimNextBuffer(&slot, &fence);
+    } else {
+        status = from->detachNextBuffer(&detachedBuffer, &fence);
+    }
+    if (status == NO_INIT) {
+        // If we just discovered that this output has been abandoned, note that,
+        // but we can't do anything else, since slot is invalid
+        onAbandonedLocked();
+        return;
+    } else {
+        LOG_ALWAYS_FATAL_IF(status != NO_ERROR,
+                "reclaiming buffer from output failed (%d)", status);
+    }
+
+    // Find the buffer in that slot of the output, or the detached buffer
+    auto isReleased = [&](const sp<BufferTracker>& tracker) {
+        if (tracker == NULL) {
+            return false;
+        }
+        if (detachedBuffer == NULL) {
+            return tracker->getOutputSlot(output) == slot;
+        }
+        return tracker->getOutputSlot(output) !=
+                BufferItem::INVALID_BUFFER_SLOT &&
+                tracker->getBuffer()->getId() == detachedBuffer->getId();
+    };
+    int inputSlot = 0;
+    while (inputSlot < BufferQueueDefs::NUM_BUFFER_SLOTS &&
+            !isReleased(mInputSlots[inputSlot])) {
+        ++inputSlot;
+    }
+    size_t retired = 0;
+    sp<BufferTracker> tracker;
+    if (inputSlot < BufferQueueDefs::NUM_BUFFER_SLOTS) {
+        tracker = mInputSlots[inputSlot];
+    } else {
+        while (retired < mRetiredBuffers.size() &&
+                !isReleased(mRetiredBuffers[retired])) {
+            ++retired;
+        }
+        LOG_ALWAYS_FATAL_IF(retired == mRetiredBuffers.size(),
+                "reclaimed untracked slot %d from output %p", slot,
+                from.get());
+        tracker = mRetiredBuffers[retired];
+    }
+
+    if (detachedBuffer != NULL) {
+        // The output doesn't keep the buffer, it's attached to it again with
+        // the next frame of the input slot
+        ALOGV("detached buffer %#" PRIx64 " from output %p",
+                detachedBuffer->getId(), from.get());
+        slot = BufferItem::INVALID_BUFFER_SLOT;
+    } else {
+        ALOGV("reclaimed slot %d from output %p", slot, from.get());
+    }
+
+    tracker->setOutputSlotLocked(output, slot, false);
+    tracker->mergeFence(fence);
+    size_t releaseCount = tracker->incrementReleaseCountLocked();
+
+    if (inputSlot == BufferQueueDefs::NUM_BUFFER_SLOTS) {
+        // The buffer is no longer in the input, so drop it from the output as
+        // well
+        if (slot != BufferItem::INVALID_BUFFER_SLOT) {
+            status = from->detachBuffer(slot);
+            if (status == NO_INIT) {
+                onAbandonedLocked();
+            }
+            tracker->setOutputSlotLocked(output,
+                    BufferItem::INVALID_BUFFER_SLOT, false);
+        }
+        if (releaseCount >= mOutputs.size()) {
+            mRetiredBuffers.removeAt(retired);
+            if (!mIsAbandoned) {
+                --mOutstandingBuffers;
+                mReleaseCondition.signal();
+            }
+        }
+        return;
+    }
+
+    if (releaseCount < mOutputs.size()) {
+        return;
+    }
+
+    // If we've been abandoned, we can't return the buffer to the input
+    if (mIsAbandoned) {
+        return;
+    }
+
+    // Release the buffer back to the input, which fails as stale if it freed
+    // the slot in the meantime, in which case onBuffersReleased retires it
+    status = mInput->releaseBuffer(inputSlot, tracker->getFrameNumber(),
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, tracker->getMergedFence());
+    LOG_ALWAYS_FATAL_IF(status != NO_ERROR &&
+            status != IGraphicBufferConsumer::STALE_BUFFER_SLOT,
+            "releasing buffer to input failed (%d)", status);
+
+    ALOGV("released input slot %d", inputSlot);
+
+    // Notify any waiting onFrameAvailable calls
+    --mOutstandingBuffers;
+    mReleaseCondition.signal();
+}
+
+void StreamSplitter::retireInputSlotLocked(int slot) {
+    sp<BufferTracker> tracker = mInputSlots[slot];
+    mInputSlots[slot] = NULL;
+
+    ALOGV("retiring buffer %#" PRIx64 " of input slot %d",
+            tracker->getBuffer()->getId(), slot);
+
+    // Detach the buffer from the outputs that hold it, the others detach it
+    // when they release it
+    bool queued = false;
+    for (size_t output = 0; output < mOutputs.size(); ++output) {
+        int outputSlot = tracker->getOutputSlot(output);
+        if (outputSlot == BufferItem::INVALID_BUFFER_SLOT) {
+            continue;
+        }
+        if (tracker->isQueuedToOutput(output)) {
+            queued = true;
+            continue;
+        }
+        status_t status = mOutputs[output]->detachBuffer(outputSlot);
+        if (status == NO_INIT) {
+            onAbandonedLocked();
+        }
+        tracker->setOutputSlotLocked(output, BufferItem::INVALID_BUFFER_SLOT,
+                false);
+    }
+    if (queued) {
+        mRetiredBuffers.push_back(tracker);
+    }
+}
+
 void StreamSplitter::onAbandonedLocked() {
     ALOGE("one of my outputs has abandoned me");
     if (!mIsAbandoned) {
@@ -274,7 +599,8 @@ void StreamSplitter::OutputListener::binderDied(const wp<IBinder>& /* who */) {
 }
 
 StreamSplitter::BufferTracker::BufferTracker(const sp<GraphicBuffer>& buffer)
-      : mBuffer(buffer), mMergedFence(Fence::NO_FENCE), mReleaseCount(0) {}
+      : mBuffer(buffer), mMergedFence(Fence::NO_FENCE), mReleaseCount(0),
+        mFrameNumber(0), mOutputSlots() {}
 
 StreamSplitter::BufferTracker::~BufferTracker() {}
 
@@ -282,4 +608,29 @@ void StreamSplitter::BufferTracker::mergeFence(const sp<Fence>& with) {
     mMergedFence = Fence::merge(String8("StreamSplitter"), mMergedFence, with);
 }
 
+void StreamSplitter::BufferTracker::startFrameLocked(uint64_t frameNumber) {
+    mFrameNumber = frameNumber;
+    mMergedFence = Fence::NO_FENCE;
+    mReleaseCount = 0;
+}
+
+int StreamSplitter::BufferTracker::getOutputSlot(size_t output) const {
+    if (output >= mOutputSlots.size()) {
+        return BufferItem::INVALID_BUFFER_SLOT;
+    }
+    return mOutputSlots[output].slot;
+}
+
+bool StreamSplitter::BufferTracker::isQueuedToOutput(size_t output) const {
+    return output < mOutputSlots.size() && mOutputSlots[output].queued;
+}
+
+void StreamSplitter::BufferTracker::setOutputSlotLocked(size_t output,
+        int slot, bool queued) {
+    while (mOutputSlots.size() <= output) {
+        mOutputSlots.push_back({BufferItem::INVALID_BUFFER_SLOT, false});
+    }
+    mOutputSlots.editItemAt(output) = {slot, queued};
+}
+
 } // namespace android
@@ -83,6 +83,7 @@ Surface::Surface(
     mTransformHint = 0;
     mConsumerRunningBehind = false;
     mConnectedToCpu = false;
+    mLockedFrameCount = 0;
     mProducerControlledByApp = controlledByApp;
     mSwapIntervalZero = false;
 }
@@ -129,6 +130,10 @@ status_t Surface::setDequeueTimeout(nsecs_t timeout) {
     return mGraphicBufferProducer->setDequeueTimeout(timeout);
 }
 
+status_t Surface::setPredictiveAllocation(bool enabled) {
+    return mGraphicBufferProducer->setPredictiveAllocation(enabled);
+}
+
 status_t Surface::getLastQueuedBuffer(sp<GraphicBuffer>* outBuffer,
         sp<Fence>* outFence, float outTransformMatrix[16]) {
     return mGraphicBufferProducer->getLastQueuedBuffer(outBuffer, outFence,
@@ -318,6 +323,7 @@ int Surface::dequeueBuffer(android_native_buffer_t** buffer, int* fenceFd) {
     }
 
     if ((result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) || gbuf == 0) {
+        mSlots[buf].lockedFrame = 0;
         result = mGraphicBufferProducer->requestBuffer(buf, &gbuf);
         if (result != NO_ERROR) {
             ALOGE("dequeueBuffer: IGraphicBufferProducer::requestBuffer failed: %d", result);
@@ -1142,6 +1148,7 @@ int Surface::setBuffersDataSpace(android_dataspace dataSpace)
 void Surface::freeAllBuffers() {
     for (int i = 0; i < NUM_BUFFER_SLOTS; i++) {
         mSlots[i].buffer = 0;
+        mSlots[i].lockedFrame = 0;
     }
 }
 
@@ -1169,6 +1176,33 @@ void Surface::setSurfaceDamage(android_native_rect_t* rects, size_t numRects) {
 // ----------------------------------------------------------------------
 // the lock/unlock APIs must be used from the same thread
 
+// Rows up to this many bytes are copied inline rather than with memcpy, whose
+// call and dispatch overhead dominates for the narrow rectangles of small
+// dirty regions
+static const size_t INLINE_COPY_MAX_ROW = 256;
+
+// Copies h rows of size bytes, in 16-byte blocks that the compiler turns into
+// NEON or SSE loads and stores. Rows of 4 bytes per pixel formats end with at
+// most 3 pixels, RGB_565 ones with at most 7, copied word by word.
+static void copyRows(uint8_t* d, size_t dbpr, uint8_t const* s, size_t sbpr,
+        size_t size, int32_t h) {
+    typedef uint8_t Block[16];
+    do {
+        size_t i = 0;
+        for (; i + sizeof(Block) <= size; i += sizeof(Block)) {
+            memcpy(d + i, s + i, sizeof(Block));
+        }
+        for (; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t)) {
+            memcpy(d + i, s + i, sizeof(uint32_t));
+        }
+        for (; i < size; i++) {
+            d[i] = s[i];
+        }
+        d += dbpr;
+        s += sbpr;
+    } while (--h > 0);
+}
+
 static status_t copyBlt(
         const sp<GraphicBuffer>& dst,
         const sp<GraphicBuffer>& src,
@@ -1207,6 +1241,10 @@ static status_t copyBlt(
                 size *= static_cast<size_t>(h);
                 h = 1;
             }
+            if (size <= INLINE_COPY_MAX_ROW) {
+                copyRows(d, dbpr, s, sbpr, size, h);
+                continue;
+            }
             do {
                 memcpy(d, s, size);
                 d += dbpr;
@@ -1267,33 +1305,38 @@ status_t Surface::lock(
                 backBuffer->format == frontBuffer->format);
 
         if (canCopyBack) {
-            // copy the area that is invalid and not repainted this round
-            const Region copyback(mDirtyRegion.subtract(newDirtyRegion));
+            // copy the area that changed since the back buffer was last
+            // rendered and is not repainted this round
+            Region copyback;
+            { // scope for the lock
+                Mutex::Autolock lock(mMutex);
+                copyback = getStaleRegionLocked(backBuffer, bounds);
+            }
+            copyback.subtractSelf(newDirtyRegion);
             if (!copyback.isEmpty())
                 copyBlt(backBuffer, frontBuffer, copyback);
         } else {
             // if we can't copy-back anything, modify the user's dirty
             // region to make sure they redraw the whole buffer
             newDirtyRegion.set(bounds);
-            mDirtyRegion.clear();
             Mutex::Autolock lock(mMutex);
             for (size_t i=0 ; i<NUM_BUFFER_SLOTS ; i++) {
-                mSlots[i].dirtyRegion.clear();
+                mSlots[i].lockedFrame = 0;
             }
         }
 
-
         { // scope for the lock
             Mutex::Autolock lock(mMutex);
+            mLockedFrameCount++;
+            mDirtyHistory[mLockedFrameCount % DIRTY_HISTORY_SIZE] =
+                    newDirtyRegion;
             int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
             if (backBufferSlot >= 0) {
-                Region& dirtyRegion(mSlots[backBufferSlot].dirtyRegion);
-                mDirtyRegion.subtract(dirtyRegion);
-                dirtyRegion = newDirtyRegion;
+                mSlots[backBufferSlot].lockedFrame = mLockedFrameCount;
             }
         }
 
-        mDirtyRegion.orSelf(newDirtyRegion);
+        mDirtyRegion = newDirtyRegion;
         if (inOutDirtyBounds) {
             *inOutDirtyBounds = newDirtyRegion.getBounds();
         }
@@ -1308,6 +1351,12 @@ status_t Surface::lock(
 
         if (res != 0) {
             err = INVALID_OPERATION;
+            // The frame won't be rendered into the buffer
+            Mutex::Autolock lock(mMutex);
+            int backBufferSlot(getSlotFromBufferLocked(backBuffer.get()));
+            if (backBufferSlot >= 0) {
+                mSlots[backBufferSlot].lockedFrame = 0;
+            }
         } else {
             mLockedBuffer = backBuffer;
             outBuffer->width  = backBuffer->width;
@@ -1320,6 +1369,23 @@ status_t Surface::lock(
     return err;
 }
 
+Region Surface::getStaleRegionLocked(const sp<GraphicBuffer>& buffer,
+        const Rect& bounds) const {
+    int slot = getSlotFromBufferLocked(buffer.get());
+    if (slot < 0) {
+        return Region(bounds);
+    }
+    uint64_t frame = mSlots[slot].lockedFrame;
+    if (frame == 0 || mLockedFrameCount - frame >= DIRTY_HISTORY_SIZE) {
+        return Region(bounds);
+    }
+    Region stale;
+    while (++frame <= mLockedFrameCount) {
+        stale.orSelf(mDirtyHistory[frame % DIRTY_HISTORY_SIZE]);
+    }
+    return stale;
+}
+
 status_t Surface::unlockAndPost()
 {
     if (mLockedBuffer == 0) {
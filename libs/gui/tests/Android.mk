@@ -10,6 +10,7 @@ LOCAL_MODULE := libgui_test
 LOCAL_MODULE_TAGS := tests
 
 LOCAL_SRC_FILES := \
+    BitTube_test.cpp \
     BufferQueue_test.cpp \
     CpuConsumer_test.cpp \
     FillBuffer.cpp \
@@ -42,6 +43,91 @@ LOCAL_SHARED_LIBRARIES := \
 # to integrate with auto-test framework.
 include $(BUILD_NATIVE_TEST)
 
+# Build the BufferQueue benchmark, which has its own main and has to be run
+# by hand, so it isn't a native test.
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_CLANG := true
+
+LOCAL_MODULE := libgui_bufferqueue_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := BufferQueueBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
+# Build the Surface::lock benchmark, which isn't a gtest either.
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_CLANG := true
+
+LOCAL_MODULE := libgui_surface_lock_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := SurfaceLockBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
+# Build the StreamSplitter benchmark, which isn't a gtest either.
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_CLANG := true
+
+LOCAL_MODULE := libgui_stream_splitter_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := StreamSplitterBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
+# Build the BitTube benchmark, which isn't a gtest either.
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_CLANG := true
+
+LOCAL_MODULE := libgui_bittube_benchmark
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := BitTubeBenchmark.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+	libbinder \
+	libcutils \
+	libgui \
+	libui \
+	libutils \
+
+include $(BUILD_EXECUTABLE)
+
 # Include subdirectory makefiles
 # ============================================================
 
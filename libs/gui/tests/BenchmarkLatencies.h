@@ -0,0 +1,65 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_GUI_TEST_BENCHMARK_LATENCIES_H
+#define ANDROID_GUI_TEST_BENCHMARK_LATENCIES_H
+
+#include <utils/Timers.h>
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+
+// The latencies of one operation in a benchmark run, printed in
+// microseconds as their count, mean, percentiles and maximum
+class Latencies {
+public:
+    void add(nsecs_t latency) {
+        mLatencies.push_back(latency);
+    }
+
+    void print(const char* name) {
+        if (mLatencies.empty()) {
+            return;
+        }
+        std::sort(mLatencies.begin(), mLatencies.end());
+        double total = 0;
+        for (nsecs_t latency : mLatencies) {
+            total += latency;
+        }
+        printf("  %-8s n=%-7zu mean=%8.2f p50=%8.2f p90=%8.2f p99=%8.2f "
+                "max=%9.2f\n", name, mLatencies.size(),
+                total / mLatencies.size() / 1000.0, percentile(50),
+                percentile(90), percentile(99),
+                mLatencies.back() / 1000.0);
+    }
+
+private:
+    double percentile(size_t percent) const {
+        size_t index = std::min(mLatencies.size() - 1,
+                mLatencies.size() * percent / 100);
+        return mLatencies[index] / 1000.0;
+    }
+
+    std::vector<nsecs_t> mLatencies;
+};
+
+} // namespace android
+
+#endif // ANDROID_GUI_TEST_BENCHMARK_LATENCIES_H
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sends DisplayEventReceiver events through event channels at a fixed rate
+ * from one thread, receives them on another that polls the channel like a
+ * Looper, and reports the latency percentiles from sending an event to
+ * receiving it, the event throughput, and how many wakeups and receive calls
+ * it took.
+ *
+ * The channels are a BitTube with one recv per message, a BitTube with the
+ * batched sendmmsg/recvmmsg APIs, and a RingBitTube, each at 1 kHz and
+ * 10 kHz. Each tick sends one event by default, like vsync, or a burst of
+ * events, like sensors that batch their events.
+ *
+ * usage: libgui_bittube_benchmark [-i events] [-b burst]
+ *   -i  the number of events per configuration (default 10000)
+ *   -b  the number of events sent per tick (default 1)
+ */
+
+#define LOG_TAG "BitTubeBenchmark"
+
+#include "BenchmarkLatencies.h"
+
+#include <gui/BitTube.h>
+#include <gui/DisplayEventReceiver.h>
+#include <gui/RingBitTube.h>
+
+#include <utils/Timers.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace android;
+
+typedef DisplayEventReceiver::Event Event;
+
+// Events received per call, the same as the buffer of the DisplayEventReceiver
+// JNI
+static const size_t RECEIVE_BUFFER_EVENTS = 100;
+
+enum Channel {
+    SOCKET,
+    SOCKET_BATCHED,
+    RING,
+};
+
+static const char* const CHANNEL_NAMES[] = {
+    "BitTube",
+    "BitTube, batched",
+    "RingBitTube",
+};
+
+static const uint32_t RATES[] = { 1000, 10000 };
+
+static ssize_t sendEvents(Channel channel, const sp<BitTube>& tube,
+        const Event* events, size_t count) {
+    if (channel == SOCKET_BATCHED) {
+        return BitTube::sendObjectsBatched(tube, events, count);
+    }
+    // One message per event in every case, as EventThread sends them
+    ssize_t sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        ssize_t result = BitTube::sendObjects(tube, &events[i], 1);
+        if (result < 0) {
+            return sent > 0 ? sent : result;
+        }
+        sent += result;
+    }
+    return sent;
+}
+
+static ssize_t recvEvents(Channel channel, const sp<BitTube>& tube,
+        Event* events, size_t count) {
+    if (channel == SOCKET_BATCHED) {
+        return BitTube::recvObjectsBatched(tube, events, count);
+    }
+    return BitTube::recvObjects(tube, events, count);
+}
+
+static bool runConfig(Channel channel, uint32_t rate, size_t numEvents,
+        size_t burst) {
+    sp<BitTube> tube;
+    if (channel == RING) {
+        sp<RingBitTube> ring(new RingBitTube());
+        if (!ring->isRing()) {
+            fprintf(stderr, "RingBitTube fell back to a socket\n");
+            return false;
+        }
+        tube = ring;
+    } else {
+        tube = new BitTube();
+    }
+    if (tube->initCheck() != NO_ERROR) {
+        fprintf(stderr, "failed to create the channel\n");
+        return false;
+    }
+
+    std::atomic<bool> senderDone(false);
+    size_t dropped = 0;
+    std::thread sender([&]() {
+        const nsecs_t period = s2ns(1) * static_cast<nsecs_t>(burst) / rate;
+        nsecs_t deadline = systemTime();
+        std::vector<Event> events(burst);
+        for (size_t sent = 0; sent < numEvents; sent += burst) {
+            deadline += period;
+            struct timespec ts;
+            ts.tv_sec = static_cast<time_t>(deadline / s2ns(1));
+            ts.tv_nsec = static_cast<long>(deadline % s2ns(1));
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                    NULL) == EINTR) {
+            }
+
+            size_t count = std::min(burst, numEvents - sent);
+            nsecs_t now = systemTime();
+            for (size_t i = 0; i < count; i++) {
+                events[i].header.type =
+                        DisplayEventReceiver::DISPLAY_EVENT_VSYNC;
+                events[i].header.timestamp = now;
+                events[i].vsync.count = static_cast<uint32_t>(sent + i);
+            }
+            ssize_t result = sendEvents(channel, tube, events.data(), count);
+            if (result == -EAGAIN || result == -EWOULDBLOCK) {
+                dropped += count;
+            } else if (result < 0) {
+                fprintf(stderr, "send failed: %zd\n", result);
+                break;
+            } else {
+                dropped += count - static_cast<size_t>(result);
+            }
+        }
+        senderDone = true;
+    });
+
+    Latencies latencies;
+    size_t received = 0;
+    size_t wakeups = 0;
+    size_t receiveCalls = 0;
+    bool success = true;
+    Event events[RECEIVE_BUFFER_EVENTS];
+    nsecs_t start = systemTime();
+    while (true) {
+        // Stop once the sender is done and everything it sent is received
+        bool done = senderDone;
+        struct pollfd pfd = { tube->getFd(), POLLIN, 0 };
+        int result = poll(&pfd, 1, done ? 0 : 100);
+        if (result < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed: %d\n", errno);
+            success = false;
+            break;
+        }
+        if (result <= 0) {
+            if (done) {
+                break;
+            }
+            continue;
+        }
+
+        ++wakeups;
+        ssize_t count;
+        do {
+            ++receiveCalls;
+            count = recvEvents(channel, tube, events, RECEIVE_BUFFER_EVENTS);
+            nsecs_t now = systemTime();
+            for (ssize_t i = 0; i < count; i++) {
+                latencies.add(now - events[i].header.timestamp);
+            }
+            received += count > 0 ? static_cast<size_t>(count) : 0;
+        } while (count > 0);
+        if (count < 0) {
+            fprintf(stderr, "receive failed: %zd\n", count);
+            success = false;
+            break;
+        }
+    }
+    nsecs_t elapsed = systemTime() - start;
+    sender.join();
+
+    printf("%s, %u Hz: %.0f events/s, %zu dropped, per event: %.2f wakeups, "
+            "%.2f receive calls\n", CHANNEL_NAMES[channel], rate,
+            received * 1e9 / elapsed, dropped,
+            received > 0 ? static_cast<double>(wakeups) / received : 0.0,
+            received > 0 ? static_cast<double>(receiveCalls) / received : 0.0);
+    latencies.print("latency");
+    return success;
+}
+
+int main(int argc, char** argv) {
+    int numEvents = 10000;
+    int burst = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:b:")) != -1) {
+        switch (opt) {
+            case 'i':
+                numEvents = atoi(optarg);
+                break;
+            case 'b':
+                burst = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i events] [-b burst]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (numEvents <= 0 || burst <= 0 ||
+            static_cast<size_t>(burst) > RECEIVE_BUFFER_EVENTS) {
+        fprintf(stderr, "invalid number of events\n");
+        return 1;
+    }
+
+    printf("%d events per configuration, %d per tick, latencies in us\n",
+            numEvents, burst);
+
+    bool success = true;
+    for (uint32_t rate : RATES) {
+        for (Channel channel : { SOCKET, SOCKET_BATCHED, RING }) {
+            if (!runConfig(channel, rate, static_cast<size_t>(numEvents),
+                    static_cast<size_t>(burst))) {
+                fprintf(stderr, "%s, %u Hz: failed\n", CHANNEL_NAMES[channel],
+                        rate);
+                success = false;
+            }
+        }
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BitTube_test"
+//#define LOG_NDEBUG 0
+
+#include <gui/BitTube.h>
+#include <gui/RingBitTube.h>
+
+#include <binder/Parcel.h>
+
+#include <cutils/ashmem.h>
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+class BitTubeTest : public ::testing::Test {
+
+protected:
+    BitTubeTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("Begin test: %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+
+    ~BitTubeTest() {
+        const ::testing::TestInfo* const testInfo =
+            ::testing::UnitTest::GetInstance()->current_test_info();
+        ALOGV("End test:   %s.%s", testInfo->test_case_name(),
+                testInfo->name());
+    }
+};
+
+// 20 bytes, so that the 24 byte records of single events don't divide the
+// ring sizes
+struct TestEvent {
+    uint32_t sequence;
+    uint32_t data[4];
+};
+
+static TestEvent makeEvent(uint32_t sequence) {
+    TestEvent event = { sequence,
+            { sequence * 3, ~sequence, sequence << 16, 0x5a5a5a5au } };
+    return event;
+}
+
+static void expectEvent(uint32_t sequence, const TestEvent& event) {
+    EXPECT_EQ(sequence, event.sequence);
+    EXPECT_EQ(sequence * 3, event.data[0]);
+    EXPECT_EQ(~sequence, event.data[1]);
+    EXPECT_EQ(sequence << 16, event.data[2]);
+    EXPECT_EQ(0x5a5a5a5au, event.data[3]);
+}
+
+// The layout of the header at the start of the shared memory of a
+// RingBitTube, which a misbehaving peer can write to
+struct SharedRingHeader {
+    alignas(64) uint32_t head;
+    alignas(64) uint32_t tail;
+};
+
+// Maps the shared memory of a RingBitTube, as its peer would
+class SharedRing {
+public:
+    explicit SharedRing(const sp<RingBitTube>& tube)
+      : mParcel(), mMemory(MAP_FAILED), mSize(0) {
+        if (tube->writeToParcel(&mParcel) != NO_ERROR) {
+            return;
+        }
+        mParcel.setDataPosition(0);
+        if (mParcel.readInt32() == 0) {
+            return;
+        }
+        int memoryFd = mParcel.readFileDescriptor();
+        int size = ashmem_get_size_region(memoryFd);
+        if (size <= 0) {
+            return;
+        }
+        mSize = static_cast<size_t>(size);
+        mMemory = mmap(NULL, mSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                memoryFd, 0);
+    }
+
+    ~SharedRing() {
+        if (mMemory != MAP_FAILED) {
+            munmap(mMemory, mSize);
+        }
+    }
+
+    SharedRingHeader* getHeader() const {
+        return mMemory != MAP_FAILED ?
+                static_cast<SharedRingHeader*>(mMemory) : NULL;
+    }
+
+private:
+    Parcel mParcel;
+    void* mMemory;
+    size_t mSize;
+};
+
+// Sends count events numbered from first, one per message
+static ssize_t sendEvents(const sp<BitTube>& tube, uint32_t first,
+        size_t count) {
+    std::vector<TestEvent> events;
+    for (size_t i = 0; i < count; ++i) {
+        events.push_back(makeEvent(first + static_cast<uint32_t>(i)));
+    }
+    return BitTube::sendObjectsBatched(tube, events.data(), count);
+}
+
+TEST_F(BitTubeTest, BatchedRoundTripFillsSocket) {
+    const size_t BATCH_SIZE = 64;
+
+    sp<BitTube> tube(new BitTube());
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+
+    // Send batches until the socket is full, at which point a batch is only
+    // partly sent, or not at all
+    uint32_t sent = 0;
+    ssize_t result;
+    do {
+        result = sendEvents(tube, sent, BATCH_SIZE);
+        if (result > 0) {
+            sent += static_cast<uint32_t>(result);
+        }
+    } while (result == static_cast<ssize_t>(BATCH_SIZE));
+    ASSERT_TRUE(result == -EAGAIN ||
+            (result >= 0 && result < static_cast<ssize_t>(BATCH_SIZE)))
+            << "result " << result;
+    ASSERT_GT(sent, 0u);
+    EXPECT_EQ(-EAGAIN, sendEvents(tube, sent, 1));
+
+    // Receive them in order in batches smaller than what was sent, so that
+    // each but the last one is full
+    const size_t RECEIVE_SIZE = 10;
+    uint32_t received = 0;
+    while (received < sent) {
+        TestEvent events[RECEIVE_SIZE];
+        result = BitTube::recvObjectsBatched(tube, events, RECEIVE_SIZE);
+        ASSERT_GT(result, 0);
+        ASSERT_EQ(std::min(RECEIVE_SIZE, static_cast<size_t>(sent - received)),
+                static_cast<size_t>(result));
+        for (ssize_t i = 0; i < result; ++i) {
+            expectEvent(received + static_cast<uint32_t>(i), events[i]);
+        }
+        received += static_cast<uint32_t>(result);
+    }
+    TestEvent event;
+    EXPECT_EQ(0, BitTube::recvObjectsBatched(tube, &event, 1));
+
+    // The socket has room again
+    EXPECT_EQ(1, sendEvents(tube, sent, 1));
+    ASSERT_EQ(1, BitTube::recvObjectsBatched(tube, &event, 1));
+    expectEvent(sent, event);
+}
+
+// Sends 5 events in messages of up to 2 events, and checks that receiving
+// them with windows of 2 events packs them at the start of the buffer
+static void testShortMessagesArePacked(const sp<BitTube>& tube) {
+    TestEvent events[5];
+    for (uint32_t i = 0; i < 5; ++i) {
+        events[i] = makeEvent(i);
+    }
+    ASSERT_EQ(5, BitTube::sendObjectsBatched(tube, events, 5, 2));
+    ASSERT_EQ(2, BitTube::sendObjectsBatched(tube, events, 2, 2));
+
+    // The message with the last event doesn't fill its window, and the next
+    // message is moved up behind it
+    TestEvent received[8];
+    ASSERT_EQ(7, BitTube::recvObjectsBatched(tube, received, 8, 2));
+    for (uint32_t i = 0; i < 5; ++i) {
+        expectEvent(i, received[i]);
+    }
+    expectEvent(0, received[5]);
+    expectEvent(1, received[6]);
+}
+
+TEST_F(BitTubeTest, ShortMessagesArePacked) {
+    sp<BitTube> tube(new BitTube());
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    testShortMessagesArePacked(tube);
+}
+
+TEST_F(BitTubeTest, RingShortMessagesArePacked) {
+    sp<RingBitTube> tube(new RingBitTube());
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+    testShortMessagesArePacked(tube);
+}
+
+TEST_F(BitTubeTest, RingWrapsAround) {
+    // The smallest ring, which holds fewer records than are sent below, and
+    // isn't a multiple of the record size, so that records straddle its end
+    sp<RingBitTube> tube(new RingBitTube(256));
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+
+    // Fill the ring, then keep reading and writing so that the indices go
+    // around the ring several times
+    uint32_t sent = 0;
+    ssize_t result;
+    while ((result = sendEvents(tube, sent, 3)) > 0) {
+        sent += static_cast<uint32_t>(result);
+    }
+    ASSERT_EQ(-EAGAIN, result);
+    ASSERT_GT(sent, 0u);
+
+    uint32_t received = 0;
+    while (received < 1000) {
+        TestEvent events[4];
+        result = BitTube::recvObjectsBatched(tube, events, 4);
+        ASSERT_GT(result, 0);
+        for (ssize_t i = 0; i < result; ++i) {
+            expectEvent(received + static_cast<uint32_t>(i), events[i]);
+        }
+        received += static_cast<uint32_t>(result);
+
+        while ((result = sendEvents(tube, sent, 3)) > 0) {
+            sent += static_cast<uint32_t>(result);
+        }
+        ASSERT_EQ(-EAGAIN, result);
+    }
+
+    // A message larger than the ring can never be sent
+    TestEvent events[32];
+    for (uint32_t i = 0; i < 32; ++i) {
+        events[i] = makeEvent(i);
+    }
+    EXPECT_EQ(-EMSGSIZE, BitTube::sendObjects(tube, events, 32));
+}
+
+TEST_F(BitTubeTest, RingDoesNotLoseWakeups) {
+    const uint32_t NUM_EVENTS = 100000;
+
+    sp<RingBitTube> tube(new RingBitTube(256));
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+
+    // The writer publishes one event at a time while the reader drains the
+    // ring, and only waits for the eventfd once it's empty. A lost wakeup
+    // leaves the reader waiting with events in the ring. Failures are only
+    // checked once both threads have been joined.
+    std::atomic<bool> writerFailed(false);
+    std::thread writer([&]() {
+        for (uint32_t sequence = 0; sequence < NUM_EVENTS; ) {
+            TestEvent event = makeEvent(sequence);
+            ssize_t result = BitTube::sendObjects(tube, &event, 1);
+            if (result == 1) {
+                ++sequence;
+                // Let the reader catch up, so that the ring keeps running
+                // empty while the writer publishes
+                std::this_thread::yield();
+            } else if (result == -EAGAIN) {
+                std::this_thread::yield();
+            } else {
+                writerFailed = true;
+                return;
+            }
+        }
+    });
+
+    uint32_t received = 0;
+    bool lostWakeup = false;
+    bool outOfOrder = false;
+    while (received < NUM_EVENTS && !writerFailed) {
+        struct pollfd pfd = { tube->getFd(), POLLIN, 0 };
+        int result = poll(&pfd, 1, 5000);
+        if (result == 0) {
+            lostWakeup = true;
+            break;
+        }
+        if (result < 0) {
+            continue;
+        }
+        ssize_t count;
+        do {
+            TestEvent events[8];
+            count = BitTube::recvObjects(tube, events, 8);
+            for (ssize_t i = 0; i < count; ++i) {
+                outOfOrder |= events[i].sequence !=
+                        received + static_cast<uint32_t>(i);
+            }
+            received += count > 0 ? static_cast<uint32_t>(count) : 0;
+        } while (count > 0);
+    }
+    writer.join();
+
+    EXPECT_FALSE(writerFailed);
+    EXPECT_FALSE(lostWakeup) << "received " << received << " events";
+    EXPECT_FALSE(outOfOrder);
+    EXPECT_EQ(NUM_EVENTS, received);
+}
+
+TEST_F(BitTubeTest, RingRejectsCorruptedTail) {
+    sp<RingBitTube> tube(new RingBitTube(256));
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+    SharedRing ring(tube);
+    SharedRingHeader* header = ring.getHeader();
+    ASSERT_TRUE(header != NULL);
+
+    // A tail more than the ring size ahead of the head
+    ASSERT_EQ(2, sendEvents(tube, 0, 2));
+    header->tail = header->head + 4096;
+    TestEvent events[4];
+    EXPECT_EQ(-EINVAL, BitTube::recvObjects(tube, events, 4));
+
+    // The reader dropped everything up to the bad tail, after which the ring
+    // works again
+    EXPECT_EQ(header->tail, header->head);
+    EXPECT_EQ(0, BitTube::recvObjects(tube, events, 4));
+    ASSERT_EQ(1, sendEvents(tube, 7, 1));
+    ASSERT_EQ(1, BitTube::recvObjects(tube, events, 4));
+    expectEvent(7, events[0]);
+
+    // A tail in the middle of a record
+    ASSERT_EQ(1, sendEvents(tube, 8, 1));
+    header->tail = header->tail - 4;
+    EXPECT_EQ(-EINVAL, BitTube::recvObjects(tube, events, 4));
+    EXPECT_EQ(header->tail, header->head);
+}
+
+TEST_F(BitTubeTest, RingRejectsCorruptedHead) {
+    sp<RingBitTube> tube(new RingBitTube(256));
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+    SharedRing ring(tube);
+    SharedRingHeader* header = ring.getHeader();
+    ASSERT_TRUE(header != NULL);
+
+    // A head past the tail, which would let the writer overwrite records
+    // that weren't read yet
+    header->head = header->tail + 16;
+    EXPECT_EQ(-EINVAL, sendEvents(tube, 0, 1));
+
+    header->head = header->tail;
+    ASSERT_EQ(1, sendEvents(tube, 0, 1));
+    TestEvent event;
+    ASSERT_EQ(1, BitTube::recvObjects(tube, &event, 1));
+    expectEvent(0, event);
+}
+
+TEST_F(BitTubeTest, RingParcelRoundTrip) {
+    sp<RingBitTube> tube(new RingBitTube());
+    ASSERT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_TRUE(tube->isRing());
+
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, tube->writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    sp<RingBitTube> receiver(new RingBitTube(parcel));
+    ASSERT_EQ(NO_ERROR, receiver->initCheck());
+    ASSERT_TRUE(receiver->isRing());
+
+    // Unlike a BitTube, the sending side keeps the eventfd, which it signals
+    // when the receiving side has nothing left to read
+    EXPECT_EQ(NO_ERROR, tube->initCheck());
+    ASSERT_EQ(3, sendEvents(tube, 0, 3));
+    struct pollfd pfd = { receiver->getFd(), POLLIN, 0 };
+    ASSERT_EQ(1, poll(&pfd, 1, 1000));
+    TestEvent events[4];
+    ASSERT_EQ(3, BitTube::recvObjects(receiver, events, 4));
+    for (uint32_t i = 0; i < 3; ++i) {
+        expectEvent(i, events[i]);
+    }
+
+    // Once drained, the eventfd is cleared
+    EXPECT_EQ(0, poll(&pfd, 1, 0));
+}
+
+TEST_F(BitTubeTest, SocketFallbackParcelRoundTrip) {
+    // A RingBitTube that fell back to a socket is parceled like a BitTube
+    // after a 0, as if it had been made from this one
+    sp<BitTube> sender(new BitTube());
+    ASSERT_EQ(NO_ERROR, sender->initCheck());
+    Parcel parcel;
+    ASSERT_EQ(NO_ERROR, parcel.writeInt32(0));
+    ASSERT_EQ(NO_ERROR, sender->writeToParcel(&parcel));
+    parcel.setDataPosition(0);
+    sp<RingBitTube> fallback(new RingBitTube(parcel));
+    ASSERT_EQ(NO_ERROR, fallback->initCheck());
+    ASSERT_FALSE(fallback->isRing());
+
+    // Parcel the fallback again, which hands over the socket
+    Parcel fallbackParcel;
+    ASSERT_EQ(NO_ERROR, fallback->writeToParcel(&fallbackParcel));
+    EXPECT_NE(NO_ERROR, fallback->initCheck());
+    fallbackParcel.setDataPosition(0);
+    sp<RingBitTube> receiver(new RingBitTube(fallbackParcel));
+    ASSERT_EQ(NO_ERROR, receiver->initCheck());
+    ASSERT_FALSE(receiver->isRing());
+
+    ASSERT_EQ(3, sendEvents(sender, 0, 3));
+    TestEvent events[4];
+    ASSERT_EQ(3, BitTube::recvObjectsBatched(receiver, events, 4));
+    for (uint32_t i = 0; i < 3; ++i) {
+        expectEvent(i, events[i]);
+    }
+}
+
+} // namespace android
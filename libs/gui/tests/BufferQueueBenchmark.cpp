@@ -0,0 +1,387 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs frames through BufferQueues - dequeueBuffer, queueBuffer, then
+ * acquireBuffer and releaseBuffer until the consumers have nothing left to
+ * acquire - and reports the latency percentiles of each of these calls, the
+ * frame throughput, and how long the calls held the BufferQueueCore mutex.
+ *
+ * The configurations cover synchronous and asynchronous mode, shared buffer
+ * mode, several maxDequeuedBufferCounts (that many buffers are dequeued and
+ * queued per round) and StreamSplitters with several outputs, whose consumers
+ * are all drained. The binder configurations use BufferQueues hosted by a
+ * child process; the mutex statistics are taken from the BufferQueue dump,
+ * so they come from whichever process hosts the queue.
+ *
+ * usage: libgui_bufferqueue_benchmark [-i frames] [-l] [-s]
+ *   -i  the number of frames per configuration (default 5000)
+ *   -l  only run the in-process configurations
+ *   -s  use shared memory buffers even if there is a gralloc module
+ */
+
+#define LOG_TAG "BufferQueueBenchmark"
+
+#include "BenchmarkLatencies.h"
+#include "DummyConsumer.h"
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/BufferQueueCore.h>
+#include <gui/GraphicBufferAlloc.h>
+#include <gui/IProducerListener.h>
+#include <gui/StreamSplitter.h>
+
+#include <ui/Gralloc1.h>
+#include <ui/GraphicBuffer.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace android;
+
+static const uint32_t WIDTH = 1280;
+static const uint32_t HEIGHT = 720;
+static const PixelFormat FORMAT = PIXEL_FORMAT_RGBA_8888;
+static const uint32_t USAGE = GRALLOC_USAGE_SW_READ_OFTEN |
+        GRALLOC_USAGE_SW_WRITE_OFTEN;
+// Frames run before measuring, which allocate the buffers
+static const int WARMUP_FRAMES = 30;
+
+struct Config {
+    const char* name;
+    bool binder;
+    bool async;
+    bool sharedBuffer;
+    int maxDequeuedBufferCount;
+    // 0 to consume the queue directly
+    size_t splitterOutputs;
+};
+
+static const Config CONFIGS[] = {
+    { "binder sync",              true,  false, false, 1, 0 },
+    { "binder sync, 3 dequeued",  true,  false, false, 3, 0 },
+    { "binder async",             true,  true,  false, 1, 0 },
+    { "binder shared buffer",     true,  false, true,  1, 0 },
+    { "sync",                     false, false, false, 1, 0 },
+    { "sync, 2 dequeued",         false, false, false, 2, 0 },
+    { "sync, 3 dequeued",         false, false, false, 3, 0 },
+    { "async",                    false, true,  false, 1, 0 },
+    { "async, 2 dequeued",        false, true,  false, 2, 0 },
+    { "shared buffer",            false, false, true,  1, 0 },
+    { "splitter, 1 output",       false, false, false, 1, 1 },
+    { "splitter, 2 outputs",      false, false, false, 1, 2 },
+    { "splitter, 4 outputs",      false, false, false, 1, 4 },
+};
+
+static String8 serviceName(const char* kind, pid_t pid, size_t index) {
+    return String8::format("BufferQueueBenchmark%s-%d-%zu", kind, pid, index);
+}
+
+// Runs in the child process, hosting one BufferQueue per binder
+// configuration
+static void serveBufferQueues(size_t count) {
+    BufferQueueCore::setLockStatsEnabled(true);
+    sp<IServiceManager> serviceManager = defaultServiceManager();
+    sp<IGraphicBufferAlloc> allocator = new GraphicBufferAlloc();
+    for (size_t i = 0; i < count; i++) {
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        BufferQueue::createBufferQueue(&producer, &consumer, allocator);
+        serviceManager->addService(
+                String16(serviceName("Producer", getpid(), i)),
+                IInterface::asBinder(producer));
+        serviceManager->addService(
+                String16(serviceName("Consumer", getpid(), i)),
+                IInterface::asBinder(consumer));
+    }
+    ProcessState::self()->startThreadPool();
+    IPCThreadState::self()->joinThreadPool();
+    exit(EXIT_FAILURE);
+}
+
+struct Results {
+    Latencies dequeue;
+    Latencies queue;
+    Latencies acquire;
+    Latencies release;
+    uint64_t numAcquired = 0;
+};
+
+static bool runFrames(const Config& config,
+        const sp<IGraphicBufferProducer>& producer,
+        const std::vector<sp<IGraphicBufferConsumer>>& consumers,
+        int numFrames, Results* results) {
+    IGraphicBufferProducer::QueueBufferInput input(0, false,
+            HAL_DATASPACE_UNKNOWN, Rect(WIDTH, HEIGHT),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    IGraphicBufferProducer::QueueBufferOutput output;
+    std::vector<int> slots;
+
+    for (int frame = 0; frame < numFrames;
+            frame += config.maxDequeuedBufferCount) {
+        slots.clear();
+        for (int i = 0; i < config.maxDequeuedBufferCount; i++) {
+            int slot = -1;
+            sp<Fence> fence;
+            nsecs_t start = systemTime();
+            status_t result = producer->dequeueBuffer(&slot, &fence, WIDTH,
+                    HEIGHT, FORMAT, USAGE);
+            results->dequeue.add(systemTime() - start);
+            if (result < 0) {
+                fprintf(stderr, "dequeueBuffer failed: %d\n", result);
+                return false;
+            }
+            if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+                sp<GraphicBuffer> buffer;
+                result = producer->requestBuffer(slot, &buffer);
+                if (result != NO_ERROR) {
+                    fprintf(stderr, "requestBuffer failed: %d\n", result);
+                    return false;
+                }
+            }
+            slots.push_back(slot);
+        }
+
+        for (int slot : slots) {
+            nsecs_t start = systemTime();
+            status_t result = producer->queueBuffer(slot, input, &output);
+            results->queue.add(systemTime() - start);
+            if (result != NO_ERROR) {
+                fprintf(stderr, "queueBuffer failed: %d\n", result);
+                return false;
+            }
+        }
+
+        for (const auto& consumer : consumers) {
+            for (;;) {
+                BufferItem item;
+                nsecs_t start = systemTime();
+                status_t result = consumer->acquireBuffer(&item, 0);
+                nsecs_t end = systemTime();
+                if (result == IGraphicBufferConsumer::NO_BUFFER_AVAILABLE) {
+                    break;
+                } else if (result != NO_ERROR) {
+                    fprintf(stderr, "acquireBuffer failed: %d\n", result);
+                    return false;
+                }
+                results->acquire.add(end - start);
+                results->numAcquired++;
+
+                start = systemTime();
+                result = consumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                        EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+                results->release.add(systemTime() - start);
+                if (result != NO_ERROR &&
+                        result != IGraphicBufferConsumer::STALE_BUFFER_SLOT) {
+                    fprintf(stderr, "releaseBuffer failed: %d\n", result);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void printLockStats(const sp<IGraphicBufferConsumer>& consumer) {
+    String8 dump;
+    consumer->dump(dump, "");
+    const char* line = strstr(dump.string(), "-Lock hold times");
+    if (line == NULL) {
+        return;
+    }
+    const char* end = strchr(line, '\n');
+    printf("  %.*s\n", end ? static_cast<int>(end - line - 1) :
+            static_cast<int>(strlen(line) - 1), line + 1);
+}
+
+static bool runConfig(const Config& config,
+        const sp<IGraphicBufferProducer>& producer,
+        const sp<IGraphicBufferConsumer>& consumer, int numFrames) {
+    std::vector<sp<IGraphicBufferConsumer>> consumers;
+    sp<StreamSplitter> splitter;
+    if (config.splitterOutputs > 0) {
+        if (StreamSplitter::createSplitter(consumer, &splitter) != NO_ERROR) {
+            fprintf(stderr, "createSplitter failed\n");
+            return false;
+        }
+        for (size_t i = 0; i < config.splitterOutputs; i++) {
+            sp<IGraphicBufferProducer> outputProducer;
+            sp<IGraphicBufferConsumer> outputConsumer;
+            BufferQueue::createBufferQueue(&outputProducer, &outputConsumer,
+                    new GraphicBufferAlloc());
+            outputConsumer->consumerConnect(new DummyConsumer, false);
+            if (splitter->addOutput(outputProducer) != NO_ERROR) {
+                fprintf(stderr, "addOutput failed\n");
+                return false;
+            }
+            consumers.push_back(outputConsumer);
+        }
+    } else {
+        if (consumer->consumerConnect(new DummyConsumer, false) != NO_ERROR) {
+            fprintf(stderr, "consumerConnect failed\n");
+            return false;
+        }
+        consumers.push_back(consumer);
+    }
+
+    IGraphicBufferProducer::QueueBufferOutput output;
+    if (producer->connect(new DummyProducerListener, NATIVE_WINDOW_API_CPU,
+            false, &output) != NO_ERROR) {
+        fprintf(stderr, "connect failed\n");
+        return false;
+    }
+    if (producer->setMaxDequeuedBufferCount(config.maxDequeuedBufferCount) !=
+            NO_ERROR ||
+            producer->setAsyncMode(config.async) != NO_ERROR ||
+            producer->setSharedBufferMode(config.sharedBuffer) != NO_ERROR) {
+        fprintf(stderr, "configuring the producer failed\n");
+        return false;
+    }
+
+    Results warmup;
+    if (!runFrames(config, producer, consumers, WARMUP_FRAMES, &warmup)) {
+        return false;
+    }
+
+    Results results;
+    nsecs_t start = systemTime();
+    if (!runFrames(config, producer, consumers, numFrames, &results)) {
+        return false;
+    }
+    nsecs_t duration = systemTime() - start;
+
+    printf("%s: %.0f frames/s, %" PRIu64 " buffers acquired\n", config.name,
+            numFrames * 1e9 / duration, results.numAcquired);
+    results.dequeue.print("dequeue");
+    results.queue.print("queue");
+    results.acquire.print("acquire");
+    results.release.print("release");
+    printLockStats(consumer);
+
+    producer->disconnect(NATIVE_WINDOW_API_CPU);
+    if (splitter == NULL) {
+        consumer->consumerDisconnect();
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int numFrames = 5000;
+    bool runBinder = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:ls")) != -1) {
+        switch (opt) {
+            case 'i':
+                numFrames = atoi(optarg);
+                break;
+            case 'l':
+                runBinder = false;
+                break;
+            case 's':
+                Gralloc1::Loader::useHeapDevice();
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i frames] [-l] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (numFrames <= 0) {
+        fprintf(stderr, "invalid number of frames\n");
+        return 1;
+    }
+    if (runBinder && access("/dev/binder", F_OK) != 0) {
+        printf("no binder driver, only running the in-process "
+                "configurations\n");
+        runBinder = false;
+    }
+
+    // Fork before this process uses binder, the child inherits its state
+    // otherwise
+    size_t numBinderConfigs = 0;
+    for (const Config& config : CONFIGS) {
+        numBinderConfigs += config.binder ? 1 : 0;
+    }
+    pid_t serverPid = -1;
+    if (runBinder) {
+        serverPid = fork();
+        if (serverPid < 0) {
+            fprintf(stderr, "fork failed: %s\n", strerror(errno));
+            return 1;
+        } else if (serverPid == 0) {
+            serveBufferQueues(numBinderConfigs);
+        }
+        ProcessState::self()->startThreadPool();
+    }
+
+    BufferQueueCore::setLockStatsEnabled(true);
+    printf("%ux%u buffers, %d frames per configuration, latencies in us\n",
+            WIDTH, HEIGHT, numFrames);
+
+    bool success = true;
+    size_t binderIndex = 0;
+    for (const Config& config : CONFIGS) {
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        if (config.binder) {
+            if (!runBinder) {
+                continue;
+            }
+            sp<IServiceManager> serviceManager = defaultServiceManager();
+            producer = interface_cast<IGraphicBufferProducer>(
+                    serviceManager->getService(String16(serviceName(
+                            "Producer", serverPid, binderIndex))));
+            consumer = interface_cast<IGraphicBufferConsumer>(
+                    serviceManager->getService(String16(serviceName(
+                            "Consumer", serverPid, binderIndex))));
+            binderIndex++;
+            if (producer == NULL || consumer == NULL) {
+                fprintf(stderr, "%s: the BufferQueue service is missing\n",
+                        config.name);
+                success = false;
+                continue;
+            }
+        } else {
+            BufferQueue::createBufferQueue(&producer, &consumer,
+                    new GraphicBufferAlloc());
+        }
+        if (!runConfig(config, producer, consumer, numFrames)) {
+            fprintf(stderr, "%s: failed\n", config.name);
+            success = false;
+        }
+    }
+
+    if (serverPid > 0) {
+        kill(serverPid, SIGKILL);
+        waitpid(serverPid, NULL, 0);
+    }
+    return success ? 0 : 1;
+}
@@ -19,8 +19,11 @@
 
 #include "DummyConsumer.h"
 
+#include <gui/BufferCountTuner.h>
 #include <gui/BufferItem.h>
 #include <gui/BufferQueue.h>
+#include <gui/BufferQueueCore.h>
+#include <gui/GraphicBufferAlloc.h>
 #include <gui/IProducerListener.h>
 
 #include <ui/GraphicBuffer.h>
@@ -34,6 +37,9 @@
 
 #include <gtest/gtest.h>
 
+#include <sys/eventfd.h>
+
+#include <atomic>
 #include <thread>
 
 using namespace std::chrono_literals;
@@ -1067,4 +1073,524 @@ TEST_F(BufferQueueTest, TestDiscardFreeBuffers) {
     }
 }
 
+// Returns the number following key in the BufferQueue dump, or -1
+static int64_t getDumpValue(const sp<IGraphicBufferConsumer>& consumer,
+        const char* key) {
+    String8 dump;
+    consumer->dump(dump, "");
+    const char* value = strstr(dump.string(), key);
+    if (value == NULL) {
+        return -1;
+    }
+    return strtoll(value + strlen(key), NULL, 10);
+}
+
+TEST_F(BufferQueueTest, PredictiveAllocationAfterResize) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+    ASSERT_EQ(OK, mProducer->setMaxDequeuedBufferCount(2));
+
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+            HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    auto runFrame = [&](uint32_t size, sp<GraphicBuffer>* outBuffer) {
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        status_t result = mProducer->dequeueBuffer(&slot, &fence, size, size,
+                PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_READ_OFTEN);
+        ASSERT_GE(result, 0);
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            ASSERT_EQ(OK, mProducer->requestBuffer(slot, outBuffer));
+        }
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+        BufferItem item;
+        ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+        ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    };
+
+    sp<GraphicBuffer> buffer;
+    for (int i = 0; i < 5; ++i) {
+        ASSERT_NO_FATAL_FAILURE(runFrame(64, &buffer));
+    }
+
+    // The first frame after the resize has to allocate, and the second one
+    // starts replacing the other buffers in the background
+    ASSERT_EQ(OK, mProducer->setPredictiveAllocation(true));
+    ASSERT_NO_FATAL_FAILURE(runFrame(32, &buffer));
+    EXPECT_EQ(1, getDumpValue(mConsumer, "stalls="));
+    EXPECT_EQ(0, getDumpValue(mConsumer, "preallocated="));
+    ASSERT_NO_FATAL_FAILURE(runFrame(32, &buffer));
+    EXPECT_EQ(1, getDumpValue(mConsumer, "stalls="));
+    for (int i = 0; i < 100; ++i) {
+        if (getDumpValue(mConsumer, "preallocated=") >= 2) {
+            break;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    ASSERT_EQ(2, getDumpValue(mConsumer, "preallocated="));
+
+    for (int i = 0; i < 3; ++i) {
+        buffer.clear();
+        ASSERT_NO_FATAL_FAILURE(runFrame(32, &buffer));
+        if (buffer != NULL) {
+            EXPECT_EQ(32u, buffer->getWidth());
+        }
+    }
+    EXPECT_EQ(1, getDumpValue(mConsumer, "stalls="));
+    EXPECT_EQ(2, getDumpValue(mConsumer, "stalls avoided="));
+}
+
+TEST_F(BufferQueueTest, PredictiveAllocationIgnoresSingleOddDequeue) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+    ASSERT_EQ(OK, mProducer->setMaxDequeuedBufferCount(2));
+    ASSERT_EQ(OK, mProducer->setPredictiveAllocation(true));
+
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+            HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    auto runFrame = [&](uint32_t size) {
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        status_t result = mProducer->dequeueBuffer(&slot, &fence, size, size,
+                PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_READ_OFTEN);
+        ASSERT_GE(result, 0);
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        }
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+        BufferItem item;
+        ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+        ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    };
+
+    // Two frames of the same size predict it, and fill the other slots
+    ASSERT_NO_FATAL_FAILURE(runFrame(64));
+    ASSERT_NO_FATAL_FAILURE(runFrame(64));
+    for (int i = 0; i < 100; ++i) {
+        if (getDumpValue(mConsumer, "preallocated=") >= 2) {
+            break;
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    ASSERT_EQ(2, getDumpValue(mConsumer, "preallocated="));
+
+    // A single frame of another size has to allocate, but neither changes
+    // the prediction nor replaces the other buffers
+    ASSERT_NO_FATAL_FAILURE(runFrame(32));
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(2, getDumpValue(mConsumer, "preallocated="));
+    EXPECT_EQ(0, getDumpValue(mConsumer, "dropped="));
+    EXPECT_EQ(64, getDumpValue(mConsumer, "attributes=["));
+}
+
+TEST_F(BufferQueueTest, RecreatedQueueReusesFreedBuffer) {
+    // The pool is off by default, enable it for this test only
+    struct PoolEnabler {
+        PoolEnabler() {
+            GraphicBufferAlloc::setPoolLimits(1024 * 1024, s2ns(5));
+        }
+        ~PoolEnabler() {
+            GraphicBufferAlloc::setPoolLimits(0, s2ns(5));
+        }
+    } poolEnabler;
+
+    auto dequeueOnNewQueue = [](const sp<Fence>& releaseFence,
+            sp<GraphicBuffer>* outBuffer, sp<Fence>* outFence) {
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        BufferQueue::createBufferQueue(&producer, &consumer,
+                new GraphicBufferAlloc());
+        ASSERT_EQ(OK, consumer->consumerConnect(new DummyConsumer, false));
+        IGraphicBufferProducer::QueueBufferOutput output;
+        ASSERT_EQ(OK, producer->connect(new DummyProducerListener,
+                NATIVE_WINDOW_API_CPU, false, &output));
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+                producer->dequeueBuffer(&slot, outFence, 64, 64,
+                PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_READ_OFTEN));
+        ASSERT_EQ(OK, producer->requestBuffer(slot, outBuffer));
+        ASSERT_EQ(OK, producer->cancelBuffer(slot, releaseFence));
+        ASSERT_EQ(OK, producer->disconnect(NATIVE_WINDOW_API_CPU));
+    };
+
+    // Only the identity of the release fence is checked, so any file
+    // descriptor does
+    sp<Fence> releaseFence(new Fence(eventfd(0, EFD_CLOEXEC)));
+    ASSERT_TRUE(releaseFence->isValid());
+
+    sp<GraphicBuffer> first;
+    sp<Fence> fence;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(releaseFence, &first, &fence));
+    EXPECT_FALSE(fence->isValid());
+    uint64_t firstId = first->getId();
+    first.clear();
+
+    // The buffer freed by the first queue on disconnect is handed to the
+    // second one instead of being allocated again, along with the fence it
+    // was released with
+    sp<GraphicBuffer> second;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(Fence::NO_FENCE, &second,
+            &fence));
+    EXPECT_EQ(firstId, second->getId());
+    EXPECT_EQ(releaseFence, fence);
+
+    // Nothing is reused once the pool has been trimmed
+    second.clear();
+    GraphicBufferAlloc::trimPool(0);
+    sp<GraphicBuffer> third;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(Fence::NO_FENCE, &third,
+            &fence));
+    EXPECT_NE(firstId, third->getId());
+    EXPECT_FALSE(fence->isValid());
+}
+
+TEST_F(BufferQueueTest, PoolClassesDoNotShareBuffers) {
+    // Only the virtual display scratch buffers are pooled in this test
+    struct PoolEnabler {
+        PoolEnabler() {
+            GraphicBufferAlloc::setPoolLimits(
+                    GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY, 1024 * 1024, 0);
+        }
+        ~PoolEnabler() {
+            GraphicBufferAlloc::setPoolLimits(
+                    GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY, 0, 0);
+        }
+    } poolEnabler;
+
+    auto dequeueOnNewQueue = [](GraphicBufferAlloc::PoolClass poolClass,
+            uint64_t* outId) {
+        sp<IGraphicBufferProducer> producer;
+        sp<IGraphicBufferConsumer> consumer;
+        BufferQueue::createBufferQueue(&producer, &consumer,
+                new GraphicBufferAlloc(poolClass));
+        ASSERT_EQ(OK, consumer->consumerConnect(new DummyConsumer, false));
+        IGraphicBufferProducer::QueueBufferOutput output;
+        ASSERT_EQ(OK, producer->connect(new DummyProducerListener,
+                NATIVE_WINDOW_API_CPU, false, &output));
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+                producer->dequeueBuffer(&slot, &fence, 64, 64,
+                PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_SW_READ_OFTEN));
+        sp<GraphicBuffer> buffer;
+        ASSERT_EQ(OK, producer->requestBuffer(slot, &buffer));
+        *outId = buffer->getId();
+        ASSERT_EQ(OK, producer->cancelBuffer(slot, Fence::NO_FENCE));
+        ASSERT_EQ(OK, producer->disconnect(NATIVE_WINDOW_API_CPU));
+    };
+
+    uint64_t firstId = 0;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(
+            GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY, &firstId));
+
+    // A queue of another class allocates, and doesn't recycle what it frees
+    uint64_t sharedId = 0;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(
+            GraphicBufferAlloc::POOL_SHARED, &sharedId));
+    EXPECT_NE(firstId, sharedId);
+
+    uint64_t secondId = 0;
+    ASSERT_NO_FATAL_FAILURE(dequeueOnNewQueue(
+            GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY, &secondId));
+    EXPECT_EQ(firstId, secondId);
+}
+
+TEST_F(BufferQueueTest, BufferCountTunerReplaysRecentSegmentsOldestFirst) {
+    const OccupancyTracker::Segment used(ms2ns(100), 6, 1.5f, true);
+    const OccupancyTracker::Segment unused(ms2ns(100), 6, 0.5f, false);
+    const int tripleBuffered = 2;
+
+    // The third buffer was only used in the most recent segment, so the
+    // queue has to stay triple-buffered
+    BufferCountTuner tuner;
+    tuner.onRecentSegments({used, unused, unused, unused});
+    EXPECT_EQ(tripleBuffered,
+            tuner.getTargetMaxDequeuedBufferCount(tripleBuffered));
+
+    // Then it is used once more, and left unused for three segments taken
+    // over two calls
+    tuner.onRecentSegments({unused, unused, used});
+    EXPECT_EQ(tripleBuffered,
+            tuner.getTargetMaxDequeuedBufferCount(tripleBuffered));
+    tuner.onRecentSegments({unused});
+    EXPECT_EQ(tripleBuffered - 1,
+            tuner.getTargetMaxDequeuedBufferCount(tripleBuffered));
+}
+
+TEST_F(BufferQueueTest, BufferCountTuningGrowsBlockingDoubleBufferedQueue) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    ASSERT_EQ(BAD_VALUE, mConsumer->setBufferCountTuning(-1));
+    ASSERT_EQ(OK, mConsumer->setBufferCountTuning(
+            IGraphicBufferConsumer::BUFFER_COUNT_TUNING_AUTO));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+    ASSERT_EQ(OK, mProducer->setMaxDequeuedBufferCount(1));
+
+    // A consumer that is slower than the producer, so that dequeueBuffer
+    // keeps blocking while the queue is double-buffered
+    std::atomic<bool> producerDone(false);
+    std::thread consumer([&]() {
+        while (!producerDone) {
+            BufferItem item;
+            if (mConsumer->acquireBuffer(&item, 0) != OK) {
+                std::this_thread::sleep_for(1ms);
+                continue;
+            }
+            std::this_thread::sleep_for(4ms);
+            mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                    EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+        }
+    });
+
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+            HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    // Failures are only checked once the consumer thread has been joined
+    status_t producerResult = OK;
+    for (int i = 0; i < 60 && producerResult == OK; ++i) {
+        int slot = BufferQueue::INVALID_BUFFER_SLOT;
+        sp<Fence> fence;
+        status_t result = mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0, 0);
+        if (result < 0) {
+            producerResult = result;
+            break;
+        }
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            producerResult = mProducer->requestBuffer(slot, &buffer);
+            if (producerResult != OK) {
+                break;
+            }
+        }
+        producerResult = mProducer->queueBuffer(slot, input, &output);
+    }
+    producerDone = true;
+    consumer.join();
+    ASSERT_EQ(OK, producerResult);
+
+    // Drain the queue, after which a triple-buffered queue lets the producer
+    // dequeue two buffers at once
+    BufferItem item;
+    while (mConsumer->acquireBuffer(&item, 0) == OK) {
+        ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+                EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    }
+    // With a timeout, a queue that didn't grow fails the second dequeue
+    // instead of blocking
+    ASSERT_EQ(OK, mProducer->setDequeueTimeout(ms2ns(250)));
+    int slots[2] = {};
+    sp<Fence> fence;
+    EXPECT_EQ(OK, mProducer->dequeueBuffer(&slots[0], &fence, 0, 0, 0, 0));
+    EXPECT_EQ(OK, mProducer->dequeueBuffer(&slots[1], &fence, 0, 0, 0, 0));
+
+    String8 dump;
+    mConsumer->dump(dump, "");
+    EXPECT_NE(-1, dump.find("Buffer count tuning: auto"));
+}
+
+// Runs a producer, a consumer and a thread changing the configuration of the
+// BufferQueue at the same time, checking the consistency of the slot lists
+// after every change
+TEST_F(BufferQueueTest, ConcurrentUseKeepsSlotsConsistent) {
+    BufferQueueCore::setConsistencyChecksEnabled(true);
+    const uint32_t errorCountBefore =
+            BufferQueueCore::getConsistencyErrorCount();
+
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    ASSERT_EQ(OK, mConsumer->setMaxAcquiredBufferCount(2));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+
+    const int NUM_FRAMES = 2000;
+    std::atomic<bool> producerDone(false);
+    std::atomic<int> producerErrors(0);
+    std::atomic<int> consumerErrors(0);
+
+    std::thread producer([&]() {
+        IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+                HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+                NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+        for (int i = 0; i < NUM_FRAMES; ++i) {
+            // Reconnecting frees all of the buffers, even the acquired ones
+            if (i % 500 == 499) {
+                mProducer->disconnect(NATIVE_WINDOW_API_CPU);
+                IGraphicBufferProducer::QueueBufferOutput output;
+                if (mProducer->connect(new DummyProducerListener,
+                        NATIVE_WINDOW_API_CPU, false, &output) != OK) {
+                    producerErrors++;
+                    break;
+                }
+            }
+
+            int slot = BufferQueue::INVALID_BUFFER_SLOT;
+            sp<Fence> fence;
+            status_t result = mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0,
+                    GRALLOC_USAGE_SW_READ_OFTEN);
+            if (result == WOULD_BLOCK) {
+                // Possible in async mode while the buffer count shrinks
+                std::this_thread::yield();
+                continue;
+            } else if (result < 0) {
+                producerErrors++;
+                continue;
+            }
+            if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+                sp<GraphicBuffer> buffer;
+                if (mProducer->requestBuffer(slot, &buffer) != OK) {
+                    producerErrors++;
+                    continue;
+                }
+            }
+            if (i % 8 == 7) {
+                result = mProducer->cancelBuffer(slot, Fence::NO_FENCE);
+            } else {
+                result = mProducer->queueBuffer(slot, input, &output);
+            }
+            if (result != OK) {
+                producerErrors++;
+            }
+        }
+        producerDone = true;
+    });
+
+    std::thread consumer([&]() {
+        int numAcquired = 0;
+        while (true) {
+            bool done = producerDone;
+            BufferItem item;
+            status_t result = mConsumer->acquireBuffer(&item, 0);
+            if (result == IGraphicBufferConsumer::NO_BUFFER_AVAILABLE) {
+                if (done) {
+                    break;
+                }
+                std::this_thread::yield();
+                continue;
+            } else if (result != OK) {
+                consumerErrors++;
+                continue;
+            }
+            if (++numAcquired % 16 == 0) {
+                // Detaching an acquired buffer frees its slot. This fails if
+                // the producer reconnected and freed it in the meantime.
+                mConsumer->detachBuffer(item.mSlot);
+                continue;
+            } else {
+                result = mConsumer->releaseBuffer(item.mSlot,
+                        item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                        Fence::NO_FENCE);
+                // The producer may have reconnected in the meantime
+                if (result == IGraphicBufferConsumer::STALE_BUFFER_SLOT) {
+                    result = OK;
+                }
+            }
+            if (result != OK) {
+                consumerErrors++;
+            }
+        }
+    });
+
+    // These may fail depending on what the producer and the consumer are
+    // doing, but must never leave the slots inconsistent
+    for (int i = 0; !producerDone; ++i) {
+        mProducer->setAsyncMode(i % 2 == 1);
+        mProducer->setMaxDequeuedBufferCount(1 + i % 3);
+        mConsumer->setDefaultBufferSize(i % 4 < 2 ? 64 : 32, 64);
+        if (i % 5 == 0) {
+            mConsumer->discardFreeBuffers();
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+
+    producer.join();
+    consumer.join();
+
+    EXPECT_EQ(0, producerErrors);
+    EXPECT_EQ(0, consumerErrors);
+    EXPECT_EQ(errorCountBefore, BufferQueueCore::getConsistencyErrorCount());
+    BufferQueueCore::setConsistencyChecksEnabled(false);
+}
+
+
+// Releases are handed off to the producer without locking mMutex. They must
+// still wake up a producer waiting for a free buffer, and fail like releases
+// under mMutex.
+TEST_F(BufferQueueTest, DeferredReleaseWakesUpWaitingProducer) {
+    createBufferQueue();
+    sp<DummyConsumer> dc(new DummyConsumer);
+    ASSERT_EQ(OK, mConsumer->consumerConnect(dc, false));
+    IGraphicBufferProducer::QueueBufferOutput output;
+    ASSERT_EQ(OK, mProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output));
+    ASSERT_EQ(OK, mProducer->setDequeueTimeout(ms2ns(1000)));
+
+    IGraphicBufferProducer::QueueBufferInput input(0ull, true,
+            HAL_DATASPACE_UNKNOWN, Rect::INVALID_RECT,
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    int slot = BufferQueue::INVALID_BUFFER_SLOT;
+    sp<Fence> fence;
+    sp<GraphicBuffer> buffer;
+
+    // Fill both buffers of the queue, one acquired and one queued
+    BufferItem item;
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION,
+                mProducer->dequeueBuffer(&slot, &fence, 0, 0, 0,
+                GRALLOC_USAGE_SW_READ_OFTEN));
+        ASSERT_EQ(OK, mProducer->requestBuffer(slot, &buffer));
+        ASSERT_EQ(OK, mProducer->queueBuffer(slot, input, &output));
+        if (i == 0) {
+            ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+        }
+    }
+
+    std::atomic<bool> dequeued(false);
+    int dequeuedSlot = BufferQueue::INVALID_BUFFER_SLOT;
+    status_t dequeueResult = NO_INIT;
+    std::thread producer([&]() {
+        sp<Fence> fence;
+        dequeueResult = mProducer->dequeueBuffer(&dequeuedSlot, &fence, 0, 0,
+                0, GRALLOC_USAGE_SW_READ_OFTEN);
+        dequeued = true;
+    });
+
+    // Release the acquired buffer once the producer waits for it
+    std::this_thread::sleep_for(100ms);
+    EXPECT_FALSE(dequeued);
+    ASSERT_EQ(OK, mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+    producer.join();
+    ASSERT_EQ(OK, dequeueResult);
+    ASSERT_EQ(item.mSlot, dequeuedSlot);
+
+    // The buffer was released already
+    ASSERT_EQ(BAD_VALUE, mConsumer->releaseBuffer(item.mSlot,
+            item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+            Fence::NO_FENCE));
+
+    // Reconnecting frees the buffer acquired next
+    ASSERT_EQ(OK, mConsumer->acquireBuffer(&item, 0));
+    ASSERT_EQ(OK, mProducer->disconnect(NATIVE_WINDOW_API_CPU));
+    ASSERT_EQ(IGraphicBufferConsumer::STALE_BUFFER_SLOT,
+            mConsumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+}
+
 } // namespace android
@@ -33,10 +33,14 @@
 #include <utils/Mutex.h>
 #include <utils/Condition.h>
 
+#include <algorithm>
+#include <vector>
+
 #define CPU_CONSUMER_TEST_FORMAT_RAW 0
 #define CPU_CONSUMER_TEST_FORMAT_Y8 0
 #define CPU_CONSUMER_TEST_FORMAT_Y16 0
 #define CPU_CONSUMER_TEST_FORMAT_RGBA_8888 1
+#define CPU_CONSUMER_TEST_FORMAT_YV12 1
 
 namespace android {
 
@@ -689,6 +693,133 @@ TEST_P(CpuConsumerTest, FromCpuLockMax) {
 
 }
 
+// Checks the planes of a locked buffer against the layout of its format
+void checkPlanes(const CpuConsumer::LockedBuffer &buf) {
+    const CpuConsumer::Plane* planes = buf.planes;
+    switch (buf.format) {
+        case HAL_PIXEL_FORMAT_YV12: {
+            // A Y plane followed by a Cr and a Cb plane, whose stride is half
+            // the Y stride aligned to 16 bytes
+            ASSERT_EQ(3u, buf.planeCount);
+            const uint32_t chromaStride = (buf.stride / 2 + 0xf) & ~0xfu;
+            const size_t chromaWidth = (buf.width + 1) / 2;
+            const size_t chromaHeight = (buf.height + 1) / 2;
+            EXPECT_EQ(buf.data, planes[0].data);
+            EXPECT_EQ(buf.stride, planes[0].rowStride);
+            EXPECT_EQ(1u, planes[0].pixelStride);
+            EXPECT_EQ((buf.height - 1) * buf.stride + buf.width,
+                    planes[0].size);
+            EXPECT_EQ(buf.dataCb, planes[1].data);
+            EXPECT_EQ(buf.dataCr, planes[2].data);
+            EXPECT_EQ(buf.data + buf.stride * buf.height, planes[2].data);
+            EXPECT_EQ(planes[2].data + chromaStride * chromaHeight,
+                    planes[1].data);
+            for (size_t i = 1; i < 3; i++) {
+                EXPECT_EQ(chromaStride, planes[i].rowStride);
+                EXPECT_EQ(1u, planes[i].pixelStride);
+                EXPECT_EQ((chromaHeight - 1) * chromaStride + chromaWidth,
+                        planes[i].size);
+            }
+            break;
+        }
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+            ASSERT_EQ(1u, buf.planeCount);
+            EXPECT_EQ(buf.data, planes[0].data);
+            EXPECT_EQ(buf.stride * 4, planes[0].rowStride);
+            EXPECT_EQ(4u, planes[0].pixelStride);
+            EXPECT_EQ(((buf.height - 1) * buf.stride + buf.width) * 4,
+                    planes[0].size);
+            break;
+        default:
+            ASSERT_EQ(1u, buf.planeCount);
+            EXPECT_EQ(buf.data, planes[0].data);
+            break;
+    }
+}
+
+// Produces two rounds of frames and consumes them in batches of up to
+// maxLockedBuffers frames with persistent mappings. The second round reuses
+// the buffers of the first, which have to be mapped at the same address.
+void runPersistentMappingBatched(const sp<CpuConsumer>& cc,
+        const sp<ANativeWindow>& anw, const CpuConsumerTestParams& params) {
+    status_t err;
+
+    // Set up
+
+    cc->setPersistentMappingEnabled(true);
+    const int numInQueue = 5;
+    ASSERT_NO_FATAL_FAILURE(configureANW(anw, params, numInQueue));
+
+    const size_t batchSize = static_cast<size_t>(params.maxLockedBuffers);
+    std::vector<CpuConsumer::LockedBuffer> b(batchSize);
+    std::vector<uint8_t*> mappedData;
+    for (int round = 0; round < 2; round++) {
+
+        // Produce
+
+        uint32_t stride[numInQueue];
+        for (int i = 0; i < numInQueue; i++) {
+            ALOGV("Producing frame %d of round %d", i, round);
+            ASSERT_NO_FATAL_FAILURE(produceOneFrame(anw, params,
+                    round * numInQueue + i + 1, &stride[i]));
+        }
+
+        // Consume
+
+        int consumed = 0;
+        while (consumed < numInQueue) {
+            size_t count = 0;
+            err = cc->lockNextBuffers(b.data(), batchSize, &count);
+            ASSERT_NO_ERROR(err, "lockNextBuffers error: ");
+            ASSERT_LT(0u, count);
+            ASSERT_GE(batchSize, count);
+
+            for (size_t i = 0; i < count; i++, consumed++) {
+                ALOGV("Consuming frame %d of round %d", consumed, round);
+                ASSERT_TRUE(b[i].data != NULL);
+                EXPECT_EQ(params.width,  b[i].width);
+                EXPECT_EQ(params.height, b[i].height);
+                EXPECT_EQ(params.format, b[i].format);
+                EXPECT_EQ(stride[consumed], b[i].stride);
+                EXPECT_EQ(round * numInQueue + consumed + 1, b[i].timestamp);
+                ASSERT_NO_FATAL_FAILURE(checkPlanes(b[i]));
+
+                bool mapped = std::find(mappedData.begin(), mappedData.end(),
+                        b[i].data) != mappedData.end();
+                if (round == 0) {
+                    if (!mapped) {
+                        mappedData.push_back(b[i].data);
+                    }
+                } else {
+                    EXPECT_TRUE(mapped) << "frame " << consumed
+                            << " wasn't mapped where its buffer was before";
+                }
+
+                checkAnyBuffer(b[i], params.format);
+            }
+            for (size_t i = 0; i < count; i++) {
+                err = cc->unlockBuffer(b[i]);
+                ASSERT_NO_ERROR(err, "Could not unlock buffer: ");
+            }
+        }
+    }
+
+    size_t count = 1;
+    EXPECT_EQ(BAD_VALUE, cc->lockNextBuffers(b.data(), batchSize, &count));
+    EXPECT_EQ(0u, count);
+}
+
+TEST_P(CpuConsumerTest, FromCpuPersistentMappingBatched) {
+    runPersistentMappingBatched(mCC, mANW, GetParam());
+}
+
+// The tests of the planes of locked buffers also run with YUV formats
+class CpuConsumerYuvTest : public CpuConsumerTest {};
+
+TEST_P(CpuConsumerYuvTest, FromCpuPersistentMappingBatched) {
+    runPersistentMappingBatched(mCC, mANW, GetParam());
+}
+
 CpuConsumerTestParams y8TestSets[] = {
     { 512,   512, 1, HAL_PIXEL_FORMAT_Y8},
     { 512,   512, 3, HAL_PIXEL_FORMAT_Y8},
@@ -716,6 +847,13 @@ CpuConsumerTestParams rawTestSets[] = {
     { 100,   100, 3, HAL_PIXEL_FORMAT_RAW16},
 };
 
+CpuConsumerTestParams yv12TestSets[] = {
+    { 512,   512, 1, HAL_PIXEL_FORMAT_YV12},
+    { 512,   512, 3, HAL_PIXEL_FORMAT_YV12},
+    { 100,   100, 1, HAL_PIXEL_FORMAT_YV12},
+    { 100,   100, 3, HAL_PIXEL_FORMAT_YV12},
+};
+
 CpuConsumerTestParams rgba8888TestSets[] = {
     { 512,   512, 1, HAL_PIXEL_FORMAT_RGBA_8888},
     { 512,   512, 3, HAL_PIXEL_FORMAT_RGBA_8888},
@@ -749,6 +887,12 @@ INSTANTIATE_TEST_CASE_P(Rgba8888Tests,
         ::testing::ValuesIn(rgba8888TestSets));
 #endif
 
+#if CPU_CONSUMER_TEST_FORMAT_YV12
+INSTANTIATE_TEST_CASE_P(Yv12Tests,
+        CpuConsumerYuvTest,
+        ::testing::ValuesIn(yv12TestSets));
+#endif
+
 
 
 } // namespace android
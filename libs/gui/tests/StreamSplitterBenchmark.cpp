@@ -0,0 +1,427 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Splits a stream to one to four outputs with StreamSplitter, with and
+ * without persistent slots, and reports the calls the splitter makes to the
+ * input and output queues per frame - each of which is a binder transaction
+ * when the queues live in other processes - along with the latency
+ * percentiles of a frame, from queueing it to the input to the last output
+ * releasing it.
+ *
+ * usage: libgui_stream_splitter_benchmark [-i frames] [-s]
+ *   -i  the number of frames per configuration (default 2000)
+ *   -s  use shared memory buffers even if there is a gralloc module
+ */
+
+#define LOG_TAG "StreamSplitterBenchmark"
+
+#include "BenchmarkLatencies.h"
+#include "DummyConsumer.h"
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/GraphicBufferAlloc.h>
+#include <gui/IGraphicBufferConsumer.h>
+#include <gui/IGraphicBufferProducer.h>
+#include <gui/StreamSplitter.h>
+
+#include <ui/Gralloc1.h>
+
+#include <utils/Timers.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace android;
+
+static const uint32_t WIDTH = 1280;
+static const uint32_t HEIGHT = 720;
+static const int MAX_OUTPUTS = 4;
+// Frames run before measuring, which attach the buffers
+static const int WARMUP_FRAMES = 10;
+
+// CountingProducer forwards to an output queue, counting the calls
+class CountingProducer : public IGraphicBufferProducer {
+public:
+    explicit CountingProducer(const sp<IGraphicBufferProducer>& producer)
+      : mProducer(producer), mCalls(0) {}
+
+    uint64_t getCalls() const { return mCalls; }
+
+    virtual status_t requestBuffer(int slot, sp<GraphicBuffer>* buf) {
+        ++mCalls;
+        return mProducer->requestBuffer(slot, buf);
+    }
+    virtual status_t setMaxDequeuedBufferCount(int maxDequeuedBuffers) {
+        ++mCalls;
+        return mProducer->setMaxDequeuedBufferCount(maxDequeuedBuffers);
+    }
+    virtual status_t setAsyncMode(bool async) {
+        ++mCalls;
+        return mProducer->setAsyncMode(async);
+    }
+    virtual status_t dequeueBuffer(int* slot, sp<Fence>* fence, uint32_t w,
+            uint32_t h, PixelFormat format, uint32_t usage) {
+        ++mCalls;
+        return mProducer->dequeueBuffer(slot, fence, w, h, format, usage);
+    }
+    virtual status_t detachBuffer(int slot) {
+        ++mCalls;
+        return mProducer->detachBuffer(slot);
+    }
+    virtual status_t detachNextBuffer(sp<GraphicBuffer>* outBuffer,
+            sp<Fence>* outFence) {
+        ++mCalls;
+        return mProducer->detachNextBuffer(outBuffer, outFence);
+    }
+    virtual status_t attachBuffer(int* outSlot,
+            const sp<GraphicBuffer>& buffer) {
+        ++mCalls;
+        return mProducer->attachBuffer(outSlot, buffer);
+    }
+    virtual status_t queueBuffer(int slot, const QueueBufferInput& input,
+            QueueBufferOutput* output) {
+        ++mCalls;
+        return mProducer->queueBuffer(slot, input, output);
+    }
+    virtual status_t cancelBuffer(int slot, const sp<Fence>& fence) {
+        ++mCalls;
+        return mProducer->cancelBuffer(slot, fence);
+    }
+    virtual int query(int what, int* value) {
+        ++mCalls;
+        return mProducer->query(what, value);
+    }
+    virtual status_t connect(const sp<IProducerListener>& listener, int api,
+            bool producerControlledByApp, QueueBufferOutput* output) {
+        ++mCalls;
+        return mProducer->connect(listener, api, producerControlledByApp,
+                output);
+    }
+    virtual status_t disconnect(int api, DisconnectMode mode) {
+        ++mCalls;
+        return mProducer->disconnect(api, mode);
+    }
+    virtual status_t setSidebandStream(const sp<NativeHandle>& stream) {
+        ++mCalls;
+        return mProducer->setSidebandStream(stream);
+    }
+    virtual void allocateBuffers(uint32_t width, uint32_t height,
+            PixelFormat format, uint32_t usage) {
+        ++mCalls;
+        mProducer->allocateBuffers(width, height, format, usage);
+    }
+    virtual status_t allowAllocation(bool allow) {
+        ++mCalls;
+        return mProducer->allowAllocation(allow);
+    }
+    virtual status_t setGenerationNumber(uint32_t generationNumber) {
+        ++mCalls;
+        return mProducer->setGenerationNumber(generationNumber);
+    }
+    virtual String8 getConsumerName() const {
+        return mProducer->getConsumerName();
+    }
+    virtual status_t setSharedBufferMode(bool sharedBufferMode) {
+        ++mCalls;
+        return mProducer->setSharedBufferMode(sharedBufferMode);
+    }
+    virtual status_t setAutoRefresh(bool autoRefresh) {
+        ++mCalls;
+        return mProducer->setAutoRefresh(autoRefresh);
+    }
+    virtual status_t setDequeueTimeout(nsecs_t timeout) {
+        ++mCalls;
+        return mProducer->setDequeueTimeout(timeout);
+    }
+    virtual status_t getLastQueuedBuffer(sp<GraphicBuffer>* outBuffer,
+            sp<Fence>* outFence, float outTransformMatrix[16]) {
+        ++mCalls;
+        return mProducer->getLastQueuedBuffer(outBuffer, outFence,
+                outTransformMatrix);
+    }
+    virtual status_t getUniqueId(uint64_t* outId) const {
+        return mProducer->getUniqueId(outId);
+    }
+    virtual status_t setPredictiveAllocation(bool enabled) {
+        ++mCalls;
+        return mProducer->setPredictiveAllocation(enabled);
+    }
+    virtual status_t reclaimNextBuffer(int* outSlot, sp<Fence>* outFence) {
+        ++mCalls;
+        return mProducer->reclaimNextBuffer(outSlot, outFence);
+    }
+
+protected:
+    virtual IBinder* onAsBinder() {
+        return IInterface::asBinder(mProducer).get();
+    }
+
+private:
+    sp<IGraphicBufferProducer> mProducer;
+    uint64_t mCalls;
+};
+
+// CountingConsumer forwards to the input queue, counting the calls
+class CountingConsumer : public IGraphicBufferConsumer {
+public:
+    explicit CountingConsumer(const sp<IGraphicBufferConsumer>& consumer)
+      : mConsumer(consumer), mCalls(0) {}
+
+    uint64_t getCalls() const { return mCalls; }
+
+    virtual status_t acquireBuffer(BufferItem* buffer, nsecs_t presentWhen,
+            uint64_t maxFrameNumber) {
+        ++mCalls;
+        return mConsumer->acquireBuffer(buffer, presentWhen, maxFrameNumber);
+    }
+    virtual status_t detachBuffer(int slot) {
+        ++mCalls;
+        return mConsumer->detachBuffer(slot);
+    }
+    virtual status_t attachBuffer(int* outSlot,
+            const sp<GraphicBuffer>& buffer) {
+        ++mCalls;
+        return mConsumer->attachBuffer(outSlot, buffer);
+    }
+    virtual status_t releaseBuffer(int buf, uint64_t frameNumber,
+            EGLDisplay display, EGLSyncKHR fence,
+            const sp<Fence>& releaseFence) {
+        ++mCalls;
+        return mConsumer->releaseBuffer(buf, frameNumber, display, fence,
+                releaseFence);
+    }
+    virtual status_t consumerConnect(const sp<IConsumerListener>& consumer,
+            bool controlledByApp) {
+        ++mCalls;
+        return mConsumer->consumerConnect(consumer, controlledByApp);
+    }
+    virtual status_t consumerDisconnect() {
+        ++mCalls;
+        return mConsumer->consumerDisconnect();
+    }
+    virtual status_t getReleasedBuffers(uint64_t* slotMask) {
+        ++mCalls;
+        return mConsumer->getReleasedBuffers(slotMask);
+    }
+    virtual status_t setDefaultBufferSize(uint32_t w, uint32_t h) {
+        ++mCalls;
+        return mConsumer->setDefaultBufferSize(w, h);
+    }
+    virtual status_t setMaxBufferCount(int bufferCount) {
+        ++mCalls;
+        return mConsumer->setMaxBufferCount(bufferCount);
+    }
+    virtual status_t setMaxAcquiredBufferCount(int maxAcquiredBuffers) {
+        ++mCalls;
+        return mConsumer->setMaxAcquiredBufferCount(maxAcquiredBuffers);
+    }
+    virtual void setConsumerName(const String8& name) {
+        ++mCalls;
+        mConsumer->setConsumerName(name);
+    }
+    virtual status_t setDefaultBufferFormat(PixelFormat defaultFormat) {
+        ++mCalls;
+        return mConsumer->setDefaultBufferFormat(defaultFormat);
+    }
+    virtual status_t setDefaultBufferDataSpace(
+            android_dataspace defaultDataSpace) {
+        ++mCalls;
+        return mConsumer->setDefaultBufferDataSpace(defaultDataSpace);
+    }
+    virtual status_t setConsumerUsageBits(uint32_t usage) {
+        ++mCalls;
+        return mConsumer->setConsumerUsageBits(usage);
+    }
+    virtual status_t setTransformHint(uint32_t hint) {
+        ++mCalls;
+        return mConsumer->setTransformHint(hint);
+    }
+    virtual sp<NativeHandle> getSidebandStream() const {
+        return mConsumer->getSidebandStream();
+    }
+    virtual status_t getOccupancyHistory(bool forceFlush,
+            std::vector<OccupancyTracker::Segment>* outHistory) {
+        ++mCalls;
+        return mConsumer->getOccupancyHistory(forceFlush, outHistory);
+    }
+    virtual status_t discardFreeBuffers() {
+        ++mCalls;
+        return mConsumer->discardFreeBuffers();
+    }
+    virtual status_t setBufferCountTuning(int mode) {
+        ++mCalls;
+        return mConsumer->setBufferCountTuning(mode);
+    }
+    virtual void dump(String8& result, const char* prefix) const {
+        mConsumer->dump(result, prefix);
+    }
+
+protected:
+    virtual IBinder* onAsBinder() {
+        return IInterface::asBinder(mConsumer).get();
+    }
+
+private:
+    sp<IGraphicBufferConsumer> mConsumer;
+    uint64_t mCalls;
+};
+
+static bool runConfig(int numOutputs, bool persistentSlots, int numFrames) {
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer,
+            new GraphicBufferAlloc());
+    inputConsumer->setDefaultBufferSize(WIDTH, HEIGHT);
+    sp<CountingConsumer> input(new CountingConsumer(inputConsumer));
+
+    sp<StreamSplitter> splitter;
+    if (StreamSplitter::createSplitter(input, &splitter) != NO_ERROR ||
+            splitter->setPersistentSlotsEnabled(persistentSlots) !=
+                    NO_ERROR) {
+        fprintf(stderr, "failed to create the splitter\n");
+        return false;
+    }
+
+    sp<CountingProducer> outputs[MAX_OUTPUTS];
+    sp<IGraphicBufferConsumer> outputConsumers[MAX_OUTPUTS];
+    for (int output = 0; output < numOutputs; ++output) {
+        sp<IGraphicBufferProducer> outputProducer;
+        BufferQueue::createBufferQueue(&outputProducer,
+                &outputConsumers[output], new GraphicBufferAlloc());
+        outputs[output] = new CountingProducer(outputProducer);
+        if (outputConsumers[output]->consumerConnect(new DummyConsumer,
+                false) != NO_ERROR ||
+                splitter->addOutput(outputs[output]) != NO_ERROR) {
+            fprintf(stderr, "failed to add an output\n");
+            return false;
+        }
+    }
+
+    IGraphicBufferProducer::QueueBufferOutput output;
+    if (inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &output) != NO_ERROR) {
+        fprintf(stderr, "failed to connect to the input\n");
+        return false;
+    }
+    IGraphicBufferProducer::QueueBufferInput queueInput(0, false,
+            HAL_DATASPACE_UNKNOWN, Rect(WIDTH, HEIGHT),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+
+    Latencies latencies;
+    uint64_t startInputCalls = 0;
+    uint64_t startOutputCalls = 0;
+    for (int frame = -WARMUP_FRAMES; frame < numFrames; frame++) {
+        if (frame == 0) {
+            startInputCalls = input->getCalls();
+            for (int i = 0; i < numOutputs; ++i) {
+                startOutputCalls += outputs[i]->getCalls();
+            }
+        }
+
+        int slot;
+        sp<Fence> fence;
+        status_t result = inputProducer->dequeueBuffer(&slot, &fence, 0, 0,
+                0, GRALLOC_USAGE_SW_WRITE_OFTEN);
+        if (result < 0) {
+            fprintf(stderr, "dequeueBuffer failed: %d\n", result);
+            return false;
+        }
+        if (result & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            sp<GraphicBuffer> buffer;
+            inputProducer->requestBuffer(slot, &buffer);
+        }
+
+        // The splitter queues the frame to the outputs from queueBuffer, and
+        // releases it to the input from the last releaseBuffer
+        nsecs_t start = systemTime();
+        result = inputProducer->queueBuffer(slot, queueInput, &output);
+        if (result != NO_ERROR) {
+            fprintf(stderr, "queueBuffer failed: %d\n", result);
+            return false;
+        }
+        for (int i = 0; i < numOutputs; ++i) {
+            BufferItem item;
+            result = outputConsumers[i]->acquireBuffer(&item, 0);
+            if (result != NO_ERROR) {
+                fprintf(stderr, "acquireBuffer failed: %d\n", result);
+                return false;
+            }
+            outputConsumers[i]->releaseBuffer(item.mSlot, item.mFrameNumber,
+                    EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+        }
+        nsecs_t end = systemTime();
+        if (frame >= 0) {
+            latencies.add(end - start);
+        }
+    }
+
+    uint64_t inputCalls = input->getCalls() - startInputCalls;
+    uint64_t outputCalls = 0;
+    for (int i = 0; i < numOutputs; ++i) {
+        outputCalls += outputs[i]->getCalls();
+    }
+    outputCalls -= startOutputCalls;
+    printf("%d output%s, %s: calls per frame: input %.2f, outputs %.2f\n",
+            numOutputs, numOutputs > 1 ? "s" : "",
+            persistentSlots ? "persistent slots" : "attach/detach",
+            static_cast<double>(inputCalls) / numFrames,
+            static_cast<double>(outputCalls) / numFrames);
+    latencies.print("frame");
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int numFrames = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:s")) != -1) {
+        switch (opt) {
+            case 'i':
+                numFrames = atoi(optarg);
+                break;
+            case 's':
+                Gralloc1::Loader::useHeapDevice();
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i frames] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (numFrames <= 0) {
+        fprintf(stderr, "invalid number of frames\n");
+        return 1;
+    }
+
+    printf("%ux%u buffers, %d frames per configuration, latencies in us\n",
+            WIDTH, HEIGHT, numFrames);
+
+    bool success = true;
+    for (int numOutputs = 1; numOutputs <= MAX_OUTPUTS; ++numOutputs) {
+        for (bool persistentSlots : { false, true }) {
+            if (!runConfig(numOutputs, persistentSlots, numFrames)) {
+                fprintf(stderr, "%d outputs, %s: failed\n", numOutputs,
+                        persistentSlots ? "persistent slots" :
+                                "attach/detach");
+                success = false;
+            }
+        }
+    }
+    return success ? 0 : 1;
+}
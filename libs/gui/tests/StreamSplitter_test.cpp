@@ -54,6 +54,276 @@ struct DummyListener : public BnConsumerListener {
 
 static const uint32_t TEST_DATA = 0x12345678u;
 
+// DeferringConsumer forwards to the input queue, and can hold back the
+// onBuffersReleased callbacks to the splitter, as if they were still on their
+// way when the splitter releases the freed buffers
+class DeferringConsumer : public IGraphicBufferConsumer {
+public:
+    explicit DeferringConsumer(const sp<IGraphicBufferConsumer>& consumer)
+      : mConsumer(consumer), mListener(new DeferringListener) {}
+
+    // Delivers the callbacks held back so far once deferring is disabled
+    void setDeferring(bool deferring) { mListener->setDeferring(deferring); }
+
+    virtual status_t acquireBuffer(BufferItem* buffer, nsecs_t presentWhen,
+            uint64_t maxFrameNumber) {
+        return mConsumer->acquireBuffer(buffer, presentWhen, maxFrameNumber);
+    }
+    virtual status_t detachBuffer(int slot) {
+        return mConsumer->detachBuffer(slot);
+    }
+    virtual status_t attachBuffer(int* outSlot,
+            const sp<GraphicBuffer>& buffer) {
+        return mConsumer->attachBuffer(outSlot, buffer);
+    }
+    virtual status_t releaseBuffer(int buf, uint64_t frameNumber,
+            EGLDisplay display, EGLSyncKHR fence,
+            const sp<Fence>& releaseFence) {
+        return mConsumer->releaseBuffer(buf, frameNumber, display, fence,
+                releaseFence);
+    }
+    virtual status_t consumerConnect(const sp<IConsumerListener>& consumer,
+            bool controlledByApp) {
+        mListener->setListener(consumer);
+        return mConsumer->consumerConnect(mListener, controlledByApp);
+    }
+    virtual status_t consumerDisconnect() {
+        return mConsumer->consumerDisconnect();
+    }
+    virtual status_t getReleasedBuffers(uint64_t* slotMask) {
+        return mConsumer->getReleasedBuffers(slotMask);
+    }
+    virtual status_t setDefaultBufferSize(uint32_t w, uint32_t h) {
+        return mConsumer->setDefaultBufferSize(w, h);
+    }
+    virtual status_t setMaxBufferCount(int bufferCount) {
+        return mConsumer->setMaxBufferCount(bufferCount);
+    }
+    virtual status_t setMaxAcquiredBufferCount(int maxAcquiredBuffers) {
+        return mConsumer->setMaxAcquiredBufferCount(maxAcquiredBuffers);
+    }
+    virtual void setConsumerName(const String8& name) {
+        mConsumer->setConsumerName(name);
+    }
+    virtual status_t setDefaultBufferFormat(PixelFormat defaultFormat) {
+        return mConsumer->setDefaultBufferFormat(defaultFormat);
+    }
+    virtual status_t setDefaultBufferDataSpace(
+            android_dataspace defaultDataSpace) {
+        return mConsumer->setDefaultBufferDataSpace(defaultDataSpace);
+    }
+    virtual status_t setConsumerUsageBits(uint32_t usage) {
+        return mConsumer->setConsumerUsageBits(usage);
+    }
+    virtual status_t setTransformHint(uint32_t hint) {
+        return mConsumer->setTransformHint(hint);
+    }
+    virtual sp<NativeHandle> getSidebandStream() const {
+        return mConsumer->getSidebandStream();
+    }
+    virtual status_t getOccupancyHistory(bool forceFlush,
+            std::vector<OccupancyTracker::Segment>* outHistory) {
+        return mConsumer->getOccupancyHistory(forceFlush, outHistory);
+    }
+    virtual status_t discardFreeBuffers() {
+        return mConsumer->discardFreeBuffers();
+    }
+    virtual status_t setBufferCountTuning(int mode) {
+        return mConsumer->setBufferCountTuning(mode);
+    }
+    virtual void dump(String8& result, const char* prefix) const {
+        mConsumer->dump(result, prefix);
+    }
+
+protected:
+    virtual IBinder* onAsBinder() {
+        return IInterface::asBinder(mConsumer).get();
+    }
+
+private:
+    class DeferringListener : public BnConsumerListener {
+    public:
+        DeferringListener() : mDeferring(false), mDeferred(false) {}
+
+        void setListener(const sp<IConsumerListener>& listener) {
+            mListener = listener;
+        }
+
+        void setDeferring(bool deferring) {
+            mDeferring = deferring;
+            if (!mDeferring && mDeferred) {
+                mDeferred = false;
+                mListener->onBuffersReleased();
+            }
+        }
+
+        virtual void onFrameAvailable(const BufferItem& item) {
+            mListener->onFrameAvailable(item);
+        }
+        virtual void onFrameReplaced(const BufferItem& item) {
+            mListener->onFrameReplaced(item);
+        }
+        virtual void onBuffersReleased() {
+            if (mDeferring) {
+                mDeferred = true;
+            } else {
+                mListener->onBuffersReleased();
+            }
+        }
+        virtual void onSidebandStreamChanged() {
+            mListener->onSidebandStreamChanged();
+        }
+
+    private:
+        sp<IConsumerListener> mListener;
+        bool mDeferring;
+        bool mDeferred;
+    };
+
+    sp<IGraphicBufferConsumer> mConsumer;
+    sp<DeferringListener> mListener;
+};
+
+// LegacyProducer forwards to an output queue, but predates
+// IGraphicBufferProducer::reclaimNextBuffer, so the splitter has to detach the
+// released buffers from it
+class LegacyProducer : public IGraphicBufferProducer {
+public:
+    explicit LegacyProducer(const sp<IGraphicBufferProducer>& producer)
+      : mProducer(producer) {}
+
+    virtual status_t requestBuffer(int slot, sp<GraphicBuffer>* buf) {
+        return mProducer->requestBuffer(slot, buf);
+    }
+    virtual status_t setMaxDequeuedBufferCount(int maxDequeuedBuffers) {
+        return mProducer->setMaxDequeuedBufferCount(maxDequeuedBuffers);
+    }
+    virtual status_t setAsyncMode(bool async) {
+        return mProducer->setAsyncMode(async);
+    }
+    virtual status_t dequeueBuffer(int* slot, sp<Fence>* fence, uint32_t w,
+            uint32_t h, PixelFormat format, uint32_t usage) {
+        return mProducer->dequeueBuffer(slot, fence, w, h, format, usage);
+    }
+    virtual status_t detachBuffer(int slot) {
+        return mProducer->detachBuffer(slot);
+    }
+    virtual status_t detachNextBuffer(sp<GraphicBuffer>* outBuffer,
+            sp<Fence>* outFence) {
+        return mProducer->detachNextBuffer(outBuffer, outFence);
+    }
+    virtual status_t attachBuffer(int* outSlot,
+            const sp<GraphicBuffer>& buffer) {
+        return mProducer->attachBuffer(outSlot, buffer);
+    }
+    virtual status_t queueBuffer(int slot, const QueueBufferInput& input,
+            QueueBufferOutput* output) {
+        return mProducer->queueBuffer(slot, input, output);
+    }
+    virtual status_t cancelBuffer(int slot, const sp<Fence>& fence) {
+        return mProducer->cancelBuffer(slot, fence);
+    }
+    virtual int query(int what, int* value) {
+        return mProducer->query(what, value);
+    }
+    virtual status_t connect(const sp<IProducerListener>& listener, int api,
+            bool producerControlledByApp, QueueBufferOutput* output) {
+        return mProducer->connect(listener, api, producerControlledByApp,
+                output);
+    }
+    virtual status_t disconnect(int api, DisconnectMode mode) {
+        return mProducer->disconnect(api, mode);
+    }
+    virtual status_t setSidebandStream(const sp<NativeHandle>& stream) {
+        return mProducer->setSidebandStream(stream);
+    }
+    virtual void allocateBuffers(uint32_t width, uint32_t height,
+            PixelFormat format, uint32_t usage) {
+        mProducer->allocateBuffers(width, height, format, usage);
+    }
+    virtual status_t allowAllocation(bool allow) {
+        return mProducer->allowAllocation(allow);
+    }
+    virtual status_t setGenerationNumber(uint32_t generationNumber) {
+        return mProducer->setGenerationNumber(generationNumber);
+    }
+    virtual String8 getConsumerName() const {
+        return mProducer->getConsumerName();
+    }
+    virtual status_t setSharedBufferMode(bool sharedBufferMode) {
+        return mProducer->setSharedBufferMode(sharedBufferMode);
+    }
+    virtual status_t setAutoRefresh(bool autoRefresh) {
+        return mProducer->setAutoRefresh(autoRefresh);
+    }
+    virtual status_t setDequeueTimeout(nsecs_t timeout) {
+        return mProducer->setDequeueTimeout(timeout);
+    }
+    virtual status_t getLastQueuedBuffer(sp<GraphicBuffer>* outBuffer,
+            sp<Fence>* outFence, float outTransformMatrix[16]) {
+        return mProducer->getLastQueuedBuffer(outBuffer, outFence,
+                outTransformMatrix);
+    }
+    virtual status_t getUniqueId(uint64_t* outId) const {
+        return mProducer->getUniqueId(outId);
+    }
+
+protected:
+    virtual IBinder* onAsBinder() {
+        return IInterface::asBinder(mProducer).get();
+    }
+
+private:
+    sp<IGraphicBufferProducer> mProducer;
+};
+
+// Dequeues a buffer from the input, writes data to it and queues it
+static void queueInputFrame(const sp<IGraphicBufferProducer>& producer,
+        uint32_t data) {
+    int slot;
+    sp<Fence> fence;
+    ASSERT_GE(producer->dequeueBuffer(&slot, &fence, 0, 0, 0,
+            GRALLOC_USAGE_SW_WRITE_OFTEN), 0);
+    sp<GraphicBuffer> buffer;
+    ASSERT_EQ(OK, producer->requestBuffer(slot, &buffer));
+
+    uint32_t* dataIn;
+    ASSERT_EQ(OK, buffer->lock(GraphicBuffer::USAGE_SW_WRITE_OFTEN,
+            reinterpret_cast<void**>(&dataIn)));
+    *dataIn = data;
+    ASSERT_EQ(OK, buffer->unlock());
+
+    IGraphicBufferProducer::QueueBufferInput qbInput(0, false,
+            HAL_DATASPACE_UNKNOWN, Rect(0, 0, 1, 1),
+            NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, producer->queueBuffer(slot, qbInput, &qbOutput));
+}
+
+// Acquires the next frame of an output and checks its data. buffers holds the
+// buffers the output sent so far, by slot.
+static void acquireOutputFrame(const sp<IGraphicBufferConsumer>& consumer,
+        sp<GraphicBuffer>* buffers, uint32_t data, BufferItem* outItem) {
+    ASSERT_EQ(OK, consumer->acquireBuffer(outItem, 0));
+    if (outItem->mGraphicBuffer != NULL) {
+        buffers[outItem->mSlot] = outItem->mGraphicBuffer;
+    }
+    const sp<GraphicBuffer>& buffer(buffers[outItem->mSlot]);
+    ASSERT_TRUE(buffer != NULL);
+
+    uint32_t* dataOut;
+    ASSERT_EQ(OK, buffer->lock(GraphicBuffer::USAGE_SW_READ_OFTEN,
+            reinterpret_cast<void**>(&dataOut)));
+    ASSERT_EQ(data, *dataOut);
+    ASSERT_EQ(OK, buffer->unlock());
+}
+
+static void releaseOutputFrame(const sp<IGraphicBufferConsumer>& consumer,
+        const BufferItem& item) {
+    ASSERT_EQ(OK, consumer->releaseBuffer(item.mSlot, item.mFrameNumber,
+            EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE));
+}
+
 TEST_F(StreamSplitterTest, OneInputOneOutput) {
     sp<IGraphicBufferProducer> inputProducer;
     sp<IGraphicBufferConsumer> inputConsumer;
@@ -193,6 +463,278 @@ TEST_F(StreamSplitterTest, OneInputMultipleOutputs) {
                     GRALLOC_USAGE_SW_WRITE_OFTEN));
 }
 
+TEST_F(StreamSplitterTest, PersistentSlotsOneInputMultipleOutputs) {
+    const int NUM_OUTPUTS = 2;
+    const uint32_t NUM_FRAMES = 8;
+
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer);
+
+    sp<IGraphicBufferProducer> outputProducers[NUM_OUTPUTS] = {};
+    sp<IGraphicBufferConsumer> outputConsumers[NUM_OUTPUTS] = {};
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        BufferQueue::createBufferQueue(&outputProducers[output],
+                &outputConsumers[output]);
+        ASSERT_EQ(OK, outputConsumers[output]->consumerConnect(
+                    new DummyListener, false));
+    }
+
+    sp<StreamSplitter> splitter;
+    status_t status = StreamSplitter::createSplitter(inputConsumer, &splitter);
+    ASSERT_EQ(OK, status);
+    ASSERT_EQ(OK, splitter->setPersistentSlotsEnabled(true));
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        ASSERT_EQ(OK, splitter->addOutput(outputProducers[output]));
+
+        // Never allow the output BufferQueues to allocate a buffer
+        ASSERT_EQ(OK, outputProducers[output]->allowAllocation(false));
+    }
+    ASSERT_EQ(INVALID_OPERATION, splitter->setPersistentSlotsEnabled(false));
+
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+
+    sp<GraphicBuffer> inputBuffers[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    sp<GraphicBuffer> outputBuffers[NUM_OUTPUTS]
+            [BufferQueueDefs::NUM_BUFFER_SLOTS];
+    int numAllocations = 0;
+    int numBuffersSent[NUM_OUTPUTS] = {};
+    for (uint32_t frame = 0; frame < NUM_FRAMES; ++frame) {
+        int slot;
+        sp<Fence> fence;
+        status = inputProducer->dequeueBuffer(&slot, &fence, 0, 0, 0,
+                GRALLOC_USAGE_SW_WRITE_OFTEN);
+        ASSERT_GE(status, 0);
+        if (status & IGraphicBufferProducer::BUFFER_NEEDS_REALLOCATION) {
+            ASSERT_EQ(OK, inputProducer->requestBuffer(slot,
+                    &inputBuffers[slot]));
+            ++numAllocations;
+        }
+
+        uint32_t* dataIn;
+        ASSERT_EQ(OK, inputBuffers[slot]->lock(
+                GraphicBuffer::USAGE_SW_WRITE_OFTEN,
+                reinterpret_cast<void**>(&dataIn)));
+        *dataIn = TEST_DATA + frame;
+        ASSERT_EQ(OK, inputBuffers[slot]->unlock());
+
+        IGraphicBufferProducer::QueueBufferInput qbInput(0, false,
+                HAL_DATASPACE_UNKNOWN, Rect(0, 0, 1, 1),
+                NATIVE_WINDOW_SCALING_MODE_FREEZE, 0, Fence::NO_FENCE);
+        ASSERT_EQ(OK, inputProducer->queueBuffer(slot, qbInput, &qbOutput));
+
+        for (int output = 0; output < NUM_OUTPUTS; ++output) {
+            BufferItem item;
+            ASSERT_EQ(OK, outputConsumers[output]->acquireBuffer(&item, 0));
+            if (item.mGraphicBuffer != NULL) {
+                outputBuffers[output][item.mSlot] = item.mGraphicBuffer;
+                ++numBuffersSent[output];
+            }
+            const sp<GraphicBuffer>& buffer(outputBuffers[output][item.mSlot]);
+            ASSERT_TRUE(buffer != NULL);
+
+            uint32_t* dataOut;
+            ASSERT_EQ(OK, buffer->lock(GraphicBuffer::USAGE_SW_READ_OFTEN,
+                    reinterpret_cast<void**>(&dataOut)));
+            ASSERT_EQ(TEST_DATA + frame, *dataOut);
+            ASSERT_EQ(OK, buffer->unlock());
+
+            ASSERT_EQ(OK, outputConsumers[output]->releaseBuffer(item.mSlot,
+                    item.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                    Fence::NO_FENCE));
+        }
+    }
+
+    // Each buffer was only attached to, and sent by, each output once
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        ASSERT_EQ(numAllocations, numBuffersSent[output]);
+    }
+}
+
+TEST_F(StreamSplitterTest, PersistentSlotsOutputWithoutReclaim) {
+    const uint32_t NUM_FRAMES = 8;
+
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer);
+
+    sp<IGraphicBufferProducer> outputProducer;
+    sp<IGraphicBufferConsumer> outputConsumer;
+    BufferQueue::createBufferQueue(&outputProducer, &outputConsumer);
+    ASSERT_EQ(OK, outputConsumer->consumerConnect(new DummyListener, false));
+
+    sp<IGraphicBufferProducer> legacyOutputProducer;
+    sp<IGraphicBufferConsumer> legacyOutputConsumer;
+    BufferQueue::createBufferQueue(&legacyOutputProducer,
+            &legacyOutputConsumer);
+    ASSERT_EQ(OK, legacyOutputConsumer->consumerConnect(new DummyListener,
+            false));
+
+    sp<StreamSplitter> splitter;
+    status_t status = StreamSplitter::createSplitter(inputConsumer, &splitter);
+    ASSERT_EQ(OK, status);
+    ASSERT_EQ(OK, splitter->setPersistentSlotsEnabled(true));
+    ASSERT_EQ(OK, splitter->addOutput(outputProducer));
+    ASSERT_EQ(OK, splitter->addOutput(new LegacyProducer(
+            legacyOutputProducer)));
+
+    // Never allow the output BufferQueues to allocate a buffer
+    ASSERT_EQ(OK, outputProducer->allowAllocation(false));
+    ASSERT_EQ(OK, legacyOutputProducer->allowAllocation(false));
+
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+
+    sp<GraphicBuffer> outputBuffers[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    sp<GraphicBuffer> legacyOutputBuffers[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    int numBuffersSent = 0;
+    int numLegacyBuffersSent = 0;
+    for (uint32_t frame = 0; frame < NUM_FRAMES; ++frame) {
+        ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer,
+                TEST_DATA + frame));
+
+        BufferItem item;
+        ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(outputConsumer,
+                outputBuffers, TEST_DATA + frame, &item));
+        if (item.mGraphicBuffer != NULL) {
+            ++numBuffersSent;
+        }
+        ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumer, item));
+
+        ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(legacyOutputConsumer,
+                legacyOutputBuffers, TEST_DATA + frame, &item));
+        if (item.mGraphicBuffer != NULL) {
+            ++numLegacyBuffersSent;
+        }
+        ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(legacyOutputConsumer,
+                item));
+    }
+
+    // The output that reclaims its buffers keeps them in their slots, while
+    // every frame is attached to the other one again
+    ASSERT_LT(numBuffersSent, static_cast<int>(NUM_FRAMES));
+    ASSERT_EQ(static_cast<int>(NUM_FRAMES), numLegacyBuffersSent);
+}
+
+TEST_F(StreamSplitterTest, PersistentSlotsRetireBuffersFreedByInput) {
+    const int NUM_OUTPUTS = 2;
+
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer);
+
+    sp<IGraphicBufferProducer> outputProducers[NUM_OUTPUTS] = {};
+    sp<IGraphicBufferConsumer> outputConsumers[NUM_OUTPUTS] = {};
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        BufferQueue::createBufferQueue(&outputProducers[output],
+                &outputConsumers[output]);
+        ASSERT_EQ(OK, outputConsumers[output]->consumerConnect(
+                    new DummyListener, false));
+    }
+
+    sp<StreamSplitter> splitter;
+    ASSERT_EQ(OK, StreamSplitter::createSplitter(inputConsumer, &splitter));
+    ASSERT_EQ(OK, splitter->setPersistentSlotsEnabled(true));
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        ASSERT_EQ(OK, splitter->addOutput(outputProducers[output]));
+        ASSERT_EQ(OK, outputProducers[output]->allowAllocation(false));
+    }
+
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+
+    sp<GraphicBuffer> outputBuffers[NUM_OUTPUTS]
+            [BufferQueueDefs::NUM_BUFFER_SLOTS];
+    BufferItem items[NUM_OUTPUTS];
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA));
+    for (int output = 0; output < NUM_OUTPUTS; ++output) {
+        ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(outputConsumers[output],
+                outputBuffers[output], TEST_DATA, &items[output]));
+    }
+    const uint64_t retiredId = items[0].mGraphicBuffer->getId();
+
+    // Disconnecting frees the buffers of the input. The splitter detaches the
+    // buffer from the first output, which released it, and retires it until
+    // the second output releases it too.
+    ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumers[0], items[0]));
+    ASSERT_EQ(OK, inputProducer->disconnect(NATIVE_WINDOW_API_CPU));
+    ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumers[1], items[1]));
+
+    // The retired buffer is no longer outstanding, otherwise queueing the
+    // second frame would block, and both outputs get the new buffers
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA + 1));
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA + 2));
+    for (uint32_t frame = 1; frame <= 2; ++frame) {
+        for (int output = 0; output < NUM_OUTPUTS; ++output) {
+            BufferItem item;
+            ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(outputConsumers[output],
+                    outputBuffers[output], TEST_DATA + frame, &item));
+            ASSERT_TRUE(item.mGraphicBuffer != NULL);
+            EXPECT_NE(retiredId, item.mGraphicBuffer->getId());
+            ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumers[output],
+                    item));
+        }
+    }
+}
+
+TEST_F(StreamSplitterTest, PersistentSlotsReleaseFreedBufferBeforeRetiring) {
+    sp<IGraphicBufferProducer> inputProducer;
+    sp<IGraphicBufferConsumer> inputConsumer;
+    BufferQueue::createBufferQueue(&inputProducer, &inputConsumer);
+    sp<DeferringConsumer> deferringConsumer(
+            new DeferringConsumer(inputConsumer));
+
+    sp<IGraphicBufferProducer> outputProducer;
+    sp<IGraphicBufferConsumer> outputConsumer;
+    BufferQueue::createBufferQueue(&outputProducer, &outputConsumer);
+    ASSERT_EQ(OK, outputConsumer->consumerConnect(new DummyListener, false));
+
+    sp<StreamSplitter> splitter;
+    ASSERT_EQ(OK, StreamSplitter::createSplitter(deferringConsumer,
+            &splitter));
+    ASSERT_EQ(OK, splitter->setPersistentSlotsEnabled(true));
+    ASSERT_EQ(OK, splitter->addOutput(outputProducer));
+    ASSERT_EQ(OK, outputProducer->allowAllocation(false));
+
+    IGraphicBufferProducer::QueueBufferOutput qbOutput;
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+
+    sp<GraphicBuffer> outputBuffers[BufferQueueDefs::NUM_BUFFER_SLOTS];
+    BufferItem item;
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA));
+    ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(outputConsumer, outputBuffers,
+            TEST_DATA, &item));
+    const uint64_t freedId = item.mGraphicBuffer->getId();
+
+    // The input frees the buffer, but the splitter only learns about it after
+    // the output released it, so releasing it to the input fails as stale
+    deferringConsumer->setDeferring(true);
+    ASSERT_EQ(OK, inputProducer->disconnect(NATIVE_WINDOW_API_CPU));
+    ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumer, item));
+
+    // onBuffersReleased then detaches the buffer from the output
+    deferringConsumer->setDeferring(false);
+
+    ASSERT_EQ(OK, inputProducer->connect(new DummyProducerListener,
+            NATIVE_WINDOW_API_CPU, false, &qbOutput));
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA + 1));
+    ASSERT_NO_FATAL_FAILURE(queueInputFrame(inputProducer, TEST_DATA + 2));
+    for (uint32_t frame = 1; frame <= 2; ++frame) {
+        ASSERT_NO_FATAL_FAILURE(acquireOutputFrame(outputConsumer,
+                outputBuffers, TEST_DATA + frame, &item));
+        ASSERT_TRUE(item.mGraphicBuffer != NULL);
+        EXPECT_NE(freedId, item.mGraphicBuffer->getId());
+        ASSERT_NO_FATAL_FAILURE(releaseOutputFrame(outputConsumer, item));
+    }
+}
+
 TEST_F(StreamSplitterTest, OutputAbandonment) {
     sp<IGraphicBufferProducer> inputProducer;
     sp<IGraphicBufferConsumer> inputConsumer;
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Renders frames the way software-rendered UI does - Surface::lock with a
+ * small dirty rectangle, filling that rectangle, then unlockAndPost - and
+ * reports the latency percentiles of lock, which dequeues the back buffer and
+ * copies back the part of the front buffer that isn't redrawn, and of
+ * unlockAndPost.
+ *
+ * The consumer keeps the most recently posted buffer acquired, as a display
+ * would, so the producer cycles through two or three buffers.
+ *
+ * usage: libgui_surface_lock_benchmark [-i frames] [-s]
+ *   -i  the number of frames per configuration (default 2000)
+ *   -s  use shared memory buffers even if there is a gralloc module
+ */
+
+#define LOG_TAG "SurfaceLockBenchmark"
+
+#include "BenchmarkLatencies.h"
+#include "DummyConsumer.h"
+
+#include <gui/BufferItem.h>
+#include <gui/BufferQueue.h>
+#include <gui/GraphicBufferAlloc.h>
+#include <gui/Surface.h>
+
+#include <ui/Gralloc1.h>
+#include <ui/PixelFormat.h>
+
+#include <utils/Timers.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace android;
+
+static const uint32_t WIDTH = 1080;
+static const uint32_t HEIGHT = 1920;
+// Frames run before measuring, which allocate the buffers
+static const int WARMUP_FRAMES = 10;
+
+enum Pattern {
+    // A text cursor blinking in place
+    CURSOR,
+    // A progress spinner
+    SPINNER,
+    // A text field that moves down the screen by a line per frame
+    MOVING_FIELD,
+    // Every pixel redrawn, no copy back
+    FULL_FRAME,
+};
+
+struct Config {
+    const char* name;
+    PixelFormat format;
+    int maxDequeuedBufferCount;
+    Pattern pattern;
+};
+
+static const Config CONFIGS[] = {
+    { "RGBA_8888, 2 buffers, cursor",       PIXEL_FORMAT_RGBA_8888, 1, CURSOR },
+    { "RGBA_8888, 2 buffers, spinner",      PIXEL_FORMAT_RGBA_8888, 1, SPINNER },
+    { "RGBA_8888, 2 buffers, moving field", PIXEL_FORMAT_RGBA_8888, 1,
+            MOVING_FIELD },
+    { "RGBA_8888, 3 buffers, moving field", PIXEL_FORMAT_RGBA_8888, 2,
+            MOVING_FIELD },
+    { "RGBA_8888, 2 buffers, full frame",   PIXEL_FORMAT_RGBA_8888, 1,
+            FULL_FRAME },
+    { "RGB_565, 2 buffers, cursor",         PIXEL_FORMAT_RGB_565,   1, CURSOR },
+    { "RGB_565, 2 buffers, moving field",   PIXEL_FORMAT_RGB_565,   1,
+            MOVING_FIELD },
+};
+
+static Rect dirtyRect(Pattern pattern, int frame) {
+    switch (pattern) {
+        case CURSOR:
+            return Rect(500, 900, 504, 948);
+        case SPINNER:
+            return Rect(508, 928, 572, 992);
+        case MOVING_FIELD: {
+            int32_t top = static_cast<int32_t>(
+                    static_cast<uint32_t>(frame + WARMUP_FRAMES) * 48 %
+                    (HEIGHT - 96));
+            return Rect(40, top, WIDTH - 40, top + 96);
+        }
+        case FULL_FRAME:
+            return Rect(WIDTH, HEIGHT);
+    }
+    return Rect(WIDTH, HEIGHT);
+}
+
+static bool runConfig(const Config& config, int numFrames) {
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer,
+            new GraphicBufferAlloc());
+    if (consumer->consumerConnect(new DummyConsumer, false) != NO_ERROR ||
+            consumer->setDefaultBufferSize(WIDTH, HEIGHT) != NO_ERROR ||
+            consumer->setDefaultBufferFormat(config.format) != NO_ERROR ||
+            producer->setMaxDequeuedBufferCount(
+                    config.maxDequeuedBufferCount) != NO_ERROR) {
+        fprintf(stderr, "failed to set up the BufferQueue\n");
+        return false;
+    }
+    sp<Surface> surface(new Surface(producer));
+
+    const uint32_t bpp = bytesPerPixel(config.format);
+    Latencies lockLatencies;
+    Latencies postLatencies;
+    BufferItem displayed;
+    bool hasDisplayed = false;
+
+    for (int frame = -WARMUP_FRAMES; frame < numFrames; frame++) {
+        Rect dirty(dirtyRect(config.pattern, frame));
+        ARect bounds = { dirty.left, dirty.top, dirty.right, dirty.bottom };
+        ANativeWindow_Buffer buffer;
+        nsecs_t start = systemTime();
+        status_t result = surface->lock(&buffer, &bounds);
+        nsecs_t end = systemTime();
+        if (result != NO_ERROR) {
+            fprintf(stderr, "lock failed: %d\n", result);
+            return false;
+        }
+
+        // Draw the dirty region
+        uint8_t* bits = static_cast<uint8_t*>(buffer.bits);
+        size_t rowSize = static_cast<size_t>(bounds.right - bounds.left) * bpp;
+        for (int32_t y = bounds.top; y < bounds.bottom; y++) {
+            memset(bits + (static_cast<size_t>(y) *
+                    static_cast<size_t>(buffer.stride) +
+                    static_cast<size_t>(bounds.left)) * bpp,
+                    frame & 0xff, rowSize);
+        }
+
+        nsecs_t postStart = systemTime();
+        result = surface->unlockAndPost();
+        nsecs_t postEnd = systemTime();
+        if (result != NO_ERROR) {
+            fprintf(stderr, "unlockAndPost failed: %d\n", result);
+            return false;
+        }
+        if (frame >= 0) {
+            lockLatencies.add(end - start);
+            postLatencies.add(postEnd - postStart);
+        }
+
+        // Display the new frame, returning the previous one
+        BufferItem item;
+        result = consumer->acquireBuffer(&item, 0);
+        if (result != NO_ERROR) {
+            fprintf(stderr, "acquireBuffer failed: %d\n", result);
+            return false;
+        }
+        if (hasDisplayed) {
+            consumer->releaseBuffer(displayed.mSlot, displayed.mFrameNumber,
+                    EGL_NO_DISPLAY, EGL_NO_SYNC_KHR, Fence::NO_FENCE);
+        }
+        displayed = item;
+        hasDisplayed = true;
+    }
+
+    printf("%s\n", config.name);
+    lockLatencies.print("lock");
+    postLatencies.print("post");
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int numFrames = 2000;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:s")) != -1) {
+        switch (opt) {
+            case 'i':
+                numFrames = atoi(optarg);
+                break;
+            case 's':
+                Gralloc1::Loader::useHeapDevice();
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-i frames] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (numFrames <= 0) {
+        fprintf(stderr, "invalid number of frames\n");
+        return 1;
+    }
+
+    printf("%ux%u buffers, %d frames per configuration, latencies in us\n",
+            WIDTH, HEIGHT, numFrames);
+
+    bool success = true;
+    for (const Config& config : CONFIGS) {
+        if (!runConfig(config, numFrames)) {
+            fprintf(stderr, "%s: failed\n", config.name);
+            success = false;
+        }
+    }
+    return success ? 0 : 1;
+}
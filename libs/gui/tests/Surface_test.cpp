@@ -29,6 +29,8 @@
 #include <private/gui/ComposerService.h>
 #include <binder/ProcessState.h>
 
+#include <vector>
+
 namespace android {
 
 class SurfaceTest : public ::testing::Test {
@@ -232,6 +234,62 @@ TEST_F(SurfaceTest, GetConsumerName) {
     EXPECT_STREQ("TestConsumer", surface->getConsumerName().string());
 }
 
+TEST_F(SurfaceTest, LockCopiesBackFrontBufferOutsideDirtyRegion) {
+    const uint32_t SIZE = 32;
+    sp<IGraphicBufferProducer> producer;
+    sp<IGraphicBufferConsumer> consumer;
+    BufferQueue::createBufferQueue(&producer, &consumer);
+    ASSERT_EQ(NO_ERROR, consumer->consumerConnect(new DummyConsumer, false));
+    ASSERT_EQ(NO_ERROR, consumer->setDefaultBufferSize(SIZE, SIZE));
+    ASSERT_EQ(NO_ERROR, producer->setMaxDequeuedBufferCount(2));
+    sp<Surface> surface = new Surface(producer);
+
+    // What the front buffer should contain
+    std::vector<uint32_t> expected(SIZE * SIZE, 0);
+    BufferItem displayed;
+    bool hasDisplayed = false;
+    for (uint32_t frame = 1; frame < 40; frame++) {
+        // Small rectangles at varying positions, after a full first frame
+        int32_t offset = static_cast<int32_t>((frame * 7) % (SIZE - 8));
+        ARect bounds = { offset, offset / 2, offset + 8, offset / 2 + 5 };
+        ANativeWindow_Buffer buffer;
+        ASSERT_EQ(NO_ERROR, surface->lock(&buffer,
+                frame == 1 ? NULL : &bounds));
+        if (frame == 1) {
+            bounds = { 0, 0, static_cast<int32_t>(SIZE),
+                    static_cast<int32_t>(SIZE) };
+        }
+
+        uint32_t* bits = static_cast<uint32_t*>(buffer.bits);
+        for (uint32_t y = 0; y < SIZE; y++) {
+            for (uint32_t x = 0; x < SIZE; x++) {
+                uint32_t* pixel = bits + y * buffer.stride + x;
+                int32_t px = static_cast<int32_t>(x);
+                int32_t py = static_cast<int32_t>(y);
+                if (px >= bounds.left && px < bounds.right &&
+                        py >= bounds.top && py < bounds.bottom) {
+                    *pixel = frame;
+                    expected[y * SIZE + x] = frame;
+                } else {
+                    ASSERT_EQ(expected[y * SIZE + x], *pixel) << "frame "
+                            << frame << " x=" << x << " y=" << y;
+                }
+            }
+        }
+        ASSERT_EQ(NO_ERROR, surface->unlockAndPost());
+
+        BufferItem item;
+        ASSERT_EQ(NO_ERROR, consumer->acquireBuffer(&item, 0));
+        if (hasDisplayed) {
+            ASSERT_EQ(NO_ERROR, consumer->releaseBuffer(displayed.mSlot,
+                    displayed.mFrameNumber, EGL_NO_DISPLAY, EGL_NO_SYNC_KHR,
+                    Fence::NO_FENCE));
+        }
+        displayed = item;
+        hasDisplayed = true;
+    }
+}
+
 TEST_F(SurfaceTest, DynamicSetBufferCount) {
     sp<IGraphicBufferProducer> producer;
     sp<IGraphicBufferConsumer> consumer;
@@ -18,6 +18,8 @@
 
 #include <ui/Gralloc1.h>
 
+#include <string.h>
+
 #include <vector>
 
 #undef LOG_TAG
@@ -370,22 +372,34 @@ bool Device::loadFunctions()
 }
 
 std::unique_ptr<Gralloc1On0Adapter> Loader::mAdapter = nullptr;
+std::unique_ptr<Gralloc1OnHeap> Loader::mHeapDevice = nullptr;
+std::atomic<bool> Loader::mUseHeapDevice(false);
 
 Loader::Loader()
   : mDevice(nullptr)
 {
-    hw_module_t const* module;
-    int err = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
-    uint8_t majorVersion = (module->module_api_version >> 8) & 0xFF;
-    uint8_t minorVersion = module->module_api_version & 0xFF;
     gralloc1_device_t* device = nullptr;
-    if (majorVersion == 1) {
-        gralloc1_open(module, &device);
+    if (mUseHeapDevice) {
+        if (!mHeapDevice) {
+            mHeapDevice = std::make_unique<Gralloc1OnHeap>();
+        }
+        device = mHeapDevice->getDevice();
     } else {
-        if (!mAdapter) {
-            mAdapter = std::make_unique<Gralloc1On0Adapter>(module);
+        hw_module_t const* module = nullptr;
+        int err = hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &module);
+        // Only processes that asked for shared memory buffers get them, a
+        // missing module is a broken device everywhere else
+        LOG_ALWAYS_FATAL_IF(err != 0, "Failed to load the gralloc module: "
+                "%s (%d)", strerror(-err), err);
+        uint8_t majorVersion = (module->module_api_version >> 8) & 0xFF;
+        if (majorVersion == 1) {
+            gralloc1_open(module, &device);
+        } else {
+            if (!mAdapter) {
+                mAdapter = std::make_unique<Gralloc1On0Adapter>(module);
+            }
+            device = mAdapter->getDevice();
         }
-        device = mAdapter->getDevice();
     }
     mDevice = std::make_unique<Gralloc1::Device>(device);
 }
@@ -397,6 +411,11 @@ std::unique_ptr<Device> Loader::getDevice()
     return std::move(mDevice);
 }
 
+void Loader::useHeapDevice()
+{
+    mUseHeapDevice = true;
+}
+
 } // namespace android::Gralloc1
 
 } // namespace android
@@ -0,0 +1,767 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "Gralloc1OnHeap"
+//#define LOG_NDEBUG 0
+
+#include <ui/Gralloc1OnHeap.h>
+
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+template <typename PFN, typename T>
+static gralloc1_function_pointer_t asFP(T function)
+{
+    static_assert(std::is_same<PFN, T>::value, "Incompatible function pointer");
+    return reinterpret_cast<gralloc1_function_pointer_t>(function);
+}
+
+namespace android {
+
+static const uint32_t HEAP_BUFFER_MAGIC = 'HGBF';
+
+static const int NUM_LAYOUT_INTS = 12;
+
+static inline uint32_t alignTo(uint32_t value, uint32_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static inline uint64_t combine(uint32_t low, uint32_t high)
+{
+    return (static_cast<uint64_t>(high) << 32) | low;
+}
+
+static inline uint32_t low32(uint64_t value)
+{
+    return static_cast<uint32_t>(value & 0xFFFFFFFF);
+}
+
+static inline uint32_t high32(uint64_t value)
+{
+    return static_cast<uint32_t>(value >> 32);
+}
+
+static uint32_t getBytesPerPixel(int32_t format)
+{
+    switch (format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+        case HAL_PIXEL_FORMAT_BGRA_8888:
+        case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED:
+            return 4;
+        case HAL_PIXEL_FORMAT_RGB_888:
+            return 3;
+        case HAL_PIXEL_FORMAT_RGB_565:
+        case HAL_PIXEL_FORMAT_YCbCr_422_I:
+        case HAL_PIXEL_FORMAT_RAW16:
+        case HAL_PIXEL_FORMAT_Y16:
+            return 2;
+        case HAL_PIXEL_FORMAT_Y8:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Where the chroma samples of a YUV 4:2:0 buffer are, relative to the start
+// of the buffer, given the stride of the luma plane in bytes
+struct ChromaLayout {
+    size_t cbOffset;
+    size_t crOffset;
+    uint32_t stride;
+    uint32_t step;
+    // The end of the chroma samples, i.e. the size of the buffer
+    size_t end;
+};
+
+static bool getChromaLayout(int32_t format, uint32_t yStride, uint32_t height,
+        ChromaLayout* outLayout)
+{
+    size_t ySize = static_cast<size_t>(yStride) * height;
+    size_t chromaHeight = (height + 1) / 2;
+    switch (format) {
+        case HAL_PIXEL_FORMAT_YV12:
+            outLayout->stride = alignTo(yStride / 2, 16);
+            outLayout->step = 1;
+            outLayout->crOffset = ySize;
+            outLayout->cbOffset = ySize + outLayout->stride * chromaHeight;
+            outLayout->end = outLayout->cbOffset +
+                    outLayout->stride * chromaHeight;
+            return true;
+        case HAL_PIXEL_FORMAT_YCbCr_420_888:
+            // I420, the same as YV12 with the chroma planes swapped
+            outLayout->stride = alignTo(yStride / 2, 16);
+            outLayout->step = 1;
+            outLayout->cbOffset = ySize;
+            outLayout->crOffset = ySize + outLayout->stride * chromaHeight;
+            outLayout->end = outLayout->crOffset +
+                    outLayout->stride * chromaHeight;
+            return true;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            // NV21, a plane of interleaved V and U samples after the Y plane
+            outLayout->stride = yStride;
+            outLayout->step = 2;
+            outLayout->crOffset = ySize;
+            outLayout->cbOffset = ySize + 1;
+            outLayout->end = ySize + outLayout->stride * chromaHeight;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Computes the stride and size of a buffer, or returns false if buffers of
+// this format can't be allocated
+static bool computeLayout(uint32_t width, uint32_t height, int32_t format,
+        uint32_t* outStride, uint32_t* outSize)
+{
+    uint64_t size = 0;
+    ChromaLayout chroma{};
+    if (format == HAL_PIXEL_FORMAT_BLOB) {
+        *outStride = width;
+        size = static_cast<uint64_t>(width) * height;
+    } else if (getChromaLayout(format, alignTo(width, 16), height, &chroma)) {
+        *outStride = alignTo(width, 16);
+        size = chroma.end;
+    } else {
+        uint32_t bytesPerPixel = getBytesPerPixel(format);
+        if (bytesPerPixel == 0) {
+            return false;
+        }
+        *outStride = alignTo(width, 16);
+        size = static_cast<uint64_t>(*outStride) * height * bytesPerPixel;
+    }
+    if (size == 0 || size > UINT32_MAX) {
+        return false;
+    }
+    *outSize = static_cast<uint32_t>(size);
+    return true;
+}
+
+static int createSharedMemory(size_t size)
+{
+    const char* name = "gralloc-heap-buffer";
+#ifdef __NR_memfd_create
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+    int fd = static_cast<int>(syscall(__NR_memfd_create, name, MFD_CLOEXEC));
+    if (fd >= 0) {
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            ALOGE("ftruncate(%zu) failed: %s", size, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    // memfd_create was added in Linux 3.17, older kernels have ashmem
+#endif
+    return ashmem_create_region(name, size);
+}
+
+Gralloc1OnHeap::Gralloc1OnHeap()
+  : gralloc1_device_t()
+{
+    ALOGV("Constructing");
+    static_assert(sizeof(Layout) == NUM_LAYOUT_INTS * sizeof(int),
+            "Layout doesn't fit in the handle");
+    getCapabilities = getCapabilitiesHook;
+    getFunction = getFunctionHook;
+}
+
+Gralloc1OnHeap::~Gralloc1OnHeap()
+{
+    ALOGV("Destructing");
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    for (const auto& entry : mBuffers) {
+        const auto& buffer = entry.second;
+        if (buffer->data) {
+            munmap(buffer->data, buffer->layout.size);
+        }
+        if (buffer->wasAllocated) {
+            native_handle_close(buffer->handle);
+            native_handle_delete(buffer->handle);
+        }
+    }
+}
+
+void Gralloc1OnHeap::getCapabilitiesHook(gralloc1_device_t* /*device*/,
+        uint32_t* outCount, int32_t* /*outCapabilities*/)
+{
+    *outCount = 0;
+}
+
+gralloc1_function_pointer_t Gralloc1OnHeap::doGetFunction(
+        int32_t intDescriptor)
+{
+    constexpr auto lastDescriptor =
+            static_cast<int32_t>(GRALLOC1_LAST_FUNCTION);
+    if (intDescriptor < 0 || intDescriptor > lastDescriptor) {
+        // This includes the functions only offered by Gralloc1On0Adapter
+        ALOGV("Unsupported function descriptor %d", intDescriptor);
+        return nullptr;
+    }
+
+    auto descriptor =
+            static_cast<gralloc1_function_descriptor_t>(intDescriptor);
+    switch (descriptor) {
+        case GRALLOC1_FUNCTION_DUMP:
+            return asFP<GRALLOC1_PFN_DUMP>(dumpHook);
+        case GRALLOC1_FUNCTION_CREATE_DESCRIPTOR:
+            return asFP<GRALLOC1_PFN_CREATE_DESCRIPTOR>(createDescriptorHook);
+        case GRALLOC1_FUNCTION_DESTROY_DESCRIPTOR:
+            return asFP<GRALLOC1_PFN_DESTROY_DESCRIPTOR>(destroyDescriptorHook);
+        case GRALLOC1_FUNCTION_SET_CONSUMER_USAGE:
+            return asFP<GRALLOC1_PFN_SET_CONSUMER_USAGE>(setConsumerUsageHook);
+        case GRALLOC1_FUNCTION_SET_DIMENSIONS:
+            return asFP<GRALLOC1_PFN_SET_DIMENSIONS>(setDimensionsHook);
+        case GRALLOC1_FUNCTION_SET_FORMAT:
+            return asFP<GRALLOC1_PFN_SET_FORMAT>(setFormatHook);
+        case GRALLOC1_FUNCTION_SET_PRODUCER_USAGE:
+            return asFP<GRALLOC1_PFN_SET_PRODUCER_USAGE>(setProducerUsageHook);
+        case GRALLOC1_FUNCTION_GET_BACKING_STORE:
+            return asFP<GRALLOC1_PFN_GET_BACKING_STORE>(getBackingStoreHook);
+        case GRALLOC1_FUNCTION_GET_CONSUMER_USAGE:
+            return asFP<GRALLOC1_PFN_GET_CONSUMER_USAGE>(getConsumerUsageHook);
+        case GRALLOC1_FUNCTION_GET_DIMENSIONS:
+            return asFP<GRALLOC1_PFN_GET_DIMENSIONS>(getDimensionsHook);
+        case GRALLOC1_FUNCTION_GET_FORMAT:
+            return asFP<GRALLOC1_PFN_GET_FORMAT>(getFormatHook);
+        case GRALLOC1_FUNCTION_GET_PRODUCER_USAGE:
+            return asFP<GRALLOC1_PFN_GET_PRODUCER_USAGE>(getProducerUsageHook);
+        case GRALLOC1_FUNCTION_GET_STRIDE:
+            return asFP<GRALLOC1_PFN_GET_STRIDE>(getStrideHook);
+        case GRALLOC1_FUNCTION_ALLOCATE:
+            return asFP<GRALLOC1_PFN_ALLOCATE>(allocateHook);
+        case GRALLOC1_FUNCTION_RETAIN:
+            return asFP<GRALLOC1_PFN_RETAIN>(retainHook);
+        case GRALLOC1_FUNCTION_RELEASE:
+            return asFP<GRALLOC1_PFN_RELEASE>(releaseHook);
+        case GRALLOC1_FUNCTION_GET_NUM_FLEX_PLANES:
+            return asFP<GRALLOC1_PFN_GET_NUM_FLEX_PLANES>(
+                    getNumFlexPlanesHook);
+        case GRALLOC1_FUNCTION_LOCK:
+            return asFP<GRALLOC1_PFN_LOCK>(lockHook);
+        case GRALLOC1_FUNCTION_LOCK_FLEX:
+            return asFP<GRALLOC1_PFN_LOCK_FLEX>(lockFlexHook);
+        case GRALLOC1_FUNCTION_UNLOCK:
+            return asFP<GRALLOC1_PFN_UNLOCK>(unlockHook);
+        case GRALLOC1_FUNCTION_INVALID:
+            ALOGE("Invalid function descriptor");
+            return nullptr;
+    }
+
+    ALOGE("Unknown function descriptor: %d", intDescriptor);
+    return nullptr;
+}
+
+void Gralloc1OnHeap::dump(uint32_t* outSize, char* outBuffer)
+{
+    if (outBuffer) {
+        *outSize = std::min(*outSize,
+                static_cast<uint32_t>(mCachedDump.size()));
+        std::copy_n(mCachedDump.cbegin(), *outSize, outBuffer);
+        return;
+    }
+
+    String8 result;
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    uint64_t totalSize = 0;
+    size_t numMapped = 0;
+    for (const auto& entry : mBuffers) {
+        totalSize += entry.second->layout.size;
+        numMapped += entry.second->data ? 1 : 0;
+    }
+    result.appendFormat("Gralloc1OnHeap: %zu buffers (%zu mapped), "
+            "%.2f KiB\n", mBuffers.size(), numMapped,
+            static_cast<double>(totalSize) / 1024.0);
+    for (const auto& entry : mBuffers) {
+        const Buffer& buffer = *entry.second;
+        result.appendFormat("  %10p: %7.2f KiB | %4u (%4u) x %4u | %8X | "
+                "%s refs=%zu locks=%u%s\n", entry.first,
+                static_cast<double>(buffer.layout.size) / 1024.0,
+                buffer.layout.width, buffer.layout.stride, buffer.layout.height,
+                buffer.layout.format,
+                buffer.wasAllocated ? "allocated" : "imported",
+                buffer.referenceCount, buffer.lockCount,
+                buffer.data ? " mapped" : "");
+    }
+    mCachedDump.assign(result.string(), result.size());
+    *outSize = static_cast<uint32_t>(mCachedDump.size());
+}
+
+int32_t Gralloc1OnHeap::createDescriptorHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t* outDescriptor)
+{
+    auto heap = getHeap(device);
+    auto descriptorId = sNextBufferDescriptorId++;
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    heap->mDescriptors.emplace(descriptorId, Descriptor());
+    *outDescriptor = descriptorId;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::destroyDescriptorHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t descriptor)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    if (heap->mDescriptors.erase(descriptor) == 0) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::setConsumerUsageHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t descriptor, uint64_t usage)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    auto iter = heap->mDescriptors.find(descriptor);
+    if (iter == heap->mDescriptors.end()) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    iter->second.consumerUsage = static_cast<gralloc1_consumer_usage_t>(usage);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::setDimensionsHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t descriptor, uint32_t width,
+        uint32_t height)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    auto iter = heap->mDescriptors.find(descriptor);
+    if (iter == heap->mDescriptors.end()) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    iter->second.width = width;
+    iter->second.height = height;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::setFormatHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t descriptor, int32_t format)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    auto iter = heap->mDescriptors.find(descriptor);
+    if (iter == heap->mDescriptors.end()) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    iter->second.format = format;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::setProducerUsageHook(gralloc1_device_t* device,
+        gralloc1_buffer_descriptor_t descriptor, uint64_t usage)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+    auto iter = heap->mDescriptors.find(descriptor);
+    if (iter == heap->mDescriptors.end()) {
+        return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+    }
+    iter->second.producerUsage = static_cast<gralloc1_producer_usage_t>(usage);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::allocateHook(gralloc1_device_t* device,
+        uint32_t numDescriptors,
+        const gralloc1_buffer_descriptor_t* descriptors,
+        buffer_handle_t* outBuffers)
+{
+    auto heap = getHeap(device);
+    for (uint32_t i = 0; i < numDescriptors; i++) {
+        Descriptor descriptor;
+        {
+            std::lock_guard<std::mutex> lock(heap->mDescriptorMutex);
+            auto iter = heap->mDescriptors.find(descriptors[i]);
+            if (iter == heap->mDescriptors.end()) {
+                for (uint32_t j = 0; j < i; j++) {
+                    releaseHook(device, outBuffers[j]);
+                }
+                return GRALLOC1_ERROR_BAD_DESCRIPTOR;
+            }
+            descriptor = iter->second;
+        }
+
+        auto error = heap->allocate(descriptor, &outBuffers[i]);
+        if (error != GRALLOC1_ERROR_NONE) {
+            for (uint32_t j = 0; j < i; j++) {
+                releaseHook(device, outBuffers[j]);
+            }
+            return error;
+        }
+    }
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t Gralloc1OnHeap::allocate(const Descriptor& descriptor,
+        buffer_handle_t* outBuffer)
+{
+    ALOGV("allocate(%u, %u, %d)", descriptor.width, descriptor.height,
+            descriptor.format);
+
+    uint32_t stride = 0;
+    uint32_t size = 0;
+    if (!computeLayout(descriptor.width, descriptor.height, descriptor.format,
+            &stride, &size)) {
+        ALOGE("Can't allocate %u x %u buffers of format %d", descriptor.width,
+                descriptor.height, descriptor.format);
+        return GRALLOC1_ERROR_UNSUPPORTED;
+    }
+
+    int fd = createSharedMemory(size);
+    if (fd < 0) {
+        ALOGE("Failed to create a %u byte shared memory region: %s", size,
+                strerror(errno));
+        return GRALLOC1_ERROR_NO_RESOURCES;
+    }
+    native_handle_t* handle = native_handle_create(1, NUM_LAYOUT_INTS);
+    if (!handle) {
+        close(fd);
+        return GRALLOC1_ERROR_NO_RESOURCES;
+    }
+
+    uint64_t store = combine(sNextBufferId++, static_cast<uint32_t>(getpid()));
+    Layout layout{};
+    layout.magic = HEAP_BUFFER_MAGIC;
+    layout.width = descriptor.width;
+    layout.height = descriptor.height;
+    layout.stride = stride;
+    layout.format = descriptor.format;
+    layout.size = size;
+    layout.producerUsageLow = low32(descriptor.producerUsage);
+    layout.producerUsageHigh = high32(descriptor.producerUsage);
+    layout.consumerUsageLow = low32(descriptor.consumerUsage);
+    layout.consumerUsageHigh = high32(descriptor.consumerUsage);
+    layout.storeLow = low32(store);
+    layout.storeHigh = high32(store);
+    handle->data[0] = fd;
+    memcpy(&handle->data[1], &layout, sizeof(layout));
+
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    mBuffers.emplace(handle,
+            std::make_unique<Buffer>(handle, layout, true));
+    *outBuffer = handle;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::retainHook(gralloc1_device_t* device,
+        buffer_handle_t bufferHandle)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mBufferMutex);
+    auto iter = heap->mBuffers.find(bufferHandle);
+    if (iter != heap->mBuffers.end()) {
+        iter->second->referenceCount++;
+        return GRALLOC1_ERROR_NONE;
+    }
+
+    // A handle received from another process
+    Layout layout{};
+    if (!bufferHandle || bufferHandle->numFds != 1 ||
+            bufferHandle->numInts != NUM_LAYOUT_INTS) {
+        ALOGE("retain(%p): not a heap buffer", bufferHandle);
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    memcpy(&layout, &bufferHandle->data[1], sizeof(layout));
+    if (layout.magic != HEAP_BUFFER_MAGIC) {
+        ALOGE("retain(%p): not a heap buffer", bufferHandle);
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+
+    ALOGV("Importing %p", bufferHandle);
+    auto handle = const_cast<native_handle_t*>(bufferHandle);
+    heap->mBuffers.emplace(bufferHandle,
+            std::make_unique<Buffer>(handle, layout, false));
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::releaseHook(gralloc1_device_t* device,
+        buffer_handle_t bufferHandle)
+{
+    auto heap = getHeap(device);
+    std::unique_ptr<Buffer> buffer;
+    {
+        std::lock_guard<std::mutex> lock(heap->mBufferMutex);
+        auto iter = heap->mBuffers.find(bufferHandle);
+        if (iter == heap->mBuffers.end()) {
+            return GRALLOC1_ERROR_BAD_HANDLE;
+        }
+        if (--iter->second->referenceCount > 0) {
+            return GRALLOC1_ERROR_NONE;
+        }
+        buffer = std::move(iter->second);
+        heap->mBuffers.erase(iter);
+    }
+
+    if (buffer->data) {
+        munmap(buffer->data, buffer->layout.size);
+    }
+    // The owner of an imported handle closes and deletes it
+    if (buffer->wasAllocated) {
+        ALOGV("Freeing %p", bufferHandle);
+        native_handle_close(buffer->handle);
+        native_handle_delete(buffer->handle);
+    }
+    return GRALLOC1_ERROR_NONE;
+}
+
+bool Gralloc1OnHeap::getLayout(buffer_handle_t bufferHandle,
+        Layout* outLayout)
+{
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    auto iter = mBuffers.find(bufferHandle);
+    if (iter == mBuffers.end()) {
+        return false;
+    }
+    *outLayout = iter->second->layout;
+    return true;
+}
+
+int32_t Gralloc1OnHeap::getBackingStoreHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, gralloc1_backing_store_t* outStore)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outStore = combine(layout.storeLow, layout.storeHigh);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getConsumerUsageHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint64_t* outUsage)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outUsage = combine(layout.consumerUsageLow, layout.consumerUsageHigh);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getDimensionsHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint32_t* outWidth, uint32_t* outHeight)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outWidth = layout.width;
+    *outHeight = layout.height;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getFormatHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, int32_t* outFormat)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outFormat = layout.format;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getNumFlexPlanesHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint32_t* outNumPlanes)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    ChromaLayout chroma{};
+    if (!getChromaLayout(layout.format, layout.stride, layout.height,
+            &chroma)) {
+        return GRALLOC1_ERROR_UNSUPPORTED;
+    }
+    *outNumPlanes = 3;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getProducerUsageHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint64_t* outUsage)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outUsage = combine(layout.producerUsageLow, layout.producerUsageHigh);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::getStrideHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint32_t* outStride)
+{
+    Layout layout{};
+    if (!getHeap(device)->getLayout(buffer, &layout)) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    *outStride = layout.stride;
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t Gralloc1OnHeap::lock(buffer_handle_t bufferHandle,
+        const gralloc1_rect_t* accessRegion, int32_t acquireFenceFd,
+        Layout* outLayout, uint8_t** outData)
+{
+    sp<Fence> acquireFence{new Fence(acquireFenceFd)};
+    if (!accessRegion) {
+        ALOGE("accessRegion is null");
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+    acquireFence->waitForever("Gralloc1OnHeap::lock");
+
+    std::lock_guard<std::mutex> lock(mBufferMutex);
+    auto iter = mBuffers.find(bufferHandle);
+    if (iter == mBuffers.end()) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    Buffer& buffer = *iter->second;
+    if (!buffer.data) {
+        void* data = mmap(nullptr, buffer.layout.size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, buffer.handle->data[0], 0);
+        if (data == MAP_FAILED) {
+            ALOGE("Failed to map %p: %s", bufferHandle, strerror(errno));
+            return GRALLOC1_ERROR_NO_RESOURCES;
+        }
+        buffer.data = static_cast<uint8_t*>(data);
+    }
+    buffer.lockCount++;
+    *outLayout = buffer.layout;
+    *outData = buffer.data;
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::lockHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint64_t /*producerUsage*/,
+        uint64_t /*consumerUsage*/, const gralloc1_rect_t* accessRegion,
+        void** outData, int32_t acquireFence)
+{
+    if (!outData) {
+        // Nothing but the CPU can access these buffers
+        close(acquireFence);
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    Layout layout{};
+    uint8_t* data = nullptr;
+    auto error = getHeap(device)->lock(buffer, accessRegion, acquireFence,
+            &layout, &data);
+    if (error == GRALLOC1_ERROR_NONE) {
+        *outData = data;
+    }
+    return error;
+}
+
+int32_t Gralloc1OnHeap::lockFlexHook(gralloc1_device_t* device,
+        buffer_handle_t buffer, uint64_t /*producerUsage*/,
+        uint64_t /*consumerUsage*/, const gralloc1_rect_t* accessRegion,
+        struct android_flex_layout* outFlexLayout, int32_t acquireFence)
+{
+    auto heap = getHeap(device);
+
+    Layout layout{};
+    if (!heap->getLayout(buffer, &layout)) {
+        close(acquireFence);
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    ChromaLayout chroma{};
+    if (!getChromaLayout(layout.format, layout.stride, layout.height,
+            &chroma)) {
+        close(acquireFence);
+        return GRALLOC1_ERROR_UNSUPPORTED;
+    }
+    if (!outFlexLayout || outFlexLayout->num_planes < 3 ||
+            !outFlexLayout->planes) {
+        close(acquireFence);
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    uint8_t* data = nullptr;
+    auto error = heap->lock(buffer, accessRegion, acquireFence, &layout,
+            &data);
+    if (error != GRALLOC1_ERROR_NONE) {
+        return error;
+    }
+
+    outFlexLayout->format = FLEX_FORMAT_YCbCr;
+    outFlexLayout->num_planes = 3;
+    android_flex_plane_t* planes = outFlexLayout->planes;
+    for (uint32_t i = 0; i < 3; i++) {
+        planes[i].bits_per_component = 8;
+        planes[i].bits_used = 8;
+        planes[i].h_subsampling = i == 0 ? 1 : 2;
+        planes[i].v_subsampling = i == 0 ? 1 : 2;
+    }
+    planes[0].top_left = data;
+    planes[0].component = FLEX_COMPONENT_Y;
+    planes[0].h_increment = 1;
+    planes[0].v_increment = static_cast<int32_t>(layout.stride);
+    planes[1].top_left = data + chroma.cbOffset;
+    planes[1].component = FLEX_COMPONENT_Cb;
+    planes[1].h_increment = static_cast<int32_t>(chroma.step);
+    planes[1].v_increment = static_cast<int32_t>(chroma.stride);
+    planes[2].top_left = data + chroma.crOffset;
+    planes[2].component = FLEX_COMPONENT_Cr;
+    planes[2].h_increment = static_cast<int32_t>(chroma.step);
+    planes[2].v_increment = static_cast<int32_t>(chroma.stride);
+    return GRALLOC1_ERROR_NONE;
+}
+
+int32_t Gralloc1OnHeap::unlockHook(gralloc1_device_t* device,
+        buffer_handle_t bufferHandle, int32_t* outReleaseFence)
+{
+    auto heap = getHeap(device);
+    std::lock_guard<std::mutex> lock(heap->mBufferMutex);
+    auto iter = heap->mBuffers.find(bufferHandle);
+    if (iter == heap->mBuffers.end()) {
+        return GRALLOC1_ERROR_BAD_HANDLE;
+    }
+    Buffer& buffer = *iter->second;
+    if (buffer.lockCount == 0) {
+        ALOGE("unlock(%p): the buffer isn't locked", bufferHandle);
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+    // The buffer stays mapped until it's released, since it's usually
+    // locked again for the next frame
+    buffer.lockCount--;
+    *outReleaseFence = -1;
+    return GRALLOC1_ERROR_NONE;
+}
+
+std::atomic<gralloc1_buffer_descriptor_t>
+        Gralloc1OnHeap::sNextBufferDescriptorId(1);
+std::atomic<uint32_t> Gralloc1OnHeap::sNextBufferId(1);
+
+} // namespace android
@@ -34,3 +34,10 @@ LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
 LOCAL_SRC_FILES := mat_test.cpp
 LOCAL_MODULE := mat_test
 include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_SHARED_LIBRARIES := libui libutils
+LOCAL_SRC_FILES := Gralloc1OnHeap_test.cpp
+LOCAL_MODULE := Gralloc1OnHeap_test
+include $(BUILD_NATIVE_TEST)
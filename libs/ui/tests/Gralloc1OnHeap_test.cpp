@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "Gralloc1OnHeap_test"
+
+#include <ui/Gralloc1.h>
+#include <ui/GraphicBuffer.h>
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <vector>
+
+namespace android {
+
+class Gralloc1OnHeapTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        // Before the first buffer creates the allocator and mapper
+        Gralloc1::Loader::useHeapDevice();
+    }
+
+    static const uint32_t USAGE = GraphicBuffer::USAGE_SW_READ_OFTEN |
+            GraphicBuffer::USAGE_SW_WRITE_OFTEN;
+};
+
+TEST_F(Gralloc1OnHeapTest, LockedBufferKeepsItsContents) {
+    sp<GraphicBuffer> buffer = new GraphicBuffer(100, 50,
+            PIXEL_FORMAT_RGBA_8888, USAGE);
+    ASSERT_EQ(NO_ERROR, buffer->initCheck());
+    ASSERT_GE(buffer->getStride(), 100u);
+
+    uint32_t* pixels = nullptr;
+    ASSERT_EQ(NO_ERROR, buffer->lock(USAGE,
+            reinterpret_cast<void**>(&pixels)));
+    for (uint32_t y = 0; y < 50; y++) {
+        for (uint32_t x = 0; x < 100; x++) {
+            pixels[y * buffer->getStride() + x] = y << 16 | x;
+        }
+    }
+    ASSERT_EQ(NO_ERROR, buffer->unlock());
+
+    pixels = nullptr;
+    ASSERT_EQ(NO_ERROR, buffer->lock(USAGE,
+            reinterpret_cast<void**>(&pixels)));
+    EXPECT_EQ(0u, pixels[0]);
+    EXPECT_EQ(49u << 16 | 99u, pixels[49 * buffer->getStride() + 99]);
+    ASSERT_EQ(NO_ERROR, buffer->unlock());
+}
+
+TEST_F(Gralloc1OnHeapTest, UnflattenedBufferSharesMemory) {
+    sp<GraphicBuffer> buffer = new GraphicBuffer(64, 64,
+            PIXEL_FORMAT_RGBA_8888, USAGE);
+    ASSERT_EQ(NO_ERROR, buffer->initCheck());
+
+    std::vector<uint8_t> flattened(buffer->getFlattenedSize());
+    std::vector<int> fds(buffer->getFdCount());
+    void* data = flattened.data();
+    size_t size = flattened.size();
+    int* fdData = fds.data();
+    size_t fdCount = fds.size();
+    ASSERT_EQ(NO_ERROR, buffer->flatten(data, size, fdData, fdCount));
+    // Like binder, which gives the receiver its own file descriptors
+    for (int& fd : fds) {
+        fd = dup(fd);
+    }
+
+    sp<GraphicBuffer> imported = new GraphicBuffer();
+    const void* constData = flattened.data();
+    const int* constFdData = fds.data();
+    size = flattened.size();
+    fdCount = fds.size();
+    ASSERT_EQ(NO_ERROR, imported->unflatten(constData, size, constFdData,
+            fdCount));
+    ASSERT_EQ(buffer->getWidth(), imported->getWidth());
+    ASSERT_EQ(buffer->getStride(), imported->getStride());
+
+    uint32_t* pixels = nullptr;
+    ASSERT_EQ(NO_ERROR, buffer->lock(USAGE,
+            reinterpret_cast<void**>(&pixels)));
+    pixels[0] = 0x12345678;
+    ASSERT_EQ(NO_ERROR, buffer->unlock());
+
+    pixels = nullptr;
+    ASSERT_EQ(NO_ERROR, imported->lock(USAGE,
+            reinterpret_cast<void**>(&pixels)));
+    EXPECT_EQ(0x12345678u, pixels[0]);
+    ASSERT_EQ(NO_ERROR, imported->unlock());
+}
+
+TEST_F(Gralloc1OnHeapTest, LockYCbCr) {
+    sp<GraphicBuffer> buffer = new GraphicBuffer(60, 40,
+            HAL_PIXEL_FORMAT_YV12, USAGE);
+    ASSERT_EQ(NO_ERROR, buffer->initCheck());
+
+    android_ycbcr ycbcr{};
+    ASSERT_EQ(NO_ERROR, buffer->lockYCbCr(USAGE, &ycbcr));
+    uint8_t* y = static_cast<uint8_t*>(ycbcr.y);
+    uint8_t* cb = static_cast<uint8_t*>(ycbcr.cb);
+    uint8_t* cr = static_cast<uint8_t*>(ycbcr.cr);
+    EXPECT_EQ(64u, ycbcr.ystride);
+    EXPECT_EQ(32u, ycbcr.cstride);
+    EXPECT_EQ(1u, ycbcr.chroma_step);
+    // YV12 has the Cr plane before the Cb plane
+    EXPECT_EQ(y + 64 * 40, cr);
+    EXPECT_EQ(cr + 32 * 20, cb);
+    cb[32 * 20 - 1] = 0xFF;
+    ASSERT_EQ(NO_ERROR, buffer->unlock());
+}
+
+TEST_F(Gralloc1OnHeapTest, UnsupportedFormatFails) {
+    sp<GraphicBuffer> buffer = new GraphicBuffer(64, 64,
+            HAL_PIXEL_FORMAT_RAW_OPAQUE, USAGE);
+    EXPECT_NE(NO_ERROR, buffer->initCheck());
+}
+
+} // namespace android
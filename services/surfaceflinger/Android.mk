@@ -11,10 +11,13 @@ LOCAL_SRC_FILES := \
     EventControlThread.cpp \
     EventThread.cpp \
     FenceTracker.cpp \
+    FenceWatcher.cpp \
+    FrameScheduler.cpp \
     FrameTracker.cpp \
     GpuService.cpp \
     Layer.cpp \
     LayerDim.cpp \
+    LayerTracer.cpp \
     MessageQueue.cpp \
     MonitoredProducer.cpp \
     SurfaceFlingerConsumer.cpp \
@@ -27,6 +30,7 @@ LOCAL_SRC_FILES := \
     Effects/Daltonizer.cpp \
     EventLog/EventLogTags.logtags \
     EventLog/EventLog.cpp \
+    RenderEngine/CompositionCache.cpp \
     RenderEngine/Description.cpp \
     RenderEngine/Mesh.cpp \
     RenderEngine/Program.cpp \
@@ -59,6 +59,14 @@ static const nsecs_t kErrorThreshold = 160000000000;    // 400 usec squared
 // vsync event.
 static const int64_t kPresentTimeOffset = PRESENT_TIME_OFFSET_FROM_VSYNC_NS;
 
+// Residuals of the trimmed fit below this value are never considered
+// outliers, whatever the spread of the other samples.
+static const nsecs_t kMinOutlierResidual = 100000;       // 100 usec
+
+// A resync sample is an outlier if its residual is larger than this many
+// times the (normalized) median absolute residual.
+static const double kOutlierResidualFactor = 3.0;
+
 #undef LOG_TAG
 #define LOG_TAG "DispSyncThread"
 class DispSyncThread: public Thread {
@@ -380,6 +388,9 @@ private:
 DispSync::DispSync(const char* name) :
         mName(name),
         mRefreshSkipCount(0),
+        mEstimator(ESTIMATOR_MEAN),
+        mNumOutliers(0),
+        mTotalOutliers(0),
         mThread(new DispSyncThread(name)) {
 
     mThread->run("DispSync", PRIORITY_URGENT_DISPLAY + PRIORITY_MORE_FAVORABLE);
@@ -408,6 +419,11 @@ DispSync::DispSync(const char* name) :
 
 DispSync::~DispSync() {}
 
+void DispSync::setEstimator(Estimator estimator) {
+    Mutex::Autolock lock(mMutex);
+    mEstimator = estimator;
+}
+
 void DispSync::reset() {
     Mutex::Autolock lock(mMutex);
 
@@ -425,6 +441,18 @@ bool DispSync::addPresentFence(const sp<Fence>& fence) {
 
     mPresentFences[mPresentSampleOffset] = fence;
     mPresentTimes[mPresentSampleOffset] = 0;
+    return checkPresentTimesLocked();
+}
+
+bool DispSync::addPresentTime(nsecs_t presentTime) {
+    Mutex::Autolock lock(mMutex);
+
+    mPresentFences[mPresentSampleOffset].clear();
+    mPresentTimes[mPresentSampleOffset] = presentTime + kPresentTimeOffset;
+    return checkPresentTimesLocked();
+}
+
+bool DispSync::checkPresentTimesLocked() {
     mPresentSampleOffset = (mPresentSampleOffset + 1) % NUM_PRESENT_SAMPLES;
     mNumResyncSamplesSincePresent = 0;
 
@@ -535,46 +563,10 @@ void DispSync::updateModelLocked() {
     ALOGV("[%s] updateModelLocked %zu", mName, mNumResyncSamples);
     if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
         ALOGV("[%s] Computing...", mName);
-        nsecs_t durationSum = 0;
-        nsecs_t minDuration = INT64_MAX;
-        nsecs_t maxDuration = 0;
-        for (size_t i = 1; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
-            nsecs_t duration = mResyncSamples[idx] - mResyncSamples[prev];
-            durationSum += duration;
-            minDuration = min(minDuration, duration);
-            maxDuration = max(maxDuration, duration);
-        }
-
-        // Exclude the min and max from the average
-        durationSum -= minDuration + maxDuration;
-        mPeriod = durationSum / (mNumResyncSamples - 3);
-
-        ALOGV("[%s] mPeriod = %" PRId64, mName, ns2us(mPeriod));
-
-        double sampleAvgX = 0;
-        double sampleAvgY = 0;
-        double scale = 2.0 * M_PI / double(mPeriod);
-        // Intentionally skip the first sample
-        for (size_t i = 1; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            nsecs_t sample = mResyncSamples[idx] - mReferenceTime;
-            double samplePhase = double(sample % mPeriod) * scale;
-            sampleAvgX += cos(samplePhase);
-            sampleAvgY += sin(samplePhase);
-        }
-
-        sampleAvgX /= double(mNumResyncSamples - 1);
-        sampleAvgY /= double(mNumResyncSamples - 1);
-
-        mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
-
-        ALOGV("[%s] mPhase = %" PRId64, mName, ns2us(mPhase));
-
-        if (mPhase < -(mPeriod / 2)) {
-            mPhase += mPeriod;
-            ALOGV("[%s] Adjusting mPhase -> %" PRId64, mName, ns2us(mPhase));
+        if (mEstimator == ESTIMATOR_TRIMMED_FIT) {
+            computeTrimmedFitModelLocked();
+        } else {
+            computeMeanModelLocked();
         }
 
         if (kTraceDetailedInfo) {
@@ -590,6 +582,167 @@ void DispSync::updateModelLocked() {
     }
 }
 
+void DispSync::computeMeanModelLocked() {
+    nsecs_t durationSum = 0;
+    nsecs_t minDuration = INT64_MAX;
+    nsecs_t maxDuration = 0;
+    for (size_t i = 1; i < mNumResyncSamples; i++) {
+        size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
+        size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
+        nsecs_t duration = mResyncSamples[idx] - mResyncSamples[prev];
+        durationSum += duration;
+        minDuration = min(minDuration, duration);
+        maxDuration = max(maxDuration, duration);
+    }
+
+    // Exclude the min and max from the average
+    durationSum -= minDuration + maxDuration;
+    mPeriod = durationSum / (mNumResyncSamples - 3);
+
+    ALOGV("[%s] mPeriod = %" PRId64, mName, ns2us(mPeriod));
+
+    double sampleAvgX = 0;
+    double sampleAvgY = 0;
+    double scale = 2.0 * M_PI / double(mPeriod);
+    // Intentionally skip the first sample
+    for (size_t i = 1; i < mNumResyncSamples; i++) {
+        size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
+        nsecs_t sample = mResyncSamples[idx] - mReferenceTime;
+        double samplePhase = double(sample % mPeriod) * scale;
+        sampleAvgX += cos(samplePhase);
+        sampleAvgY += sin(samplePhase);
+    }
+
+    sampleAvgX /= double(mNumResyncSamples - 1);
+    sampleAvgY /= double(mNumResyncSamples - 1);
+
+    mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
+
+    ALOGV("[%s] mPhase = %" PRId64, mName, ns2us(mPhase));
+
+    if (mPhase < -(mPeriod / 2)) {
+        mPhase += mPeriod;
+        ALOGV("[%s] Adjusting mPhase -> %" PRId64, mName, ns2us(mPhase));
+    }
+}
+
+void DispSync::computeTrimmedFitModelLocked() {
+    // Start from the median interval between samples, which is good enough
+    // to tell which vsync each sample belongs to, even when some vsyncs were
+    // missed.
+    nsecs_t intervals[MAX_RESYNC_SAMPLES];
+    size_t numIntervals = 0;
+    for (size_t i = 1; i < mNumResyncSamples; i++) {
+        size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
+        size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
+        nsecs_t duration = mResyncSamples[idx] - mResyncSamples[prev];
+        if (duration > 0) {
+            intervals[numIntervals++] = duration;
+        }
+    }
+    if (numIntervals == 0) {
+        return;
+    }
+    std::nth_element(intervals, intervals + numIntervals / 2,
+            intervals + numIntervals);
+    const double nominalPeriod = double(intervals[numIntervals / 2]);
+
+    // Fit sample = intercept + period * index, with times relative to the
+    // reference time to keep the numbers small. Like the mean estimator,
+    // the first sample is intentionally skipped.
+    double index[MAX_RESYNC_SAMPLES];
+    double time[MAX_RESYNC_SAMPLES];
+    bool used[MAX_RESYNC_SAMPLES];
+    size_t numUsed = 0;
+    const nsecs_t first = mResyncSamples[mFirstResyncSample];
+    for (size_t i = 1; i < mNumResyncSamples; i++) {
+        size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
+        index[numUsed] = round(double(mResyncSamples[idx] - first) / nominalPeriod);
+        time[numUsed] = double(mResyncSamples[idx] - mReferenceTime);
+        used[numUsed] = true;
+        numUsed++;
+    }
+    const size_t numSamples = numUsed;
+
+    double period = nominalPeriod;
+    double intercept = 0;
+    mNumOutliers = 0;
+    while (true) {
+        double meanIndex = 0;
+        double meanTime = 0;
+        for (size_t i = 0; i < numSamples; i++) {
+            if (used[i]) {
+                meanIndex += index[i];
+                meanTime += time[i];
+            }
+        }
+        meanIndex /= numUsed;
+        meanTime /= numUsed;
+
+        double covariance = 0;
+        double variance = 0;
+        for (size_t i = 0; i < numSamples; i++) {
+            if (used[i]) {
+                covariance += (index[i] - meanIndex) * (time[i] - meanTime);
+                variance += (index[i] - meanIndex) * (index[i] - meanIndex);
+            }
+        }
+        if (variance > 0) {
+            period = covariance / variance;
+        }
+        intercept = meanTime - period * meanIndex;
+
+        if (numUsed <= MIN_RESYNC_SAMPLES_FOR_UPDATE - 1) {
+            break;
+        }
+
+        // Find the worst sample, and how far from the fit samples usually
+        // are (the median absolute residual, scaled to match the standard
+        // deviation of normally distributed residuals).
+        double residuals[MAX_RESYNC_SAMPLES];
+        size_t numResiduals = 0;
+        size_t worst = 0;
+        double worstResidual = -1;
+        for (size_t i = 0; i < numSamples; i++) {
+            if (used[i]) {
+                double residual = fabs(time[i] - (intercept + period * index[i]));
+                residuals[numResiduals++] = residual;
+                if (residual > worstResidual) {
+                    worstResidual = residual;
+                    worst = i;
+                }
+            }
+        }
+        std::nth_element(residuals, residuals + numResiduals / 2,
+                residuals + numResiduals);
+        double threshold = max(kOutlierResidualFactor * 1.4826 *
+                residuals[numResiduals / 2], double(kMinOutlierResidual));
+        if (worstResidual <= threshold) {
+            break;
+        }
+
+        ALOGV("[%s] Rejecting resync sample with residual %.1f us", mName,
+                worstResidual / 1000.0);
+        used[worst] = false;
+        numUsed--;
+        mNumOutliers++;
+    }
+    mTotalOutliers += mNumOutliers;
+
+    mPeriod = nsecs_t(period);
+    ALOGV("[%s] mPeriod = %" PRId64, mName, ns2us(mPeriod));
+
+    // the intercept is the time of a vsync event relative to the reference
+    // time, bring it within half a period of it
+    mPhase = nsecs_t(intercept) % mPeriod;
+    if (mPhase > mPeriod / 2) {
+        mPhase -= mPeriod;
+    } else if (mPhase < -(mPeriod / 2)) {
+        mPhase += mPeriod;
+    }
+    ALOGV("[%s] mPhase = %" PRId64, mName, ns2us(mPhase));
+}
+
 void DispSync::updateErrorLocked() {
     if (!mModelUpdated) {
         return;
@@ -634,6 +787,21 @@ void DispSync::resetErrorLocked() {
     }
 }
 
+nsecs_t DispSync::computeVsyncError(nsecs_t timestamp) const {
+    Mutex::Autolock lock(mMutex);
+    nsecs_t period = mPeriod / (1 + mRefreshSkipCount);
+    if (period <= 0) {
+        return 0;
+    }
+    nsecs_t error = (timestamp - mReferenceTime - mPhase) % period;
+    if (error > period / 2) {
+        error -= period;
+    } else if (error < -(period / 2)) {
+        error += period;
+    }
+    return error;
+}
+
 nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
     Mutex::Autolock lock(mMutex);
     nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
@@ -650,6 +818,13 @@ void DispSync::dump(String8& result) const {
     result.appendFormat("mPhase: %" PRId64 " ns\n", mPhase);
     result.appendFormat("mError: %" PRId64 " ns (sqrt=%.1f)\n",
             mError, sqrt(mError));
+    result.appendFormat("estimator: %s",
+            mEstimator == ESTIMATOR_TRIMMED_FIT ? "trimmed fit" : "mean");
+    if (mEstimator == ESTIMATOR_TRIMMED_FIT) {
+        result.appendFormat(" (outliers: %zu last fit, %" PRIu64 " total)",
+                mNumOutliers, mTotalOutliers);
+    }
+    result.append("\n");
     result.appendFormat("mNumResyncSamplesSincePresent: %d (limit %d)\n",
             mNumResyncSamplesSincePresent, MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
     result.appendFormat("mNumResyncSamples: %zd (max %d)\n",
@@ -61,9 +61,28 @@ public:
         virtual void onDispSyncEvent(nsecs_t when) = 0;
     };
 
+    // Estimators used to fit the vsync event model to the resync samples.
+    //
+    // ESTIMATOR_MEAN averages the intervals between samples, excluding the
+    // shortest and the longest one, and averages their phase.
+    //
+    // ESTIMATOR_TRIMMED_FIT does a least-squares fit of the sample times
+    // against their vsync index, repeatedly discarding the sample with the
+    // largest residual while it is an outlier. It tolerates missed vsyncs
+    // and jittery samples better, at a slightly higher cost.
+    enum Estimator {
+        ESTIMATOR_MEAN,
+        ESTIMATOR_TRIMMED_FIT,
+    };
+
     DispSync(const char* name);
     ~DispSync();
 
+    // setEstimator selects how the model is computed from resync samples.
+    // It takes effect at the next resync sample. The default is
+    // ESTIMATOR_MEAN.
+    void setEstimator(Estimator estimator);
+
     // reset clears the resync samples and error value.
     void reset();
 
@@ -78,6 +97,11 @@ public:
     // set call that affects the display.
     bool addPresentFence(const sp<Fence>& fence);
 
+    // addPresentTime is the same as addPresentFence, for a present fence
+    // that is known to have signaled at the given time (e.g. when replaying
+    // a recorded trace).
+    bool addPresentTime(nsecs_t presentTime);
+
     // The beginResync, addResyncSample, and endResync methods are used to re-
     // synchronize the DispSync's model to the hardware vsync events.  The re-
     // synchronization process involves first calling beginResync, then
@@ -125,6 +149,10 @@ public:
     // the refresh after next. etc.
     nsecs_t computeNextRefresh(int periodOffset) const;
 
+    // computeVsyncError returns the signed difference between the given
+    // time and the closest vsync event predicted by the current model.
+    nsecs_t computeVsyncError(nsecs_t timestamp) const;
+
     // dump appends human-readable debug info to the result string.
     void dump(String8& result) const;
 
@@ -133,6 +161,11 @@ private:
     void updateModelLocked();
     void updateErrorLocked();
     void resetErrorLocked();
+    bool checkPresentTimesLocked();
+
+    // compute mPeriod and mPhase from the resync samples
+    void computeMeanModelLocked();
+    void computeTrimmedFitModelLocked();
 
     enum { MAX_RESYNC_SAMPLES = 32 };
     enum { MIN_RESYNC_SAMPLES_FOR_UPDATE = 6 };
@@ -177,6 +210,12 @@ private:
 
     int mRefreshSkipCount;
 
+    Estimator mEstimator;
+    // number of resync samples rejected as outliers by the last fit, and
+    // since startup
+    size_t mNumOutliers;
+    uint64_t mTotalOutliers;
+
     // mThread is the thread from which all the callbacks are called.
     sp<DispSyncThread> mThread;
 
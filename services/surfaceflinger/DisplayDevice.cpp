@@ -92,6 +92,8 @@ DisplayDevice::DisplayDevice(
       mSurface(EGL_NO_SURFACE),
       mDisplayWidth(),
       mDisplayHeight(),
+      mRequestedWidth(),
+      mRequestedHeight(),
 #ifndef USE_HWC2
       mFormat(),
 #endif
@@ -376,6 +378,30 @@ void DisplayDevice::setVisibleLayersSortedByZ(const Vector< sp<Layer> >& layers)
     mVisibleLayersSortedByZ = layers;
 }
 
+bool DisplayDevice::setVisibleLayersSortedByZ(const std::vector<Layer*>& layers) {
+    const size_t count = layers.size();
+    if (mVisibleLayersSortedByZ.size() == count) {
+        bool changed = false;
+        for (size_t i = 0; i < count; i++) {
+            if (mVisibleLayersSortedByZ[i].get() != layers[i]) {
+                changed = true;
+                break;
+            }
+        }
+        if (!changed) {
+            return false;
+        }
+    }
+
+    Vector< sp<Layer> > visibleLayers;
+    visibleLayers.setCapacity(count);
+    for (Layer* layer : layers) {
+        visibleLayers.add(layer);
+    }
+    mVisibleLayersSortedByZ = visibleLayers;
+    return true;
+}
+
 const Vector< sp<Layer> >& DisplayDevice::getVisibleLayersSortedByZ() const {
     return mVisibleLayersSortedByZ;
 }
@@ -492,10 +518,18 @@ void DisplayDevice::setDisplaySize(const int newWidth, const int newHeight) {
     eglQuerySurface(mDisplay, mSurface, EGL_WIDTH,  &mDisplayWidth);
     eglQuerySurface(mDisplay, mSurface, EGL_HEIGHT, &mDisplayHeight);
 
-    LOG_FATAL_IF(mDisplayWidth != newWidth,
+    // Virtual displays may compose at the smaller size of their sink
+    LOG_FATAL_IF(mDisplayWidth > newWidth ||
+                (mDisplayWidth != newWidth && mType < DISPLAY_VIRTUAL),
                 "Unable to set new width to %d", newWidth);
-    LOG_FATAL_IF(mDisplayHeight != newHeight,
+    LOG_FATAL_IF(mDisplayHeight > newHeight ||
+                (mDisplayHeight != newHeight && mType < DISPLAY_VIRTUAL),
                 "Unable to set new height to %d", newHeight);
+    mRequestedWidth = newWidth;
+    mRequestedHeight = newHeight;
+
+    // Map the projection to the new size
+    setProjection(mOrientation, mRequestedViewport, mRequestedFrame);
 }
 
 void DisplayDevice::setProjection(int orientation,
@@ -505,6 +539,12 @@ void DisplayDevice::setProjection(int orientation,
 
     const int w = mDisplayWidth;
     const int h = mDisplayHeight;
+    // the size the viewport and frame were specified for
+    const int requestedWidth = mRequestedWidth > 0 ? mRequestedWidth : w;
+    const int requestedHeight = mRequestedHeight > 0 ? mRequestedHeight : h;
+
+    mRequestedViewport = newViewport;
+    mRequestedFrame = newFrame;
 
     Transform R;
     DisplayDevice::orientationToTransfrom(orientation, w, h, &R);
@@ -513,6 +553,17 @@ void DisplayDevice::setProjection(int orientation,
         // the destination frame can be invalid if it has never been set,
         // in that case we assume the whole display frame.
         frame = Rect(w, h);
+    } else if (requestedWidth != w || requestedHeight != h) {
+        // the display surface composes at a smaller size than requested,
+        // scale the frame down to it. The frame is in the logical
+        // orientation of the display.
+        int64_t sx = w, sy = h, dx = requestedWidth, dy = requestedHeight;
+        if (R.getOrientation() & Transform::ROT_90) {
+            swap(sx, sy);
+            swap(dx, dy);
+        }
+        frame = Rect(frame.left * sx / dx, frame.top * sy / dy,
+                frame.right * sx / dx, frame.bottom * sy / dy);
     }
 
     if (viewport.isEmpty()) {
@@ -520,7 +571,7 @@ void DisplayDevice::setProjection(int orientation,
         // we assume the whole display size.
         // it's also invalid to have an empty viewport, so we handle that
         // case in the same way.
-        viewport = Rect(w, h);
+        viewport = Rect(requestedWidth, requestedHeight);
         if (R.getOrientation() & Transform::ROT_90) {
             // viewport is always specified in the logical orientation
             // of the display (ie: post-rotation).
@@ -42,6 +42,7 @@
 #ifdef USE_HWC2
 #include <memory>
 #endif
+#include <vector>
 
 struct ANativeWindow;
 
@@ -120,6 +121,9 @@ public:
     EGLSurface  getEGLSurface() const;
 
     void                    setVisibleLayersSortedByZ(const Vector< sp<Layer> >& layers);
+    // Same as above, but only touches the strong references when the set of
+    // visible layers actually changed. Returns true if it did.
+    bool                    setVisibleLayersSortedByZ(const std::vector<Layer*>& layers);
     const Vector< sp<Layer> >& getVisibleLayersSortedByZ() const;
     Region                  getDirtyRegion(bool repaintEverything) const;
 
@@ -220,6 +224,10 @@ private:
     EGLSurface      mSurface;
     int             mDisplayWidth;
     int             mDisplayHeight;
+    // size passed to setDisplaySize, 0x0 until then. The display surface may
+    // compose at a smaller size, see VirtualDisplaySurface.
+    int             mRequestedWidth;
+    int             mRequestedHeight;
 #ifndef USE_HWC2
     PixelFormat     mFormat;
 #endif
@@ -247,8 +255,12 @@ private:
     static uint32_t sPrimaryDisplayOrientation;
     // user-provided visible area of the layer stack
     Rect mViewport;
-    // user-provided rectangle where mViewport gets mapped to
+    // user-provided rectangle where mViewport gets mapped to, scaled to the
+    // size of the display surface
     Rect mFrame;
+    // the viewport and frame as provided by the user
+    Rect mRequestedViewport;
+    Rect mRequestedFrame;
     // pre-computed scissor to apply to the display
     Rect mScissor;
     Transform mGlobalTransform;
@@ -26,6 +26,7 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <chrono>
 #include <inttypes.h>
@@ -86,6 +87,7 @@ void HWC2On1Adapter::DisplayContentsDeleter::operator()(
         for (size_t l = 0; l < contents->numHwLayers; ++l) {
             auto& layer = contents->hwLayers[l];
             std::free(const_cast<hwc_rect_t*>(layer.visibleRegionScreen.rects));
+            std::free(const_cast<hwc_rect_t*>(layer.surfaceDamage.rects));
         }
     }
     std::free(contents);
@@ -555,6 +557,9 @@ HWC2On1Adapter::Display::Display(HWC2On1Adapter& device, HWC2::DisplayType type)
     mZIsDirty(false),
     mHwc1RequestedContents(nullptr),
     mHwc1ReceivedContents(nullptr),
+    mChangedHwc1Layers(),
+    mFullLayerCopies(0),
+    mPartialLayerCopies(0),
     mRetireFence(),
     mChanges(),
     mHwc1Id(-1),
@@ -590,7 +595,9 @@ Error HWC2On1Adapter::Display::acceptChanges()
 
     mChanges->clearTypeChanges();
 
-    mHwc1RequestedContents = std::move(mHwc1ReceivedContents);
+    // The received contents only differ from the requested contents in their
+    // per-frame state, so swapping them keeps both allocations
+    std::swap(mHwc1RequestedContents, mHwc1ReceivedContents);
 
     return Error::None;
 }
@@ -1286,9 +1293,12 @@ bool HWC2On1Adapter::Display::prepare()
     }
 
     for (auto& layer : mLayers) {
-        auto& hwc1Layer = mHwc1RequestedContents->hwLayers[layer->getHwc1Id()];
+        auto hwc1Id = layer->getHwc1Id();
+        auto& hwc1Layer = mHwc1RequestedContents->hwLayers[hwc1Id];
         hwc1Layer.releaseFenceFd = -1;
-        layer->applyState(hwc1Layer, applyAllState);
+        if (layer->applyState(hwc1Layer, applyAllState)) {
+            mChangedHwc1Layers[hwc1Id] = true;
+        }
     }
 
     mHwc1RequestedContents->outbuf = mOutputBuffer.getBuffer();
@@ -1299,38 +1309,77 @@ bool HWC2On1Adapter::Display::prepare()
     return true;
 }
 
-static void cloneHWCRegion(hwc_region_t& region)
+// Copies the rects of a region into another region owning its rects,
+// reusing its allocation when the number of rects is unchanged
+static void copyHWCRegion(const hwc_region_t& from, hwc_region_t& to)
 {
-    auto size = sizeof(hwc_rect_t) * region.numRects;
-    auto newRects = static_cast<hwc_rect_t*>(std::malloc(size));
-    std::copy_n(region.rects, region.numRects, newRects);
-    region.rects = newRects;
+    if (to.numRects != from.numRects || to.rects == nullptr) {
+        std::free(const_cast<hwc_rect_t*>(to.rects));
+        auto size = sizeof(hwc_rect_t) * std::max<size_t>(from.numRects, 1);
+        to.rects = static_cast<hwc_rect_t*>(std::malloc(size));
+        to.numRects = from.numRects;
+    }
+    std::copy_n(from.rects, from.numRects, const_cast<hwc_rect_t*>(to.rects));
 }
 
-HWC2On1Adapter::Display::HWC1Contents
-        HWC2On1Adapter::Display::cloneRequestedContents() const
+hwc_display_contents_1_t* HWC2On1Adapter::Display::updateReceivedContents()
 {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
 
-    size_t size = sizeof(hwc_display_contents_1_t) +
-            sizeof(hwc_layer_1_t) * (mHwc1RequestedContents->numHwLayers);
-    auto contents = static_cast<hwc_display_contents_1_t*>(std::malloc(size));
-    std::memcpy(contents, mHwc1RequestedContents.get(), size);
-    for (size_t layerId = 0; layerId < contents->numHwLayers; ++layerId) {
-        auto& layer = contents->hwLayers[layerId];
-        // Deep copy the regions to avoid double-frees
-        cloneHWCRegion(layer.visibleRegionScreen);
-        cloneHWCRegion(layer.surfaceDamage);
+    const auto& requested = *mHwc1RequestedContents;
+    size_t numLayers = requested.numHwLayers;
+    bool copyAll = false;
+    if (!mHwc1ReceivedContents ||
+            mHwc1ReceivedContents->numHwLayers != numLayers) {
+        size_t size = sizeof(hwc_display_contents_1_t) +
+                sizeof(hwc_layer_1_t) * numLayers;
+        auto contents =
+                static_cast<hwc_display_contents_1_t*>(std::calloc(size, 1));
+        contents->numHwLayers = numLayers;
+        mHwc1ReceivedContents.reset(contents);
+        copyAll = true;
+    }
+
+    auto& received = *mHwc1ReceivedContents;
+    received.retireFenceFd = requested.retireFenceFd;
+    received.outbuf = requested.outbuf;
+    received.outbufAcquireFenceFd = requested.outbufAcquireFenceFd;
+    received.flags = requested.flags;
+
+    for (size_t hwc1Id = 0; hwc1Id < numLayers; ++hwc1Id) {
+        const auto& from = requested.hwLayers[hwc1Id];
+        auto& to = received.hwLayers[hwc1Id];
+        if (copyAll || mChangedHwc1Layers[hwc1Id]) {
+            // Keep the regions owned by the received contents
+            auto visibleRegion = to.visibleRegionScreen;
+            auto surfaceDamage = to.surfaceDamage;
+            to = from;
+            copyHWCRegion(from.visibleRegionScreen, visibleRegion);
+            copyHWCRegion(from.surfaceDamage, surfaceDamage);
+            to.visibleRegionScreen = visibleRegion;
+            to.surfaceDamage = surfaceDamage;
+            ++mFullLayerCopies;
+        } else {
+            // Only the state which is either written every frame or modified
+            // by HWC1 can differ
+            to.compositionType = from.compositionType;
+            to.hints = from.hints;
+            to.flags = from.flags;
+            to.handle = from.handle;
+            to.acquireFenceFd = from.acquireFenceFd;
+            to.releaseFenceFd = from.releaseFenceFd;
+            ++mPartialLayerCopies;
+        }
     }
-    return HWC1Contents(contents);
+    mChangedHwc1Layers.assign(numLayers, false);
+
+    return mHwc1ReceivedContents.get();
 }
 
-void HWC2On1Adapter::Display::setReceivedContents(HWC1Contents contents)
+void HWC2On1Adapter::Display::handleReceivedContents()
 {
     std::unique_lock<std::recursive_mutex> lock(mStateMutex);
 
-    mHwc1ReceivedContents = std::move(contents);
-
     mChanges.reset(new Changes);
 
     size_t numLayers = mHwc1ReceivedContents->numHwLayers;
@@ -1652,6 +1701,9 @@ std::string HWC2On1Adapter::Display::dump() const
         output << "    Output buffer: " << mOutputBuffer.getBuffer() << '\n';
     }
 
+    output << "    HWC1 layer copies: " << mFullLayerCopies << " full, " <<
+            mPartialLayerCopies << " per-frame state only\n";
+
     if (mHwc1ReceivedContents) {
         output << "    Last received HWC1 state\n";
         output << to_string(*mHwc1ReceivedContents, mDevice.mHwc1MinorVersion);
@@ -1877,6 +1929,7 @@ void HWC2On1Adapter::Display::reallocateHwc1Contents()
             static_cast<hwc_display_contents_1_t*>(std::calloc(size, 1));
     contents->numHwLayers = numLayers;
     mHwc1RequestedContents.reset(contents);
+    mChangedHwc1Layers.assign(numLayers, true);
 }
 
 void HWC2On1Adapter::Display::assignHwc1LayerIds()
@@ -1941,8 +1994,18 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget()
     int32_t height = mActiveConfig->getAttribute(Attribute::Height);
 
     auto& hwc1Target = mHwc1RequestedContents->hwLayers[mLayers.size()];
-    hwc1Target.compositionType = HWC_FRAMEBUFFER_TARGET;
     hwc1Target.releaseFenceFd = -1;
+    // We will set this to the correct value in set
+    hwc1Target.acquireFenceFd = -1;
+
+    // The rest of the target only changes with the size of the display
+    if (hwc1Target.compositionType == HWC_FRAMEBUFFER_TARGET &&
+            hwc1Target.displayFrame.right == width &&
+            hwc1Target.displayFrame.bottom == height) {
+        return;
+    }
+
+    hwc1Target.compositionType = HWC_FRAMEBUFFER_TARGET;
     hwc1Target.hints = 0;
     hwc1Target.flags = 0;
     hwc1Target.transform = 0;
@@ -1955,6 +2018,7 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget()
     }
     hwc1Target.displayFrame = {0, 0, width, height};
     hwc1Target.planeAlpha = 255;
+    std::free(const_cast<hwc_rect_t*>(hwc1Target.visibleRegionScreen.rects));
     hwc1Target.visibleRegionScreen.numRects = 1;
     auto rects = static_cast<hwc_rect_t*>(std::malloc(sizeof(hwc_rect_t)));
     rects[0].left = 0;
@@ -1962,9 +2026,7 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget()
     rects[0].right = width;
     rects[0].bottom = height;
     hwc1Target.visibleRegionScreen.rects = rects;
-
-    // We will set this to the correct value in set
-    hwc1Target.acquireFenceFd = -1;
+    mChangedHwc1Layers[mLayers.size()] = true;
 }
 
 // Layer functions
@@ -2111,19 +2173,28 @@ const sp<Fence>& HWC2On1Adapter::Layer::getReleaseFence() const
     return mReleaseFence.get();
 }
 
-void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer,
+bool HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer,
         bool applyAllState)
 {
-    applyCommonState(hwc1Layer, applyAllState);
+    // Only the composition type may be dirty if nothing else is, and it is
+    // part of the per-frame state
+    bool stateChanged = applyAllState ||
+            (isDirty() && !(mDirtyCount == 1 && mCompositionType.isDirty()));
     auto compositionType = mCompositionType.getPendingValue();
-    if (compositionType == Composition::SolidColor) {
-        applySolidColorState(hwc1Layer, applyAllState);
-    } else if (compositionType == Composition::Sideband) {
-        applySidebandState(hwc1Layer, applyAllState);
-    } else {
+    if (stateChanged) {
+        applyCommonState(hwc1Layer, applyAllState);
+        if (compositionType == Composition::SolidColor) {
+            applySolidColorState(hwc1Layer, applyAllState);
+        } else if (compositionType == Composition::Sideband) {
+            applySidebandState(hwc1Layer, applyAllState);
+        }
+    }
+    if (compositionType != Composition::SolidColor &&
+            compositionType != Composition::Sideband) {
         applyBufferState(hwc1Layer);
     }
     applyCompositionType(hwc1Layer, applyAllState);
+    return stateChanged;
 }
 
 // Layer dump helpers
@@ -2425,23 +2496,20 @@ bool HWC2On1Adapter::prepareAllDisplays()
     }
 
     // Always push the primary display
-    std::vector<HWC2On1Adapter::Display::HWC1Contents> requestedContents;
+    mHwc1Contents.clear();
     auto primaryDisplayId = mHwc1DisplayMap[HWC_DISPLAY_PRIMARY];
     auto& primaryDisplay = mDisplays[primaryDisplayId];
-    auto primaryDisplayContents = primaryDisplay->cloneRequestedContents();
-    requestedContents.push_back(std::move(primaryDisplayContents));
+    mHwc1Contents.push_back(primaryDisplay->updateReceivedContents());
 
     // Push the external display, if present
     if (mHwc1DisplayMap.count(HWC_DISPLAY_EXTERNAL) != 0) {
         auto externalDisplayId = mHwc1DisplayMap[HWC_DISPLAY_EXTERNAL];
         auto& externalDisplay = mDisplays[externalDisplayId];
-        auto externalDisplayContents =
-                externalDisplay->cloneRequestedContents();
-        requestedContents.push_back(std::move(externalDisplayContents));
+        mHwc1Contents.push_back(externalDisplay->updateReceivedContents());
     } else {
         // Even if an external display isn't present, we still need to send
         // at least two displays down to HWC1
-        requestedContents.push_back(nullptr);
+        mHwc1Contents.push_back(nullptr);
     }
 
     // Push the hardware virtual display, if supported and present
@@ -2449,22 +2517,19 @@ bool HWC2On1Adapter::prepareAllDisplays()
         if (mHwc1DisplayMap.count(HWC_DISPLAY_VIRTUAL) != 0) {
             auto virtualDisplayId = mHwc1DisplayMap[HWC_DISPLAY_VIRTUAL];
             auto& virtualDisplay = mDisplays[virtualDisplayId];
-            auto virtualDisplayContents =
-                    virtualDisplay->cloneRequestedContents();
-            requestedContents.push_back(std::move(virtualDisplayContents));
+            mHwc1Contents.push_back(virtualDisplay->updateReceivedContents());
         } else {
-            requestedContents.push_back(nullptr);
+            mHwc1Contents.push_back(nullptr);
         }
     }
 
-    mHwc1Contents.clear();
-    for (auto& displayContents : requestedContents) {
-        mHwc1Contents.push_back(displayContents.get());
+    for (size_t c = 0; c < mHwc1Contents.size(); ++c) {
+        auto& displayContents = mHwc1Contents[c];
         if (!displayContents) {
             continue;
         }
 
-        ALOGV("Display %zd layers:", mHwc1Contents.size() - 1);
+        ALOGV("Display %zd layers:", c);
         for (size_t l = 0; l < displayContents->numHwLayers; ++l) {
             auto& layer = displayContents->hwLayers[l];
             ALOGV("  %zd: %d", l, layer.compositionType);
@@ -2489,7 +2554,7 @@ bool HWC2On1Adapter::prepareAllDisplays()
         }
     }
 
-    // Return the received contents to their respective displays
+    // Let the displays handle the contents received from HWC1
     for (size_t hwc1Id = 0; hwc1Id < mHwc1Contents.size(); ++hwc1Id) {
         if (mHwc1Contents[hwc1Id] == nullptr) {
             continue;
@@ -2497,7 +2562,7 @@ bool HWC2On1Adapter::prepareAllDisplays()
 
         auto displayId = mHwc1DisplayMap[hwc1Id];
         auto& display = mDisplays[displayId];
-        display->setReceivedContents(std::move(requestedContents[hwc1Id]));
+        display->handleReceivedContents();
     }
 
     return true;
@@ -231,8 +231,13 @@ private:
             void populateConfigs(uint32_t width, uint32_t height);
 
             bool prepare();
-            HWC1Contents cloneRequestedContents() const;
-            void setReceivedContents(HWC1Contents contents);
+
+            // Brings the contents handed to HWC1 up to date with the requested
+            // contents and returns them. The same contents are reused from
+            // frame to frame, and only the HWC1 layers whose state was written
+            // by prepare are copied in full.
+            struct hwc_display_contents_1* updateReceivedContents();
+            void handleReceivedContents();
             bool hasChanges() const;
             HWC2::Error set(hwc_display_contents_1& hwcContents);
             void addRetireFence(int fenceFd);
@@ -369,6 +374,11 @@ private:
             bool mZIsDirty;
             HWC1Contents mHwc1RequestedContents;
             HWC1Contents mHwc1ReceivedContents;
+            // Indexed by HWC1 layer ID, true if prepare wrote more than the
+            // per-frame state of the layer since updateReceivedContents
+            std::vector<bool> mChangedHwc1Layers;
+            uint64_t mFullLayerCopies;
+            uint64_t mPartialLayerCopies;
             DeferredFence mRetireFence;
 
             // Will only be non-null after the layer has been validated but
@@ -536,7 +546,9 @@ private:
             void setHwc1Id(size_t id) { mHwc1Id = id; }
             size_t getHwc1Id() const { return mHwc1Id; }
 
-            void applyState(struct hwc_layer_1& hwc1Layer, bool applyAllState);
+            // Returns true if anything besides the buffer and composition
+            // type was written to hwc1Layer
+            bool applyState(struct hwc_layer_1& hwc1Layer, bool applyAllState);
 
             std::string dump() const;
 
@@ -69,7 +69,9 @@ HWComposer::HWComposer(const sp<SurfaceFlinger>& flinger)
       mCBContext(),
       mEventHandler(nullptr),
       mVSyncCounts(),
-      mRemainingHwcVirtualDisplays(0)
+      mRemainingHwcVirtualDisplays(0),
+      mIssuedLayerStateCalls(0),
+      mSkippedLayerStateCalls(0)
 {
     for (size_t i=0 ; i<HWC_NUM_PHYSICAL_DISPLAY_TYPES ; i++) {
         mLastHwVSync[i] = 0;
@@ -861,6 +863,8 @@ void HWComposer::dump(String8& result) const {
     // all the state going into the layers. This is probably better done in
     // Layer itself, but it's going to take a bit of work to get there.
     result.append(mHwcDevice->dump().c_str());
+    result.appendFormat("  Layer state calls: %" PRIu64 " issued, %" PRIu64
+            " skipped\n", mIssuedLayerStateCalls, mSkippedLayerStateCalls);
 }
 
 // ---------------------------------------------------------------------------
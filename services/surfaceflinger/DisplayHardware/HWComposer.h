@@ -158,6 +158,16 @@ public:
 
     status_t setActiveColorMode(int32_t displayId, android_color_mode_t mode);
 
+    // Counts the layer state calls made to the HWC, and those skipped by
+    // Layer because the state was unchanged since it was last sent
+    void countLayerStateCall(bool skipped) {
+        if (skipped) {
+            mSkippedLayerStateCalls++;
+        } else {
+            mIssuedLayerStateCalls++;
+        }
+    }
+
     // for debugging ----------------------------------------------------------
     void dump(String8& out) const;
 
@@ -211,6 +221,8 @@ private:
     EventHandler*                   mEventHandler;
     size_t                          mVSyncCounts[HWC_NUM_PHYSICAL_DISPLAY_TYPES];
     uint32_t                        mRemainingHwcVirtualDisplays;
+    uint64_t                        mIssuedLayerStateCalls;
+    uint64_t                        mSkippedLayerStateCalls;
 
     // protected by mLock
     mutable Mutex mLock;
@@ -52,13 +52,14 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
         const sp<IGraphicBufferProducer>& sink,
         const sp<IGraphicBufferProducer>& bqProducer,
         const sp<IGraphicBufferConsumer>& bqConsumer,
-        const String8& name)
+        const String8& name, bool composeAtSinkSize)
 :   ConsumerBase(bqConsumer),
     mHwc(hwc),
     mDisplayId(dispId),
     mDisplayName(name),
     mSource{},
     mDefaultOutputFormat(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED),
+    mComposeAtSinkSize(composeAtSinkSize),
     mOutputFormat(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED),
     mOutputUsage(GRALLOC_USAGE_HW_COMPOSER),
     mProducerSlotSource(0),
@@ -66,6 +67,8 @@ VirtualDisplaySurface::VirtualDisplaySurface(HWComposer& hwc, int32_t dispId,
     mQueueBufferOutput(),
     mSinkBufferWidth(0),
     mSinkBufferHeight(0),
+    mRequestedWidth(0),
+    mRequestedHeight(0),
     mCompositionType(COMPOSITION_UNKNOWN),
     mFbFence(Fence::NO_FENCE),
     mOutputFence(Fence::NO_FENCE),
@@ -299,19 +302,48 @@ void VirtualDisplaySurface::onFrameCommitted() {
     resetPerFrameState();
 }
 
-void VirtualDisplaySurface::dumpAsString(String8& /* result */) const {
+void VirtualDisplaySurface::dumpAsString(String8& result) const {
+    if (mRequestedWidth != 0 && (mRequestedWidth != mSinkBufferWidth ||
+            mRequestedHeight != mSinkBufferHeight)) {
+        result.appendFormat("   composing at sink size %ux%u instead of "
+                "%ux%u\n", mSinkBufferWidth, mSinkBufferHeight,
+                mRequestedWidth, mRequestedHeight);
+    }
 }
 
 void VirtualDisplaySurface::resizeBuffers(const uint32_t w, const uint32_t h) {
+    mRequestedWidth = w;
+    mRequestedHeight = h;
+
+    uint32_t width = w;
+    uint32_t height = h;
+    if (mComposeAtSinkSize) {
+        // The default buffer size of the sink is the size its consumer wants
+        // to receive. If it is smaller than the display, render at that size
+        // rather than having the consumer scale every frame down.
+        int sinkWidth = 0;
+        int sinkHeight = 0;
+        mSource[SOURCE_SINK]->query(NATIVE_WINDOW_WIDTH, &sinkWidth);
+        mSource[SOURCE_SINK]->query(NATIVE_WINDOW_HEIGHT, &sinkHeight);
+        if (sinkWidth > 0 && sinkHeight > 0 &&
+                static_cast<uint32_t>(sinkWidth) <= w &&
+                static_cast<uint32_t>(sinkHeight) <= h) {
+            width = static_cast<uint32_t>(sinkWidth);
+            height = static_cast<uint32_t>(sinkHeight);
+        }
+        VDS_LOGV("resizeBuffers: %ux%u, composing at %ux%u", w, h,
+                width, height);
+    }
+
     uint32_t tmpW, tmpH, transformHint, numPendingBuffers;
     uint64_t nextFrameNumber;
     mQueueBufferOutput.deflate(&tmpW, &tmpH, &transformHint, &numPendingBuffers,
             &nextFrameNumber);
-    mQueueBufferOutput.inflate(w, h, transformHint, numPendingBuffers,
+    mQueueBufferOutput.inflate(width, height, transformHint, numPendingBuffers,
             nextFrameNumber);
 
-    mSinkBufferWidth = w;
-    mSinkBufferHeight = h;
+    mSinkBufferWidth = width;
+    mSinkBufferHeight = height;
 }
 
 const sp<Fence>& VirtualDisplaySurface::getClientTargetAcquireFence() const {
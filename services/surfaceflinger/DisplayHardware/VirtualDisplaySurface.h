@@ -67,6 +67,12 @@ class IProducerListener;
  * buffer for HWC, and a separate buffer is dequeued from the sink and used as
  * the HWC output buffer. When HWC composition is complete, the scratch buffer
  * is released and the output buffer is queued to the sink.
+ *
+ * If composeAtSinkSize is set and the display is resized to a size larger
+ * than the default buffer size of the sink, composition happens at the size
+ * of the sink instead, so that GLES and HWC don't render pixels that the
+ * consumer would only scale down. DisplayDevice scales the projection to the
+ * size reported by NATIVE_WINDOW_WIDTH and NATIVE_WINDOW_HEIGHT.
  */
 class VirtualDisplaySurface : public DisplaySurface,
                               public BnGraphicBufferProducer,
@@ -76,7 +82,7 @@ public:
             const sp<IGraphicBufferProducer>& sink,
             const sp<IGraphicBufferProducer>& bqProducer,
             const sp<IGraphicBufferConsumer>& bqConsumer,
-            const String8& name);
+            const String8& name, bool composeAtSinkSize);
 
     //
     // DisplaySurface interface
@@ -156,6 +162,7 @@ private:
     const String8 mDisplayName;
     sp<IGraphicBufferProducer> mSource[2]; // indexed by SOURCE_*
     uint32_t mDefaultOutputFormat;
+    const bool mComposeAtSinkSize;
 
     //
     // Inter-frame state
@@ -186,6 +193,10 @@ private:
     // dequeued from the sink, and are used when queueing the buffer.
     uint32_t mSinkBufferWidth, mSinkBufferHeight;
 
+    // The size last passed to resizeBuffers, 0x0 until then. Differs from
+    // the sink buffer size when composing at the size of the sink.
+    uint32_t mRequestedWidth, mRequestedHeight;
+
     //
     // Intra-frame state
     //
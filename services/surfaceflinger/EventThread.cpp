@@ -19,6 +19,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include <cutils/compiler.h>
 
 #include <gui/BitTube.h>
@@ -38,6 +40,11 @@ namespace android {
 // time to wait between VSYNC requests before sending a VSYNC OFF power hint: 40msec.
 const long vsyncHintOffDelay = 40000000;
 
+// bounds of the delay between attempts to send the pending event of a
+// connection whose channel is full, when no vsync is dispatched meanwhile
+static const nsecs_t MIN_STALLED_RETRY_DELAY = ms2ns(16);
+static const nsecs_t MAX_STALLED_RETRY_DELAY = ms2ns(256);
+
 static void vsyncOffCallback(union sigval val) {
     EventThread *ev = (EventThread *)val.sival_ptr;
     ev->sendVsyncHintOff();
@@ -49,7 +56,11 @@ EventThread::EventThread(const sp<VSyncSource>& src, SurfaceFlinger& flinger)
       mFlinger(flinger),
       mUseSoftwareVSync(false),
       mVsyncEnabled(false),
+      mStalledRetryTime(0),
+      mStalledRetryDelay(MIN_STALLED_RETRY_DELAY),
       mDebugVsyncEnabled(false),
+      mCoalescedEvents(0),
+      mDroppedEvents(0),
       mVsyncHintSent(false) {
 
     for (int32_t i=0 ; i<DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES ; i++) {
@@ -101,15 +112,36 @@ sp<EventThread::Connection> EventThread::createEventConnection() const {
 status_t EventThread::registerDisplayEventConnection(
         const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
+    // connections are only promoted when an event other than vsync is
+    // dispatched, clean-up the ones that died since here
+    for (size_t i = 0; i < mDisplayEventConnections.size(); ) {
+        if (mDisplayEventConnections[i].promote() == NULL) {
+            mDisplayEventConnections.removeAt(i);
+        } else {
+            i++;
+        }
+    }
     mDisplayEventConnections.add(connection);
     mCondition.broadcast();
     return NO_ERROR;
 }
 
 void EventThread::removeDisplayEventConnection(
-        const wp<EventThread::Connection>& connection) {
+        const sp<EventThread::Connection>& connection) {
     Mutex::Autolock _l(mLock);
     mDisplayEventConnections.remove(connection);
+    mActiveConnections.remove(connection);
+    mStalledConnections.remove(connection);
+    connection->hasPendingEvent = false;
+}
+
+void EventThread::updateActiveConnectionLocked(
+        const sp<EventThread::Connection>& connection) {
+    if (connection->count >= 0) {
+        mActiveConnections.add(connection);
+    } else {
+        mActiveConnections.remove(connection);
+    }
 }
 
 void EventThread::setVsyncRate(uint32_t count,
@@ -119,6 +151,12 @@ void EventThread::setVsyncRate(uint32_t count,
         const int32_t new_count = (count == 0) ? -1 : count;
         if (connection->count != new_count) {
             connection->count = new_count;
+            updateActiveConnectionLocked(connection);
+            mCondition.broadcast();
+        }
+        if (connection->hasPendingEvent) {
+            // the client is back, try its pending event right away
+            mStalledRetryTime = 0;
             mCondition.broadcast();
         }
     }
@@ -132,6 +170,12 @@ void EventThread::requestNextVsync(
 
     if (connection->count < 0) {
         connection->count = 0;
+        updateActiveConnectionLocked(connection);
+        mCondition.broadcast();
+    }
+    if (connection->hasPendingEvent) {
+        // the client is back, try its pending event right away
+        mStalledRetryTime = 0;
         mCondition.broadcast();
     }
 }
@@ -181,40 +225,116 @@ void EventThread::onHotplugReceived(int type, bool connected) {
 
 bool EventThread::threadLoop() {
     DisplayEventReceiver::Event event;
-    Vector< sp<EventThread::Connection> > signalConnections;
-    signalConnections = waitForEvent(&event);
+    waitForEvent(&event, &mSignalConnections, &mRetryConnections);
+
+    // send the events that didn't fit in their channel before
+    for (const sp<Connection>& conn : mRetryConnections) {
+        sendPendingEvent(conn);
+    }
+    mRetryConnections.clear();
 
     // dispatch events to listeners...
-    const size_t count = signalConnections.size();
+    const size_t count = mSignalConnections.size();
     for (size_t i=0 ; i<count ; i++) {
-        const sp<Connection>& conn(signalConnections[i]);
+        const sp<Connection>& conn(mSignalConnections[i]);
         // now see if we still need to report this event
         status_t err = conn->postEvent(event);
         if (err == -EAGAIN || err == -EWOULDBLOCK) {
             // The destination doesn't accept events anymore, it's probably
-            // full. For now, we just drop the events on the floor.
-            // FIXME: Note that some events cannot be dropped and would have
-            // to be re-sent later.
-            // Right-now we don't have the ability to do this.
-            ALOGW("EventThread: dropping event (%08x) for connection %p",
-                    event.header.type, conn.get());
+            // full.
+            onEventOverflow(conn, event);
         } else if (err < 0) {
             // handle any other error on the pipe as fatal. the only
             // reasonable thing to do is to clean-up this connection.
             // The most common error we'll get here is -EPIPE.
-            removeDisplayEventConnection(signalConnections[i]);
+            removeDisplayEventConnection(conn);
+        } else if (event.header.type ==
+                DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+            // a newer vsync made it, the pending one is obsolete
+            onPendingEventSent(conn);
         }
     }
+    mSignalConnections.clear();
     return true;
 }
 
+void EventThread::sendPendingEvent(
+        const sp<EventThread::Connection>& connection) {
+    DisplayEventReceiver::Event event;
+    {
+        Mutex::Autolock _l(mLock);
+        if (!connection->hasPendingEvent) {
+            return;
+        }
+        event = connection->pendingEvent;
+    }
+
+    status_t err = connection->postEvent(event);
+    if (err == -EAGAIN || err == -EWOULDBLOCK) {
+        // still full, keep it and back off
+        Mutex::Autolock _l(mLock);
+        if (connection->hasPendingEvent) {
+            mStalledConnections.add(connection);
+            mStalledRetryDelay = std::min(mStalledRetryDelay * 2,
+                    MAX_STALLED_RETRY_DELAY);
+            mStalledRetryTime = systemTime(SYSTEM_TIME_MONOTONIC) +
+                    mStalledRetryDelay;
+        }
+    } else if (err < 0) {
+        removeDisplayEventConnection(connection);
+    } else {
+        onPendingEventSent(connection);
+    }
+}
+
+void EventThread::onPendingEventSent(
+        const sp<EventThread::Connection>& connection) {
+    Mutex::Autolock _l(mLock);
+    if (connection->hasPendingEvent) {
+        connection->hasPendingEvent = false;
+        mStalledConnections.remove(connection);
+        mStalledRetryDelay = MIN_STALLED_RETRY_DELAY;
+    }
+}
+
+void EventThread::onEventOverflow(const sp<EventThread::Connection>& connection,
+        const DisplayEventReceiver::Event& event) {
+    Mutex::Autolock _l(mLock);
+    if (event.header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+        // The receiver only cares about the latest vsync once it catches
+        // up, so this one replaces any older pending one and is sent when
+        // the channel drains. One-shot requests aren't re-armed: that would
+        // keep vsync enabled for as long as the receiver is stalled.
+        if (connection->hasPendingEvent) {
+            connection->coalescedEvents++;
+            mCoalescedEvents++;
+        }
+        connection->pendingEvent = event;
+        connection->hasPendingEvent = true;
+        if (mStalledConnections.isEmpty()) {
+            mStalledRetryDelay = MIN_STALLED_RETRY_DELAY;
+            mStalledRetryTime = systemTime(SYSTEM_TIME_MONOTONIC) +
+                    mStalledRetryDelay;
+        }
+        mStalledConnections.add(connection);
+    } else {
+        // FIXME: other events cannot be coalesced and would have to be
+        // re-sent later. Right-now we don't have the ability to do this.
+        connection->droppedEvents++;
+        mDroppedEvents++;
+        ALOGW("EventThread: dropping event (%08x) for connection %p",
+                event.header.type, connection.get());
+    }
+}
+
 // This will return when (1) a vsync event has been received, and (2) there was
-// at least one connection interested in receiving it when we started waiting.
-Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
-        DisplayEventReceiver::Event* event)
+// at least one connection interested in receiving it when we started waiting,
+// or when the pending events of stalled connections are due to be retried.
+void EventThread::waitForEvent(DisplayEventReceiver::Event* event,
+        std::vector< sp<EventThread::Connection> >* signalConnections,
+        std::vector< sp<EventThread::Connection> >* stalledConnections)
 {
     Mutex::Autolock _l(mLock);
-    Vector< sp<EventThread::Connection> > signalConnections;
 
     do {
         bool eventPending = false;
@@ -243,45 +363,59 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
             }
         }
 
-        // find out connections waiting for events
-        size_t count = mDisplayEventConnections.size();
-        for (size_t i=0 ; i<count ; i++) {
-            sp<Connection> connection(mDisplayEventConnections[i].promote());
-            if (connection != NULL) {
-                bool added = false;
-                if (connection->count >= 0) {
-                    // we need vsync events because at least
-                    // one connection is waiting for it
-                    waitForVSync = true;
-                    if (timestamp) {
-                        // we consume the event only if it's time
-                        // (ie: we received a vsync event)
-                        if (connection->count == 0) {
-                            // fired this time around
-                            connection->count = -1;
-                            signalConnections.add(connection);
-                            added = true;
-                        } else if (connection->count == 1 ||
-                                (vsyncCount % connection->count) == 0) {
-                            // continuous event, and time to report it
-                            signalConnections.add(connection);
-                            added = true;
-                        }
-                    }
+        // we need vsync events if at least one connection is waiting for
+        // them
+        waitForVSync = !mActiveConnections.isEmpty();
+        if (timestamp) {
+            // find out connections waiting for this vsync event
+            for (size_t i = 0; i < mActiveConnections.size(); ) {
+                sp<Connection> connection(mActiveConnections[i].promote());
+                if (connection == NULL) {
+                    // the connection has died, clean-up
+                    mActiveConnections.removeAt(i);
+                    continue;
+                }
+                if (connection->count == 0) {
+                    // fired this time around
+                    connection->count = -1;
+                    signalConnections->push_back(connection);
+                    mActiveConnections.removeAt(i);
+                    continue;
+                } else if (connection->count == 1 ||
+                        (vsyncCount % connection->count) == 0) {
+                    // continuous event, and time to report it
+                    signalConnections->push_back(connection);
+                }
+                i++;
+            }
+        } else if (eventPending) {
+            // we don't have a vsync event to process (timestamp==0), but
+            // we have some pending messages, which go to every connection
+            size_t count = mDisplayEventConnections.size();
+            for (size_t i=0 ; i<count ; i++) {
+                sp<Connection> connection(mDisplayEventConnections[i].promote());
+                if (connection != NULL) {
+                    signalConnections->push_back(connection);
+                } else {
+                    // we couldn't promote this reference, the connection has
+                    // died, so clean-up!
+                    mDisplayEventConnections.removeAt(i);
+                    --i; --count;
                 }
+            }
+        }
 
-                if (eventPending && !timestamp && !added) {
-                    // we don't have a vsync event to process
-                    // (timestamp==0), but we have some pending
-                    // messages.
-                    signalConnections.add(connection);
+        // retry the pending events with each vsync dispatched, or once
+        // their delay has passed
+        if (!mStalledConnections.isEmpty() && (timestamp ||
+                systemTime(SYSTEM_TIME_MONOTONIC) >= mStalledRetryTime)) {
+            for (size_t i = 0; i < mStalledConnections.size(); i++) {
+                sp<Connection> connection(mStalledConnections[i].promote());
+                if (connection != NULL) {
+                    stalledConnections->push_back(connection);
                 }
-            } else {
-                // we couldn't promote this reference, the connection has
-                // died, so clean-up!
-                mDisplayEventConnections.removeAt(i);
-                --i; --count;
             }
+            mStalledConnections.clear();
         }
 
         // Here we figure out if we need to enable or disable vsyncs
@@ -301,7 +435,7 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
 
         // note: !timestamp implies signalConnections.isEmpty(), because we
         // don't populate signalConnections if there's no vsync pending
-        if (!timestamp && !eventPending) {
+        if (!timestamp && !eventPending && stalledConnections->empty()) {
             // wait for something to happen
             if (waitForVSync) {
                 // This is where we spend most of our time, waiting
@@ -327,6 +461,14 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                     mVSyncEvent[0].header.timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
                     mVSyncEvent[0].vsync.count++;
                 }
+            } else if (!mStalledConnections.isEmpty()) {
+                // Nobody is interested in vsync, but there are pending
+                // events to retry. Sleep until then, with h/w vsync off.
+                nsecs_t timeout = mStalledRetryTime -
+                        systemTime(SYSTEM_TIME_MONOTONIC);
+                if (timeout > 0) {
+                    mCondition.waitRelative(mLock, timeout);
+                }
             } else {
                 // Nobody is interested in vsync, so we just want to sleep.
                 // h/w vsync should be disabled, so this will wait until we
@@ -335,12 +477,12 @@ Vector< sp<EventThread::Connection> > EventThread::waitForEvent(
                 mCondition.wait(mLock);
             }
         }
-    } while (signalConnections.isEmpty());
+    } while (signalConnections->empty() && stalledConnections->empty());
 
-    // here we're guaranteed to have a timestamp and some connections to signal
+    // here we're guaranteed to have a timestamp and some connections to
+    // signal, or some pending events to retry
     // (The connections might have dropped out of mDisplayEventConnections
     // while we were asleep, but we'll still have strong references to them.)
-    return signalConnections;
 }
 
 void EventThread::enableVSyncLocked() {
@@ -370,14 +512,23 @@ void EventThread::dump(String8& result) const {
             mDebugVsyncEnabled?"enabled":"disabled");
     result.appendFormat("  soft-vsync: %s\n",
             mUseSoftwareVSync?"enabled":"disabled");
-    result.appendFormat("  numListeners=%zu,\n  events-delivered: %u\n",
-            mDisplayEventConnections.size(),
+    result.appendFormat("  numListeners=%zu, active=%zu,\n  events-delivered: %u\n",
+            mDisplayEventConnections.size(), mActiveConnections.size(),
             mVSyncEvent[DisplayDevice::DISPLAY_PRIMARY].vsync.count);
+    result.appendFormat("  events-coalesced: %u, events-dropped: %u, "
+            "stalled=%zu\n", mCoalescedEvents, mDroppedEvents,
+            mStalledConnections.size());
     for (size_t i=0 ; i<mDisplayEventConnections.size() ; i++) {
         sp<Connection> connection =
                 mDisplayEventConnections.itemAt(i).promote();
-        result.appendFormat("    %p: count=%d\n",
-                connection.get(), connection!=NULL ? connection->count : 0);
+        if (connection != NULL) {
+            result.appendFormat("    %p: count=%d, coalesced=%u, dropped=%u%s\n",
+                    connection.get(), connection->count,
+                    connection->coalescedEvents, connection->droppedEvents,
+                    connection->hasPendingEvent ? ", pending" : "");
+        } else {
+            result.appendFormat("    %p: count=0\n", connection.get());
+        }
     }
 }
 
@@ -385,7 +536,9 @@ void EventThread::dump(String8& result) const {
 
 EventThread::Connection::Connection(
         const sp<EventThread>& eventThread)
-    : count(-1), mEventThread(eventThread), mChannel(new BitTube())
+    : count(-1), coalescedEvents(0), droppedEvents(0),
+      hasPendingEvent(false),
+      mEventThread(eventThread), mChannel(new BitTube())
 {
 }
 
@@ -30,6 +30,8 @@
 #include "DisplayDevice.h"
 #include "DisplayHardware/PowerHAL.h"
 
+#include <vector>
+
 // ---------------------------------------------------------------------------
 namespace android {
 // ---------------------------------------------------------------------------
@@ -65,6 +67,18 @@ class EventThread : public Thread, private VSyncSource::Callback {
         // count ==-1 : one-shot event that fired this round / disabled
         int32_t count;
 
+        // events that couldn't be written because the channel was full: a
+        // vsync event replaces the pending one (see below), which is counted
+        // as coalesced, and other events are dropped
+        uint32_t coalescedEvents;
+        uint32_t droppedEvents;
+
+        // the latest vsync event that couldn't be written because the
+        // channel was full, sent once the channel drains. Protected by the
+        // EventThread's mLock.
+        DisplayEventReceiver::Event pendingEvent;
+        bool hasPendingEvent;
+
     private:
         virtual ~Connection();
         virtual void onFirstRef();
@@ -94,8 +108,9 @@ public:
     // called when receiving a hotplug event
     void onHotplugReceived(int type, bool connected);
 
-    Vector< sp<EventThread::Connection> > waitForEvent(
-            DisplayEventReceiver::Event* event);
+    void waitForEvent(DisplayEventReceiver::Event* event,
+            std::vector< sp<EventThread::Connection> >* signalConnections,
+            std::vector< sp<EventThread::Connection> >* stalledConnections);
 
     void dump(String8& result) const;
     void sendVsyncHintOff();
@@ -108,7 +123,12 @@ private:
 
     virtual void onVSyncEvent(nsecs_t timestamp);
 
-    void removeDisplayEventConnection(const wp<Connection>& connection);
+    void removeDisplayEventConnection(const sp<Connection>& connection);
+    void onEventOverflow(const sp<Connection>& connection,
+            const DisplayEventReceiver::Event& event);
+    void sendPendingEvent(const sp<Connection>& connection);
+    void onPendingEventSent(const sp<Connection>& connection);
+    void updateActiveConnectionLocked(const sp<Connection>& connection);
     void enableVSyncLocked();
     void disableVSyncLocked();
     void sendVsyncHintOnLocked();
@@ -123,6 +143,18 @@ private:
 
     // protected by mLock
     SortedVector< wp<Connection> > mDisplayEventConnections;
+    // connections waiting for vsync events (count >= 0), kept up to date
+    // when their count changes so that they are found without going
+    // through every connection at each vsync. Like mDisplayEventConnections,
+    // these are weak references: the connections belong to their clients.
+    SortedVector< wp<Connection> > mActiveConnections;
+    // connections holding a pending event, and when to try sending it again.
+    // A full channel can't wake us up when it drains, so this is retried at
+    // each vsync we dispatch anyway, when the connection asks for vsync
+    // again, and otherwise after a delay that backs off while it stays full.
+    SortedVector< wp<Connection> > mStalledConnections;
+    nsecs_t mStalledRetryTime;
+    nsecs_t mStalledRetryDelay;
     Vector< DisplayEventReceiver::Event > mPendingEvents;
     DisplayEventReceiver::Event mVSyncEvent[DisplayDevice::NUM_BUILTIN_DISPLAY_TYPES];
     bool mUseSoftwareVSync;
@@ -130,6 +162,12 @@ private:
 
     // for debugging
     bool mDebugVsyncEnabled;
+    uint32_t mCoalescedEvents;
+    uint32_t mDroppedEvents;
+
+    // only used by threadLoop(), kept to reuse their storage
+    std::vector< sp<Connection> > mSignalConnections;
+    std::vector< sp<Connection> > mRetryConnections;
 
     bool mVsyncHintSent;
     timer_t mTimerId;
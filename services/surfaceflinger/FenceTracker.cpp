@@ -45,7 +45,7 @@ void FenceTracker::dump(String8* outString) {
         if (frame.glesCompositionDoneTime) {
             outString->appendFormat("- GLES done\t%" PRId64 "\n",
                     frame.glesCompositionDoneTime);
-        } else if (frame.glesCompositionDoneFence != Fence::NO_FENCE) {
+        } else if (frame.glesCompositionDoneFence != NULL) {
             outString->append("- GLES done\tNot signaled\n");
         }
         if (frame.retireTime) {
@@ -82,37 +82,44 @@ static inline bool isValidTimestamp(nsecs_t time) {
     return time > 0 && time < INT64_MAX;
 }
 
+sp<FenceTime> FenceTracker::watchFence(const sp<Fence>& fence) {
+    if (fence == NULL || fence == Fence::NO_FENCE) {
+        return NULL;
+    }
+    return FenceWatcher::getInstance().watch(fence);
+}
+
 void FenceTracker::checkFencesForCompletion() {
     ATRACE_CALL();
     for (auto& frame : mFrames) {
-        if (frame.retireFence != Fence::NO_FENCE) {
+        if (frame.retireFence != NULL) {
             nsecs_t time = frame.retireFence->getSignalTime();
             if (isValidTimestamp(time)) {
                 frame.retireTime = time;
-                frame.retireFence = Fence::NO_FENCE;
+                frame.retireFence = NULL;
             }
         }
-        if (frame.glesCompositionDoneFence != Fence::NO_FENCE) {
+        if (frame.glesCompositionDoneFence != NULL) {
             nsecs_t time = frame.glesCompositionDoneFence->getSignalTime();
             if (isValidTimestamp(time)) {
                 frame.glesCompositionDoneTime = time;
-                frame.glesCompositionDoneFence = Fence::NO_FENCE;
+                frame.glesCompositionDoneFence = NULL;
             }
         }
         for (auto& kv : frame.layers) {
             LayerRecord& layer = kv.second;
-            if (layer.acquireFence != Fence::NO_FENCE) {
+            if (layer.acquireFence != NULL) {
                 nsecs_t time = layer.acquireFence->getSignalTime();
                 if (isValidTimestamp(time)) {
                     layer.acquireTime = time;
-                    layer.acquireFence = Fence::NO_FENCE;
+                    layer.acquireFence = NULL;
                 }
             }
-            if (layer.releaseFence != Fence::NO_FENCE) {
+            if (layer.releaseFence != NULL) {
                 nsecs_t time = layer.releaseFence->getSignalTime();
                 if (isValidTimestamp(time)) {
                     layer.releaseTime = time;
-                    layer.releaseFence = Fence::NO_FENCE;
+                    layer.releaseFence = NULL;
                 }
             }
         }
@@ -146,42 +153,39 @@ void FenceTracker::addFrame(nsecs_t refreshStartTime, sp<Fence> retireFence,
             frame.layers.emplace(std::piecewise_construct,
                     std::forward_as_tuple(layerId),
                     std::forward_as_tuple(name, frameNumber, glesComposition,
-                    postedTime, 0, 0, acquireFence, prevReleaseFence));
+                    postedTime, 0, 0, watchFence(acquireFence),
+                    watchFence(prevReleaseFence)));
             wasGlesCompositionDone = true;
         } else {
             frame.layers.emplace(std::piecewise_construct,
                     std::forward_as_tuple(layerId),
                     std::forward_as_tuple(name, frameNumber, glesComposition,
-                    postedTime, 0, 0, acquireFence, Fence::NO_FENCE));
+                    postedTime, 0, 0, watchFence(acquireFence), NULL));
             auto prevLayer = prevFrame.layers.find(layerId);
             if (prevLayer != prevFrame.layers.end()) {
-                prevLayer->second.releaseFence = prevReleaseFence;
+                prevLayer->second.releaseFence = watchFence(prevReleaseFence);
             }
         }
 #else
         frame.layers.emplace(std::piecewise_construct,
                 std::forward_as_tuple(layerId),
                 std::forward_as_tuple(name, frameNumber, glesComposition,
-                postedTime, 0, 0, acquireFence,
-                glesComposition ? Fence::NO_FENCE : prevReleaseFence));
+                postedTime, 0, 0, watchFence(acquireFence),
+                glesComposition ? NULL : watchFence(prevReleaseFence)));
         if (glesComposition) {
             wasGlesCompositionDone = true;
         }
 #endif
-        frame.layers.emplace(std::piecewise_construct,
-                std::forward_as_tuple(layerId),
-                std::forward_as_tuple(name, frameNumber, glesComposition,
-                postedTime, 0, 0, acquireFence, prevReleaseFence));
     }
 
     frame.frameId = mFrameCounter;
     frame.refreshStartTime = refreshStartTime;
     frame.retireTime = 0;
     frame.glesCompositionDoneTime = 0;
-    prevFrame.retireFence = retireFence;
-    frame.retireFence = Fence::NO_FENCE;
-    frame.glesCompositionDoneFence = wasGlesCompositionDone ? glDoneFence :
-            Fence::NO_FENCE;
+    prevFrame.retireFence = watchFence(retireFence);
+    frame.retireFence = NULL;
+    frame.glesCompositionDoneFence = wasGlesCompositionDone ?
+            watchFence(glDoneFence) : NULL;
 
     mOffset = (mOffset + 1) % MAX_FRAME_HISTORY;
     mFrameCounter++;
@@ -26,13 +26,16 @@
 
 #include <unordered_map>
 
+#include "FenceWatcher.h"
+
 namespace android {
 
 class Layer;
 struct FrameTimestamps;
 /*
  * Keeps a circular buffer of fence/timestamp data for the last N frames in
- * SurfaceFlinger. Gets timestamps for fences after they have signaled.
+ * SurfaceFlinger. Gets timestamps for fences after they have signaled, the
+ * fences are waited for by the FenceWatcher thread.
  */
 class FenceTracker {
 public:
@@ -53,21 +56,21 @@ protected:
          nsecs_t postedTime; // time when buffer was queued
          nsecs_t acquireTime; // timestamp from the acquire fence
          nsecs_t releaseTime; // timestamp from the release fence
-         sp<Fence> acquireFence; // acquire fence
-         sp<Fence> releaseFence; // release fence
+         sp<FenceTime> acquireFence; // acquire fence
+         sp<FenceTime> releaseFence; // release fence
 
          LayerRecord(const String8& name, uint64_t frameNumber,
                  bool isGlesComposition, nsecs_t postedTime,
                  nsecs_t acquireTime, nsecs_t releaseTime,
-                 sp<Fence> acquireFence, sp<Fence> releaseFence) :
+                 sp<FenceTime> acquireFence, sp<FenceTime> releaseFence) :
                  name(name), frameNumber(frameNumber),
                  isGlesComposition(isGlesComposition), postedTime(postedTime),
                  acquireTime(acquireTime), releaseTime(releaseTime),
                  acquireFence(acquireFence), releaseFence(releaseFence) {};
          LayerRecord() : name("uninitialized"), frameNumber(0),
                  isGlesComposition(false), postedTime(0), acquireTime(0),
-                 releaseTime(0), acquireFence(Fence::NO_FENCE),
-                 releaseFence(Fence::NO_FENCE) {};
+                 releaseTime(0), acquireFence(NULL),
+                 releaseFence(NULL) {};
      };
 
      struct FrameRecord {
@@ -82,14 +85,14 @@ protected:
          // timestamp from the GLES composition completion fence
          nsecs_t glesCompositionDoneTime;
          // primary display retire fence for this frame
-         sp<Fence> retireFence;
+         sp<FenceTime> retireFence;
          // if GLES composition was done, the fence for its completion
-         sp<Fence> glesCompositionDoneFence;
+         sp<FenceTime> glesCompositionDoneFence;
 
          FrameRecord() : frameId(0), layers(), refreshStartTime(0),
                  retireTime(0), glesCompositionDoneTime(0),
-                 retireFence(Fence::NO_FENCE),
-                 glesCompositionDoneFence(Fence::NO_FENCE) {}
+                 retireFence(NULL),
+                 glesCompositionDoneFence(NULL) {}
      };
 
      uint64_t mFrameCounter;
@@ -98,6 +101,8 @@ protected:
      Mutex mMutex;
 
      void checkFencesForCompletion();
+     // returns a FenceTime for the fence, or NULL for Fence::NO_FENCE
+     static sp<FenceTime> watchFence(const sp<Fence>& fence);
 };
 
 }
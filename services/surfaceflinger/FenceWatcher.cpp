@@ -0,0 +1,184 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ATRACE_TAG ATRACE_TAG_GRAPHICS
+
+// This is needed for stdint.h to define INT64_MAX in C++
+#define __STDC_LIMIT_MACROS
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include <ui/Fence.h>
+
+#include <utils/String8.h>
+#include <utils/Trace.h>
+
+#include "FenceWatcher.h"
+
+namespace android {
+
+FenceTime::FenceTime(const sp<Fence>& fence) :
+        mFence(fence),
+        mSignalTime(INT64_MAX) {
+}
+
+FenceTime::~FenceTime() {
+}
+
+FenceWatcher& FenceWatcher::getInstance() {
+    static sp<FenceWatcher> sInstance = [] {
+        sp<FenceWatcher> watcher(new FenceWatcher());
+        watcher->run("FenceWatcher", PRIORITY_NORMAL);
+        return watcher;
+    }();
+    return *sInstance;
+}
+
+FenceWatcher::FenceWatcher() :
+        Thread(false),
+        mWakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+        mNumSignaled(0),
+        mNumWakeups(0),
+        mNumWatched(0) {
+    LOG_ALWAYS_FATAL_IF(mWakeFd < 0, "FenceWatcher: eventfd failed: %s",
+            strerror(errno));
+}
+
+FenceWatcher::~FenceWatcher() {
+    for (const auto& watched : mWatched) {
+        close(watched.fd);
+    }
+    close(mWakeFd);
+}
+
+sp<FenceTime> FenceWatcher::watch(const sp<Fence>& fence) {
+    sp<FenceTime> fenceTime(new FenceTime(fence));
+    if (fence == NULL || !fence->isValid()) {
+        fenceTime->mFence.clear();
+        fenceTime->mSignalTime.store(-1, std::memory_order_release);
+        return fenceTime;
+    }
+
+    bool wake;
+    {
+        Mutex::Autolock lock(mMutex);
+        // only the first fence since the thread last woke up needs to wake
+        // it up
+        wake = mAdded.empty();
+        mAdded.push_back(fenceTime);
+    }
+    if (wake) {
+        uint64_t one = 1;
+        if (write(mWakeFd, &one, sizeof(one)) < 0) {
+            ALOGE("FenceWatcher: can't wake up the thread: %s", strerror(errno));
+        }
+    }
+    return fenceTime;
+}
+
+bool FenceWatcher::threadLoop() {
+    std::vector<sp<FenceTime>> added;
+    {
+        Mutex::Autolock lock(mMutex);
+        added.swap(mAdded);
+    }
+
+    // The fences are duplicated here rather than in watch(), to keep all
+    // the system calls on this thread
+    for (const auto& fenceTime : added) {
+        int fd = fenceTime->mFence->dup();
+        if (fd < 0) {
+            fenceTime->mFence.clear();
+            fenceTime->mSignalTime.store(-1, std::memory_order_release);
+            continue;
+        }
+        mWatched.push_back({fenceTime, fd});
+    }
+
+    std::vector<struct pollfd> fds(mWatched.size() + 1);
+    fds[0].fd = mWakeFd;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < mWatched.size(); i++) {
+        fds[i + 1].fd = mWatched[i].fd;
+        fds[i + 1].events = POLLIN;
+    }
+
+    int result = poll(fds.data(), fds.size(), -1);
+    if (result < 0) {
+        if (errno != EINTR) {
+            ALOGE("FenceWatcher: poll failed: %s", strerror(errno));
+        }
+        return true;
+    }
+
+    if (fds[0].revents & POLLIN) {
+        uint64_t count;
+        if (read(mWakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+            ALOGE("FenceWatcher: can't read the wake up event: %s",
+                    strerror(errno));
+        }
+    }
+
+    ATRACE_CALL();
+    size_t numSignaled = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < mWatched.size(); i++) {
+        Watched& watched(mWatched[i]);
+        const short revents = fds[i + 1].revents;
+        if (revents != 0) {
+            nsecs_t signalTime = watched.fenceTime->mFence->getSignalTime();
+            if (signalTime == INT64_MAX && (revents & (POLLERR | POLLNVAL))) {
+                // the fence is in error, it will never signal
+                signalTime = -1;
+            }
+            if (signalTime != INT64_MAX) {
+                watched.fenceTime->mSignalTime.store(signalTime,
+                        std::memory_order_release);
+                watched.fenceTime->mFence.clear();
+                close(watched.fd);
+                numSignaled++;
+                continue;
+            }
+        }
+        if (kept != i) {
+            mWatched[kept] = mWatched[i];
+        }
+        kept++;
+    }
+    mWatched.resize(kept);
+
+    Mutex::Autolock lock(mMutex);
+    mNumSignaled += numSignaled;
+    mNumWakeups++;
+    mNumWatched = mWatched.size();
+    return true;
+}
+
+void FenceWatcher::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    result.appendFormat("FenceWatcher: %zu fences watched, %zu pending, "
+            "%" PRIu64 " signaled in %" PRIu64 " wakeups\n",
+            mNumWatched, mAdded.size(), mNumSignaled, mNumWakeups);
+}
+
+}
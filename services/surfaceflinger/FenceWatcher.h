@@ -0,0 +1,100 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FENCEWATCHER_H
+#define ANDROID_FENCEWATCHER_H
+
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <vector>
+
+namespace android {
+
+class Fence;
+class String8;
+
+// FenceTime holds the signal time of a fence watched by the FenceWatcher. It
+// is filled in asynchronously once the fence signals, so that it can be read
+// from any thread without a system call.
+class FenceTime : public LightRefBase<FenceTime> {
+public:
+    // getSignalTime returns the time at which the fence signaled, INT64_MAX
+    // while it is pending, or -1 if the fence is invalid or in error.
+    nsecs_t getSignalTime() const {
+        return mSignalTime.load(std::memory_order_acquire);
+    }
+
+private:
+    friend class FenceWatcher;
+    friend class LightRefBase<FenceTime>;
+
+    explicit FenceTime(const sp<Fence>& fence);
+    ~FenceTime();
+
+    // only accessed by the FenceWatcher thread once watched
+    sp<Fence> mFence;
+    std::atomic<nsecs_t> mSignalTime;
+};
+
+// FenceWatcher is a process-wide thread that waits for all the fences given
+// to it with a single poll() call, and records their signal time in the
+// corresponding FenceTime. This keeps the per-fence system calls needed to
+// track frame timing off the composition thread.
+class FenceWatcher : public Thread {
+public:
+    static FenceWatcher& getInstance();
+
+    // watch returns a FenceTime that gets the signal time of the fence once
+    // it signals. Invalid fences resolve immediately to -1.
+    sp<FenceTime> watch(const sp<Fence>& fence);
+
+    // dump appends the state of the watcher to the result string.
+    void dump(String8& result) const;
+
+private:
+    FenceWatcher();
+    virtual ~FenceWatcher();
+
+    virtual bool threadLoop();
+
+    // eventfd used to wake up the thread when fences are added
+    int mWakeFd;
+
+    // mMutex protects mAdded and the statistics
+    mutable Mutex mMutex;
+    // fences added since the thread last woke up
+    std::vector<sp<FenceTime>> mAdded;
+    uint64_t mNumSignaled;
+    uint64_t mNumWakeups;
+    size_t mNumWatched;
+
+    // only accessed by the thread
+    struct Watched {
+        sp<FenceTime> fenceTime;
+        int fd;
+    };
+    std::vector<Watched> mWatched;
+};
+
+}
+
+#endif // ANDROID_FENCEWATCHER_H
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "FrameScheduler.h"
+
+namespace android {
+
+FrameScheduler::FrameScheduler()
+    : mMargin(0),
+      mFrameStart(0),
+      mFrameDeadline(0),
+      mDurations(),
+      mNumDurations(0),
+      mNextDuration(0),
+      mNumFrames(0),
+      mNumDelayedFrames(0),
+      mNumLateFrames(0),
+      mTotalDelay(0),
+      mLastPrediction(0) {
+}
+
+void FrameScheduler::setMargin(nsecs_t margin) {
+    Mutex::Autolock lock(mMutex);
+    mMargin = margin;
+    mNumDurations = 0;
+    mNextDuration = 0;
+}
+
+nsecs_t FrameScheduler::getStartDelay(nsecs_t now, nsecs_t deadline) {
+    mFrameDeadline = deadline;
+    if (!isEnabled()) {
+        return 0;
+    }
+
+    Mutex::Autolock lock(mMutex);
+    if (mNumDurations < MIN_HISTORY_SIZE) {
+        return 0;
+    }
+    // The slowest recent frame is the prediction: frames taking a little
+    // longer than usual are common, while the cost of a missed deadline is
+    // a whole refresh period.
+    nsecs_t prediction = *std::max_element(mDurations,
+            mDurations + mNumDurations);
+    mLastPrediction = prediction;
+    nsecs_t delay = deadline - mMargin - prediction - now;
+    if (delay <= 0) {
+        return 0;
+    }
+    mNumDelayedFrames++;
+    mTotalDelay += delay;
+    return delay;
+}
+
+void FrameScheduler::beginFrame(nsecs_t startTime) {
+    mFrameStart = startTime;
+}
+
+void FrameScheduler::endFrame(nsecs_t endTime) {
+    if (mFrameStart == 0) {
+        return;
+    }
+    nsecs_t duration = endTime - mFrameStart;
+    bool late = mFrameDeadline != 0 && endTime > mFrameDeadline;
+    mFrameStart = 0;
+    mFrameDeadline = 0;
+
+    Mutex::Autolock lock(mMutex);
+    mNumFrames++;
+    if (late) {
+        // Start over, this doesn't delay frames until MIN_HISTORY_SIZE
+        // frames have been measured again
+        mNumLateFrames++;
+        mNumDurations = 0;
+        mNextDuration = 0;
+    }
+    mDurations[mNextDuration] = duration;
+    mNextDuration = (mNextDuration + 1) % HISTORY_SIZE;
+    mNumDurations = std::min<size_t>(mNumDurations + 1, HISTORY_SIZE);
+}
+
+void FrameScheduler::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    if (!isEnabled()) {
+        result.append("Frame scheduler: disabled\n");
+        return;
+    }
+    result.appendFormat("Frame scheduler: margin %.3f ms, predicted frame "
+            "duration %.3f ms, %" PRIu64 " frames, %" PRIu64 " delayed "
+            "(mean %.3f ms), %" PRIu64 " late\n",
+            mMargin / 1e6, mLastPrediction / 1e6, mNumFrames,
+            mNumDelayedFrames,
+            mNumDelayedFrames ? mTotalDelay / 1e6 / mNumDelayedFrames : 0.0,
+            mNumLateFrames);
+}
+
+}; // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_FRAMESCHEDULER_H
+#define ANDROID_FRAMESCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+// FrameScheduler decides how long SurfaceFlinger waits after its vsync event
+// before starting a frame. It measures how long recent frames took, from the
+// start of INVALIDATE to the end of REFRESH, and starts the next frame so
+// that it would finish a safety margin before the deadline even if it took
+// as long as the slowest of them. Starting later lets buffers queued by
+// applications shortly after the vsync event make it into the frame, which
+// lowers their latency.
+//
+// After a frame misses its deadline, frames are started without delay until
+// enough new durations have been measured.
+//
+// All the methods but dump must be called from the same thread.
+class FrameScheduler {
+public:
+    FrameScheduler();
+
+    // setMargin sets the time to keep between the predicted end of a frame
+    // and its deadline. A margin of 0 or less disables the scheduler.
+    void setMargin(nsecs_t margin);
+
+    bool isEnabled() const { return mMargin > 0; }
+
+    // getStartDelay returns how long to wait, from now, before starting the
+    // frame that must be done by deadline
+    nsecs_t getStartDelay(nsecs_t now, nsecs_t deadline);
+
+    // beginFrame and endFrame record the start and end of the frame. Frames
+    // without an end, e.g. because no refresh was needed, are not measured.
+    void beginFrame(nsecs_t startTime);
+    void endFrame(nsecs_t endTime);
+
+    void dump(String8& result) const;
+
+private:
+    enum {
+        // the number of frames whose durations are used for the prediction
+        HISTORY_SIZE = 32,
+        // the number of frames to measure before delaying any
+        MIN_HISTORY_SIZE = 8,
+    };
+
+    nsecs_t mMargin;
+
+    // only accessed by the main thread
+    nsecs_t mFrameStart;
+    nsecs_t mFrameDeadline;
+
+    mutable Mutex mMutex;
+    // ring buffer of the durations of the last frames
+    nsecs_t mDurations[HISTORY_SIZE];
+    size_t mNumDurations;
+    size_t mNextDuration;
+    uint64_t mNumFrames;
+    uint64_t mNumDelayedFrames;
+    uint64_t mNumLateFrames;
+    nsecs_t mTotalDelay;
+    nsecs_t mLastPrediction;
+};
+
+}; // namespace android
+
+#endif // ANDROID_FRAMESCHEDULER_H
@@ -50,7 +50,8 @@ void FrameTracker::setFrameReadyTime(nsecs_t readyTime) {
 
 void FrameTracker::setFrameReadyFence(const sp<Fence>& readyFence) {
     Mutex::Autolock lock(mMutex);
-    mFrameRecords[mOffset].frameReadyFence = readyFence;
+    mFrameRecords[mOffset].frameReadyFence =
+            FenceWatcher::getInstance().watch(readyFence);
     mNumFences++;
 }
 
@@ -61,7 +62,8 @@ void FrameTracker::setActualPresentTime(nsecs_t presentTime) {
 
 void FrameTracker::setActualPresentFence(const sp<Fence>& readyFence) {
     Mutex::Autolock lock(mMutex);
-    mFrameRecords[mOffset].actualPresentFence = readyFence;
+    mFrameRecords[mOffset].actualPresentFence =
+            FenceWatcher::getInstance().watch(readyFence);
     mNumFences++;
 }
 
@@ -96,8 +98,8 @@ void FrameTracker::advanceFrame() {
         mNumFences--;
     }
 
-    // Clean up the signaled fences to keep the number of open fence FDs in
-    // this process reasonable.
+    // Pick up the signal times of the fences that signaled, and release
+    // them.
     processFencesLocked();
 }
 
@@ -156,7 +158,7 @@ void FrameTracker::processFencesLocked() const {
         size_t idx = (mOffset+NUM_FRAME_RECORDS-i) % NUM_FRAME_RECORDS;
         bool updated = false;
 
-        const sp<Fence>& rfence = records[idx].frameReadyFence;
+        const sp<FenceTime>& rfence = records[idx].frameReadyFence;
         if (rfence != NULL) {
             records[idx].frameReadyTime = rfence->getSignalTime();
             if (records[idx].frameReadyTime < INT64_MAX) {
@@ -166,7 +168,7 @@ void FrameTracker::processFencesLocked() const {
             }
         }
 
-        const sp<Fence>& pfence = records[idx].actualPresentFence;
+        const sp<FenceTime>& pfence = records[idx].actualPresentFence;
         if (pfence != NULL) {
             records[idx].actualPresentTime = pfence->getSignalTime();
             if (records[idx].actualPresentTime < INT64_MAX) {
@@ -23,6 +23,8 @@
 #include <utils/Timers.h>
 #include <utils/RefBase.h>
 
+#include "FenceWatcher.h"
+
 namespace android {
 
 class String8;
@@ -35,7 +37,9 @@ class Fence;
 //
 // Some of the time values tracked may be set either as a specific timestamp
 // or a fence.  When a non-NULL fence is set for a given time value, the
-// signal time of that fence is used instead of the timestamp.
+// signal time of that fence is used instead of the timestamp.  Fences are
+// waited for by the FenceWatcher thread, so that reading their signal time
+// doesn't need a system call.
 class FrameTracker {
 
 public:
@@ -100,8 +104,8 @@ private:
         nsecs_t desiredPresentTime;
         nsecs_t frameReadyTime;
         nsecs_t actualPresentTime;
-        sp<Fence> frameReadyFence;
-        sp<Fence> actualPresentFence;
+        sp<FenceTime> frameReadyFence;
+        sp<FenceTime> actualPresentFence;
     };
 
     // processFences iterates over all the frame records that have a fence set
@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <math.h>
+#include <string.h>
 
 #include <cutils/compiler.h>
 #include <cutils/native_handle.h>
@@ -51,6 +52,7 @@
 
 #include "RenderEngine/RenderEngine.h"
 
+#include <algorithm>
 #include <mutex>
 
 #define DEBUG_RESIZE    0
@@ -168,6 +170,11 @@ void Layer::onFirstRef() {
 #else
     mProducer->setMaxDequeuedBufferCount(2);
 #endif
+    if (mFlinger->mBufferCountTuning !=
+            IGraphicBufferConsumer::BUFFER_COUNT_TUNING_OFF) {
+        mSurfaceFlingerConsumer->setBufferCountTuning(
+                mFlinger->mBufferCountTuning);
+    }
 
     const sp<const DisplayDevice> hw(mFlinger->getDefaultDisplayDevice());
     updateTransformHint(hw);
@@ -495,6 +502,52 @@ FloatRect Layer::computeCrop(const sp<const DisplayDevice>& hw) const {
     return crop;
 }
 
+#ifdef USE_HWC2
+static bool isSameRegion(const Region& lhs, const Region& rhs) {
+    if (lhs.isTriviallyEqual(rhs)) {
+        return true;
+    }
+    size_t lhsCount = 0;
+    size_t rhsCount = 0;
+    const Rect* lhsRects = lhs.getArray(&lhsCount);
+    const Rect* rhsRects = rhs.getArray(&rhsCount);
+    return lhsCount == rhsCount &&
+            std::equal(lhsRects, lhsRects + lhsCount, rhsRects);
+}
+
+// Whether a state of the HWC layer is the same as the one last sent
+template <typename T>
+static bool isSameHwcState(const T& lhs, const T& rhs) {
+    return lhs == rhs;
+}
+
+static bool isSameHwcState(const Region& lhs, const Region& rhs) {
+    return isSameRegion(lhs, rhs);
+}
+
+static bool isSameHwcState(const hwc_color_t& lhs, const hwc_color_t& rhs) {
+    return memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+}
+
+template <typename T, typename Setter>
+HWC2::Error Layer::HWCInfo::setIfChanged(HWComposer& hwc, uint32_t bit,
+        T& sent, const T& value, Setter setter) {
+    bool update = !(sentState & bit) || !isSameHwcState(sent, value);
+    hwc.countLayerStateCall(!update);
+    if (!update) {
+        return HWC2::Error::None;
+    }
+    auto error = setter(value);
+    if (error != HWC2::Error::None) {
+        sentState &= ~bit;
+    } else {
+        sent = value;
+        sentState |= bit;
+    }
+    return error;
+}
+#endif
+
 #ifdef USE_HWC2
 void Layer::setGeometry(const sp<const DisplayDevice>& displayDevice)
 #else
@@ -506,6 +559,7 @@ void Layer::setGeometry(
 #ifdef USE_HWC2
     const auto hwcId = displayDevice->getHwcDisplayId();
     auto& hwcInfo = mHwcLayers[hwcId];
+    auto& hwc = mFlinger->getHwComposer();
 #else
     layer.setDefaultState();
 #endif
@@ -533,10 +587,16 @@ void Layer::setGeometry(
     if (!isOpaque(s) || s.alpha != 1.0f) {
         auto blendMode = mPremultipliedAlpha ?
                 HWC2::BlendMode::Premultiplied : HWC2::BlendMode::Coverage;
-        auto error = hwcLayer->setBlendMode(blendMode);
-        ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set blend mode %s:"
-                " %s (%d)", mName.string(), to_string(blendMode).c_str(),
-                to_string(error).c_str(), static_cast<int32_t>(error));
+        auto error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_BLEND_MODE,
+                hwcInfo.blendMode, blendMode,
+                [&](HWC2::BlendMode mode) {
+                    return hwcLayer->setBlendMode(mode);
+                });
+        if (error != HWC2::Error::None) {
+            ALOGE("[%s] Failed to set blend mode %s: %s (%d)",
+                    mName.string(), to_string(blendMode).c_str(),
+                    to_string(error).c_str(), static_cast<int32_t>(error));
+        }
     }
 #else
     if (!isOpaque(s) || s.alpha != 0xFF) {
@@ -590,36 +650,46 @@ void Layer::setGeometry(
     }
     const Transform& tr(displayDevice->getTransform());
     Rect transformedFrame = tr.transform(frame);
-    auto error = hwcLayer->setDisplayFrame(transformedFrame);
+    auto error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_DISPLAY_FRAME,
+            hwcInfo.displayFrame, transformedFrame,
+            [&](const Rect& displayFrame) {
+                return hwcLayer->setDisplayFrame(displayFrame);
+            });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set display frame [%d, %d, %d, %d]: %s (%d)",
                 mName.string(), transformedFrame.left, transformedFrame.top,
                 transformedFrame.right, transformedFrame.bottom,
                 to_string(error).c_str(), static_cast<int32_t>(error));
-    } else {
-        hwcInfo.displayFrame = transformedFrame;
     }
 
     FloatRect sourceCrop = computeCrop(displayDevice);
-    error = hwcLayer->setSourceCrop(sourceCrop);
+    error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_SOURCE_CROP,
+            hwcInfo.sourceCrop, sourceCrop,
+            [&](const FloatRect& crop) {
+                return hwcLayer->setSourceCrop(crop);
+            });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set source crop [%.3f, %.3f, %.3f, %.3f]: "
                 "%s (%d)", mName.string(), sourceCrop.left, sourceCrop.top,
-                sourceCrop.right, sourceCrop.bottom, to_string(error).c_str(),
-                static_cast<int32_t>(error));
-    } else {
-        hwcInfo.sourceCrop = sourceCrop;
+                sourceCrop.right, sourceCrop.bottom,
+                to_string(error).c_str(), static_cast<int32_t>(error));
     }
 
-    error = hwcLayer->setPlaneAlpha(s.alpha);
-    ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set plane alpha %.3f: "
-            "%s (%d)", mName.string(), s.alpha, to_string(error).c_str(),
-            static_cast<int32_t>(error));
+    error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_PLANE_ALPHA,
+            hwcInfo.planeAlpha, s.alpha,
+            [&](float alpha) { return hwcLayer->setPlaneAlpha(alpha); });
+    if (error != HWC2::Error::None) {
+        ALOGE("[%s] Failed to set plane alpha %.3f: %s (%d)",
+                mName.string(), s.alpha, to_string(error).c_str(),
+                static_cast<int32_t>(error));
+    }
 
-    error = hwcLayer->setZOrder(s.z);
-    ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set Z %u: %s (%d)",
-            mName.string(), s.z, to_string(error).c_str(),
-            static_cast<int32_t>(error));
+    error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_Z_ORDER, hwcInfo.z, s.z,
+            [&](uint32_t z) { return hwcLayer->setZOrder(z); });
+    if (error != HWC2::Error::None) {
+        ALOGE("[%s] Failed to set Z %u: %s (%d)", mName.string(), s.z,
+                to_string(error).c_str(), static_cast<int32_t>(error));
+    }
 #else
     if (!frame.intersect(hw->getViewport(), &frame)) {
         frame.clear();
@@ -665,10 +735,7 @@ void Layer::setGeometry(
         hwcInfo.forceClientComposition = true;
     } else {
         auto transform = static_cast<HWC2::Transform>(orientation);
-        auto error = hwcLayer->setTransform(transform);
-        ALOGE_IF(error != HWC2::Error::None, "[%s] Failed to set transform %s: "
-                "%s (%d)", mName.string(), to_string(transform).c_str(),
-                to_string(error).c_str(), static_cast<int32_t>(error));
+        setHwcTransform(hwcId, transform);
     }
 #else
     if (orientation & Transform::ROT_INVALID) {
@@ -689,6 +756,19 @@ void Layer::forceClientComposition(int32_t hwcId) {
 
     mHwcLayers[hwcId].forceClientComposition = true;
 }
+
+void Layer::setHwcTransform(int32_t hwcId, HWC2::Transform transform) {
+    auto& hwcInfo = mHwcLayers[hwcId];
+    auto& hwcLayer = hwcInfo.layer;
+    auto error = hwcInfo.setIfChanged(mFlinger->getHwComposer(),
+            HWCInfo::SENT_TRANSFORM, hwcInfo.transform, transform,
+            [&](HWC2::Transform t) { return hwcLayer->setTransform(t); });
+    if (error != HWC2::Error::None) {
+        ALOGE("[%s] Failed to set transform %s: %s (%d)", mName.string(),
+                to_string(transform).c_str(), to_string(error).c_str(),
+                static_cast<int32_t>(error));
+    }
+}
 #endif
 
 #ifdef USE_HWC2
@@ -699,15 +779,27 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
     const auto& viewport = displayDevice->getViewport();
     Region visible = tr.transform(visibleRegion.intersect(viewport));
     auto hwcId = displayDevice->getHwcDisplayId();
-    auto& hwcLayer = mHwcLayers[hwcId].layer;
-    auto error = hwcLayer->setVisibleRegion(visible);
+    auto& hwcInfo = mHwcLayers[hwcId];
+    auto& hwcLayer = hwcInfo.layer;
+    auto& hwc = mFlinger->getHwComposer();
+    HWC2::Error error = HWC2::Error::None;
+
+    error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_VISIBLE_REGION,
+            hwcInfo.visibleRegion, visible,
+            [&](const Region& region) {
+                return hwcLayer->setVisibleRegion(region);
+            });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set visible region: %s (%d)", mName.string(),
                 to_string(error).c_str(), static_cast<int32_t>(error));
         visible.dump(LOG_TAG);
     }
 
-    error = hwcLayer->setSurfaceDamage(surfaceDamageRegion);
+    error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_SURFACE_DAMAGE,
+            hwcInfo.surfaceDamage, surfaceDamageRegion,
+            [&](const Region& region) {
+                return hwcLayer->setSurfaceDamage(region);
+            });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set surface damage: %s (%d)", mName.string(),
                 to_string(error).c_str(), static_cast<int32_t>(error));
@@ -728,7 +820,7 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
     }
 
     // Client layers
-    if (mHwcLayers[hwcId].forceClientComposition ||
+    if (hwcInfo.forceClientComposition ||
             (mActiveBuffer != nullptr && mActiveBuffer->handle == nullptr)) {
         ALOGV("[%s] Requesting Client composition", mName.string());
         setCompositionType(hwcId, HWC2::Composition::Client);
@@ -740,7 +832,9 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
         setCompositionType(hwcId, HWC2::Composition::SolidColor);
 
         // For now, we only support black for DimLayer
-        error = hwcLayer->setColor({0, 0, 0, 255});
+        const hwc_color_t color = {0, 0, 0, 255};
+        error = hwcInfo.setIfChanged(hwc, HWCInfo::SENT_COLOR, hwcInfo.color,
+                color, [&](hwc_color_t c) { return hwcLayer->setColor(c); });
         if (error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set color: %s (%d)", mName.string(),
                     to_string(error).c_str(), static_cast<int32_t>(error));
@@ -748,11 +842,7 @@ void Layer::setPerFrameData(const sp<const DisplayDevice>& displayDevice) {
 
         // Clear out the transform, because it doesn't make sense absent a
         // source buffer
-        error = hwcLayer->setTransform(HWC2::Transform::None);
-        if (error != HWC2::Error::None) {
-            ALOGE("[%s] Failed to clear transform: %s (%d)", mName.string(),
-                    to_string(error).c_str(), static_cast<int32_t>(error));
-        }
+        setHwcTransform(hwcId, HWC2::Transform::None);
 
         return;
     }
@@ -1718,6 +1808,26 @@ void Layer::useEmptyDamage() {
     surfaceDamageRegion.clear();
 }
 
+Region Layer::getScreenDamage(const sp<const DisplayDevice>& hw) const {
+    const Region visible(hw->getTransform().transform(visibleRegion));
+
+    // The surface damage is in buffer space, it only maps directly onto the
+    // layer when the buffer is neither transformed nor scaled
+    const bool damageIsFullScreen = surfaceDamageRegion.isRect() &&
+            surfaceDamageRegion.getBounds() == Rect::INVALID_RECT;
+    const State& s(getDrawingState());
+    if (damageIsFullScreen || mActiveBuffer == NULL ||
+            mCurrentTransform != 0 ||
+            !mCurrentCrop.isEmpty() ||
+            mActiveBuffer->getWidth() != s.active.w ||
+            mActiveBuffer->getHeight() != s.active.h) {
+        return visible;
+    }
+
+    const Transform tr(hw->getTransform() * s.active.transform);
+    return visible.intersect(tr.transform(surfaceDamageRegion));
+}
+
 // ----------------------------------------------------------------------------
 // pageflip handling...
 // ----------------------------------------------------------------------------
@@ -2186,6 +2296,12 @@ void Layer::updateTransformHint(const sp<const DisplayDevice>& hw) const {
 // ----------------------------------------------------------------------------
 
 void Layer::dump(String8& result, Colorizer& colorizer) const
+{
+    dumpState(result, colorizer);
+    dumpBufferQueue(result);
+}
+
+void Layer::dumpState(String8& result, Colorizer& colorizer) const
 {
     const Layer::State& s(getDrawingState());
 
@@ -2235,7 +2351,10 @@ void Layer::dump(String8& result, Colorizer& colorizer) const
             " queued-frames=%d, mRefreshPending=%d\n",
             mFormat, w0, h0, s0,f0,
             mQueuedFrames, mRefreshPending);
+}
 
+void Layer::dumpBufferQueue(String8& result) const
+{
     if (mSurfaceFlingerConsumer != 0) {
         mSurfaceFlingerConsumer->dump(result, "            ");
     }
@@ -2289,6 +2408,64 @@ void Layer::miniDump(String8& result, int32_t hwcId) const {
 }
 #endif
 
+void Layer::fillTraceRecord(const sp<const DisplayDevice>& hw,
+        LayerTraceLayer* record) const {
+    const Layer::State& s(getDrawingState());
+    record->hwcId = hw->getHwcDisplayId();
+    record->z = s.z;
+    record->layerStack = s.layerStack;
+
+    Rect frame;
+    FloatRect crop;
+#ifdef USE_HWC2
+    if (mHwcLayers.count(record->hwcId) != 0) {
+        const HWCInfo& hwcInfo = mHwcLayers.at(record->hwcId);
+        frame = hwcInfo.displayFrame;
+        crop = hwcInfo.sourceCrop;
+        record->compositionType =
+                static_cast<uint8_t>(hwcInfo.compositionType);
+    } else
+#endif
+    {
+        // Not composited by the HWC, computed the way setGeometry does
+        frame = s.active.transform.transform(computeBounds());
+        if (!frame.intersect(hw->getViewport(), &frame)) {
+            frame.clear();
+        }
+        frame = hw->getTransform().transform(frame);
+        crop = computeCrop(hw);
+        record->compositionType = LayerTraceLayer::COMPOSITION_CLIENT;
+    }
+    record->frameLeft = frame.left;
+    record->frameTop = frame.top;
+    record->frameRight = frame.right;
+    record->frameBottom = frame.bottom;
+    record->cropLeft = crop.left;
+    record->cropTop = crop.top;
+    record->cropRight = crop.right;
+    record->cropBottom = crop.bottom;
+
+    record->bufferFrameNumber = mSurfaceFlingerConsumer->getFrameNumber();
+    if (mActiveBuffer != NULL) {
+        record->bufferWidth = mActiveBuffer->getWidth();
+        record->bufferHeight = mActiveBuffer->getHeight();
+        record->bufferFormat = mActiveBuffer->format;
+    }
+#ifdef USE_HWC2
+    record->alpha = s.alpha;
+#else
+    record->alpha = s.alpha / 255.0f;
+#endif
+    record->transform = static_cast<uint8_t>(
+            s.active.transform.getOrientation());
+    record->flags = (isOpaque(s) ? LayerTraceLayer::FLAG_OPAQUE : 0) |
+            (isSecure() ? LayerTraceLayer::FLAG_SECURE : 0) |
+            (isProtected() ? LayerTraceLayer::FLAG_PROTECTED : 0);
+    int32_t queuedFrames = android_atomic_acquire_load(&mQueuedFrames);
+    record->queuedFrames = static_cast<uint8_t>(
+            std::min(queuedFrames, 255));
+}
+
 void Layer::dumpFrameStats(String8& result) const {
     mFrameTracker.dumpStats(result);
 }
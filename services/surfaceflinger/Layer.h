@@ -172,6 +172,13 @@ public:
     void useSurfaceDamage();
     void useEmptyDamage();
 
+    // Returns the area of the display touched by the latest buffer, based on
+    // the surface damage when it can be mapped to the screen, or the whole
+    // visible region otherwise.
+    Region getScreenDamage(const sp<const DisplayDevice>& hw) const;
+
+    uint64_t getCurrentFrameNumber() const { return mCurrentFrameNumber; }
+
     uint32_t getTransactionFlags(uint32_t flags);
     uint32_t setTransactionFlags(uint32_t flags);
 
@@ -380,6 +387,8 @@ public:
     void setHwcLayer(int32_t hwcId, std::shared_ptr<HWC2::Layer>&& layer) {
         if (layer) {
             mHwcLayers[hwcId].layer = layer;
+            // a new HWC layer has none of the previously sent state
+            mHwcLayers[hwcId].sentState = 0;
         } else {
             mHwcLayers.erase(hwcId);
         }
@@ -402,10 +411,19 @@ public:
 
     /* always call base class first */
     void dump(String8& result, Colorizer& colorizer) const;
+    // dump() is dumpState() followed by dumpBufferQueue(). dumpState() reads
+    // the drawing state and must be called with mStateLock held,
+    // dumpBufferQueue() only takes the BufferQueue's own lock.
+    void dumpState(String8& result, Colorizer& colorizer) const;
+    void dumpBufferQueue(String8& result) const;
 #ifdef USE_HWC2
     static void miniDumpHeader(String8& result);
     void miniDump(String8& result, int32_t hwcId) const;
 #endif
+    // fills in the record of this layer for the current frame on hw, see
+    // LayerTracer
+    void fillTraceRecord(const sp<const DisplayDevice>& hw,
+            LayerTraceLayer* record) const;
     void dumpFrameStats(String8& result) const;
     void clearFrameStats();
     void logFrameStats();
@@ -458,6 +476,10 @@ private:
     uint32_t getEffectiveUsage(uint32_t usage) const;
     FloatRect computeCrop(const sp<const DisplayDevice>& hw) const;
     bool isCropped() const;
+#ifdef USE_HWC2
+    // Sets the transform of the HWC layer unless it was already sent
+    void setHwcTransform(int32_t hwcId, HWC2::Transform transform);
+#endif
     static bool getOpacityForFormat(uint32_t format);
 
     // drawing
@@ -586,7 +608,36 @@ private:
           : layer(),
             forceClientComposition(false),
             compositionType(HWC2::Composition::Invalid),
-            clearClientTarget(false) {}
+            clearClientTarget(false),
+            sentState(0),
+            blendMode(HWC2::BlendMode::Invalid),
+            planeAlpha(0.0f),
+            z(0),
+            transform(HWC2::Transform::None),
+            color() {}
+
+        // Bits of sentState, set when the corresponding state below holds
+        // the value last accepted by the HWC layer
+        enum {
+            SENT_BLEND_MODE     = 0x001,
+            SENT_DISPLAY_FRAME  = 0x002,
+            SENT_SOURCE_CROP    = 0x004,
+            SENT_PLANE_ALPHA    = 0x008,
+            SENT_Z_ORDER        = 0x010,
+            SENT_TRANSFORM      = 0x020,
+            SENT_VISIBLE_REGION = 0x040,
+            SENT_SURFACE_DAMAGE = 0x080,
+            SENT_COLOR          = 0x100,
+        };
+
+        // Sends value to the HWC layer with setter, unless it is the same
+        // as the state last sent, whose sentState bit is set. The state is
+        // only updated once the HWC layer accepted the value. Sent and
+        // skipped calls are counted by hwc. Returns the error of the call,
+        // or None if it was skipped.
+        template <typename T, typename Setter>
+        HWC2::Error setIfChanged(HWComposer& hwc, uint32_t bit, T& sent,
+                const T& value, Setter setter);
 
         std::shared_ptr<HWC2::Layer> layer;
         bool forceClientComposition;
@@ -594,6 +645,16 @@ private:
         bool clearClientTarget;
         Rect displayFrame;
         FloatRect sourceCrop;
+
+        // State last sent to the HWC layer, used to skip redundant calls
+        uint32_t sentState;
+        HWC2::BlendMode blendMode;
+        float planeAlpha;
+        uint32_t z;
+        HWC2::Transform transform;
+        Region visibleRegion;
+        Region surfaceDamage;
+        hwc_color_t color;
     };
     std::unordered_map<int32_t, HWCInfo> mHwcLayers;
 #else
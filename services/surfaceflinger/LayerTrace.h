@@ -0,0 +1,126 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LAYERTRACE_H
+#define ANDROID_LAYERTRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary format of the layer traces written by
+ * "dumpsys SurfaceFlinger --layer-trace". This header has no dependencies so
+ * that offline tools can include it.
+ *
+ * A trace is, in host byte order:
+ *     LayerTraceHeader
+ *     LayerTraceFrame[numFrames], oldest first
+ *     LayerTraceLayer[numLayers], the layers of each frame in frame order
+ *     numNames times: int32_t sequence, uint32_t length, char name[length]
+ *
+ * Readers must use the record sizes of the header, so that fields can be
+ * appended to the records without breaking them.
+ */
+
+namespace android {
+
+enum {
+    LAYER_TRACE_MAGIC = 0x544c4653, // "SFLT"
+    LAYER_TRACE_VERSION = 1,
+};
+
+struct LayerTraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t frameSize;
+    uint32_t layerSize;
+    uint32_t numFrames;
+    uint32_t numLayers;
+    uint32_t numNames;
+};
+
+struct LayerTraceFrame {
+    enum {
+        // at least one layer was composited by the GPU
+        FLAG_CLIENT_COMPOSITION = 0x1,
+        // the visible regions were recomputed this frame
+        FLAG_GEOMETRY_CHANGED   = 0x2,
+    };
+
+    // refresh count since SurfaceFlinger started
+    uint64_t frameNumber;
+    // CLOCK_MONOTONIC times, in ns, at which the refresh started and ended
+    int64_t startTime;
+    int64_t endTime;
+    uint32_t numLayers;
+    uint32_t flags;
+};
+
+// One visible layer on one display
+struct LayerTraceLayer {
+    // Same values as HWC2::Composition
+    enum {
+        COMPOSITION_INVALID      = 0,
+        COMPOSITION_CLIENT       = 1,
+        COMPOSITION_DEVICE       = 2,
+        COMPOSITION_SOLID_COLOR  = 3,
+        COMPOSITION_CURSOR       = 4,
+        COMPOSITION_SIDEBAND     = 5,
+    };
+
+    enum {
+        FLAG_OPAQUE    = 0x1,
+        FLAG_SECURE    = 0x2,
+        FLAG_PROTECTED = 0x4,
+    };
+
+    int32_t sequence;
+    // HWC display id, or -1 for displays not backed by the HWC
+    int32_t hwcId;
+    uint32_t z;
+    uint32_t layerStack;
+    // display frame, in display coordinates
+    int32_t frameLeft;
+    int32_t frameTop;
+    int32_t frameRight;
+    int32_t frameBottom;
+    // source crop, in buffer coordinates
+    float cropLeft;
+    float cropTop;
+    float cropRight;
+    float cropBottom;
+    // frame number of the buffer on screen. A new buffer was latched when it
+    // differs from the previous frame's.
+    uint64_t bufferFrameNumber;
+    uint32_t bufferWidth;
+    uint32_t bufferHeight;
+    int32_t bufferFormat;
+    float alpha;
+    uint8_t compositionType;
+    uint8_t transform;
+    uint8_t flags;
+    // buffers queued but not latched yet, saturated at 255
+    uint8_t queuedFrames;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(LayerTraceHeader) == 32, "LayerTraceHeader changed");
+static_assert(sizeof(LayerTraceFrame) == 32, "LayerTraceFrame changed");
+static_assert(sizeof(LayerTraceLayer) == 80, "LayerTraceLayer changed");
+
+}; // namespace android
+
+#endif // ANDROID_LAYERTRACE_H
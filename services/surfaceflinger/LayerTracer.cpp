@@ -0,0 +1,217 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "LayerTracer.h"
+
+namespace android {
+
+LayerTracer::LayerTracer()
+    : mFrameNumber(0),
+      mStartTime(0),
+      mMaxFrames(0),
+      mMaxLayers(0),
+      mNumFrames(0),
+      mNumLayers(0),
+      mDroppedFrames(0) {
+}
+
+void LayerTracer::setCapacity(size_t maxFrames, size_t maxLayers) {
+    Mutex::Autolock lock(mMutex);
+    mMaxFrames = maxLayers != 0 ? maxFrames : 0;
+    mMaxLayers = mMaxFrames != 0 ? maxLayers : 0;
+    mFrames.clear();
+    mFrames.resize(mMaxFrames);
+    mLayers.clear();
+    mLayers.resize(mMaxLayers);
+    mNumFrames = 0;
+    mNumLayers = 0;
+    mDroppedFrames = 0;
+    mNames.clear();
+}
+
+void LayerTracer::beginFrame(nsecs_t startTime) {
+    mStartTime = startTime;
+    mStaged.clear();
+}
+
+LayerTraceLayer* LayerTracer::addLayer(int32_t sequence,
+        const String8& name) {
+    if (mNames.count(sequence) == 0) {
+        Mutex::Autolock lock(mMutex);
+        mNames.emplace(sequence, name);
+    }
+    mStaged.emplace_back();
+    LayerTraceLayer* record = &mStaged.back();
+    memset(record, 0, sizeof(*record));
+    record->sequence = sequence;
+    return record;
+}
+
+void LayerTracer::endFrame(nsecs_t endTime, uint32_t flags) {
+    Frame frame;
+    frame.record.frameNumber = mFrameNumber++;
+    frame.record.startTime = mStartTime;
+    frame.record.endTime = endTime;
+    frame.record.numLayers = static_cast<uint32_t>(mStaged.size());
+    frame.record.flags = flags;
+
+    Mutex::Autolock lock(mMutex);
+    if (mMaxFrames == 0) {
+        return;
+    }
+    if (mStaged.size() > mMaxLayers) {
+        mDroppedFrames++;
+        return;
+    }
+
+    frame.firstLayer = mNumLayers;
+    size_t start = mNumLayers % mMaxLayers;
+    size_t head = std::min(mStaged.size(), mMaxLayers - start);
+    memcpy(&mLayers[start], mStaged.data(), head * sizeof(LayerTraceLayer));
+    memcpy(&mLayers[0], mStaged.data() + head,
+            (mStaged.size() - head) * sizeof(LayerTraceLayer));
+    mNumLayers += mStaged.size();
+
+    mFrames[mNumFrames % mMaxFrames] = frame;
+    mNumFrames++;
+
+    // Each time the frame ring buffer wraps around, forget the names of the
+    // layers that dropped out of the trace
+    if (mNumFrames % mMaxFrames == 0) {
+        pruneNamesLocked();
+    }
+}
+
+void LayerTracer::pruneNamesLocked() {
+    std::unordered_set<int32_t> traced;
+    uint64_t oldestLayer = mNumLayers > mMaxLayers ?
+            mNumLayers - mMaxLayers : 0;
+    for (uint64_t i = oldestLayer; i < mNumLayers; i++) {
+        traced.insert(mLayers[i % mMaxLayers].sequence);
+    }
+    for (auto it = mNames.begin(); it != mNames.end(); ) {
+        if (traced.count(it->first) == 0) {
+            it = mNames.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+static bool writeFully(int fd, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool LayerTracer::writeTo(int fd) const {
+    std::vector<LayerTraceFrame> frames;
+    std::vector<LayerTraceLayer> layers;
+    std::vector<uint8_t> names;
+    uint32_t numNames = 0;
+    {
+        Mutex::Autolock lock(mMutex);
+        if (mMaxFrames != 0) {
+            // Skip the frames whose layer records were overwritten
+            uint64_t oldestFrame = mNumFrames > mMaxFrames ?
+                    mNumFrames - mMaxFrames : 0;
+            uint64_t oldestLayer = mNumLayers > mMaxLayers ?
+                    mNumLayers - mMaxLayers : 0;
+            while (oldestFrame < mNumFrames && mFrames[oldestFrame %
+                    mMaxFrames].firstLayer < oldestLayer) {
+                oldestFrame++;
+            }
+
+            std::unordered_set<int32_t> traced;
+            for (uint64_t f = oldestFrame; f < mNumFrames; f++) {
+                const Frame& frame(mFrames[f % mMaxFrames]);
+                frames.push_back(frame.record);
+                for (uint32_t l = 0; l < frame.record.numLayers; l++) {
+                    layers.push_back(
+                            mLayers[(frame.firstLayer + l) % mMaxLayers]);
+                    traced.insert(layers.back().sequence);
+                }
+            }
+
+            for (const auto& entry : mNames) {
+                if (traced.count(entry.first) == 0) {
+                    continue;
+                }
+                int32_t sequence = entry.first;
+                uint32_t length = static_cast<uint32_t>(entry.second.size());
+                const uint8_t* p = reinterpret_cast<const uint8_t*>(&sequence);
+                names.insert(names.end(), p, p + sizeof(sequence));
+                p = reinterpret_cast<const uint8_t*>(&length);
+                names.insert(names.end(), p, p + sizeof(length));
+                p = reinterpret_cast<const uint8_t*>(entry.second.string());
+                names.insert(names.end(), p, p + length);
+                numNames++;
+            }
+        }
+    }
+
+    LayerTraceHeader header;
+    header.magic = LAYER_TRACE_MAGIC;
+    header.version = LAYER_TRACE_VERSION;
+    header.headerSize = sizeof(LayerTraceHeader);
+    header.frameSize = sizeof(LayerTraceFrame);
+    header.layerSize = sizeof(LayerTraceLayer);
+    header.numFrames = static_cast<uint32_t>(frames.size());
+    header.numLayers = static_cast<uint32_t>(layers.size());
+    header.numNames = numNames;
+
+    return writeFully(fd, &header, sizeof(header)) &&
+            writeFully(fd, frames.data(),
+                    frames.size() * sizeof(LayerTraceFrame)) &&
+            writeFully(fd, layers.data(),
+                    layers.size() * sizeof(LayerTraceLayer)) &&
+            writeFully(fd, names.data(), names.size());
+}
+
+void LayerTracer::dump(String8& result) const {
+    Mutex::Autolock lock(mMutex);
+    if (mMaxFrames == 0) {
+        result.append("Layer trace: disabled\n");
+        return;
+    }
+    result.appendFormat("Layer trace: %zu frames, %zu layer records "
+            "(%zu KiB), %" PRIu64 " frames recorded, %" PRIu64 " dropped, "
+            "%zu layer names\n",
+            mMaxFrames, mMaxLayers,
+            (mMaxFrames * sizeof(Frame) +
+                    mMaxLayers * sizeof(LayerTraceLayer)) / 1024,
+            mNumFrames, mDroppedFrames, mNames.size());
+}
+
+}; // namespace android
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LAYERTRACER_H
+#define ANDROID_LAYERTRACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "LayerTrace.h"
+
+namespace android {
+
+// LayerTracer records, for each refresh, a fixed-size LayerTraceLayer record
+// per visible layer and display into a ring buffer, which can be written out
+// in the LayerTrace.h format at any time.
+//
+// beginFrame, addLayer and endFrame must only be called from the main thread.
+// Records are staged until endFrame, which copies them into the ring buffer
+// under the lock, so writeTo and dump can be called from any thread.
+class LayerTracer {
+public:
+    LayerTracer();
+
+    // setCapacity sizes the ring buffers and discards the trace. A capacity
+    // of 0 frames disables tracing.
+    void setCapacity(size_t maxFrames, size_t maxLayers);
+
+    bool isEnabled() const { return mMaxFrames != 0; }
+
+    void beginFrame(nsecs_t startTime);
+
+    // addLayer returns the record of a layer of the current frame, zeroed
+    // except for the sequence number. It is only valid until the next call.
+    LayerTraceLayer* addLayer(int32_t sequence, const String8& name);
+
+    void endFrame(nsecs_t endTime, uint32_t flags);
+
+    // writeTo writes the trace to fd, returns false if the write failed
+    bool writeTo(int fd) const;
+
+    void dump(String8& result) const;
+
+private:
+    struct Frame {
+        LayerTraceFrame record;
+        // index of the frame's first layer record since tracing started
+        uint64_t firstLayer;
+    };
+
+    // forgets the names of the layers no longer in the ring buffer
+    void pruneNamesLocked();
+
+    // only accessed by the main thread
+    uint64_t mFrameNumber;
+    nsecs_t mStartTime;
+    std::vector<LayerTraceLayer> mStaged;
+
+    mutable Mutex mMutex;
+    size_t mMaxFrames;
+    size_t mMaxLayers;
+    std::vector<Frame> mFrames;
+    std::vector<LayerTraceLayer> mLayers;
+    // frames and layer records written since tracing started
+    uint64_t mNumFrames;
+    uint64_t mNumLayers;
+    // frames dropped because they had more layers than the ring buffer holds
+    uint64_t mDroppedFrames;
+    // modified only by the main thread, under mMutex
+    std::unordered_map<int32_t, String8> mNames;
+};
+
+}; // namespace android
+
+#endif // ANDROID_LAYERTRACER_H
@@ -28,7 +28,9 @@
 #include <gui/BitTube.h>
 
 #include "MessageQueue.h"
+#include "DispSync.h"
 #include "EventThread.h"
+#include "FrameScheduler.h"
 #include "SurfaceFlinger.h"
 
 namespace android {
@@ -57,7 +59,14 @@ void MessageQueue::Handler::dispatchRefresh() {
 
 void MessageQueue::Handler::dispatchInvalidate() {
     if ((android_atomic_or(eventMaskInvalidate, &mEventMask) & eventMaskInvalidate) == 0) {
-        mQueue.mLooper->sendMessage(this, Message(MessageQueue::INVALIDATE));
+        // Only consult the scheduler for an INVALIDATE that is actually posted
+        nsecs_t delay = mQueue.computeInvalidateDelay();
+        if (delay > 0) {
+            mQueue.mLooper->sendMessageDelayed(delay, this,
+                    Message(MessageQueue::INVALIDATE));
+        } else {
+            mQueue.mLooper->sendMessage(this, Message(MessageQueue::INVALIDATE));
+        }
     }
 }
 
@@ -77,6 +86,8 @@ void MessageQueue::Handler::handleMessage(const Message& message) {
 // ---------------------------------------------------------------------------
 
 MessageQueue::MessageQueue()
+    : mFrameScheduler(NULL),
+      mDispSync(NULL)
 {
 }
 
@@ -99,6 +110,13 @@ void MessageQueue::setEventThread(const sp<EventThread>& eventThread)
             MessageQueue::cb_eventReceiver, this);
 }
 
+void MessageQueue::setFrameScheduler(FrameScheduler* scheduler,
+        const DispSync* dispSync)
+{
+    mFrameScheduler = scheduler;
+    mDispSync = dispSync;
+}
+
 void MessageQueue::waitMessage() {
     do {
         IPCThreadState::self()->flushCommands();
@@ -161,6 +179,14 @@ int MessageQueue::eventReceiver(int /*fd*/, int /*events*/) {
     return 1;
 }
 
+nsecs_t MessageQueue::computeInvalidateDelay() {
+    if (mFrameScheduler == NULL || !mFrameScheduler->isEnabled()) {
+        return 0;
+    }
+    return mFrameScheduler->getStartDelay(systemTime(SYSTEM_TIME_MONOTONIC),
+            mDispSync->computeNextRefresh(0));
+}
+
 // ---------------------------------------------------------------------------
 
 }; // namespace android
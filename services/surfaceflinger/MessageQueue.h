@@ -31,8 +31,10 @@
 
 namespace android {
 
+class DispSync;
 class IDisplayEventConnection;
 class EventThread;
+class FrameScheduler;
 class SurfaceFlinger;
 
 // ---------------------------------------------------------------------------
@@ -83,10 +85,13 @@ class MessageQueue {
     sp<IDisplayEventConnection> mEvents;
     sp<BitTube> mEventTube;
     sp<Handler> mHandler;
+    FrameScheduler* mFrameScheduler;
+    const DispSync* mDispSync;
 
 
     static int cb_eventReceiver(int fd, int events, void* data);
     int eventReceiver(int fd, int events);
+    nsecs_t computeInvalidateDelay();
 
 public:
     enum {
@@ -98,11 +103,16 @@ public:
     ~MessageQueue();
     void init(const sp<SurfaceFlinger>& flinger);
     void setEventThread(const sp<EventThread>& events);
+    // delays INVALIDATE messages by what the scheduler returns for the next
+    // refresh predicted by dispSync
+    void setFrameScheduler(FrameScheduler* scheduler,
+            const DispSync* dispSync);
 
     void waitMessage();
     status_t postMessage(const sp<MessageBase>& message, nsecs_t reltime=0);
 
-    // sends INVALIDATE message at next VSYNC
+    // sends INVALIDATE message at next VSYNC, or later if a FrameScheduler
+    // is set
     void invalidate();
     // sends REFRESH message at next VSYNC
     void refresh();
@@ -149,6 +149,15 @@ status_t MonitoredProducer::getUniqueId(uint64_t* outId) const {
     return mProducer->getUniqueId(outId);
 }
 
+status_t MonitoredProducer::setPredictiveAllocation(bool enabled) {
+    return mProducer->setPredictiveAllocation(enabled);
+}
+
+status_t MonitoredProducer::reclaimNextBuffer(int* outSlot,
+        sp<Fence>* outFence) {
+    return mProducer->reclaimNextBuffer(outSlot, outFence);
+}
+
 IBinder* MonitoredProducer::onAsBinder() {
     return IInterface::asBinder(mProducer).get();
 }
@@ -64,6 +64,9 @@ public:
     virtual status_t setSharedBufferMode(bool sharedBufferMode) override;
     virtual status_t setAutoRefresh(bool autoRefresh) override;
     virtual status_t getUniqueId(uint64_t* outId) const override;
+    virtual status_t setPredictiveAllocation(bool enabled) override;
+    virtual status_t reclaimNextBuffer(int* outSlot,
+            sp<Fence>* outFence) override;
 
 private:
     sp<IGraphicBufferProducer> mProducer;
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <utils/String8.h>
+
+#include "CompositionCache.h"
+#include "RenderEngine.h"
+
+namespace android {
+
+CompositionCache::CompositionCache(RenderEngine& engine)
+    : mEngine(engine),
+      mWidth(0),
+      mHeight(0),
+      mTexName(0),
+      mFbName(0),
+      mGeometryGeneration(0),
+      mFullRenders(0),
+      mDamageRenders(0),
+      mReusedFrames(0),
+      mSkippedFrames(0) {
+}
+
+CompositionCache::~CompositionCache() {
+    release();
+}
+
+bool CompositionCache::setTarget(uint32_t width, uint32_t height,
+        uint64_t geometryGeneration, const mat4& colorTransform) {
+    if (mFbName == 0 || mWidth != width || mHeight != height) {
+        release();
+        if (!mEngine.createRenderTarget(width, height, &mTexName, &mFbName)) {
+            mTexName = 0;
+            mFbName = 0;
+            return false;
+        }
+        mWidth = width;
+        mHeight = height;
+    }
+
+    if (mGeometryGeneration != geometryGeneration ||
+            memcmp(mColorTransform.asArray(), colorTransform.asArray(),
+                    sizeof(float) * 16) != 0) {
+        invalidate();
+        mGeometryGeneration = geometryGeneration;
+        mColorTransform = colorTransform;
+    }
+    return true;
+}
+
+CompositionCache::Plan CompositionCache::plan(
+        const std::vector<LayerKey>& layers) {
+    Plan plan;
+    plan.validLayers = 0;
+    plan.cachedLayers = 0;
+
+    // The cached layers must still be the bottom-most layers, in the same
+    // order, for the cached content to be of any use
+    bool valid = mCachedLayers.size() <= layers.size();
+    for (size_t i = 0; valid && i < mCachedLayers.size(); i++) {
+        valid = mCachedLayers[i].sequence == layers[i].sequence;
+    }
+    if (valid) {
+        plan.validLayers = mCachedLayers.size();
+        for (size_t i = 0; i < plan.validLayers; i++) {
+            if (mCachedLayers[i].frameNumber != layers[i].frameNumber) {
+                Change change;
+                change.index = i;
+                change.useSurfaceDamage = layers[i].frameNumber ==
+                        mCachedLayers[i].frameNumber + 1;
+                plan.changes.push_back(change);
+            }
+        }
+    } else {
+        invalidate();
+    }
+
+    // Grow the cache with the layers that were unchanged since the previous
+    // frame
+    size_t cachedLayers = plan.validLayers;
+    while (cachedLayers < layers.size() &&
+            cachedLayers < mPreviousLayers.size() &&
+            layers[cachedLayers] == mPreviousLayers[cachedLayers]) {
+        cachedLayers++;
+    }
+    mPreviousLayers = layers;
+
+    if (cachedLayers < MIN_CACHED_LAYERS) {
+        invalidate();
+        mSkippedFrames++;
+        plan.validLayers = 0;
+        plan.changes.clear();
+        return plan;
+    }
+    plan.cachedLayers = cachedLayers;
+
+    if (plan.validLayers == 0) {
+        mFullRenders++;
+    } else if (!plan.changes.empty() || cachedLayers > plan.validLayers) {
+        mDamageRenders++;
+    } else {
+        mReusedFrames++;
+    }
+    return plan;
+}
+
+void CompositionCache::beginRender(bool clear) {
+    mEngine.bindRenderTarget(mFbName);
+    if (clear) {
+        mEngine.clearWithColor(0, 0, 0, 0);
+    }
+}
+
+void CompositionCache::endRender(const std::vector<LayerKey>& layers,
+        size_t cachedLayers) {
+    mEngine.bindRenderTarget(0);
+    mCachedLayers.assign(layers.begin(), layers.begin() + cachedLayers);
+}
+
+void CompositionCache::draw() const {
+    mEngine.drawRenderTarget(mTexName, mWidth, mHeight);
+}
+
+void CompositionCache::release() {
+    if (mFbName != 0) {
+        mEngine.deleteRenderTarget(mTexName, mFbName);
+        mTexName = 0;
+        mFbName = 0;
+    }
+    mWidth = 0;
+    mHeight = 0;
+    invalidate();
+    mPreviousLayers.clear();
+}
+
+void CompositionCache::invalidate() {
+    mCachedLayers.clear();
+}
+
+void CompositionCache::dump(String8& result, int32_t displayId) const {
+    result.appendFormat("  composition cache [%d]: %ux%u, %zu layers cached, "
+            "full renders=%" PRIu64 ", damage renders=%" PRIu64
+            ", reused=%" PRIu64 ", skipped=%" PRIu64 "\n",
+            displayId, mWidth, mHeight, mCachedLayers.size(),
+            mFullRenders, mDamageRenders, mReusedFrames, mSkippedFrames);
+}
+
+} /* namespace android */
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SF_RENDER_ENGINE_COMPOSITIONCACHE_H
+#define SF_RENDER_ENGINE_COMPOSITIONCACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <ui/mat4.h>
+
+#include <vector>
+
+namespace android {
+
+class RenderEngine;
+class String8;
+
+/*
+ * CompositionCache keeps the composition of the bottom-most, unchanged
+ * client-composited layers of a display in an offscreen render target, so
+ * that they don't have to be redrawn every frame.
+ *
+ * The cache is keyed by the identity and the buffer frame number of each
+ * cached layer. Any geometry change (which SurfaceFlinger reports through
+ * the geometry generation) or color transform change discards it. When the
+ * buffer of a cached layer changes, only the damaged area of the cache is
+ * re-rendered.
+ */
+class CompositionCache {
+public:
+    // minimum number of layers worth caching, drawing the cache costs
+    // about as much as drawing a single full-screen layer
+    enum { MIN_CACHED_LAYERS = 2 };
+
+    struct LayerKey {
+        int32_t sequence;
+        uint64_t frameNumber;
+
+        bool operator==(const LayerKey& other) const {
+            return sequence == other.sequence &&
+                    frameNumber == other.frameNumber;
+        }
+        bool operator!=(const LayerKey& other) const {
+            return !(*this == other);
+        }
+    };
+
+    struct Change {
+        // index of the layer in the list given to plan()
+        size_t index;
+        // true if exactly one new buffer was latched since the layer was
+        // rendered into the cache, in which case the layer's surface damage
+        // is accurate. Otherwise the whole layer must be re-rendered.
+        bool useSurfaceDamage;
+    };
+
+    struct Plan {
+        // number of bottom-most layers whose cached content can be reused
+        // once the changed layers have been re-rendered
+        size_t validLayers;
+        // number of bottom-most layers held by the cache for this frame,
+        // the layers in [validLayers, cachedLayers) must be rendered into
+        // the cache on top of its current content. 0 if the cache should
+        // not be used this frame.
+        size_t cachedLayers;
+        // cached layers whose buffer has changed
+        std::vector<Change> changes;
+    };
+
+    explicit CompositionCache(RenderEngine& engine);
+    ~CompositionCache();
+
+    // Discards the cached content if the size of the target, the geometry
+    // generation or the color transform changed since the last frame.
+    // Returns false if offscreen render targets are not supported.
+    bool setTarget(uint32_t width, uint32_t height,
+            uint64_t geometryGeneration, const mat4& colorTransform);
+
+    // Matches the client-composited layers of this frame, bottom-most
+    // first, against the cached content. Layers that were unchanged in the
+    // previous frame are added to the cache.
+    Plan plan(const std::vector<LayerKey>& layers);
+
+    // Redirects rendering to the offscreen target. When clear is true, the
+    // whole target is cleared first.
+    void beginRender(bool clear);
+
+    // Restores rendering to the display's framebuffer and records the
+    // layers now held by the cache. layers must be those given to plan().
+    void endRender(const std::vector<LayerKey>& layers, size_t cachedLayers);
+
+    // Draws the cached content into the current framebuffer
+    void draw() const;
+
+    // Frees the offscreen target and forgets everything about the layers
+    void release();
+
+    void dump(String8& result, int32_t displayId) const;
+
+private:
+    void invalidate();
+
+    RenderEngine& mEngine;
+
+    uint32_t mWidth;
+    uint32_t mHeight;
+    uint32_t mTexName;
+    uint32_t mFbName;
+
+    uint64_t mGeometryGeneration;
+    mat4 mColorTransform;
+
+    // layers held by the cache, bottom-most first
+    std::vector<LayerKey> mCachedLayers;
+    // layers of the previous frame, used to find stable layers
+    std::vector<LayerKey> mPreviousLayers;
+
+    // statistics
+    uint64_t mFullRenders;
+    uint64_t mDamageRenders;
+    uint64_t mReusedFrames;
+    uint64_t mSkippedFrames;
+};
+
+} /* namespace android */
+
+#endif /* SF_RENDER_ENGINE_COMPOSITIONCACHE_H */
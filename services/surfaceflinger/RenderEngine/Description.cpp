@@ -92,5 +92,25 @@ const mat4& Description::getColorMatrix() const {
     return mColorMatrix;
 }
 
+bool Description::isTextureEnabled() const {
+    return mTextureEnabled;
+}
+
+bool Description::canBatchWith(const Description& other) const {
+    if (mTextureEnabled || other.mTextureEnabled) {
+        return false;
+    }
+    return mPlaneAlpha == other.mPlaneAlpha &&
+            mPremultipliedAlpha == other.mPremultipliedAlpha &&
+            mOpaque == other.mOpaque &&
+            memcmp(mColor, other.mColor, sizeof(mColor)) == 0 &&
+            memcmp(mProjectionMatrix.asArray(), other.mProjectionMatrix.asArray(),
+                    sizeof(float) * 16) == 0 &&
+            mColorMatrixEnabled == other.mColorMatrixEnabled &&
+            (!mColorMatrixEnabled ||
+                    memcmp(mColorMatrix.asArray(), other.mColorMatrix.asArray(),
+                            sizeof(float) * 16) == 0);
+}
+
 
 } /* namespace android */
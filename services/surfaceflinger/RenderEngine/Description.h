@@ -67,6 +67,12 @@ public:
     void setProjectionMatrix(const mat4& mtx);
     void setColorMatrix(const mat4& mtx);
     const mat4& getColorMatrix() const;
+    bool isTextureEnabled() const;
+
+    // returns true if meshes drawn with this description and the other one
+    // can be submitted together, i.e. both are untextured and would use
+    // the same program and uniforms
+    bool canBatchWith(const Description& other) const;
 
 private:
     bool mUniformsDirty;
@@ -285,6 +285,8 @@ void GLES11RenderEngine::drawMesh(const Mesh& mesh) {
             mesh.getPositions());
 
     glDrawArrays(mesh.getPrimitive(), 0, mesh.getVertexCount());
+    mMeshCount++;
+    mDrawCallCount++;
 
     if (mesh.getTexCoordsSize()) {
         glDisableClientState(GL_TEXTURE_COORD_ARRAY);
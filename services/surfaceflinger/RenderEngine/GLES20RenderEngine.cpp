@@ -25,6 +25,7 @@
 #include <utils/Trace.h>
 
 #include <cutils/compiler.h>
+#include <cutils/log.h>
 #include <gui/ISurfaceComposer.h>
 #include <math.h>
 
@@ -40,7 +41,9 @@ namespace android {
 // ---------------------------------------------------------------------------
 
 GLES20RenderEngine::GLES20RenderEngine() :
-        mVpWidth(0), mVpHeight(0) {
+        mVpWidth(0), mVpHeight(0),
+        mBlendEnabled(false), mBlendSrcFactor(GL_ONE),
+        mBatching(false) {
 
     glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxTextureSize);
     glGetIntegerv(GL_MAX_VIEWPORT_DIMS, mMaxViewportDims);
@@ -58,10 +61,13 @@ GLES20RenderEngine::GLES20RenderEngine() :
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0,
             GL_RGB, GL_UNSIGNED_SHORT_5_6_5, protTexData);
 
+    glGenBuffers(1, &mBatchBuffer);
+
     //mColorBlindnessCorrection = M;
 }
 
 GLES20RenderEngine::~GLES20RenderEngine() {
+    releaseCompositionCaches();
 }
 
 
@@ -111,6 +117,7 @@ void GLES20RenderEngine::setViewportAndProjection(
             break;
     }
 
+    flushBatch();
     glViewport(0, 0, vpw, vph);
     mState.setProjectionMatrix(m);
     mVpWidth = vpw;
@@ -136,10 +143,9 @@ void GLES20RenderEngine::setupLayerBlending(
 
     if (alpha < 0xFF || !opaque) {
 #endif
-        glEnable(GL_BLEND);
-        glBlendFunc(premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, premultipliedAlpha ? GL_ONE : GL_SRC_ALPHA);
     } else {
-        glDisable(GL_BLEND);
+        setBlending(false, GL_ONE);
     }
 }
 
@@ -163,10 +169,9 @@ void GLES20RenderEngine::setupDimLayerBlending(int alpha) {
 #else
     if (alpha == 0xFF) {
 #endif
-        glDisable(GL_BLEND);
+        setBlending(false, GL_ONE);
     } else {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        setBlending(true, GL_ONE);
     }
 }
 
@@ -203,12 +208,28 @@ void GLES20RenderEngine::disableTexturing() {
 }
 
 void GLES20RenderEngine::disableBlending() {
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
+}
+
+void GLES20RenderEngine::setBlending(bool enabled, GLenum srcFactor) {
+    if (enabled == mBlendEnabled && (!enabled || srcFactor == mBlendSrcFactor)) {
+        return;
+    }
+    flushBatch();
+    if (enabled) {
+        glEnable(GL_BLEND);
+        glBlendFunc(srcFactor, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+        glDisable(GL_BLEND);
+    }
+    mBlendEnabled = enabled;
+    mBlendSrcFactor = srcFactor;
 }
 
 
 void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
         uint32_t* texName, uint32_t* fbName, uint32_t* status) {
+    flushBatch();
     GLuint tname, name;
     // turn our EGLImage into a texture
     glGenTextures(1, &tname);
@@ -226,6 +247,7 @@ void GLES20RenderEngine::bindImageAsFramebuffer(EGLImageKHR image,
 }
 
 void GLES20RenderEngine::unbindFramebuffer(uint32_t texName, uint32_t fbName) {
+    flushBatch();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fbName);
     glDeleteTextures(1, &texName);
@@ -237,10 +259,15 @@ void GLES20RenderEngine::setupFillWithColor(float r, float g, float b, float a)
     mState.setOpaque(false);
     mState.setColor(r, g, b, a);
     mState.disableTexture();
-    glDisable(GL_BLEND);
+    setBlending(false, GL_ONE);
 }
 
 void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
+    mMeshCount++;
+    if (mBatching && appendToBatch(mesh)) {
+        return;
+    }
+    flushBatch();
 
     ProgramCache::getInstance().useProgram(mState);
 
@@ -260,12 +287,165 @@ void GLES20RenderEngine::drawMesh(const Mesh& mesh) {
             mesh.getPositions());
 
     glDrawArrays(mesh.getPrimitive(), 0, mesh.getVertexCount());
+    mDrawCallCount++;
 
     if (mesh.getTexCoordsSize()) {
         glDisableVertexAttribArray(Program::texCoords);
     }
 }
 
+void GLES20RenderEngine::beginBatch() {
+    mBatching = true;
+}
+
+void GLES20RenderEngine::endBatch() {
+    flushBatch();
+    mBatching = false;
+}
+
+bool GLES20RenderEngine::appendToBatch(const Mesh& mesh) {
+    // Textured meshes are never deferred: layers are bound to their own
+    // (often external) textures right before being drawn, which can't be
+    // merged. This leaves color fills, i.e. the clearing of overlay layers
+    // and dim layers, which commonly come in runs with the same state.
+    if (mesh.getTexCoordsSize() != 0 || mesh.getVertexSize() != 2 ||
+            mState.isTextureEnabled()) {
+        return false;
+    }
+    if (!mBatchVertices.empty() && !mBatchState.canBatchWith(mState)) {
+        flushBatch();
+    }
+    if (mBatchVertices.empty()) {
+        mBatchState = mState;
+    }
+
+    // everything is turned into independent triangles
+    const size_t count = mesh.getVertexCount();
+    const size_t stride = mesh.getStride();
+    const float* positions = mesh.getPositions();
+    auto append = [&](size_t i) {
+        mBatchVertices.push_back(positions[i * stride]);
+        mBatchVertices.push_back(positions[i * stride + 1]);
+    };
+    switch (mesh.getPrimitive()) {
+        case Mesh::TRIANGLES:
+            for (size_t i = 0; i < count; i++) {
+                append(i);
+            }
+            break;
+        case Mesh::TRIANGLE_STRIP:
+            for (size_t i = 2; i < count; i++) {
+                // keep the winding of odd triangles consistent
+                append(i & 1 ? i - 1 : i - 2);
+                append(i & 1 ? i - 2 : i - 1);
+                append(i);
+            }
+            break;
+        case Mesh::TRIANGLE_FAN:
+            for (size_t i = 2; i < count; i++) {
+                append(0);
+                append(i - 1);
+                append(i);
+            }
+            break;
+    }
+    return true;
+}
+
+void GLES20RenderEngine::flushBatch() {
+    if (mBatchVertices.empty()) {
+        return;
+    }
+
+    ProgramCache::getInstance().useProgram(mBatchState);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mBatchBuffer);
+    glBufferData(GL_ARRAY_BUFFER, mBatchVertices.size() * sizeof(GLfloat),
+            mBatchVertices.data(), GL_STREAM_DRAW);
+    glVertexAttribPointer(Program::position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glDrawArrays(GL_TRIANGLES, 0, mBatchVertices.size() / 2);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mDrawCallCount++;
+
+    mBatchVertices.clear();
+}
+
+bool GLES20RenderEngine::createRenderTarget(uint32_t width, uint32_t height,
+        uint32_t* texName, uint32_t* fbName) {
+    flushBatch();
+    GLuint tname, name;
+    glGenTextures(1, &tname);
+    glBindTexture(GL_TEXTURE_2D, tname);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &name);
+    glBindFramebuffer(GL_FRAMEBUFFER, name);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, tname, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        ALOGE("createRenderTarget: %ux%u framebuffer incomplete (0x%04x)",
+                width, height, status);
+        glDeleteFramebuffers(1, &name);
+        glDeleteTextures(1, &tname);
+        return false;
+    }
+
+    *texName = tname;
+    *fbName = name;
+    return true;
+}
+
+void GLES20RenderEngine::deleteRenderTarget(uint32_t texName, uint32_t fbName) {
+    glDeleteFramebuffers(1, &fbName);
+    glDeleteTextures(1, &texName);
+}
+
+void GLES20RenderEngine::bindRenderTarget(uint32_t fbName) {
+    flushBatch();
+    glBindFramebuffer(GL_FRAMEBUFFER, fbName);
+}
+
+void GLES20RenderEngine::drawRenderTarget(uint32_t texName, uint32_t width,
+        uint32_t height) {
+    // The render target was drawn with the same projection as the viewport,
+    // so the texture maps 1:1 onto the viewport.
+    Mesh mesh(Mesh::TRIANGLE_FAN, 4, 2, 2);
+    Mesh::VertexArray<vec2> position(mesh.getPositionArray<vec2>());
+    Mesh::VertexArray<vec2> texCoords(mesh.getTexCoordArray<vec2>());
+    position[0] = vec2(0, 0);
+    position[1] = vec2(0, height);
+    position[2] = vec2(width, height);
+    position[3] = vec2(width, 0);
+    texCoords[0] = vec2(0, 0);
+    texCoords[1] = vec2(0, 1);
+    texCoords[2] = vec2(1, 1);
+    texCoords[3] = vec2(1, 0);
+
+    Texture texture(Texture::TEXTURE_2D, texName);
+    texture.setDimensions(width, height);
+    setupLayerTexturing(texture);
+
+    // the color transform has already been applied to the render target
+    const mat4 colorTransform(setupColorTransform(mat4()));
+    mState.setPlaneAlpha(1.0f);
+    mState.setPremultipliedAlpha(true);
+    mState.setOpaque(false);
+    setBlending(false, GL_ONE);
+
+    drawMesh(mesh);
+
+    setupColorTransform(colorTransform);
+    disableTexturing();
+}
+
 void GLES20RenderEngine::dump(String8& result) {
     RenderEngine::dump(result);
 }
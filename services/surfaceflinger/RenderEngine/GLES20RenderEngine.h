@@ -28,6 +28,8 @@
 #include "ProgramCache.h"
 #include "Description.h"
 
+#include <vector>
+
 // ---------------------------------------------------------------------------
 namespace android {
 // ---------------------------------------------------------------------------
@@ -54,10 +56,26 @@ class GLES20RenderEngine : public RenderEngine {
     Description mState;
     Vector<Group> mGroupStack;
 
+    // blending state last set, deferred meshes are submitted before it
+    // changes
+    bool mBlendEnabled;
+    GLenum mBlendSrcFactor;
+
+    // untextured meshes deferred since beginBatch(), as a list of 2D
+    // triangles all drawn with mBatchState
+    bool mBatching;
+    Description mBatchState;
+    std::vector<GLfloat> mBatchVertices;
+    GLuint mBatchBuffer;
+
     virtual void bindImageAsFramebuffer(EGLImageKHR image,
             uint32_t* texName, uint32_t* fbName, uint32_t* status);
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName);
 
+    void setBlending(bool enabled, GLenum srcFactor);
+    // defers the mesh if it can be merged into the current batch
+    bool appendToBatch(const Mesh& mesh);
+
 public:
     GLES20RenderEngine();
 
@@ -85,6 +103,16 @@ protected:
     virtual void disableBlending();
 
     virtual void drawMesh(const Mesh& mesh);
+    virtual void beginBatch();
+    virtual void endBatch();
+    virtual void flushBatch();
+
+    virtual bool createRenderTarget(uint32_t width, uint32_t height,
+            uint32_t* texName, uint32_t* fbName);
+    virtual void deleteRenderTarget(uint32_t texName, uint32_t fbName);
+    virtual void bindRenderTarget(uint32_t fbName);
+    virtual void drawRenderTarget(uint32_t texName, uint32_t width,
+            uint32_t height);
 
     virtual size_t getMaxTextureSize() const;
     virtual size_t getMaxViewportDims() const;
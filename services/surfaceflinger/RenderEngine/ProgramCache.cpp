@@ -14,9 +14,16 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 
+#include <cutils/log.h>
 #include <utils/String8.h>
 
 #include "ProgramCache.h"
@@ -75,9 +82,118 @@ Formatter& dedent(Formatter& f) {
 
 // -----------------------------------------------------------------------------------------------
 
+// The profile is a text file with a version line followed by one key per
+// line. The version must be bumped whenever the meaning of the keys changes.
+static const char* const PROFILE_PATH = "/data/misc/surfaceflinger/program_cache";
+static const uint32_t PROFILE_VERSION = 1;
+
+// New keys tend to be used in bursts (e.g. when a color transform is
+// enabled), wait a little before saving the profile to write it only once.
+static const nsecs_t PROFILE_SAVE_DELAY = ms2ns(1000);
+
+static bool isValidKey(uint32_t key) {
+    if (key & ~ProgramCache::Key::ALL_MASKS) {
+        return false;
+    }
+    uint32_t tex = key & ProgramCache::Key::TEXTURE_MASK;
+    return tex == ProgramCache::Key::TEXTURE_OFF ||
+            tex == ProgramCache::Key::TEXTURE_EXT ||
+            tex == ProgramCache::Key::TEXTURE_2D;
+}
+
+/*
+ * ProfileThread compiles the programs of the profile on a context sharing
+ * its objects with the main context, then saves the profile whenever new
+ * keys are used.
+ */
+
+class ProgramCache::ProfileThread : public Thread {
+public:
+    ProfileThread(ProgramCache& cache, EGLDisplay display, EGLSurface surface,
+            EGLContext context, const Vector<Key>& keys)
+        : Thread(false),
+          mCache(cache),
+          mDisplay(display),
+          mSurface(surface),
+          mContext(context),
+          mKeys(keys) {
+    }
+
+private:
+    virtual bool threadLoop();
+    void compilePrograms();
+
+    ProgramCache& mCache;
+    EGLDisplay mDisplay;
+    EGLSurface mSurface;
+    EGLContext mContext;
+    Vector<Key> mKeys;
+};
+
+bool ProgramCache::ProfileThread::threadLoop() {
+    if (mContext != EGL_NO_CONTEXT) {
+        compilePrograms();
+        mContext = EGL_NO_CONTEXT;
+        mSurface = EGL_NO_SURFACE;
+        mKeys.clear();
+    }
+
+    {
+        Mutex::Autolock _l(mCache.mLock);
+        while (!mCache.mProfileDirty) {
+            mCache.mProfileCondition.wait(mCache.mLock);
+        }
+    }
+
+    usleep(ns2us(PROFILE_SAVE_DELAY));
+
+    SortedVector<Key> keys;
+    {
+        Mutex::Autolock _l(mCache.mLock);
+        keys = mCache.mProfileKeys;
+        mCache.mProfileDirty = false;
+    }
+    saveProfile(keys);
+    return true;
+}
+
+void ProgramCache::ProfileThread::compilePrograms() {
+    if (!eglMakeCurrent(mDisplay, mSurface, mSurface, mContext)) {
+        ALOGE("ProgramCache: can't make the shared context current (0x%x)",
+                eglGetError());
+    } else {
+        nsecs_t timeBefore = systemTime();
+        for (size_t i = 0; i < mKeys.size(); i++) {
+            Program* program = generateProgram(mKeys[i]);
+            // Objects of a shared context are only guaranteed to be complete
+            // for the other contexts once the commands creating them have
+            // finished
+            glFinish();
+
+            Mutex::Autolock _l(mCache.mLock);
+            mCache.mPendingPrograms.add(mKeys[i], program);
+            mCache.mHasPendingPrograms.store(true, std::memory_order_release);
+        }
+        nsecs_t timeAfter = systemTime();
+        float compileTimeMs = static_cast<float>(timeAfter - timeBefore) / 1.0E6;
+        ALOGD("profiled shaders generated - %zu shaders in %f ms\n",
+                mKeys.size(), compileTimeMs);
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+    if (mSurface != EGL_NO_SURFACE) {
+        eglDestroySurface(mDisplay, mSurface);
+    }
+    eglDestroyContext(mDisplay, mContext);
+}
+
+// -----------------------------------------------------------------------------------------------
+
 ANDROID_SINGLETON_STATIC_INSTANCE(ProgramCache)
 
-ProgramCache::ProgramCache() {
+ProgramCache::ProgramCache()
+    : mProfileDirty(false),
+      mHasPendingPrograms(false) {
     // Until surfaceflinger has a dependable blob cache on the filesystem,
     // generate shaders on initialization so as to avoid jank.
     primeCache();
@@ -115,6 +231,107 @@ void ProgramCache::primeCache() {
     ALOGD("shader cache generated - %u shaders in %f ms\n", shaderCount, compileTimeMs);
 }
 
+void ProgramCache::warmUp(EGLDisplay display, EGLSurface surface,
+        EGLContext context) {
+    SortedVector<Key> profile;
+    loadProfile(profile);
+
+    // Only the programs not primed already are built in the background.
+    // Note that priming the cache on the main context is also what enables
+    // the position attribute array there.
+    Vector<Key> keys;
+    for (size_t i = 0; i < profile.size(); i++) {
+        if (mCache.indexOfKey(profile[i]) < 0) {
+            keys.add(profile[i]);
+        }
+    }
+
+    {
+        Mutex::Autolock _l(mLock);
+        for (size_t i = 0; i < profile.size(); i++) {
+            mProfileKeys.add(profile[i]);
+        }
+    }
+
+    mProfileThread = new ProfileThread(*this, display, surface, context, keys);
+    mProfileThread->run("ProgramCache", PRIORITY_BACKGROUND);
+}
+
+void ProgramCache::addPendingPrograms() {
+    Mutex::Autolock _l(mLock);
+    for (size_t i = 0; i < mPendingPrograms.size(); i++) {
+        const Key& key(mPendingPrograms.keyAt(i));
+        if (mCache.indexOfKey(key) < 0) {
+            mCache.add(key, mPendingPrograms.valueAt(i));
+        } else {
+            // the main thread needed it before the profile thread was done
+            delete mPendingPrograms.valueAt(i);
+        }
+    }
+    mPendingPrograms.clear();
+    mHasPendingPrograms.store(false, std::memory_order_relaxed);
+}
+
+void ProgramCache::recordKey(const Key& key) {
+    mUsedKeys.add(key);
+
+    Mutex::Autolock _l(mLock);
+    if (mProfileKeys.indexOf(key) < 0) {
+        mProfileKeys.add(key);
+        mProfileDirty = true;
+        mProfileCondition.signal();
+    }
+}
+
+void ProgramCache::loadProfile(SortedVector<Key>& keys) {
+    FILE* file = fopen(PROFILE_PATH, "r");
+    if (file == NULL) {
+        // first boot, or the profile was removed
+        return;
+    }
+
+    uint32_t version = 0;
+    if (fscanf(file, "version %u\n", &version) != 1 || version != PROFILE_VERSION) {
+        ALOGW("ignoring program cache profile with version %u", version);
+        fclose(file);
+        return;
+    }
+
+    uint32_t value;
+    while (fscanf(file, "%x\n", &value) == 1) {
+        if (isValidKey(value)) {
+            Key key;
+            key.mKey = value;
+            keys.add(key);
+        }
+    }
+    fclose(file);
+}
+
+void ProgramCache::saveProfile(const SortedVector<Key>& keys) {
+    // write a new file and rename it, so that the profile is never seen
+    // partially written
+    String8 tmpPath(PROFILE_PATH);
+    tmpPath.append(".tmp");
+    FILE* file = fopen(tmpPath.string(), "w");
+    if (file == NULL) {
+        ALOGE("can't write program cache profile %s: %s", tmpPath.string(),
+                strerror(errno));
+        return;
+    }
+
+    fprintf(file, "version %u\n", PROFILE_VERSION);
+    for (size_t i = 0; i < keys.size(); i++) {
+        fprintf(file, "%08x\n", keys[i].mKey);
+    }
+    bool success = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    success = (fclose(file) == 0) && success;
+    if (!success || rename(tmpPath.string(), PROFILE_PATH) != 0) {
+        ALOGE("can't save program cache profile: %s", strerror(errno));
+        unlink(tmpPath.string());
+    }
+}
+
 ProgramCache::Key ProgramCache::computeKey(const Description& description) {
     Key needs;
     needs.set(Key::TEXTURE_MASK,
@@ -227,6 +444,13 @@ void ProgramCache::useProgram(const Description& description) {
     // generate the key for the shader based on the description
     Key needs(computeKey(description));
 
+    if (mHasPendingPrograms.load(std::memory_order_acquire)) {
+        addPendingPrograms();
+    }
+    if (mUsedKeys.indexOf(needs) < 0) {
+        recordKey(needs);
+    }
+
      // look-up the program in the cache
     Program* program = mCache.valueFor(needs);
     if (program == NULL) {
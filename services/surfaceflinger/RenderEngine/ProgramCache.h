@@ -17,11 +17,19 @@
 #ifndef SF_RENDER_ENGINE_PROGRAMCACHE_H
 #define SF_RENDER_ENGINE_PROGRAMCACHE_H
 
+#include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
+#include <utils/Condition.h>
 #include <utils/Singleton.h>
 #include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/SortedVector.h>
+#include <utils/Thread.h>
 #include <utils/TypeHelpers.h>
+#include <utils/Vector.h>
+
+#include <atomic>
 
 #include "Description.h"
 
@@ -36,6 +44,10 @@ class String8;
  * Description. It's responsible for figuring out what to
  * generate from a Description.
  * It also maintains a cache of these Programs.
+ *
+ * The keys used at runtime are recorded in a profile on the filesystem, so
+ * that the programs used by previous runs can be compiled ahead of time on a
+ * background thread (see warmUp()).
  */
 class ProgramCache : public Singleton<ProgramCache> {
 public:
@@ -69,6 +81,10 @@ public:
             COLOR_MATRIX_OFF        =       0x00000000,
             COLOR_MATRIX_ON         =       0x00000020,
             COLOR_MATRIX_MASK       =       0x00000020,
+
+            ALL_MASKS               =       BLEND_MASK | OPACITY_MASK |
+                                            PLANE_ALPHA_MASK | TEXTURE_MASK |
+                                            COLOR_MATRIX_MASK,
         };
 
         inline Key() : mKey(0) { }
@@ -111,9 +127,25 @@ public:
     // if none can be found.
     void useProgram(const Description& description);
 
+    // Compiles the programs recorded in the profile by previous runs, on a
+    // background thread, and starts saving the profile as new keys are
+    // used. context must be a GLES 2 context sharing its objects with the
+    // main context, and surface a surface it can be made current with
+    // (or EGL_NO_SURFACE). Both are destroyed once the programs are built.
+    void warmUp(EGLDisplay display, EGLSurface surface, EGLContext context);
+
 private:
+    class ProfileThread;
+
     // Generate shaders to populate the cache
     void primeCache();
+    // adds the programs built by the profile thread to the cache
+    void addPendingPrograms();
+    // records a key used for the first time in the profile
+    void recordKey(const Key& key);
+    // reads/writes the keys of the profile from/to the filesystem
+    static void loadProfile(SortedVector<Key>& keys);
+    static void saveProfile(const SortedVector<Key>& keys);
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
     // generates a program from the Key
@@ -126,6 +158,20 @@ private:
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk.
     DefaultKeyedVector<Key, Program*> mCache;
+    // keys used since startup, only accessed from the main thread
+    SortedVector<Key> mUsedKeys;
+
+    // protects the members below, shared with the profile thread
+    mutable Mutex mLock;
+    Condition mProfileCondition;
+    // keys loaded from the profile and used since startup
+    SortedVector<Key> mProfileKeys;
+    bool mProfileDirty;
+    // programs built by the profile thread, not yet in mCache
+    KeyedVector<Key, Program*> mPendingPrograms;
+    std::atomic<bool> mHasPendingPrograms;
+
+    sp<ProfileThread> mProfileThread;
 };
 
 
@@ -14,11 +14,14 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
+
 #include <cutils/log.h>
 #include <ui/Rect.h>
 #include <ui/Region.h>
 
 #include "RenderEngine.h"
+#include "CompositionCache.h"
 #include "GLES10RenderEngine.h"
 #include "GLES11RenderEngine.h"
 #include "GLES20RenderEngine.h"
@@ -148,7 +151,8 @@ RenderEngine* RenderEngine::create(EGLDisplay display, int hwcFormat) {
     return engine;
 }
 
-RenderEngine::RenderEngine() : mEGLConfig(NULL), mEGLContext(EGL_NO_CONTEXT) {
+RenderEngine::RenderEngine() : mEGLConfig(NULL), mEGLContext(EGL_NO_CONTEXT),
+        mMeshCount(0), mDrawCallCount(0) {
 }
 
 RenderEngine::~RenderEngine() {
@@ -220,21 +224,25 @@ void RenderEngine::fillRegionWithColor(const Region& region, uint32_t height,
 }
 
 void RenderEngine::flush() {
+    flushBatch();
     glFlush();
 }
 
 void RenderEngine::clearWithColor(float red, float green, float blue, float alpha) {
+    flushBatch();
     glClearColor(red, green, blue, alpha);
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
 void RenderEngine::setScissor(
         uint32_t left, uint32_t bottom, uint32_t right, uint32_t top) {
+    flushBatch();
     glScissor(left, bottom, right, top);
     glEnable(GL_SCISSOR_TEST);
 }
 
 void RenderEngine::disableScissor() {
+    flushBatch();
     glDisable(GL_SCISSOR_TEST);
 }
 
@@ -247,9 +255,51 @@ void RenderEngine::deleteTextures(size_t count, uint32_t const* names) {
 }
 
 void RenderEngine::readPixels(size_t l, size_t b, size_t w, size_t h, uint32_t* pixels) {
+    flushBatch();
     glReadPixels(l, b, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
 
+void RenderEngine::beginBatch() {
+}
+
+void RenderEngine::endBatch() {
+}
+
+void RenderEngine::flushBatch() {
+}
+
+bool RenderEngine::createRenderTarget(uint32_t /*width*/, uint32_t /*height*/,
+        uint32_t* /*texName*/, uint32_t* /*fbName*/) {
+    return false;
+}
+
+void RenderEngine::deleteRenderTarget(uint32_t /*texName*/,
+        uint32_t /*fbName*/) {
+}
+
+void RenderEngine::bindRenderTarget(uint32_t /*fbName*/) {
+}
+
+void RenderEngine::drawRenderTarget(uint32_t /*texName*/, uint32_t /*width*/,
+        uint32_t /*height*/) {
+}
+
+CompositionCache& RenderEngine::getCompositionCache(int32_t displayId) {
+    std::unique_ptr<CompositionCache>& cache(mCompositionCaches[displayId]);
+    if (!cache) {
+        cache.reset(new CompositionCache(*this));
+    }
+    return *cache;
+}
+
+void RenderEngine::releaseCompositionCache(int32_t displayId) {
+    mCompositionCaches.erase(displayId);
+}
+
+void RenderEngine::releaseCompositionCaches() {
+    mCompositionCaches.clear();
+}
+
 void RenderEngine::dump(String8& result) {
     const GLExtensions& extensions(GLExtensions::getInstance());
     result.appendFormat("GLES: %s, %s, %s\n",
@@ -257,6 +307,11 @@ void RenderEngine::dump(String8& result) {
             extensions.getRenderer(),
             extensions.getVersion());
     result.appendFormat("%s\n", extensions.getExtension());
+    result.appendFormat("draw calls: %" PRIu64 " for %" PRIu64 " meshes\n",
+            mDrawCallCount, mMeshCount);
+    for (const auto& entry : mCompositionCaches) {
+        entry.second->dump(result, entry.first);
+    }
 }
 
 // ---------------------------------------------------------------------------
@@ -439,10 +494,47 @@ EGLConfig RenderEngine::chooseEglConfig(EGLDisplay display, int format) {
 }
 
 
-void RenderEngine::primeCache() const {
+void RenderEngine::primeCache(EGLDisplay display) const {
     // Getting the ProgramCache instance causes it to prime its shader cache,
     // which is performed in its constructor
-    ProgramCache::getInstance();
+    ProgramCache& cache(ProgramCache::getInstance());
+
+    // The programs used by previous runs are built in the background, on a
+    // context sharing its objects with ours. This only applies to GLES 2.
+    EGLint version = 0;
+    eglQueryContext(display, mEGLContext, EGL_CONTEXT_CLIENT_VERSION, &version);
+    if (version < 2) {
+        return;
+    }
+
+    EGLint contextAttributes[] = {
+            EGL_CONTEXT_CLIENT_VERSION, 2,
+            EGL_NONE
+    };
+    EGLContext ctxt = eglCreateContext(display, mEGLConfig, mEGLContext,
+            contextAttributes);
+    if (ctxt == EGL_NO_CONTEXT) {
+        ALOGW("can't create the program cache context (0x%x)", eglGetError());
+        return;
+    }
+
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (!findExtension(eglQueryStringImplementationANDROID(display, EGL_EXTENSIONS),
+            "EGL_KHR_surfaceless_context")) {
+        EGLConfig config = mEGLConfig;
+        if (config == EGL_NO_CONFIG) {
+            config = chooseEglConfig(display, HAL_PIXEL_FORMAT_RGBA_8888);
+        }
+        EGLint attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, attribs);
+        if (surface == EGL_NO_SURFACE) {
+            ALOGW("can't create the program cache pbuffer (0x%x)", eglGetError());
+            eglDestroyContext(display, ctxt);
+            return;
+        }
+    }
+
+    cache.warmUp(display, surface, ctxt);
 }
 
 // ---------------------------------------------------------------------------
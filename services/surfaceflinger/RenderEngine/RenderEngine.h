@@ -26,6 +26,9 @@
 #include <ui/mat4.h>
 #include <Transform.h>
 
+#include <memory>
+#include <unordered_map>
+
 #define EGL_NO_CONFIG ((EGLConfig)0)
 
 // ---------------------------------------------------------------------------
@@ -37,6 +40,7 @@ class Rect;
 class Region;
 class Mesh;
 class Texture;
+class CompositionCache;
 
 class RenderEngine {
     enum GlesVersion {
@@ -54,16 +58,31 @@ class RenderEngine {
     virtual void bindImageAsFramebuffer(EGLImageKHR image, uint32_t* texName, uint32_t* fbName, uint32_t* status) = 0;
     virtual void unbindFramebuffer(uint32_t texName, uint32_t fbName) = 0;
 
+    std::unordered_map<int32_t, std::unique_ptr<CompositionCache>> mCompositionCaches;
+
 protected:
     RenderEngine();
     virtual ~RenderEngine() = 0;
 
+    // submits the meshes deferred since beginBatch(), called before
+    // anything that could affect them
+    virtual void flushBatch();
+
+    // frees the render targets of all composition caches. Subclasses that
+    // implement render targets must call this from their destructor, as
+    // deleteRenderTarget is no longer theirs by the time ~RenderEngine runs.
+    void releaseCompositionCaches();
+
+    // statistics, meshes given to drawMesh() and draw calls issued for them
+    uint64_t mMeshCount;
+    uint64_t mDrawCallCount;
+
 public:
     static RenderEngine* create(EGLDisplay display, int hwcFormat);
 
     static EGLConfig chooseEglConfig(EGLDisplay display, int format);
 
-    void primeCache() const;
+    void primeCache(EGLDisplay display) const;
 
     // dump the extension strings. always call the base class.
     virtual void dump(String8& result);
@@ -116,6 +135,28 @@ public:
     // drawing
     virtual void drawMesh(const Mesh& mesh) = 0;
 
+    // Meshes drawn between beginBatch() and endBatch() may be deferred, and
+    // consecutive meshes drawn with the same state merged into a single draw
+    // call. Any other call to the engine submits the deferred meshes first.
+    virtual void beginBatch();
+    virtual void endBatch();
+
+    // offscreen render targets, the same size as the current viewport. Not
+    // supported before GLES 2.0, in which case createRenderTarget fails.
+    virtual bool createRenderTarget(uint32_t width, uint32_t height,
+            uint32_t* texName, uint32_t* fbName);
+    virtual void deleteRenderTarget(uint32_t texName, uint32_t fbName);
+    // binds the given render target, or the current surface if fbName is 0
+    virtual void bindRenderTarget(uint32_t fbName);
+    // copies a render target over the whole viewport, without blending
+    virtual void drawRenderTarget(uint32_t texName, uint32_t width,
+            uint32_t height);
+
+    // per-display cache of the client-composited layers, which must be
+    // released when the display is removed
+    CompositionCache& getCompositionCache(int32_t displayId);
+    void releaseCompositionCache(int32_t displayId);
+
     // queries
     virtual size_t getMaxTextureSize() const = 0;
     virtual size_t getMaxViewportDims() const = 0;
@@ -21,6 +21,7 @@
 #include <sys/types.h>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 /*
  * NOTE: Make sure this file doesn't include  anything from <gl/ > or <gl2/ >
@@ -40,6 +41,7 @@
 #include <ui/PixelFormat.h>
 #include <ui/mat4.h>
 
+#include <gui/IGraphicBufferConsumer.h>
 #include <gui/ISurfaceComposer.h>
 #include <gui/ISurfaceComposerClient.h>
 #include <gui/OccupancyTracker.h>
@@ -54,22 +56,29 @@
 #include "DisplayDevice.h"
 #include "DispSync.h"
 #include "FenceTracker.h"
+#include "FrameScheduler.h"
 #include "FrameTracker.h"
+#include "LayerTracer.h"
 #include "MessageQueue.h"
 
 #include "DisplayHardware/HWComposer.h"
 #include "Effects/Daltonizer.h"
 
+#include <deque>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace android {
 
 // ---------------------------------------------------------------------------
 
 class Client;
+class Colorizer;
 class DisplayEventConnection;
 class EventThread;
+class GraphicBuffer;
 class IGraphicBufferAlloc;
 class Layer;
 class LayerDim;
@@ -219,6 +228,11 @@ private:
             Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
             uint32_t minLayerZ, uint32_t maxLayerZ,
             bool useIdentityTransform, ISurfaceComposer::Rotation rotation);
+    virtual status_t captureScreenAsync(const sp<IBinder>& display,
+            const sp<IGraphicBufferProducer>& producer,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, ISurfaceComposer::Rotation rotation);
     virtual status_t getDisplayStats(const sp<IBinder>& display,
             DisplayStatInfo* stats);
     virtual status_t getDisplayConfigs(const sp<IBinder>& display,
@@ -352,6 +366,25 @@ private:
             bool useIdentityTransform, Transform::orientation_flags rotation,
             bool isLocalScreenshot);
 
+    // renders into a buffer dequeued by captureScreenAsync, without waiting
+    // for the buffer to be released nor for the rendering to complete.
+    // outSyncFd receives the native fence of the rendering.
+    status_t renderScreenToBufferLocked(
+            const sp<const DisplayDevice>& hw,
+            const sp<GraphicBuffer>& buffer, const sp<Fence>& bufferFence,
+            Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+            uint32_t minLayerZ, uint32_t maxLayerZ,
+            bool useIdentityTransform, Transform::orientation_flags rotation,
+            bool isLocalScreenshot, int* outSyncFd);
+
+    // returns the EGLImage of a screenshot buffer, recently used images are
+    // kept around since screenshot producers keep cycling through the same
+    // few buffers
+    EGLImageKHR getScreenshotImageLocked(const sp<GraphicBuffer>& buffer);
+
+    bool isSecureLayerVisibleLocked(const sp<const DisplayDevice>& hw,
+            uint32_t minLayerZ, uint32_t maxLayerZ) const;
+
     /* ------------------------------------------------------------------------
      * EGL
      */
@@ -405,10 +438,16 @@ private:
      * Compositing
      */
     void invalidateHwcGeometry();
+    // layers must all belong to the same layer stack, sorted by z-order
     static void computeVisibleRegions(
-            const LayerVector& currentLayers, uint32_t layerStack,
+            const std::vector<Layer*>& layers,
             Region& dirtyRegion, Region& opaqueRegion);
 
+    // partitions mDrawingState.layersSortedByZ per layer stack; only done
+    // when the drawing state's layer list or layer stacks have changed
+    void rebuildLayerStackIndex();
+    const std::vector<Layer*>& getLayersForLayerStack(uint32_t layerStack) const;
+
     void preComposition();
     void postComposition(nsecs_t refreshStartTime);
     void rebuildLayerStacks();
@@ -420,6 +459,12 @@ private:
     // compose surfaces for display hw. this fails if using GL and the surface
     // has been destroyed and is no longer valid.
     bool doComposeSurfaces(const sp<const DisplayDevice>& hw, const Region& dirty);
+#ifdef USE_HWC2
+    // draws the bottom-most unchanged client layers from the composition
+    // cache, returns how many layers don't need to be drawn anymore
+    size_t composeFromCache(const sp<const DisplayDevice>& displayDevice,
+            const mat4& colorMatrix);
+#endif
 
     void postFramebuffer();
     void drawWormhole(const sp<const DisplayDevice>& hw, const Region& region) const;
@@ -445,6 +490,42 @@ private:
     void dumpStatsLocked(const Vector<String16>& args, size_t& index, String8& result) const;
     void clearStatsLocked(const Vector<String16>& args, size_t& index, String8& result);
     void dumpAllLocked(const Vector<String16>& args, size_t& index, String8& result) const;
+
+    // Sections of a streaming dump ("--stream" or "--sections a,b,c")
+    enum DumpSection : uint32_t {
+        DUMP_CONFIG        = 1 << 0,
+        DUMP_STATIC_SCREEN = 1 << 1,
+        DUMP_BUFFERING     = 1 << 2,
+        DUMP_LAYERS        = 1 << 3,
+        DUMP_DISPLAYS      = 1 << 4,
+        DUMP_GLOBAL        = 1 << 5,
+        DUMP_VSYNC         = 1 << 6,
+        DUMP_HWC           = 1 << 7,
+        DUMP_GRALLOC       = 1 << 8,
+        DUMP_DISPSYNC      = 1 << 9,
+        DUMP_FENCES        = 1 << 10,
+        // the sections of a regular dump
+        DUMP_DEFAULT       = DUMP_CONFIG | DUMP_STATIC_SCREEN |
+                DUMP_BUFFERING | DUMP_LAYERS | DUMP_DISPLAYS | DUMP_GLOBAL |
+                DUMP_VSYNC | DUMP_HWC | DUMP_GRALLOC,
+    };
+    // What a streaming dump formats while holding mStateLock
+    struct DumpSnapshot;
+    // Returns 0, and explains why in result, if a section name is unknown
+    static uint32_t parseDumpSections(const String8& list, String8& result);
+    // Takes mStateLock only to snapshot the state, then formats the rest and
+    // writes each section to fd as soon as it is ready
+    void dumpStreaming(int fd, const Vector<String16>& args, size_t& index,
+            String8& result);
+    void snapshotDumpLocked(uint32_t sections, Colorizer& colorizer,
+            DumpSnapshot& snapshot) const;
+    void dumpConfigLocked(String8& result, Colorizer& colorizer) const;
+    void dumpDisplaysLocked(String8& result, Colorizer& colorizer) const;
+    void dumpGlobalStateLocked(String8& result, Colorizer& colorizer) const;
+#ifdef USE_HWC2
+    void dumpHwcLayersLocked(String8& result) const;
+#endif
+    void dumpHwcState(String8& result, Colorizer& colorizer) const;
     bool startDdmConnection();
     static void appendSfConfigString(String8& result);
     void checkScreenshot(size_t w, size_t s, size_t h, void const* vaddr,
@@ -453,6 +534,9 @@ private:
 
     void logFrameStats();
 
+    // records the layers composited by this refresh into mLayerTracer
+    void recordLayerTrace(nsecs_t refreshStartTime, bool geometryChanged);
+
     void dumpStaticScreenStats(String8& result) const;
 
     void recordBufferingStats(const char* layerName,
@@ -498,6 +582,11 @@ private:
     // don't need synchronization
     State mDrawingState;
     bool mVisibleRegionsDirty;
+    // the layers of mDrawingState grouped by layer stack, in z-order. These
+    // are plain pointers, the strong references are held by mDrawingState.
+    std::unordered_map<uint32_t, std::vector<Layer*>> mLayerStackIndex;
+    bool mLayerStackIndexDirty;
+    std::vector<Layer*> mVisibleLayersScratch;
 #ifndef USE_HWC2
     bool mHwWorkListDirty;
 #else
@@ -508,6 +597,9 @@ private:
     std::vector<sp<Layer>> mLayersWithQueuedFrames;
     sp<Fence> mPreviousPresentFence = Fence::NO_FENCE;
     bool mHadClientComposition = false;
+    // bumped every time the HWC geometry is invalidated, any cached
+    // composition made with an older generation is stale
+    uint64_t mGeometryGeneration = 0;
 #endif
 
     // this may only be written from the main thread with mStateLock held
@@ -526,16 +618,26 @@ private:
     bool mBootFinished;
     bool mForceFullDamage;
     FenceTracker mFenceTracker;
+    LayerTracer mLayerTracer;
+    FrameScheduler mFrameScheduler;
 #ifdef USE_HWC2
     bool mPropagateBackpressure = true;
+    bool mUseCompositionCache = false;
 #endif
     bool mUseHwcVirtualDisplays = true;
+    bool mComposeVirtualDisplaysAtSinkSize = true;
+    // see IGraphicBufferConsumer::setBufferCountTuning, set on layer creation
+    int mBufferCountTuning = IGraphicBufferConsumer::BUFFER_COUNT_TUNING_OFF;
 
     // these are thread safe
     mutable MessageQueue mEventQueue;
     FrameTracker mAnimFrameTracker;
     DispSync mPrimaryDispSync;
 
+    // EGLImages of the recent captureScreenAsync buffers, main thread only
+    enum { MAX_SCREENSHOT_IMAGES = 4 };
+    std::deque<std::pair<sp<GraphicBuffer>, EGLImageKHR>> mScreenshotImages;
+
     // protected by mDestroyedLayerLock;
     mutable Mutex mDestroyedLayerLock;
     Vector<Layer const *> mDestroyedLayers;
@@ -23,6 +23,7 @@
 #include <dlfcn.h>
 #include <inttypes.h>
 #include <stdatomic.h>
+#include <unistd.h>
 
 #include <EGL/egl.h>
 
@@ -44,6 +45,7 @@
 #include <gui/Surface.h>
 #include <gui/GraphicBufferAlloc.h>
 
+#include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferAllocator.h>
 #include <ui/HdrCapabilities.h>
 #include <ui/PixelFormat.h>
@@ -138,6 +140,7 @@ SurfaceFlinger::SurfaceFlinger()
         mRenderEngine(NULL),
         mBootTime(systemTime()),
         mVisibleRegionsDirty(false),
+        mLayerStackIndexDirty(true),
         mHwWorkListDirty(false),
         mAnimCompositionPending(false),
         mDebugRegion(0),
@@ -185,6 +188,60 @@ SurfaceFlinger::SurfaceFlinger()
     property_get("debug.sf.disable_hwc_vds", value, "0");
     mUseHwcVirtualDisplays = !atoi(value);
     ALOGI_IF(!mUseHwcVirtualDisplays, "Disabling HWC virtual displays");
+
+    property_get("debug.sf.dispsync_trimmed_fit", value, "0");
+    if (atoi(value)) {
+        mPrimaryDispSync.setEstimator(DispSync::ESTIMATOR_TRIMMED_FIT);
+        ALOGI("Using trimmed fit vsync estimator");
+    }
+
+    // Layer tracing is always on unless disabled with 0, records are 80
+    // bytes and frames are assumed to hold 16 layers on average. The trace
+    // is capped at 8192 frames, about 10MB.
+    property_get("debug.sf.layer_trace_frames", value, "512");
+    const int maxTraceFrames = 8192;
+    int traceFrames = atoi(value);
+    if (traceFrames < 0) {
+        ALOGW("Invalid debug.sf.layer_trace_frames %d, disabling layer "
+                "tracing", traceFrames);
+        traceFrames = 0;
+    } else if (traceFrames > maxTraceFrames) {
+        ALOGW("debug.sf.layer_trace_frames %d is too large, using %d",
+                traceFrames, maxTraceFrames);
+        traceFrames = maxTraceFrames;
+    }
+    mLayerTracer.setCapacity(static_cast<size_t>(traceFrames),
+            static_cast<size_t>(traceFrames) * 16);
+
+    // Start frames as late as recent frame durations allow, this many
+    // microseconds before the deadline
+    property_get("debug.sf.frame_start_margin_us", value, "0");
+    mFrameScheduler.setMargin(us2ns(atoi(value)));
+    ALOGI_IF(mFrameScheduler.isEnabled(), "Enabling adaptive frame start");
+
+    property_get("debug.sf.vds_compose_at_sink_size", value, "1");
+    mComposeVirtualDisplaysAtSinkSize = atoi(value);
+
+    // Buffers freed by the BufferQueues of the layers and physical displays
+    // are kept this long, up to this size, for surfaces created or resized
+    // again. Off unless a size is set.
+    property_get("debug.sf.buffer_pool_size_kb", value, "0");
+    int poolKb = atoi(value);
+    size_t poolBytes = poolKb > 0 ? static_cast<size_t>(poolKb) * 1024 : 0;
+    property_get("debug.sf.buffer_pool_idle_ms", value, "5000");
+    GraphicBufferAlloc::setPoolLimits(poolBytes, ms2ns(atoi(value)));
+
+    // The scratch buffers of virtual displays are pooled apart, until evicted
+    // by size. The default fits those of one 1080p virtual display.
+    property_get("debug.sf.vds_scratch_pool_kb", value, "24576");
+    int scratchKb = atoi(value);
+    GraphicBufferAlloc::setPoolLimits(GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY,
+            scratchKb > 0 ? static_cast<size_t>(scratchKb) * 1024 : 0, 0);
+
+    // 0 leaves the buffer count of the layers alone, 1 reports the count
+    // their use calls for in dumpsys, 2 applies it
+    property_get("debug.sf.buffer_count_tuning", value, "0");
+    mBufferCountTuning = atoi(value);
 }
 
 void SurfaceFlinger::onFirstRef()
@@ -464,6 +521,7 @@ void SurfaceFlinger::init() {
             sfVsyncPhaseOffsetNs, true, "sf");
     mSFEventThread = new EventThread(sfVsyncSrc, *this);
     mEventQueue.setEventThread(mSFEventThread);
+    mEventQueue.setFrameScheduler(&mFrameScheduler, &mPrimaryDispSync);
 
     // set SFEventThread to SCHED_FIFO to minimize jitter
     struct sched_param param = {0};
@@ -538,7 +596,7 @@ void SurfaceFlinger::init() {
     // set initial conditions (e.g. unblank default device)
     initializeDisplays();
 
-    mRenderEngine->primeCache();
+    mRenderEngine->primeCache(mEGLDisplay);
 
     // start boot animation
     startBootAnim();
@@ -957,6 +1015,7 @@ void SurfaceFlinger::onMessageReceived(int32_t what) {
     ATRACE_CALL();
     switch (what) {
         case MessageQueue::INVALIDATE: {
+            mFrameScheduler.beginFrame(systemTime(SYSTEM_TIME_MONOTONIC));
             bool refreshNeeded = handleMessageTransaction();
             refreshNeeded |= handleMessageInvalidate();
             refreshNeeded |= mRepaintEverything;
@@ -993,13 +1052,16 @@ void SurfaceFlinger::handleMessageRefresh() {
     ATRACE_CALL();
 
     nsecs_t refreshStartTime = systemTime(SYSTEM_TIME_MONOTONIC);
+    const bool geometryChanged = mVisibleRegionsDirty;
 
     preComposition();
     rebuildLayerStacks();
     setUpHWComposer();
     doDebugFlashRegions();
     doComposition();
+    mFrameScheduler.endFrame(systemTime(SYSTEM_TIME_MONOTONIC));
     postComposition(refreshStartTime);
+    recordLayerTrace(refreshStartTime, geometryChanged);
 }
 
 void SurfaceFlinger::doDebugFlashRegions()
@@ -1132,29 +1194,27 @@ void SurfaceFlinger::rebuildLayerStacks() {
         mVisibleRegionsDirty = false;
         invalidateHwcGeometry();
 
-        const LayerVector& layers(mDrawingState.layersSortedByZ);
+        rebuildLayerStackIndex();
         for (size_t dpy=0 ; dpy<mDisplays.size() ; dpy++) {
             Region opaqueRegion;
             Region dirtyRegion;
-            Vector< sp<Layer> > layersSortedByZ;
+            std::vector<Layer*>& layersSortedByZ(mVisibleLayersScratch);
+            layersSortedByZ.clear();
             const sp<DisplayDevice>& hw(mDisplays[dpy]);
             const Transform& tr(hw->getTransform());
             const Rect bounds(hw->getBounds());
             if (hw->isDisplayOn()) {
+                const std::vector<Layer*>& layers(
+                        getLayersForLayerStack(hw->getLayerStack()));
                 SurfaceFlinger::computeVisibleRegions(layers,
-                        hw->getLayerStack(), dirtyRegion, opaqueRegion);
-
-                const size_t count = layers.size();
-                for (size_t i=0 ; i<count ; i++) {
-                    const sp<Layer>& layer(layers[i]);
-                    const Layer::State& s(layer->getDrawingState());
-                    if (s.layerStack == hw->getLayerStack()) {
-                        Region drawRegion(tr.transform(
-                                layer->visibleNonTransparentRegion));
-                        drawRegion.andSelf(bounds);
-                        if (!drawRegion.isEmpty()) {
-                            layersSortedByZ.add(layer);
-                        }
+                        dirtyRegion, opaqueRegion);
+
+                for (Layer* layer : layers) {
+                    Region drawRegion(tr.transform(
+                            layer->visibleNonTransparentRegion));
+                    drawRegion.andSelf(bounds);
+                    if (!drawRegion.isEmpty()) {
+                        layersSortedByZ.push_back(layer);
                     }
                 }
             }
@@ -1492,8 +1552,13 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
                     sp<IGraphicBufferProducer> producer;
                     sp<IGraphicBufferProducer> bqProducer;
                     sp<IGraphicBufferConsumer> bqConsumer;
-                    BufferQueue::createBufferQueue(&bqProducer, &bqConsumer,
+                    // The scratch buffers of virtual displays are pooled
+                    sp<GraphicBufferAlloc> allocator(state.isVirtualDisplay() ?
+                            new GraphicBufferAlloc(
+                                    GraphicBufferAlloc::POOL_VIRTUAL_DISPLAY) :
                             new GraphicBufferAlloc());
+                    BufferQueue::createBufferQueue(&bqProducer, &bqConsumer,
+                            allocator);
 
                     int32_t hwcDisplayId = -1;
                     if (state.isVirtualDisplay()) {
@@ -1521,7 +1586,8 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
 
                             sp<VirtualDisplaySurface> vds = new VirtualDisplaySurface(
                                     *mHwc, hwcDisplayId, state.surface,
-                                    bqProducer, bqConsumer, state.displayName);
+                                    bqProducer, bqConsumer, state.displayName,
+                                    mComposeVirtualDisplaysAtSinkSize);
 
                             dispSurface = vds;
                             producer = vds;
@@ -1705,13 +1771,50 @@ void SurfaceFlinger::commitTransaction()
     mAnimCompositionPending = mAnimTransactionPending;
 
     mDrawingState = mCurrentState;
+    mLayerStackIndexDirty = true;
     mTransactionPending = false;
     mAnimTransactionPending = false;
     mTransactionCV.broadcast();
 }
 
+void SurfaceFlinger::rebuildLayerStackIndex()
+{
+    if (!mLayerStackIndexDirty) {
+        return;
+    }
+    mLayerStackIndexDirty = false;
+
+    // keep the per-stack vectors around so that their storage is reused
+    for (auto& entry : mLayerStackIndex) {
+        entry.second.clear();
+    }
+
+    const LayerVector& layers(mDrawingState.layersSortedByZ);
+    for (size_t i = 0, count = layers.size(); i < count; i++) {
+        Layer* layer = layers[i].get();
+        mLayerStackIndex[layer->getDrawingState().layerStack].push_back(layer);
+    }
+
+    // drop the layer stacks that are no longer used by any layer
+    for (auto it = mLayerStackIndex.begin(); it != mLayerStackIndex.end();) {
+        if (it->second.empty()) {
+            it = mLayerStackIndex.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+const std::vector<Layer*>& SurfaceFlinger::getLayersForLayerStack(
+        uint32_t layerStack) const
+{
+    static const std::vector<Layer*> sNoLayers;
+    auto it = mLayerStackIndex.find(layerStack);
+    return (it != mLayerStackIndex.end()) ? it->second : sNoLayers;
+}
+
 void SurfaceFlinger::computeVisibleRegions(
-        const LayerVector& currentLayers, uint32_t layerStack,
+        const std::vector<Layer*>& layers,
         Region& outDirtyRegion, Region& outOpaqueRegion)
 {
     ATRACE_CALL();
@@ -1722,17 +1825,13 @@ void SurfaceFlinger::computeVisibleRegions(
 
     outDirtyRegion.clear();
 
-    size_t i = currentLayers.size();
+    size_t i = layers.size();
     while (i--) {
-        const sp<Layer>& layer = currentLayers[i];
+        Layer* const layer = layers[i];
 
         // start with the whole surface at its current location
         const Layer::State& s(layer->getDrawingState());
 
-        // only consider the layers on the given layer stack
-        if (s.layerStack != layerStack)
-            continue;
-
         /*
          * opaqueRegion: area of a surface that is fully opaque.
          */
@@ -2047,6 +2146,9 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
     const Vector< sp<Layer> >& layers(hw->getVisibleLayersSortedByZ());
     const size_t count = layers.size();
     const Transform& tr = hw->getTransform();
+    // consecutive color fills (cleared overlay layers, dim layers) are
+    // merged into fewer draw calls
+    engine.beginBatch();
     if (cur != end) {
         // we're using h/w composer
         for (size_t i=0 ; i<count && cur!=end ; ++i, ++cur) {
@@ -2092,6 +2194,7 @@ bool SurfaceFlinger::doComposeSurfaces(const sp<const DisplayDevice>& hw, const
             }
         }
     }
+    engine.endBatch();
 
     // disable scissor at the end of the frame
     engine.disableScissor();
@@ -2613,6 +2716,13 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
             !PermissionCache::checkPermission(sDump, pid, uid)) {
         result.appendFormat("Permission Denial: "
                 "can't dump SurfaceFlinger from pid=%d, uid=%d\n", pid, uid);
+    } else if (args.size() && (args[0] == String16("--stream") ||
+            args[0] == String16("--sections"))) {
+        size_t index = 0;
+        dumpStreaming(fd, args, index, result);
+    } else if (args.size() && args[0] == String16("--layer-trace")) {
+        // Binary, see LayerTrace.h. It has its own lock.
+        mLayerTracer.writeTo(fd);
     } else {
         // Try to get the main lock, but give up after one second
         // (this would indicate SF is stuck, but we want to be able to
@@ -2668,6 +2778,7 @@ status_t SurfaceFlinger::dump(int fd, const Vector<String16>& args)
                     (args[index] == String16("--fences"))) {
                 index++;
                 mFenceTracker.dump(&result);
+                FenceWatcher::getInstance().dump(result);
                 dumpAll = false;
             }
         }
@@ -2743,6 +2854,60 @@ void SurfaceFlinger::clearStatsLocked(const Vector<String16>& args, size_t& inde
     mAnimFrameTracker.clearStats();
 }
 
+void SurfaceFlinger::recordLayerTrace(nsecs_t refreshStartTime,
+        bool geometryChanged) {
+    if (!mLayerTracer.isEnabled()) {
+        return;
+    }
+
+    ATRACE_CALL();
+    HWComposer& hwc(getHwComposer());
+    bool hadClientComposition = false;
+    mLayerTracer.beginFrame(refreshStartTime);
+    for (size_t dpy = 0; dpy < mDisplays.size(); dpy++) {
+        const sp<const DisplayDevice>& hw(mDisplays[dpy]);
+        const Vector< sp<Layer> >& currentLayers(
+                hw->getVisibleLayersSortedByZ());
+        const int32_t id = hw->getHwcDisplayId();
+        HWComposer::LayerListIterator cur = hwc.begin(id);
+        const HWComposer::LayerListIterator end = hwc.end(id);
+        for (size_t i = 0; i < currentLayers.size(); i++) {
+            const sp<Layer>& layer(currentLayers[i]);
+            LayerTraceLayer* record = mLayerTracer.addLayer(
+                    layer->getSequence(), layer->getName());
+            layer->fillTraceRecord(hw, record);
+            if (id >= 0 && cur != end) {
+                switch (cur->getCompositionType()) {
+                    case HWC_OVERLAY:
+                        record->compositionType =
+                                LayerTraceLayer::COMPOSITION_DEVICE;
+                        break;
+                    case HWC_SIDEBAND:
+                        record->compositionType =
+                                LayerTraceLayer::COMPOSITION_SIDEBAND;
+                        break;
+                    case HWC_CURSOR_OVERLAY:
+                        record->compositionType =
+                                LayerTraceLayer::COMPOSITION_CURSOR;
+                        break;
+                }
+                ++cur;
+            }
+            hadClientComposition = hadClientComposition ||
+                    record->compositionType ==
+                            LayerTraceLayer::COMPOSITION_CLIENT;
+        }
+    }
+    uint32_t flags = 0;
+    if (hadClientComposition) {
+        flags |= LayerTraceFrame::FLAG_CLIENT_COMPOSITION;
+    }
+    if (geometryChanged) {
+        flags |= LayerTraceFrame::FLAG_GEOMETRY_CHANGED;
+    }
+    mLayerTracer.endFrame(systemTime(SYSTEM_TIME_MONOTONIC), flags);
+}
+
 // This should only be called from the main thread.  Otherwise it would need
 // the lock and should use mCurrentState rather than mDrawingState.
 void SurfaceFlinger::logFrameStats() {
@@ -2854,39 +3019,10 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
 
     Colorizer colorizer(colorize);
 
-    // figure out if we're stuck somewhere
-    const nsecs_t now = systemTime();
-    const nsecs_t inSwapBuffers(mDebugInSwapBuffers);
-    const nsecs_t inTransaction(mDebugInTransaction);
-    nsecs_t inSwapBuffersDuration = (inSwapBuffers) ? now-inSwapBuffers : 0;
-    nsecs_t inTransactionDuration = (inTransaction) ? now-inTransaction : 0;
-
     /*
      * Dump library configuration.
      */
-
-    colorizer.bold(result);
-    result.append("Build configuration:");
-    colorizer.reset(result);
-    appendSfConfigString(result);
-    appendUiConfigString(result);
-    appendGuiConfigString(result);
-    result.append("\n");
-
-    colorizer.bold(result);
-    result.append("Sync configuration: ");
-    colorizer.reset(result);
-    result.append(SyncFeatures::getInstance().toString());
-    result.append("\n");
-
-    colorizer.bold(result);
-    result.append("DispSync configuration: ");
-    colorizer.reset(result);
-    result.appendFormat("app phase %" PRId64 " ns, sf phase %" PRId64 " ns, "
-            "present offset %d ns (refresh %" PRId64 " ns)",
-        vsyncPhaseOffsetNs, sfVsyncPhaseOffsetNs, PRESENT_TIME_OFFSET_FROM_VSYNC_NS,
-        mHwc->getRefreshPeriod(HWC_DISPLAY_PRIMARY));
-    result.append("\n");
+    dumpConfigLocked(result, colorizer);
 
     // Dump static screen stats
     result.append("\n");
@@ -2911,7 +3047,61 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     /*
      * Dump Display state
      */
+    dumpDisplaysLocked(result, colorizer);
+
+    /*
+     * Dump SurfaceFlinger global state
+     */
+    dumpGlobalStateLocked(result, colorizer);
+
+    /*
+     * VSYNC state
+     */
+    mEventThread->dump(result);
+
+    /*
+     * Dump HWComposer state
+     */
+    dumpHwcState(result, colorizer);
+
+    /*
+     * Dump gralloc state
+     */
+    const GraphicBufferAllocator& alloc(GraphicBufferAllocator::get());
+    alloc.dump(result);
+    GraphicBufferAlloc::dumpPool(result);
+}
 
+void SurfaceFlinger::dumpConfigLocked(String8& result,
+        Colorizer& colorizer) const
+{
+    colorizer.bold(result);
+    result.append("Build configuration:");
+    colorizer.reset(result);
+    appendSfConfigString(result);
+    appendUiConfigString(result);
+    appendGuiConfigString(result);
+    result.append("\n");
+
+    colorizer.bold(result);
+    result.append("Sync configuration: ");
+    colorizer.reset(result);
+    result.append(SyncFeatures::getInstance().toString());
+    result.append("\n");
+
+    colorizer.bold(result);
+    result.append("DispSync configuration: ");
+    colorizer.reset(result);
+    result.appendFormat("app phase %" PRId64 " ns, sf phase %" PRId64 " ns, "
+            "present offset %d ns (refresh %" PRId64 " ns)",
+        vsyncPhaseOffsetNs, sfVsyncPhaseOffsetNs, PRESENT_TIME_OFFSET_FROM_VSYNC_NS,
+        mHwc->getRefreshPeriod(HWC_DISPLAY_PRIMARY));
+    result.append("\n");
+}
+
+void SurfaceFlinger::dumpDisplaysLocked(String8& result,
+        Colorizer& colorizer) const
+{
     colorizer.bold(result);
     result.appendFormat("Displays (%zu entries)\n", mDisplays.size());
     colorizer.reset(result);
@@ -2919,10 +3109,17 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
         const sp<const DisplayDevice>& hw(mDisplays[dpy]);
         hw->dump(result);
     }
+}
 
-    /*
-     * Dump SurfaceFlinger global state
-     */
+void SurfaceFlinger::dumpGlobalStateLocked(String8& result,
+        Colorizer& colorizer) const
+{
+    // figure out if we're stuck somewhere
+    const nsecs_t now = systemTime();
+    const nsecs_t inSwapBuffers(mDebugInSwapBuffers);
+    const nsecs_t inTransaction(mDebugInTransaction);
+    nsecs_t inSwapBuffersDuration = (inSwapBuffers) ? now-inSwapBuffers : 0;
+    nsecs_t inTransactionDuration = (inTransaction) ? now-inTransaction : 0;
 
     colorizer.bold(result);
     result.append("SurfaceFlinger global state:\n");
@@ -2966,28 +3163,244 @@ void SurfaceFlinger::dumpAllLocked(const Vector<String16>& args, size_t& index,
     result.appendFormat("  transaction time: %f us\n",
             inTransactionDuration/1000.0);
 
-    /*
-     * VSYNC state
-     */
-    mEventThread->dump(result);
+    mFrameScheduler.dump(result);
+    mLayerTracer.dump(result);
+}
 
-    /*
-     * Dump HWComposer state
-     */
+void SurfaceFlinger::dumpHwcState(String8& result, Colorizer& colorizer) const
+{
     colorizer.bold(result);
     result.append("h/w composer state:\n");
     colorizer.reset(result);
+    HWComposer& hwc(getHwComposer());
     result.appendFormat("  h/w composer %s and %s\n",
             hwc.initCheck()==NO_ERROR ? "present" : "not present",
                     (mDebugDisableHWC || mDebugRegion || mDaltonize
                             || mHasColorMatrix) ? "disabled" : "enabled");
     hwc.dump(result);
+}
 
-    /*
-     * Dump gralloc state
-     */
-    const GraphicBufferAllocator& alloc(GraphicBufferAllocator::get());
-    alloc.dump(result);
+// ---------------------------------------------------------------------------
+
+struct SurfaceFlinger::DumpSnapshot {
+    String8 config;
+    String8 layersHeader;
+    // the layers, bottom-most first, with their state already formatted.
+    // Holding a reference keeps the layer, and its BufferQueue, alive after
+    // mStateLock is released.
+    std::vector<std::pair<sp<Layer>, String8>> layers;
+    String8 displays;
+    String8 globalState;
+    // HWComposer::dump reads the layers of each display, which needs
+    // mStateLock
+    String8 hwcState;
+};
+
+uint32_t SurfaceFlinger::parseDumpSections(const String8& list,
+        String8& result)
+{
+    static const struct {
+        const char* name;
+        uint32_t section;
+    } sSectionNames[] = {
+        { "config",        DUMP_CONFIG },
+        { "static-screen", DUMP_STATIC_SCREEN },
+        { "buffering",     DUMP_BUFFERING },
+        { "layers",        DUMP_LAYERS },
+        { "displays",      DUMP_DISPLAYS },
+        { "global",        DUMP_GLOBAL },
+        { "vsync",         DUMP_VSYNC },
+        { "hwc",           DUMP_HWC },
+        { "gralloc",       DUMP_GRALLOC },
+        { "dispsync",      DUMP_DISPSYNC },
+        { "fences",        DUMP_FENCES },
+    };
+
+    uint32_t sections = 0;
+    const char* start = list.string();
+    while (*start != '\0') {
+        const char* end = strchr(start, ',');
+        if (end == NULL) {
+            end = start + strlen(start);
+        }
+        size_t length = end - start;
+        bool found = false;
+        for (const auto& entry : sSectionNames) {
+            if (strlen(entry.name) == length &&
+                    strncmp(entry.name, start, length) == 0) {
+                sections |= entry.section;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            result.appendFormat("Unknown dump section '%.*s', expected:",
+                    static_cast<int>(length), start);
+            for (const auto& entry : sSectionNames) {
+                result.appendFormat(" %s", entry.name);
+            }
+            result.append("\n");
+            return 0;
+        }
+        start = (*end == ',') ? end + 1 : end;
+    }
+    return sections;
+}
+
+// Writes out and clears a section of a streaming dump. Returns false if the
+// reader went away, in which case there is no point formatting the rest.
+static bool writeDumpSection(int fd, String8& section) {
+    const char* data = section.string();
+    size_t remaining = section.size();
+    while (remaining > 0) {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+    section.clear();
+    return true;
+}
+
+void SurfaceFlinger::dumpStreaming(int fd, const Vector<String16>& args,
+        size_t& index, String8& result)
+{
+    uint32_t sections = DUMP_DEFAULT;
+    if (args[index] == String16("--sections")) {
+        index++;
+        if (index >= args.size()) {
+            result.append("--sections needs a comma-separated list of "
+                    "sections\n");
+            return;
+        }
+        sections = parseDumpSections(String8(args[index]), result);
+        if (sections == 0) {
+            return;
+        }
+    }
+    index++;
+
+    bool colorize = false;
+    if (index < args.size()
+            && (args[index] == String16("--color"))) {
+        colorize = true;
+        index++;
+    }
+    Colorizer colorizer(colorize);
+
+    // Format whatever reads SurfaceFlinger's state while holding mStateLock,
+    // and nothing else, so that a slow reader or a large dump does not
+    // block transactions
+    String8 section;
+    DumpSnapshot snapshot;
+    status_t err = mStateLock.timedLock(s2ns(1));
+    if (err != NO_ERROR) {
+        section.appendFormat(
+                "SurfaceFlinger appears to be unresponsive (%s [%d]), "
+                "dumping anyways (no locks held)\n", strerror(-err), err);
+    }
+    snapshotDumpLocked(sections, colorizer, snapshot);
+    if (err == NO_ERROR) {
+        mStateLock.unlock();
+    }
+
+    // Everything below only takes the locks of the objects it dumps
+    section.append(snapshot.config);
+    if (sections & DUMP_STATIC_SCREEN) {
+        section.append("\n");
+        dumpStaticScreenStats(section);
+        section.append("\n");
+    }
+    if (!writeDumpSection(fd, section)) {
+        return;
+    }
+
+    if (sections & DUMP_BUFFERING) {
+        dumpBufferingStats(section);
+        if (!writeDumpSection(fd, section)) {
+            return;
+        }
+    }
+
+    if (sections & DUMP_LAYERS) {
+        if (!writeDumpSection(fd, snapshot.layersHeader)) {
+            return;
+        }
+        for (auto& entry : snapshot.layers) {
+            section.append(entry.second);
+            entry.first->dumpBufferQueue(section);
+            if (!writeDumpSection(fd, section)) {
+                return;
+            }
+        }
+        // drop the references now rather than after the remaining sections
+        snapshot.layers.clear();
+    }
+
+    section.append(snapshot.displays);
+    section.append(snapshot.globalState);
+    if (sections & DUMP_VSYNC) {
+        mEventThread->dump(section);
+    }
+    if (!writeDumpSection(fd, section)) {
+        return;
+    }
+
+    if (sections & DUMP_HWC) {
+        if (!writeDumpSection(fd, snapshot.hwcState)) {
+            return;
+        }
+    }
+
+    if (sections & DUMP_GRALLOC) {
+        GraphicBufferAllocator::get().dump(section);
+        GraphicBufferAlloc::dumpPool(section);
+    }
+    if (sections & DUMP_DISPSYNC) {
+        mPrimaryDispSync.dump(section);
+    }
+    if (sections & DUMP_FENCES) {
+        mFenceTracker.dump(&section);
+        FenceWatcher::getInstance().dump(section);
+    }
+    writeDumpSection(fd, section);
+}
+
+void SurfaceFlinger::snapshotDumpLocked(uint32_t sections,
+        Colorizer& colorizer, DumpSnapshot& snapshot) const
+{
+    if (sections & DUMP_CONFIG) {
+        dumpConfigLocked(snapshot.config, colorizer);
+    }
+
+    const LayerVector& currentLayers = mCurrentState.layersSortedByZ;
+    if (sections & DUMP_LAYERS) {
+        colorizer.bold(snapshot.layersHeader);
+        snapshot.layersHeader.appendFormat("Visible layers (count = %zu)\n",
+                currentLayers.size());
+        colorizer.reset(snapshot.layersHeader);
+        snapshot.layers.resize(currentLayers.size());
+        for (size_t i = 0; i < currentLayers.size(); i++) {
+            snapshot.layers[i].first = currentLayers[i];
+            currentLayers[i]->dumpState(snapshot.layers[i].second, colorizer);
+        }
+    }
+
+    if (sections & DUMP_DISPLAYS) {
+        dumpDisplaysLocked(snapshot.displays, colorizer);
+    }
+    if (sections & DUMP_GLOBAL) {
+        dumpGlobalStateLocked(snapshot.globalState, colorizer);
+    }
+
+    if (sections & DUMP_HWC) {
+        dumpHwcState(snapshot.hwcState, colorizer);
+    }
 }
 
 const Vector< sp<Layer> >&
@@ -3052,6 +3465,7 @@ status_t SurfaceFlinger::onTransact(
             break;
         }
         case CAPTURE_SCREEN:
+        case CAPTURE_SCREEN_ASYNC:
         {
             // codes that require permission check
             IPCThreadState* ipc = IPCThreadState::self();
@@ -3427,6 +3841,168 @@ status_t SurfaceFlinger::captureScreen(const sp<IBinder>& display,
 }
 
 
+status_t SurfaceFlinger::captureScreenAsync(const sp<IBinder>& display,
+        const sp<IGraphicBufferProducer>& producer,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, ISurfaceComposer::Rotation rotation) {
+
+    if (CC_UNLIKELY(display == 0))
+        return BAD_VALUE;
+
+    if (CC_UNLIKELY(producer == 0))
+        return BAD_VALUE;
+
+    // without native fences, the only way to know when the rendering is
+    // done is to wait for it on the main thread
+    const SyncFeatures& syncFeatures(SyncFeatures::getInstance());
+    if (!syncFeatures.useNativeFenceSync() || !syncFeatures.useWaitSync()) {
+        return captureScreen(display, producer, sourceCrop, reqWidth, reqHeight,
+                minLayerZ, maxLayerZ, useIdentityTransform, rotation);
+    }
+
+    bool isLocalScreenshot = IInterface::asBinder(producer)->localBinder();
+
+    Transform::orientation_flags rotationFlags;
+    switch (rotation) {
+        case ISurfaceComposer::eRotateNone:
+            rotationFlags = Transform::ROT_0;
+            break;
+        case ISurfaceComposer::eRotate90:
+            rotationFlags = Transform::ROT_90;
+            break;
+        case ISurfaceComposer::eRotate180:
+            rotationFlags = Transform::ROT_180;
+            break;
+        case ISurfaceComposer::eRotate270:
+            rotationFlags = Transform::ROT_270;
+            break;
+        default:
+            rotationFlags = Transform::ROT_0;
+            ALOGE("Invalid rotation passed to captureScreenAsync(): %d\n",
+                    rotation);
+            break;
+    }
+
+    {
+        Mutex::Autolock _l(mStateLock);
+        sp<const DisplayDevice> hw(getDisplayDevice(display));
+        if (hw == NULL) {
+            return BAD_VALUE;
+        }
+        uint32_t hw_w = hw->getWidth();
+        uint32_t hw_h = hw->getHeight();
+        if (rotationFlags & Transform::ROT_90) {
+            std::swap(hw_w, hw_h);
+        }
+        if ((reqWidth > hw_w) || (reqHeight > hw_h)) {
+            ALOGE("size mismatch (%d, %d) > (%d, %d)",
+                    reqWidth, reqHeight, hw_w, hw_h);
+            return BAD_VALUE;
+        }
+        reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
+        reqHeight = (!reqHeight) ? hw_h : reqHeight;
+    }
+
+    // Only the GL commands are issued on the main thread, all the calls into
+    // the producer are made here, on the binder thread, so that a slow
+    // producer can't hold up composition.
+    class MessageRenderScreen : public MessageBase {
+        SurfaceFlinger* flinger;
+        sp<IBinder> display;
+        sp<GraphicBuffer> buffer;
+        sp<Fence> bufferFence;
+        Rect sourceCrop;
+        uint32_t reqWidth, reqHeight;
+        uint32_t minLayerZ,maxLayerZ;
+        bool useIdentityTransform;
+        Transform::orientation_flags rotation;
+        bool isLocalScreenshot;
+        status_t result;
+        int syncFd;
+    public:
+        MessageRenderScreen(SurfaceFlinger* flinger,
+                const sp<IBinder>& display,
+                const sp<GraphicBuffer>& buffer, const sp<Fence>& bufferFence,
+                Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+                uint32_t minLayerZ, uint32_t maxLayerZ,
+                bool useIdentityTransform,
+                Transform::orientation_flags rotation,
+                bool isLocalScreenshot)
+            : flinger(flinger), display(display), buffer(buffer),
+              bufferFence(bufferFence), sourceCrop(sourceCrop),
+              reqWidth(reqWidth), reqHeight(reqHeight),
+              minLayerZ(minLayerZ), maxLayerZ(maxLayerZ),
+              useIdentityTransform(useIdentityTransform),
+              rotation(rotation), isLocalScreenshot(isLocalScreenshot),
+              result(PERMISSION_DENIED), syncFd(-1)
+        {
+        }
+        status_t getResult() const {
+            return result;
+        }
+        int getSyncFd() const {
+            return syncFd;
+        }
+        virtual bool handler() {
+            Mutex::Autolock _l(flinger->mStateLock);
+            sp<const DisplayDevice> hw(flinger->getDisplayDevice(display));
+            result = flinger->renderScreenToBufferLocked(hw, buffer,
+                    bufferFence, sourceCrop, reqWidth, reqHeight,
+                    minLayerZ, maxLayerZ, useIdentityTransform, rotation,
+                    isLocalScreenshot, &syncFd);
+            return true;
+        }
+    };
+
+    sp<Surface> sur = new Surface(producer, false);
+    ANativeWindow* window = sur.get();
+
+    status_t result = native_window_api_connect(window, NATIVE_WINDOW_API_EGL);
+    if (result != NO_ERROR) {
+        return result;
+    }
+
+    uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN |
+                    GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE;
+
+    int err = 0;
+    err = native_window_set_buffers_dimensions(window, reqWidth, reqHeight);
+    err |= native_window_set_scaling_mode(window, NATIVE_WINDOW_SCALING_MODE_SCALE_TO_WINDOW);
+    err |= native_window_set_buffers_format(window, HAL_PIXEL_FORMAT_RGBA_8888);
+    err |= native_window_set_usage(window, usage);
+
+    if (err == NO_ERROR) {
+        ANativeWindowBuffer* buffer;
+        int fenceFd = -1;
+        // don't wait for the buffer to be released here, the GPU will
+        result = window->dequeueBuffer(window, &buffer, &fenceFd);
+        if (result == NO_ERROR) {
+            sp<Fence> bufferFence(new Fence(fenceFd));
+            sp<MessageRenderScreen> msg = new MessageRenderScreen(this,
+                    display, static_cast<GraphicBuffer*>(buffer), bufferFence,
+                    sourceCrop, reqWidth, reqHeight, minLayerZ, maxLayerZ,
+                    useIdentityTransform, rotationFlags, isLocalScreenshot);
+            result = postMessageSync(msg);
+            if (result == NO_ERROR) {
+                result = msg->getResult();
+            }
+            if (result == NO_ERROR) {
+                // queueBuffer takes ownership of the sync fd
+                result = window->queueBuffer(window, buffer, msg->getSyncFd());
+            } else {
+                window->cancelBuffer(window, buffer, bufferFence->dup());
+            }
+        }
+    } else {
+        result = BAD_VALUE;
+    }
+    native_window_api_disconnect(window, NATIVE_WINDOW_API_EGL);
+
+    return result;
+}
+
+
 void SurfaceFlinger::renderScreenImplLocked(
         const sp<const DisplayDevice>& hw,
         Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
@@ -3523,20 +4099,8 @@ status_t SurfaceFlinger::captureScreenImplLocked(
     reqWidth  = (!reqWidth)  ? hw_w : reqWidth;
     reqHeight = (!reqHeight) ? hw_h : reqHeight;
 
-    bool secureLayerIsVisible = false;
-    const LayerVector& layers(mDrawingState.layersSortedByZ);
-    const size_t count = layers.size();
-    for (size_t i = 0 ; i < count ; ++i) {
-        const sp<Layer>& layer(layers[i]);
-        const Layer::State& state(layer->getDrawingState());
-        if (state.layerStack == hw->getLayerStack() && state.z >= minLayerZ &&
-                state.z <= maxLayerZ && layer->isVisible() &&
-                layer->isSecure()) {
-            secureLayerIsVisible = true;
-        }
-    }
-
-    if (!isLocalScreenshot && secureLayerIsVisible) {
+    if (!isLocalScreenshot &&
+            isSecureLayerVisibleLocked(hw, minLayerZ, maxLayerZ)) {
         ALOGW("FB is protected: PERMISSION_DENIED");
         return PERMISSION_DENIED;
     }
@@ -3652,6 +4216,121 @@ status_t SurfaceFlinger::captureScreenImplLocked(
     return result;
 }
 
+EGLImageKHR SurfaceFlinger::getScreenshotImageLocked(
+        const sp<GraphicBuffer>& buffer)
+{
+    for (const auto& entry : mScreenshotImages) {
+        if (entry.first->getId() == buffer->getId()) {
+            return entry.second;
+        }
+    }
+
+    EGLImageKHR image = eglCreateImageKHR(mEGLDisplay, EGL_NO_CONTEXT,
+            EGL_NATIVE_BUFFER_ANDROID, buffer->getNativeBuffer(), NULL);
+    if (image == EGL_NO_IMAGE_KHR) {
+        return image;
+    }
+
+    if (mScreenshotImages.size() >= MAX_SCREENSHOT_IMAGES) {
+        eglDestroyImageKHR(mEGLDisplay, mScreenshotImages.front().second);
+        mScreenshotImages.pop_front();
+    }
+    mScreenshotImages.push_back(std::make_pair(buffer, image));
+    return image;
+}
+
+status_t SurfaceFlinger::renderScreenToBufferLocked(
+        const sp<const DisplayDevice>& hw,
+        const sp<GraphicBuffer>& buffer, const sp<Fence>& bufferFence,
+        Rect sourceCrop, uint32_t reqWidth, uint32_t reqHeight,
+        uint32_t minLayerZ, uint32_t maxLayerZ,
+        bool useIdentityTransform, Transform::orientation_flags rotation,
+        bool isLocalScreenshot, int* outSyncFd)
+{
+    ATRACE_CALL();
+
+    if (hw == NULL) {
+        return BAD_VALUE;
+    }
+
+    if (!isLocalScreenshot &&
+            isSecureLayerVisibleLocked(hw, minLayerZ, maxLayerZ)) {
+        ALOGW("FB is protected: PERMISSION_DENIED");
+        return PERMISSION_DENIED;
+    }
+
+    EGLImageKHR image = getScreenshotImageLocked(buffer);
+    if (image == EGL_NO_IMAGE_KHR) {
+        return BAD_VALUE;
+    }
+
+    // have the GPU, rather than this thread, wait for the previous consumer
+    // of the buffer to release it
+    if (bufferFence->isValid()) {
+        int fenceFd = bufferFence->dup();
+        EGLint attribs[] = {
+            EGL_SYNC_NATIVE_FENCE_FD_ANDROID, fenceFd,
+            EGL_NONE
+        };
+        EGLSyncKHR sync = eglCreateSyncKHR(mEGLDisplay,
+                EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+        if (sync != EGL_NO_SYNC_KHR) {
+            eglWaitSyncKHR(mEGLDisplay, sync, 0);
+            eglDestroySyncKHR(mEGLDisplay, sync);
+        } else {
+            close(fenceFd);
+            bufferFence->waitForever("SurfaceFlinger::renderScreenToBufferLocked");
+        }
+    }
+
+    // this binds the given EGLImage as a framebuffer for the
+    // duration of this scope.
+    RenderEngine::BindImageAsFramebuffer imageBond(getRenderEngine(), image);
+    if (imageBond.getStatus() != NO_ERROR) {
+        ALOGE("got GL_FRAMEBUFFER_COMPLETE_OES error while taking screenshot");
+        return INVALID_OPERATION;
+    }
+
+    renderScreenImplLocked(hw, sourceCrop, reqWidth, reqHeight,
+            minLayerZ, maxLayerZ, true, useIdentityTransform, rotation);
+
+    EGLSyncKHR sync = eglCreateSyncKHR(mEGLDisplay,
+            EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+    // native fence fd will not be populated until flush() is done.
+    getRenderEngine().flush();
+    if (sync == EGL_NO_SYNC_KHR) {
+        ALOGE("captureScreenAsync: error creating EGL fence: %#x",
+                eglGetError());
+        return UNKNOWN_ERROR;
+    }
+    int syncFd = eglDupNativeFenceFDANDROID(mEGLDisplay, sync);
+    eglDestroySyncKHR(mEGLDisplay, sync);
+    if (syncFd == EGL_NO_NATIVE_FENCE_FD_ANDROID) {
+        ALOGE("captureScreenAsync: failed to dup sync khr object");
+        return UNKNOWN_ERROR;
+    }
+    *outSyncFd = syncFd;
+    return NO_ERROR;
+}
+
+bool SurfaceFlinger::isSecureLayerVisibleLocked(
+        const sp<const DisplayDevice>& hw,
+        uint32_t minLayerZ, uint32_t maxLayerZ) const
+{
+    const LayerVector& layers(mDrawingState.layersSortedByZ);
+    const size_t count = layers.size();
+    for (size_t i = 0 ; i < count ; ++i) {
+        const sp<Layer>& layer(layers[i]);
+        const Layer::State& state(layer->getDrawingState());
+        if (state.layerStack == hw->getLayerStack() && state.z >= minLayerZ &&
+                state.z <= maxLayerZ && layer->isVisible() &&
+                layer->isSecure()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool SurfaceFlinger::getFrameTimestamps(const Layer& layer,
         uint64_t frameNumber, FrameTimestamps* outTimestamps) {
     return mFenceTracker.getFrameTimestamps(layer, frameNumber, outTimestamps);
@@ -15,6 +15,7 @@
  */
 
 #include <math.h>
+#include <stdlib.h>
 
 #include <cutils/compiler.h>
 #include <utils/String8.h>
@@ -23,6 +24,8 @@
 #include "clz.h"
 #include "Transform.h"
 
+#include <vector>
+
 // ---------------------------------------------------------------------------
 
 namespace android {
@@ -63,6 +66,13 @@ Transform Transform::operator * (const Transform& rhs) const
     if (rhs.mType == IDENTITY)
         return r;
 
+    if (mType <= TRANSLATE && rhs.mType <= TRANSLATE) {
+        // the type of a product of translations is known, keep it so that
+        // it doesn't have to be recomputed
+        r.set(tx() + rhs.tx(), ty() + rhs.ty());
+        return r;
+    }
+
     // TODO: we could use mType to optimize the matrix multiply
     const mat33& A(mMatrix);
     const mat33& B(rhs.mMatrix);
@@ -199,6 +209,32 @@ Rect Transform::makeBounds(int w, int h) const
 Rect Transform::transform(const Rect& bounds, bool roundOutwards) const
 {
     Rect r;
+    if (CC_LIKELY(isAxisAligned())) {
+        if (isIntegerIsometry() && isExactCoordinate(bounds)) {
+            return transformExact(bounds);
+        }
+
+        // Each coordinate of the result only depends on one of x or y, so
+        // the left-top and right-bottom corners are enough to find it
+        vec2 lt( bounds.left,  bounds.top    );
+        vec2 rb( bounds.right, bounds.bottom );
+        lt = transform(lt);
+        rb = transform(rb);
+
+        if (roundOutwards) {
+            r.left   = floorf(min(lt[0], rb[0]));
+            r.top    = floorf(min(lt[1], rb[1]));
+            r.right  = ceilf(max(lt[0], rb[0]));
+            r.bottom = ceilf(max(lt[1], rb[1]));
+        } else {
+            r.left   = floorf(min(lt[0], rb[0]) + 0.5f);
+            r.top    = floorf(min(lt[1], rb[1]) + 0.5f);
+            r.right  = floorf(max(lt[0], rb[0]) + 0.5f);
+            r.bottom = floorf(max(lt[1], rb[1]) + 0.5f);
+        }
+        return r;
+    }
+
     vec2 lt( bounds.left,  bounds.top    );
     vec2 rt( bounds.right, bounds.top    );
     vec2 lb( bounds.left,  bounds.bottom );
@@ -229,10 +265,12 @@ Region Transform::transform(const Region& reg) const
     Region out;
     if (CC_UNLIKELY(type() > TRANSLATE)) {
         if (CC_LIKELY(preserveRects())) {
-            Region::const_iterator it = reg.begin();
-            Region::const_iterator const end = reg.end();
-            while (it != end) {
-                out.orSelf(transform(*it++));
+            if (!transformExact(reg, &out)) {
+                Region::const_iterator it = reg.begin();
+                Region::const_iterator const end = reg.end();
+                while (it != end) {
+                    out.orSelf(transform(*it++));
+                }
             }
         } else {
             out.set(transform(reg.bounds()));
@@ -245,6 +283,157 @@ Region Transform::transform(const Region& reg) const
     return out;
 }
 
+bool Transform::isAxisAligned() const
+{
+    // Checked on the matrix rather than with type(), so that the fast
+    // paths can't disagree with the generic one
+    const mat33& M(mMatrix);
+    return (M[1][0] == 0 && M[0][1] == 0) || (M[0][0] == 0 && M[1][1] == 0);
+}
+
+bool Transform::isIntegerIsometry() const
+{
+    const mat33& M(mMatrix);
+    const float x = M[2][0];
+    const float y = M[2][1];
+    if (x != floorf(x) || y != floorf(y) ||
+            fabsf(x) > MAX_EXACT_COORDINATE ||
+            fabsf(y) > MAX_EXACT_COORDINATE) {
+        return false;
+    }
+    if (M[1][0] == 0 && M[0][1] == 0) {
+        return absIsOne(M[0][0]) && absIsOne(M[1][1]);
+    }
+    if (M[0][0] == 0 && M[1][1] == 0) {
+        return absIsOne(M[1][0]) && absIsOne(M[0][1]);
+    }
+    return false;
+}
+
+bool Transform::isExactCoordinate(const Rect& r)
+{
+    return abs(r.left) <= MAX_EXACT_COORDINATE &&
+            abs(r.top) <= MAX_EXACT_COORDINATE &&
+            abs(r.right) <= MAX_EXACT_COORDINATE &&
+            abs(r.bottom) <= MAX_EXACT_COORDINATE;
+}
+
+// Transforms count rectangles with integer math, for integer isometries
+// only. The loop has no branches so that the compiler can vectorize it.
+static void transformRectsExact(const int32_t m[6], const Rect* in,
+        Rect* out, size_t count)
+{
+    const int32_t a = m[0], b = m[1], c = m[2], d = m[3];
+    const int32_t x = m[4], y = m[5];
+    for (size_t i = 0; i < count; i++) {
+        const int32_t x0 = a * in[i].left + b * in[i].top + x;
+        const int32_t y0 = c * in[i].left + d * in[i].top + y;
+        const int32_t x1 = a * in[i].right + b * in[i].bottom + x;
+        const int32_t y1 = c * in[i].right + d * in[i].bottom + y;
+        out[i].left = x0 < x1 ? x0 : x1;
+        out[i].top = y0 < y1 ? y0 : y1;
+        out[i].right = x0 < x1 ? x1 : x0;
+        out[i].bottom = y0 < y1 ? y1 : y0;
+    }
+}
+
+Rect Transform::transformExact(const Rect& r) const
+{
+    const mat33& M(mMatrix);
+    const int32_t m[6] = {
+        int32_t(M[0][0]), int32_t(M[1][0]), int32_t(M[0][1]),
+        int32_t(M[1][1]), int32_t(M[2][0]), int32_t(M[2][1])
+    };
+    Rect result;
+    transformRectsExact(m, &r, &result, 1);
+    return result;
+}
+
+// Returns the union of count rectangles. Merging halves keeps the regions
+// being merged small, unlike adding the rectangles one at a time.
+static Region unionOf(const Rect* rects, size_t count)
+{
+    if (count == 1) {
+        Region result;
+        result.orSelf(rects[0]);
+        return result;
+    }
+    const size_t half = count / 2;
+    Region result(unionOf(rects, half));
+    result.orSelf(unionOf(rects + half, count - half));
+    return result;
+}
+
+bool Transform::transformExact(const Region& reg, Region* out) const
+{
+    if (!isIntegerIsometry() || !isExactCoordinate(reg.getBounds())) {
+        return false;
+    }
+
+    size_t count;
+    const Rect* rects = reg.getArray(&count);
+    for (size_t i = 0; i < count; i++) {
+        if (rects[i].isEmpty()) {
+            // only the empty region has an empty rectangle, leave it to
+            // the generic path
+            return false;
+        }
+    }
+
+    const mat33& M(mMatrix);
+    const int32_t m[6] = {
+        int32_t(M[0][0]), int32_t(M[1][0]), int32_t(M[0][1]),
+        int32_t(M[1][1]), int32_t(M[2][0]), int32_t(M[2][1])
+    };
+    std::vector<Rect> transformed(count);
+    transformRectsExact(m, rects, transformed.data(), count);
+
+    if (count == 1) {
+        *out = Region(transformed[0]);
+        return true;
+    }
+
+    if (M[0][0] == 0) {
+        // Rows become columns, the bands have to be rebuilt
+        *out = unionOf(transformed.data(), count);
+        return true;
+    }
+
+    // Flips and translations keep the bands of the region, a vertical flip
+    // reverses their order and a horizontal flip reverses the order of the
+    // rectangles within each band
+    const bool flipH = M[0][0] < 0;
+    const bool flipV = M[1][1] < 0;
+    const Rect regBounds(reg.getBounds());
+    Rect bounds;
+    transformRectsExact(m, &regBounds, &bounds, 1);
+    *out = Region(bounds);
+    size_t bandStart = flipV ? count : 0;
+    while (flipV ? bandStart > 0 : bandStart < count) {
+        // find the band starting, in output order, at bandStart
+        size_t begin = flipV ? bandStart - 1 : bandStart;
+        size_t end = begin;
+        const int32_t top = rects[begin].top;
+        if (flipV) {
+            while (begin > 0 && rects[begin - 1].top == top) {
+                begin--;
+            }
+            end++;
+            bandStart = begin;
+        } else {
+            while (end < count && rects[end].top == top) {
+                end++;
+            }
+            bandStart = end;
+        }
+        for (size_t i = begin; i < end; i++) {
+            const Rect& r(transformed[flipH ? begin + end - 1 - i : i]);
+            out->addRectUnchecked(r.left, r.top, r.right, r.bottom);
+        }
+    }
+    return true;
+}
+
 uint32_t Transform::type() const
 {
     if (mType & UNKNOWN_TYPE) {
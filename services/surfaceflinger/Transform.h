@@ -103,6 +103,18 @@ private:
     static bool absIsOne(float f);
     static bool isZero(float f);
 
+    // Fast paths. A rotation by a multiple of 90 degrees, possibly flipped
+    // and followed by an integer translation, maps integer coordinates
+    // within +/-MAX_EXACT_COORDINATE to integer coordinates, which the
+    // generic float path computes exactly, so it can be done with integer
+    // math instead.
+    enum { MAX_EXACT_COORDINATE = 1 << 22 };
+    bool isAxisAligned() const;
+    bool isIntegerIsometry() const;
+    static bool isExactCoordinate(const Rect& r);
+    Rect transformExact(const Rect& r) const;
+    bool transformExact(const Region& reg, Region* out) const;
+
     mat33               mMatrix;
     mutable uint32_t    mType;
 };
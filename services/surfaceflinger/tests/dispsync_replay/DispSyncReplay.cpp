@@ -0,0 +1,214 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a trace of hardware vsync and present fence timestamps into
+ * DispSync, the way SurfaceFlinger feeds it, and reports for each estimator
+ * how well the model predicts the hardware vsync events and how often
+ * hardware vsync had to be turned back on.
+ *
+ * The trace is a text file with one event per line, in time order:
+ *     vsync <timestamp in ns>
+ *     present <timestamp in ns>
+ * Empty lines and lines starting with '#' are ignored. Hardware vsync
+ * events must be recorded continuously, even while SurfaceFlinger had them
+ * turned off. When no trace is given a synthetic 60Hz trace with jitter,
+ * outliers and missed vsyncs is used.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/Timers.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "DispSync.h"
+
+using namespace android;
+
+struct TraceEvent {
+    bool isVsync;
+    nsecs_t timestamp;
+};
+
+// vsync events at the start of the trace not used to measure the error,
+// while the model is still being built
+static const size_t kWarmupVsyncs = 10;
+
+static bool loadTrace(const char* path, std::vector<TraceEvent>* trace) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[128];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        char type[16];
+        int64_t timestamp;
+        if (sscanf(line, "%15s %" SCNd64, type, &timestamp) != 2 ||
+                (strcmp(type, "vsync") && strcmp(type, "present"))) {
+            fprintf(stderr, "%s:%zu: invalid event\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+        trace->push_back({strcmp(type, "vsync") == 0, timestamp});
+    }
+    fclose(file);
+    return true;
+}
+
+static void generateTrace(std::vector<TraceEvent>* trace) {
+    const nsecs_t period = 16666667;
+    const size_t numVsyncs = 60 * 60 * 5;   // 5 minutes
+    std::mt19937 random(42);
+    std::normal_distribution<double> jitter(0, 60000);      // 60 usec
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    nsecs_t vsync = ms2ns(1000);
+    for (size_t i = 0; i < numVsyncs; i++) {
+        vsync += period;
+        double r = uniform(random);
+        if (r < 0.005) {
+            // missed vsync interrupt
+            continue;
+        }
+        nsecs_t timestamp = vsync + nsecs_t(jitter(random));
+        if (r < 0.02) {
+            // late interrupt
+            timestamp += us2ns(1500 + 2000 * uniform(random));
+        }
+        trace->push_back({true, timestamp});
+        // the present fence signals on the vsync of a frame, with much
+        // less jitter than the interrupt
+        if (uniform(random) < 0.8) {
+            trace->push_back({false, vsync + nsecs_t(jitter(random) / 4)});
+        }
+    }
+}
+
+static nsecs_t medianVsyncInterval(const std::vector<TraceEvent>& trace) {
+    std::vector<nsecs_t> intervals;
+    nsecs_t previous = 0;
+    for (const auto& event : trace) {
+        if (event.isVsync) {
+            if (previous != 0) {
+                intervals.push_back(event.timestamp - previous);
+            }
+            previous = event.timestamp;
+        }
+    }
+    if (intervals.empty()) {
+        return 0;
+    }
+    std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2,
+            intervals.end());
+    return intervals[intervals.size() / 2];
+}
+
+static void replay(const char* name, DispSync::Estimator estimator,
+        const std::vector<TraceEvent>& trace, nsecs_t period) {
+    DispSync dispSync(name);
+    dispSync.setEstimator(estimator);
+    dispSync.setPeriod(period);
+
+    // this mirrors SurfaceFlinger::enableHardwareVsync(),
+    // disableHardwareVsync() and addResyncSample()
+    bool hwVsyncEnabled = true;
+    dispSync.beginResync();
+    size_t numResyncs = 1;
+    size_t numHwVsyncs = 0;
+    size_t numVsyncs = 0;
+
+    std::vector<double> errors;
+    for (const auto& event : trace) {
+        if (event.isVsync) {
+            if (++numVsyncs > kWarmupVsyncs) {
+                errors.push_back(fabs(double(
+                        dispSync.computeVsyncError(event.timestamp))));
+            }
+            if (hwVsyncEnabled) {
+                numHwVsyncs++;
+                hwVsyncEnabled = dispSync.addResyncSample(event.timestamp);
+            }
+        } else if (dispSync.addPresentTime(event.timestamp)) {
+            if (!hwVsyncEnabled) {
+                dispSync.beginResync();
+                hwVsyncEnabled = true;
+                numResyncs++;
+            }
+        } else {
+            hwVsyncEnabled = false;
+        }
+    }
+
+    if (errors.empty() || trace.empty()) {
+        printf("%-12s not enough vsync events\n", name);
+        return;
+    }
+    double sqSum = 0;
+    for (double error : errors) {
+        sqSum += error * error;
+    }
+    std::sort(errors.begin(), errors.end());
+    double duration = double(trace.back().timestamp - trace.front().timestamp);
+    printf("%-12s error rms=%8.1fus p50=%8.1fus p99=%8.1fus max=%8.1fus  "
+            "resyncs=%zu (%.1f/min)  hw vsync on=%.1f%%\n",
+            name,
+            sqrt(sqSum / errors.size()) / 1000.0,
+            errors[errors.size() / 2] / 1000.0,
+            errors[errors.size() * 99 / 100] / 1000.0,
+            errors.back() / 1000.0,
+            numResyncs, numResyncs * 60.0e9 / duration,
+            100.0 * numHwVsyncs / numVsyncs);
+}
+
+int main(int argc, char** argv) {
+    std::vector<TraceEvent> trace;
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+        return 1;
+    } else if (argc == 2) {
+        if (!loadTrace(argv[1], &trace)) {
+            return 1;
+        }
+    } else {
+        printf("no trace given, using a synthetic 60Hz trace\n");
+        generateTrace(&trace);
+    }
+
+    nsecs_t period = medianVsyncInterval(trace);
+    if (period <= 0) {
+        fprintf(stderr, "the trace doesn't have enough vsync events\n");
+        return 1;
+    }
+    printf("%zu events, period %.3f ms\n", trace.size(), period / 1.0e6);
+
+    replay("mean", DispSync::ESTIMATOR_MEAN, trace, period);
+    replay("trimmed-fit", DispSync::ESTIMATOR_TRIMMED_FIT, trace, period);
+    return 0;
+}
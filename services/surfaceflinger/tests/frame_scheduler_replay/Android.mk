@@ -0,0 +1,22 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	FrameSchedulerReplay.cpp \
+	../../FrameScheduler.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../..
+
+LOCAL_CFLAGS := -DLOG_TAG=\"FrameSchedulerReplay\"
+LOCAL_CFLAGS += -std=c++14 -Wall -Werror
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libutils
+
+LOCAL_MODULE:= test-frame-scheduler-replay
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays recorded frame timings through FrameScheduler, the way
+ * SurfaceFlinger's MessageQueue uses it, and reports for several margins how
+ * often frames miss their deadline and how long application buffers wait
+ * between being queued and being presented, compared to starting every frame
+ * right at the vsync event. Like a BufferQueue in synchronous mode, each
+ * frame latches the oldest buffer queued before it started, so buffers
+ * queued after the vsync event only make it into the frame when it starts
+ * later; applications that are always a frame ahead don't benefit.
+ *
+ * The trace is a text file with one frame per line:
+ *     <frame duration in ns> [<buffer queue time in ns after vsync>]
+ * where the frame duration is the time from the start of INVALIDATE to the
+ * end of composition, and the optional queue time is when an application
+ * queued a buffer during that frame. The lines
+ *     period <vsync period in ns>
+ *     offset <SurfaceFlinger vsync phase offset in ns>
+ * override the defaults of 16.67 ms and 1 ms. Empty lines and lines starting
+ * with '#' are ignored. When no trace is given a synthetic 60Hz trace is used.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/Timers.h>
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "FrameScheduler.h"
+
+using namespace android;
+
+struct TraceFrame {
+    nsecs_t duration;
+    // -1 if no buffer was queued
+    nsecs_t queueTime;
+};
+
+struct Trace {
+    nsecs_t period = 16666667;
+    nsecs_t offset = 1000000;
+    std::vector<TraceFrame> frames;
+};
+
+static bool loadTrace(const char* path, Trace* trace) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[128];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        int64_t a, b;
+        int n;
+        if (sscanf(line, "period %" SCNd64, &a) == 1 && a > 0) {
+            trace->period = a;
+        } else if (sscanf(line, "offset %" SCNd64, &a) == 1) {
+            trace->offset = a;
+        } else if ((n = sscanf(line, "%" SCNd64 " %" SCNd64, &a, &b)) >= 1 &&
+                a >= 0) {
+            trace->frames.push_back({a, n == 2 ? b : -1});
+        } else {
+            fprintf(stderr, "%s:%zu: invalid line\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static void generateTrace(Trace* trace) {
+    const size_t numFrames = 60 * 60 * 5;   // 5 minutes
+    std::mt19937 random(42);
+    std::normal_distribution<double> duration(ms2ns(4), us2ns(500));
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    for (size_t i = 0; i < numFrames; i++) {
+        nsecs_t d = std::max<nsecs_t>(us2ns(500), nsecs_t(duration(random)));
+        if (uniform(random) < 0.02) {
+            // occasional slow frame, e.g. a geometry change or GPU fallback
+            d += ms2ns(4) + nsecs_t(ms2ns(4) * uniform(random));
+        }
+        nsecs_t queueTime = -1;
+        if (uniform(random) < 0.9) {
+            // the application finishes rendering anywhere in the frame
+            queueTime = ms2ns(2) + nsecs_t(ms2ns(12) * uniform(random));
+        }
+        trace->frames.push_back({d, queueTime});
+    }
+}
+
+static nsecs_t percentile(std::vector<nsecs_t>* values, size_t percent) {
+    if (values->empty()) {
+        return 0;
+    }
+    size_t index = std::min(values->size() - 1,
+            values->size() * percent / 100);
+    std::nth_element(values->begin(), values->begin() + index, values->end());
+    return (*values)[index];
+}
+
+// A margin of 0 starts every frame at the vsync event
+static void replay(const Trace& trace, nsecs_t margin) {
+    FrameScheduler scheduler;
+    scheduler.setMargin(margin);
+
+    const nsecs_t period = trace.period;
+    // the first vsync after the event of frame 0 is its deadline
+    const nsecs_t firstVsync = ms2ns(1000);
+    nsecs_t firstDeadline = firstVsync;
+    while (firstDeadline <= firstVsync + trace.offset) {
+        firstDeadline += period;
+    }
+
+    std::vector<nsecs_t> arrivals;
+    for (size_t i = 0; i < trace.frames.size(); i++) {
+        if (trace.frames[i].queueTime >= 0) {
+            arrivals.push_back(firstVsync + nsecs_t(i) * period +
+                    trace.frames[i].queueTime);
+        }
+    }
+    std::sort(arrivals.begin(), arrivals.end());
+
+    std::deque<nsecs_t> pending;
+    size_t nextArrival = 0;
+    std::vector<nsecs_t> latencies;
+    // buffers latched although they were queued after the vsync event
+    size_t numLateLatches = 0;
+    size_t numMissed = 0;
+    nsecs_t totalDelay = 0;
+    nsecs_t previousEnd = 0;
+
+    for (size_t i = 0; i < trace.frames.size(); i++) {
+        nsecs_t wakeup = firstVsync + nsecs_t(i) * period + trace.offset;
+        nsecs_t deadline = firstDeadline + nsecs_t(i) * period;
+
+        nsecs_t delay = scheduler.getStartDelay(wakeup, deadline);
+        nsecs_t start = std::max(wakeup + delay, previousEnd);
+        totalDelay += start - wakeup;
+        scheduler.beginFrame(start);
+
+        // latch the oldest buffer queued before the frame started
+        while (nextArrival < arrivals.size() &&
+                arrivals[nextArrival] <= start) {
+            pending.push_back(arrivals[nextArrival++]);
+        }
+        nsecs_t latched = -1;
+        if (!pending.empty()) {
+            latched = pending.front();
+            pending.pop_front();
+        }
+
+        nsecs_t end = start + trace.frames[i].duration;
+        scheduler.endFrame(end);
+        previousEnd = end;
+
+        nsecs_t present = deadline;
+        if (end > deadline) {
+            numMissed++;
+            present += (end - deadline + period - 1) / period * period;
+        }
+        if (latched >= 0) {
+            latencies.push_back(present - latched);
+            if (latched > wakeup) {
+                numLateLatches++;
+            }
+        }
+    }
+
+    char name[32];
+    if (margin > 0) {
+        snprintf(name, sizeof(name), "margin %.1fms", margin / 1e6);
+    } else {
+        snprintf(name, sizeof(name), "no delay");
+    }
+    double meanLatency = 0;
+    for (nsecs_t latency : latencies) {
+        meanLatency += latency;
+    }
+    meanLatency = latencies.empty() ? 0 : meanLatency / latencies.size();
+    printf("%-14s missed=%5.2f%%  mean start delay=%6.3fms  latched after "
+            "vsync=%5.1f%%  buffer latency mean=%6.3fms p50=%6.3fms "
+            "p99=%6.3fms\n",
+            name, 100.0 * numMissed / trace.frames.size(),
+            totalDelay / 1e6 / trace.frames.size(),
+            latencies.empty() ? 0.0 : 100.0 * numLateLatches / latencies.size(),
+            meanLatency / 1e6,
+            percentile(&latencies, 50) / 1e6,
+            percentile(&latencies, 99) / 1e6);
+}
+
+int main(int argc, char** argv) {
+    Trace trace;
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+        return 1;
+    } else if (argc == 2) {
+        if (!loadTrace(argv[1], &trace)) {
+            return 1;
+        }
+    } else {
+        printf("no trace given, using a synthetic 60Hz trace\n");
+        generateTrace(&trace);
+    }
+    if (trace.frames.empty()) {
+        fprintf(stderr, "the trace has no frames\n");
+        return 1;
+    }
+    printf("%zu frames, period %.3f ms, offset %.3f ms\n", trace.frames.size(),
+            trace.period / 1e6, trace.offset / 1e6);
+
+    replay(trace, 0);
+    static const nsecs_t margins[] = {
+        us2ns(500), ms2ns(1), ms2ns(2), ms2ns(4),
+    };
+    for (nsecs_t margin : margins) {
+        replay(trace, margin);
+    }
+    return 0;
+}
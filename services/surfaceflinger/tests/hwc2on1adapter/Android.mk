@@ -0,0 +1,24 @@
+LOCAL_PATH:= $(call my-dir)
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := HWC2On1Adapter_test
+
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := \
+	HWC2On1Adapter_test.cpp \
+	../../DisplayHardware/HWC2On1Adapter.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../..
+
+LOCAL_CFLAGS := -std=c++14 -Wall -Werror
+
+LOCAL_SHARED_LIBRARIES := \
+	libcutils \
+	libhardware \
+	liblog \
+	libui \
+	libutils
+
+include $(BUILD_NATIVE_TEST)
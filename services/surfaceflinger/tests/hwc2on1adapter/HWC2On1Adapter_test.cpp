@@ -0,0 +1,496 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <hardware/hwcomposer.h>
+
+#include "DisplayHardware/HWC2On1Adapter.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+namespace android {
+
+// A HWC1 device which composes every layer it can as an overlay, and which
+// records the contents of the primary display at every prepare so that the
+// fields written by the adapter between two frames can be counted.
+class FakeHwc1Device : public hwc_composer_device_1_t {
+public:
+    struct LayerSnapshot {
+        hwc_layer_1_t layer;
+        std::vector<hwc_rect_t> visibleRegion;
+    };
+
+    struct Frame {
+        const hwc_display_contents_1_t* contents;
+        uint32_t flags;
+        std::vector<LayerSnapshot> layers;
+    };
+
+    static const int32_t WIDTH = 1080;
+    static const int32_t HEIGHT = 1920;
+
+    FakeHwc1Device() : mClientLayers(0) {
+        memset(static_cast<hwc_composer_device_1_t*>(this), 0,
+                sizeof(hwc_composer_device_1_t));
+        common.tag = HARDWARE_DEVICE_TAG;
+        common.version = HWC_DEVICE_API_VERSION_1_4;
+        common.close = closeHook;
+        prepare = prepareHook;
+        set = setHook;
+        eventControl = eventControlHook;
+        setPowerMode = setPowerModeHook;
+        query = queryHook;
+        registerProcs = registerProcsHook;
+        getDisplayConfigs = getDisplayConfigsHook;
+        getDisplayAttributes = getDisplayAttributesHook;
+        getActiveConfig = getActiveConfigHook;
+        setActiveConfig = setActiveConfigHook;
+        setCursorPositionAsync = setCursorPositionAsyncHook;
+    }
+
+    // The first count layers of the primary display are left to client
+    // composition
+    void setClientLayers(size_t count) { mClientLayers = count; }
+
+    const std::vector<Frame>& getFrames() const { return mFrames; }
+
+    // Number of fields of the primary display's layers which differ between
+    // the given frame and the previous one
+    size_t countFieldWrites(size_t frame) const {
+        const auto& previous = mFrames[frame - 1].layers;
+        const auto& current = mFrames[frame].layers;
+        if (previous.size() != current.size()) {
+            return SIZE_MAX;
+        }
+        size_t writes = 0;
+        for (size_t l = 0; l < current.size(); ++l) {
+            writes += countFieldWrites(previous[l], current[l]);
+        }
+        return writes;
+    }
+
+private:
+    static FakeHwc1Device* getDevice(hwc_composer_device_1_t* device) {
+        return static_cast<FakeHwc1Device*>(device);
+    }
+
+    static size_t countFieldWrites(const LayerSnapshot& from,
+            const LayerSnapshot& to) {
+        const auto& a = from.layer;
+        const auto& b = to.layer;
+        size_t writes = 0;
+        writes += a.compositionType != b.compositionType;
+        writes += a.hints != b.hints;
+        writes += a.flags != b.flags;
+        writes += a.handle != b.handle;
+        writes += a.transform != b.transform;
+        writes += a.blending != b.blending;
+        writes += memcmp(&a.sourceCropf, &b.sourceCropf,
+                sizeof(a.sourceCropf)) != 0;
+        writes += memcmp(&a.displayFrame, &b.displayFrame,
+                sizeof(a.displayFrame)) != 0;
+        writes += a.acquireFenceFd != b.acquireFenceFd;
+        writes += a.planeAlpha != b.planeAlpha;
+        writes += from.visibleRegion.size() != to.visibleRegion.size() ||
+                memcmp(from.visibleRegion.data(), to.visibleRegion.data(),
+                        sizeof(hwc_rect_t) * to.visibleRegion.size()) != 0;
+        return writes;
+    }
+
+    static int closeHook(struct hw_device_t* /*device*/) {
+        return 0;
+    }
+
+    static int prepareHook(hwc_composer_device_1_t* device,
+            size_t numDisplays, hwc_display_contents_1_t** displays) {
+        auto fake = getDevice(device);
+        if (numDisplays == 0 || displays[HWC_DISPLAY_PRIMARY] == nullptr) {
+            return -EINVAL;
+        }
+        auto contents = displays[HWC_DISPLAY_PRIMARY];
+
+        Frame frame;
+        frame.contents = contents;
+        frame.flags = contents->flags;
+        for (size_t l = 0; l < contents->numHwLayers; ++l) {
+            const auto& layer = contents->hwLayers[l];
+            LayerSnapshot snapshot;
+            snapshot.layer = layer;
+            snapshot.visibleRegion.assign(layer.visibleRegionScreen.rects,
+                    layer.visibleRegionScreen.rects +
+                    layer.visibleRegionScreen.numRects);
+            frame.layers.push_back(snapshot);
+        }
+        fake->mFrames.push_back(frame);
+
+        for (size_t l = 0; l < contents->numHwLayers; ++l) {
+            auto& layer = contents->hwLayers[l];
+            if (layer.compositionType == HWC_FRAMEBUFFER &&
+                    (layer.flags & HWC_SKIP_LAYER) == 0 &&
+                    l >= fake->mClientLayers) {
+                layer.compositionType = HWC_OVERLAY;
+            }
+        }
+        return 0;
+    }
+
+    static int setHook(hwc_composer_device_1_t* /*device*/,
+            size_t numDisplays, hwc_display_contents_1_t** displays) {
+        for (size_t d = 0; d < numDisplays; ++d) {
+            auto contents = displays[d];
+            if (contents == nullptr) {
+                continue;
+            }
+            for (size_t l = 0; l < contents->numHwLayers; ++l) {
+                auto& layer = contents->hwLayers[l];
+                if (layer.acquireFenceFd >= 0) {
+                    close(layer.acquireFenceFd);
+                    layer.acquireFenceFd = -1;
+                }
+                layer.releaseFenceFd = -1;
+            }
+            contents->retireFenceFd = -1;
+        }
+        return 0;
+    }
+
+    static int eventControlHook(hwc_composer_device_1_t* /*device*/,
+            int /*display*/, int /*event*/, int /*enabled*/) {
+        return 0;
+    }
+
+    static int setPowerModeHook(hwc_composer_device_1_t* /*device*/,
+            int /*display*/, int /*mode*/) {
+        return 0;
+    }
+
+    static int queryHook(hwc_composer_device_1_t* /*device*/, int what,
+            int* value) {
+        if (what == HWC_DISPLAY_TYPES_SUPPORTED) {
+            *value = HWC_DISPLAY_PRIMARY_BIT;
+            return 0;
+        }
+        return -EINVAL;
+    }
+
+    static void registerProcsHook(hwc_composer_device_1_t* /*device*/,
+            hwc_procs_t const* /*procs*/) {}
+
+    static int getDisplayConfigsHook(hwc_composer_device_1_t* /*device*/,
+            int display, uint32_t* configs, size_t* numConfigs) {
+        if (display != HWC_DISPLAY_PRIMARY || *numConfigs < 1) {
+            return -EINVAL;
+        }
+        configs[0] = 0;
+        *numConfigs = 1;
+        return 0;
+    }
+
+    static int getDisplayAttributesHook(hwc_composer_device_1_t* /*device*/,
+            int display, uint32_t config, const uint32_t* attributes,
+            int32_t* values) {
+        if (display != HWC_DISPLAY_PRIMARY || config != 0) {
+            return -EINVAL;
+        }
+        for (size_t a = 0; attributes[a] != HWC_DISPLAY_NO_ATTRIBUTE; ++a) {
+            switch (attributes[a]) {
+                case HWC_DISPLAY_VSYNC_PERIOD: values[a] = 16666667; break;
+                case HWC_DISPLAY_WIDTH: values[a] = WIDTH; break;
+                case HWC_DISPLAY_HEIGHT: values[a] = HEIGHT; break;
+                case HWC_DISPLAY_DPI_X: values[a] = 320000; break;
+                case HWC_DISPLAY_DPI_Y: values[a] = 320000; break;
+                case HWC_DISPLAY_COLOR_TRANSFORM: values[a] = 0; break;
+                default: return -EINVAL;
+            }
+        }
+        return 0;
+    }
+
+    static int getActiveConfigHook(hwc_composer_device_1_t* /*device*/,
+            int /*display*/) {
+        return 0;
+    }
+
+    static int setActiveConfigHook(hwc_composer_device_1_t* /*device*/,
+            int /*display*/, int index) {
+        return index == 0 ? 0 : -EINVAL;
+    }
+
+    static int setCursorPositionAsyncHook(hwc_composer_device_1_t* /*device*/,
+            int /*display*/, int /*x*/, int /*y*/) {
+        return 0;
+    }
+
+    size_t mClientLayers;
+    std::vector<Frame> mFrames;
+};
+
+const int32_t FakeHwc1Device::WIDTH;
+const int32_t FakeHwc1Device::HEIGHT;
+
+class HWC2On1AdapterTest : public ::testing::Test {
+protected:
+    static const size_t NUM_LAYERS = 4;
+
+    virtual void SetUp() {
+        mDevice = std::make_unique<FakeHwc1Device>();
+        mAdapter = std::make_unique<HWC2On1Adapter>(mDevice.get());
+        mDisplay = 0;
+
+        auto registerCallback = getFunction<HWC2_PFN_REGISTER_CALLBACK>(
+                HWC2_FUNCTION_REGISTER_CALLBACK);
+        ASSERT_EQ(HWC2_ERROR_NONE, registerCallback(mAdapter.get(),
+                HWC2_CALLBACK_HOTPLUG, this,
+                reinterpret_cast<hwc2_function_pointer_t>(hotplugHook)));
+        ASSERT_NE(0u, mDisplay);
+    }
+
+    virtual void TearDown() {
+        mAdapter.reset();
+        mDevice.reset();
+    }
+
+    template <typename PFN>
+    PFN getFunction(hwc2_function_descriptor_t descriptor) {
+        return reinterpret_cast<PFN>(mAdapter->getFunction(mAdapter.get(),
+                descriptor));
+    }
+
+    static void hotplugHook(hwc2_callback_data_t data, hwc2_display_t display,
+            int32_t connected) {
+        if (connected == HWC2_CONNECTION_CONNECTED) {
+            static_cast<HWC2On1AdapterTest*>(data)->mDisplay = display;
+        }
+    }
+
+    hwc2_layer_t createLayer(uint32_t z) {
+        hwc2_layer_t layer = 0;
+        EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_CREATE_LAYER>(
+                HWC2_FUNCTION_CREATE_LAYER)(mAdapter.get(), mDisplay, &layer));
+        EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_SET_LAYER_Z_ORDER>(
+                HWC2_FUNCTION_SET_LAYER_Z_ORDER)(mAdapter.get(), mDisplay,
+                layer, z));
+        mLayers.push_back(layer);
+        return layer;
+    }
+
+    // Sends the whole state of a layer, the way SurfaceFlinger does when the
+    // geometry changes
+    void setLayerState(hwc2_layer_t layer, const hwc_rect_t& frame) {
+        hwc_frect_t crop = {0.0f, 0.0f,
+                static_cast<float>(frame.right - frame.left),
+                static_cast<float>(frame.bottom - frame.top)};
+        hwc_region_t visible = {1, &frame};
+        auto device = mAdapter.get();
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_COMPOSITION_TYPE>(
+                HWC2_FUNCTION_SET_LAYER_COMPOSITION_TYPE)(device, mDisplay,
+                layer, HWC2_COMPOSITION_DEVICE));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_BLEND_MODE>(
+                HWC2_FUNCTION_SET_LAYER_BLEND_MODE)(device, mDisplay, layer,
+                HWC2_BLEND_MODE_PREMULTIPLIED));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
+                HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)(device, mDisplay, layer,
+                frame));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_SOURCE_CROP>(
+                HWC2_FUNCTION_SET_LAYER_SOURCE_CROP)(device, mDisplay, layer,
+                crop));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_PLANE_ALPHA>(
+                HWC2_FUNCTION_SET_LAYER_PLANE_ALPHA)(device, mDisplay, layer,
+                1.0f));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_TRANSFORM>(
+                HWC2_FUNCTION_SET_LAYER_TRANSFORM)(device, mDisplay, layer,
+                0));
+        EXPECT_EQ(HWC2_ERROR_NONE,
+                getFunction<HWC2_PFN_SET_LAYER_VISIBLE_REGION>(
+                HWC2_FUNCTION_SET_LAYER_VISIBLE_REGION)(device, mDisplay,
+                layer, visible));
+    }
+
+    void setLayerBuffer(hwc2_layer_t layer, uintptr_t buffer) {
+        EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_SET_LAYER_BUFFER>(
+                HWC2_FUNCTION_SET_LAYER_BUFFER)(mAdapter.get(), mDisplay,
+                layer, reinterpret_cast<buffer_handle_t>(buffer), -1));
+    }
+
+    void createLayers() {
+        for (size_t l = 0; l < NUM_LAYERS; ++l) {
+            auto layer = createLayer(static_cast<uint32_t>(l));
+            int32_t offset = static_cast<int32_t>(l) * 100;
+            setLayerState(layer, {offset, offset, offset + 500, offset + 500});
+        }
+    }
+
+    // Posts a new buffer on every layer, then validates and presents
+    void presentFrame() {
+        ++mFrameNumber;
+        for (size_t l = 0; l < mLayers.size(); ++l) {
+            setLayerBuffer(mLayers[l], 0x1000 * (l + 1) + mFrameNumber);
+        }
+
+        auto device = mAdapter.get();
+        uint32_t numTypes = 0;
+        uint32_t numRequests = 0;
+        int32_t error = getFunction<HWC2_PFN_VALIDATE_DISPLAY>(
+                HWC2_FUNCTION_VALIDATE_DISPLAY)(device, mDisplay, &numTypes,
+                &numRequests);
+        if (error == HWC2_ERROR_HAS_CHANGES) {
+            EXPECT_EQ(HWC2_ERROR_NONE,
+                    getFunction<HWC2_PFN_ACCEPT_DISPLAY_CHANGES>(
+                    HWC2_FUNCTION_ACCEPT_DISPLAY_CHANGES)(device, mDisplay));
+        } else {
+            EXPECT_EQ(HWC2_ERROR_NONE, error);
+        }
+
+        hwc_region_t damage = {0, nullptr};
+        EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_SET_CLIENT_TARGET>(
+                HWC2_FUNCTION_SET_CLIENT_TARGET)(device, mDisplay,
+                reinterpret_cast<buffer_handle_t>(0x100 + mFrameNumber), -1,
+                HAL_DATASPACE_UNKNOWN, damage));
+
+        int32_t retireFence = -1;
+        EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_PRESENT_DISPLAY>(
+                HWC2_FUNCTION_PRESENT_DISPLAY)(device, mDisplay,
+                &retireFence));
+        if (retireFence >= 0) {
+            close(retireFence);
+        }
+    }
+
+    const FakeHwc1Device::Frame& lastFrame() const {
+        return mDevice->getFrames().back();
+    }
+
+    size_t lastFrameIndex() const {
+        return mDevice->getFrames().size() - 1;
+    }
+
+    std::unique_ptr<FakeHwc1Device> mDevice;
+    std::unique_ptr<HWC2On1Adapter> mAdapter;
+    hwc2_display_t mDisplay;
+    std::vector<hwc2_layer_t> mLayers;
+    uintptr_t mFrameNumber = 0;
+};
+
+const size_t HWC2On1AdapterTest::NUM_LAYERS;
+
+TEST_F(HWC2On1AdapterTest, StaticLayersOnlyUpdateBuffers) {
+    createLayers();
+    presentFrame();
+    ASSERT_EQ(1u, mDevice->getFrames().size());
+    EXPECT_NE(0u, lastFrame().flags & HWC_GEOMETRY_CHANGED);
+    const auto contents = lastFrame().contents;
+
+    for (int frame = 0; frame < 10; ++frame) {
+        // Resend the same state, like SurfaceFlinger does on every geometry
+        // change
+        for (size_t l = 0; l < mLayers.size(); ++l) {
+            int32_t offset = static_cast<int32_t>(l) * 100;
+            setLayerState(mLayers[l],
+                    {offset, offset, offset + 500, offset + 500});
+        }
+        presentFrame();
+
+        // Only the buffer handles change, and the contents are reused
+        EXPECT_EQ(contents, lastFrame().contents);
+        EXPECT_EQ(0u, lastFrame().flags & HWC_GEOMETRY_CHANGED);
+        EXPECT_EQ(NUM_LAYERS, mDevice->countFieldWrites(lastFrameIndex()));
+    }
+}
+
+TEST_F(HWC2On1AdapterTest, ChangedLayerOnlyUpdatesChangedField) {
+    createLayers();
+    presentFrame();
+    presentFrame();
+    const auto contents = lastFrame().contents;
+
+    hwc_rect_t frame = {0, 0, 300, 300};
+    EXPECT_EQ(HWC2_ERROR_NONE, getFunction<HWC2_PFN_SET_LAYER_DISPLAY_FRAME>(
+            HWC2_FUNCTION_SET_LAYER_DISPLAY_FRAME)(mAdapter.get(), mDisplay,
+            mLayers[2], frame));
+    presentFrame();
+
+    EXPECT_EQ(contents, lastFrame().contents);
+    EXPECT_NE(0u, lastFrame().flags & HWC_GEOMETRY_CHANGED);
+    EXPECT_EQ(NUM_LAYERS + 1, mDevice->countFieldWrites(lastFrameIndex()));
+    const auto& hwc1Frame = lastFrame().layers[2].layer.displayFrame;
+    EXPECT_EQ(0, memcmp(&frame, &hwc1Frame, sizeof(frame)));
+
+    presentFrame();
+    EXPECT_EQ(0u, lastFrame().flags & HWC_GEOMETRY_CHANGED);
+    EXPECT_EQ(NUM_LAYERS, mDevice->countFieldWrites(lastFrameIndex()));
+}
+
+TEST_F(HWC2On1AdapterTest, AddingLayerReallocatesContents) {
+    createLayers();
+    presentFrame();
+
+    auto layer = createLayer(NUM_LAYERS);
+    setLayerState(layer, {0, 0, 100, 100});
+    presentFrame();
+
+    // One more layer, plus the framebuffer target
+    ASSERT_EQ(NUM_LAYERS + 2, lastFrame().layers.size());
+    EXPECT_NE(0u, lastFrame().flags & HWC_GEOMETRY_CHANGED);
+    const auto& target = lastFrame().layers.back();
+    EXPECT_EQ(HWC_FRAMEBUFFER_TARGET, target.layer.compositionType);
+    ASSERT_EQ(1u, target.visibleRegion.size());
+    EXPECT_EQ(FakeHwc1Device::WIDTH, target.visibleRegion[0].right);
+    EXPECT_EQ(FakeHwc1Device::HEIGHT, target.visibleRegion[0].bottom);
+
+    presentFrame();
+    EXPECT_EQ(NUM_LAYERS + 1, mDevice->countFieldWrites(lastFrameIndex()));
+}
+
+TEST_F(HWC2On1AdapterTest, AcceptedChangesKeepContentsConsistent) {
+    createLayers();
+    mDevice->setClientLayers(1);
+    presentFrame();
+    presentFrame();
+
+    // The first layer fell back to client composition, and HWC1 must still
+    // see the complete state of every layer
+    const auto& frame = lastFrame();
+    EXPECT_EQ(HWC_FRAMEBUFFER, frame.layers[0].layer.compositionType);
+    EXPECT_NE(0u, frame.layers[0].layer.flags & HWC_SKIP_LAYER);
+    for (size_t l = 0; l < NUM_LAYERS; ++l) {
+        int32_t offset = static_cast<int32_t>(l) * 100;
+        hwc_rect_t expected = {offset, offset, offset + 500, offset + 500};
+        const auto& layer = frame.layers[l];
+        EXPECT_EQ(0, memcmp(&expected, &layer.layer.displayFrame,
+                sizeof(expected)));
+        ASSERT_EQ(1u, layer.visibleRegion.size());
+        EXPECT_EQ(0, memcmp(&expected, &layer.visibleRegion[0],
+                sizeof(expected)));
+    }
+
+    presentFrame();
+    EXPECT_EQ(NUM_LAYERS, mDevice->countFieldWrites(lastFrameIndex()));
+}
+
+} // namespace android
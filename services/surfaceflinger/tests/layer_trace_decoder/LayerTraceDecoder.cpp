@@ -0,0 +1,212 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Converts a layer trace, as written by
+ *     adb exec-out dumpsys SurfaceFlinger --layer-trace > trace.bin
+ * to JSON on stdout. With no argument, the trace is read from stdin.
+ *
+ * A layer is reported as having latched a buffer when its buffer frame
+ * number differs from the one it had on the same display in the previous
+ * frame it was visible in.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LayerTrace.h"
+
+using namespace android;
+
+// Reads a record written with a size of fileSize bytes. Fields missing from
+// older traces are left zeroed, fields added by newer ones are skipped.
+template <typename T>
+static bool readRecord(FILE* file, uint32_t fileSize, T* record) {
+    memset(record, 0, sizeof(T));
+    size_t known = std::min<size_t>(fileSize, sizeof(T));
+    if (fread(record, 1, known, file) != known) {
+        return false;
+    }
+    for (size_t skip = fileSize - known; skip > 0; skip--) {
+        if (fgetc(file) == EOF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const char* compositionName(uint8_t type) {
+    switch (type) {
+        case LayerTraceLayer::COMPOSITION_CLIENT: return "client";
+        case LayerTraceLayer::COMPOSITION_DEVICE: return "device";
+        case LayerTraceLayer::COMPOSITION_SOLID_COLOR: return "solid-color";
+        case LayerTraceLayer::COMPOSITION_CURSOR: return "cursor";
+        case LayerTraceLayer::COMPOSITION_SIDEBAND: return "sideband";
+        default: return "invalid";
+    }
+}
+
+static void printJsonString(const std::string& value) {
+    putchar('"');
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static const char* toBool(bool value) {
+    return value ? "true" : "false";
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+        return 1;
+    }
+    FILE* file = stdin;
+    if (argc == 2) {
+        file = fopen(argv[1], "rb");
+        if (file == NULL) {
+            fprintf(stderr, "can't open %s: %s\n", argv[1], strerror(errno));
+            return 1;
+        }
+    }
+
+    LayerTraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+            header.magic != LAYER_TRACE_MAGIC) {
+        fprintf(stderr, "not a layer trace\n");
+        return 1;
+    }
+    if (header.version != LAYER_TRACE_VERSION ||
+            header.headerSize < sizeof(header)) {
+        fprintf(stderr, "unsupported layer trace version %u\n",
+                header.version);
+        return 1;
+    }
+    for (size_t skip = header.headerSize - sizeof(header); skip > 0; skip--) {
+        fgetc(file);
+    }
+
+    std::vector<LayerTraceFrame> frames(header.numFrames);
+    for (auto& frame : frames) {
+        if (!readRecord(file, header.frameSize, &frame)) {
+            fprintf(stderr, "truncated frame records\n");
+            return 1;
+        }
+    }
+    std::vector<LayerTraceLayer> layers(header.numLayers);
+    for (auto& layer : layers) {
+        if (!readRecord(file, header.layerSize, &layer)) {
+            fprintf(stderr, "truncated layer records\n");
+            return 1;
+        }
+    }
+    std::map<int32_t, std::string> names;
+    for (uint32_t i = 0; i < header.numNames; i++) {
+        int32_t sequence;
+        uint32_t length;
+        if (fread(&sequence, sizeof(sequence), 1, file) != 1 ||
+                fread(&length, sizeof(length), 1, file) != 1) {
+            fprintf(stderr, "truncated layer names\n");
+            return 1;
+        }
+        std::string name(length, '\0');
+        if (length > 0 && fread(&name[0], 1, length, file) != length) {
+            fprintf(stderr, "truncated layer names\n");
+            return 1;
+        }
+        names[sequence] = name;
+    }
+
+    // last buffer frame number of each (sequence, hwcId)
+    std::map<std::pair<int32_t, int32_t>, uint64_t> lastFrameNumbers;
+    size_t nextLayer = 0;
+    printf("{\n  \"frames\": [");
+    for (size_t f = 0; f < frames.size(); f++) {
+        const LayerTraceFrame& frame(frames[f]);
+        if (nextLayer + frame.numLayers > layers.size()) {
+            fprintf(stderr, "frame %" PRIu64 " has missing layers\n",
+                    frame.frameNumber);
+            return 1;
+        }
+        printf("%s\n    {\"frameNumber\": %" PRIu64 ", \"startTime\": %"
+                PRId64 ", \"endTime\": %" PRId64 ", "
+                "\"clientComposition\": %s, \"geometryChanged\": %s, "
+                "\"layers\": [",
+                f == 0 ? "" : ",", frame.frameNumber, frame.startTime,
+                frame.endTime,
+                toBool(frame.flags & LayerTraceFrame::FLAG_CLIENT_COMPOSITION),
+                toBool(frame.flags & LayerTraceFrame::FLAG_GEOMETRY_CHANGED));
+
+        for (uint32_t l = 0; l < frame.numLayers; l++) {
+            const LayerTraceLayer& layer(layers[nextLayer++]);
+            auto key = std::make_pair(layer.sequence, layer.hwcId);
+            auto last = lastFrameNumbers.find(key);
+            bool latched = last != lastFrameNumbers.end() &&
+                    last->second != layer.bufferFrameNumber;
+            lastFrameNumbers[key] = layer.bufferFrameNumber;
+
+            printf("%s\n      {\"sequence\": %d, \"name\": ",
+                    l == 0 ? "" : ",", layer.sequence);
+            auto name = names.find(layer.sequence);
+            printJsonString(name != names.end() ? name->second : "");
+            printf(", \"hwcId\": %d, \"z\": %u, \"layerStack\": %u, "
+                    "\"composition\": \"%s\", "
+                    "\"frame\": [%d, %d, %d, %d], "
+                    "\"crop\": [%g, %g, %g, %g], "
+                    "\"bufferFrameNumber\": %" PRIu64 ", \"latched\": %s, "
+                    "\"bufferWidth\": %u, \"bufferHeight\": %u, "
+                    "\"bufferFormat\": %d, \"alpha\": %g, \"transform\": %u, "
+                    "\"opaque\": %s, \"secure\": %s, \"protected\": %s, "
+                    "\"queuedFrames\": %u}",
+                    layer.hwcId, layer.z, layer.layerStack,
+                    compositionName(layer.compositionType),
+                    layer.frameLeft, layer.frameTop, layer.frameRight,
+                    layer.frameBottom,
+                    layer.cropLeft, layer.cropTop, layer.cropRight,
+                    layer.cropBottom,
+                    layer.bufferFrameNumber, toBool(latched),
+                    layer.bufferWidth, layer.bufferHeight, layer.bufferFormat,
+                    layer.alpha, layer.transform,
+                    toBool(layer.flags & LayerTraceLayer::FLAG_OPAQUE),
+                    toBool(layer.flags & LayerTraceLayer::FLAG_SECURE),
+                    toBool(layer.flags & LayerTraceLayer::FLAG_PROTECTED),
+                    layer.queuedFrames);
+        }
+        printf("%s]}", frame.numLayers ? "\n    " : "");
+    }
+    printf("\n  ]\n}\n");
+
+    if (file != stdin) {
+        fclose(file);
+    }
+    return 0;
+}
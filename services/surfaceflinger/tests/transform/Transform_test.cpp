@@ -0,0 +1,239 @@
+/*
+ * Copyright 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <ui/Rect.h>
+#include <ui/Region.h>
+
+#include "Transform.h"
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace android {
+
+// The generic implementations the fast paths must match exactly
+
+static Rect referenceTransform(const Transform& t, const Rect& bounds,
+        bool roundOutwards) {
+    vec2 lt = t.transform(vec2(bounds.left, bounds.top));
+    vec2 rt = t.transform(vec2(bounds.right, bounds.top));
+    vec2 lb = t.transform(vec2(bounds.left, bounds.bottom));
+    vec2 rb = t.transform(vec2(bounds.right, bounds.bottom));
+    const float minX = std::min({lt[0], rt[0], lb[0], rb[0]});
+    const float minY = std::min({lt[1], rt[1], lb[1], rb[1]});
+    const float maxX = std::max({lt[0], rt[0], lb[0], rb[0]});
+    const float maxY = std::max({lt[1], rt[1], lb[1], rb[1]});
+
+    Rect r;
+    if (roundOutwards) {
+        r.left = floorf(minX);
+        r.top = floorf(minY);
+        r.right = ceilf(maxX);
+        r.bottom = ceilf(maxY);
+    } else {
+        r.left = floorf(minX + 0.5f);
+        r.top = floorf(minY + 0.5f);
+        r.right = floorf(maxX + 0.5f);
+        r.bottom = floorf(maxY + 0.5f);
+    }
+    return r;
+}
+
+static Region referenceTransform(const Transform& t, const Region& reg) {
+    Region out;
+    if (t.getType() > Transform::TRANSLATE) {
+        if (t.preserveRects()) {
+            for (const Rect& r : reg) {
+                out.orSelf(referenceTransform(t, r, false));
+            }
+        } else {
+            out.set(referenceTransform(t, reg.bounds(), false));
+        }
+    } else {
+        out = reg.translate(floorf(t.tx() + 0.5f), floorf(t.ty() + 0.5f));
+    }
+    return out;
+}
+
+static ::testing::AssertionResult sameRegion(const Region& expected,
+        const Region& actual) {
+    size_t expectedCount;
+    size_t actualCount;
+    const Rect* e = expected.getArray(&expectedCount);
+    const Rect* a = actual.getArray(&actualCount);
+    if (expectedCount != actualCount) {
+        return ::testing::AssertionFailure() << "expected " << expectedCount
+                << " rects, got " << actualCount;
+    }
+    for (size_t i = 0; i < expectedCount; i++) {
+        if (e[i] != a[i]) {
+            return ::testing::AssertionFailure() << "rect " << i
+                    << " differs";
+        }
+    }
+    if (expected.getBounds() != actual.getBounds()) {
+        return ::testing::AssertionFailure() << "bounds differ";
+    }
+    return ::testing::AssertionSuccess();
+}
+
+class TransformTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        static const float sizes[][2] = {
+            {0, 0}, {1080, 1920}, {1921, 1081},
+        };
+        static const float translations[][2] = {
+            {0, 0}, {7, -3}, {0.5f, 0.25f}, {-100.5f, 3},
+            {1 << 22, -(1 << 22)}, {1 << 23, 1},
+        };
+        for (uint32_t flags = 0; flags <= Transform::ROT_270; flags++) {
+            for (const auto& size : sizes) {
+                for (const auto& translation : translations) {
+                    Transform orientation;
+                    orientation.set(flags, size[0], size[1]);
+                    Transform translate;
+                    translate.set(translation[0], translation[1]);
+                    mTransforms.push_back(translate * orientation);
+                    mTransforms.push_back(orientation * translate);
+                }
+            }
+        }
+
+        static const float matrices[][4] = {
+            {2, 0, 0, 2}, {0.5f, 0, 0, 0.5f}, {-1.5f, 0, 0, 3},
+            {0, 2, -2, 0}, {0, -1, 1, 0}, {1, 0, 0, -1},
+            {0.7f, 0.7f, -0.7f, 0.7f},
+        };
+        for (const auto& m : matrices) {
+            for (const auto& translation : translations) {
+                Transform t;
+                t.set(m[0], m[1], m[2], m[3]);
+                t.set(translation[0], translation[1]);
+                mTransforms.push_back(t);
+            }
+        }
+    }
+
+    std::vector<Transform> mTransforms;
+};
+
+TEST_F(TransformTest, SmallRectsMatchGenericPath) {
+    // every rectangle, valid or not, with coordinates in [-3, 3]
+    for (const Transform& t : mTransforms) {
+        for (int l = -3; l <= 3; l++) {
+            for (int top = -3; top <= 3; top++) {
+                for (int r = -3; r <= 3; r++) {
+                    for (int b = -3; b <= 3; b++) {
+                        const Rect rect(l, top, r, b);
+                        ASSERT_EQ(referenceTransform(t, rect, false),
+                                t.transform(rect));
+                        ASSERT_EQ(referenceTransform(t, rect, true),
+                                t.transform(rect, true));
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_F(TransformTest, LargeRectsMatchGenericPath) {
+    static const int32_t coordinates[] = {
+        -(1 << 24) - 1, -(1 << 23) - 1, -(1 << 22) - 1, -(1 << 22),
+        -1920, 0, 1080, (1 << 22), (1 << 22) + 1, (1 << 23) + 1,
+        (1 << 24) + 1, INT32_MAX / 2,
+    };
+    for (const Transform& t : mTransforms) {
+        for (int32_t l : coordinates) {
+            for (int32_t top : coordinates) {
+                for (int32_t r : coordinates) {
+                    for (int32_t b : coordinates) {
+                        const Rect rect(l, top, r, b);
+                        ASSERT_EQ(referenceTransform(t, rect, false),
+                                t.transform(rect));
+                        ASSERT_EQ(referenceTransform(t, rect, true),
+                                t.transform(rect, true));
+                    }
+                }
+            }
+        }
+        ASSERT_EQ(referenceTransform(t, Rect::INVALID_RECT, false),
+                t.transform(Rect::INVALID_RECT));
+    }
+}
+
+TEST_F(TransformTest, RegionsMatchGenericPath) {
+    std::mt19937 random(0);
+    std::uniform_int_distribution<int32_t> coordinate(-500, 2500);
+    std::uniform_int_distribution<int32_t> length(1, 600);
+    std::uniform_int_distribution<int32_t> rectCount(1, 24);
+
+    std::vector<Region> regions;
+    regions.push_back(Region());
+    regions.push_back(Region(Rect(0, 0, 1080, 1920)));
+    regions.push_back(Region(Rect(1 << 22, 0, (1 << 22) + 1, 1)));
+    for (int i = 0; i < 200; i++) {
+        Region region;
+        const int32_t count = rectCount(random);
+        for (int32_t r = 0; r < count; r++) {
+            const int32_t left = coordinate(random);
+            const int32_t top = coordinate(random);
+            const Rect rect(left, top, left + length(random),
+                    top + length(random));
+            // make holes every now and then
+            if (r % 4 == 3) {
+                region.subtractSelf(rect);
+            } else {
+                region.orSelf(rect);
+            }
+        }
+        regions.push_back(region);
+    }
+
+    for (const Transform& t : mTransforms) {
+        for (const Region& region : regions) {
+            ASSERT_TRUE(sameRegion(referenceTransform(t, region),
+                    t.transform(region)));
+        }
+    }
+}
+
+TEST_F(TransformTest, TranslationProductKeepsType) {
+    Transform a;
+    a.set(1.5f, -2);
+    Transform b;
+    b.set(-1.5f, 2);
+    Transform c;
+    c.set(3, 0.25f);
+
+    Transform identity = a * b;
+    EXPECT_EQ(Transform::IDENTITY, identity.getType());
+    EXPECT_EQ(0.0f, identity.tx());
+    EXPECT_EQ(0.0f, identity.ty());
+
+    Transform translate = a * c;
+    EXPECT_EQ(Transform::TRANSLATE, translate.getType());
+    EXPECT_EQ(4.5f, translate.tx());
+    EXPECT_EQ(-1.75f, translate.ty());
+}
+
+} // namespace android